@@ -3,6 +3,7 @@
 
 u8 *DMEM;
 u8 *IMEM;
+u8 *HEADER;
 u64 TMEM[512];
 u8 *RDRAM;
 u32 RDRAMSize;
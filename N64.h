@@ -37,6 +37,7 @@ struct N64Regs
 extern N64Regs REG;
 extern u8 *DMEM;
 extern u8 *IMEM;
+extern u8 *HEADER;
 extern u8 *RDRAM;
 extern u64 TMEM[512];
 extern u32 RDRAMSize;
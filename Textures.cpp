@@ -12,27 +12,30 @@
 #include "2xSAI.h"
 #include "FrameBuffer.h"
 #include "convert.h"
+#include "xxhash.h"
 
-typedef u32 (*GetTexelFunc)( u64 *src, u16 x, u16 i, u8 palette );
+#define PALETTE_HASH_SEED   0xdeadbeef
 
-inline u32 GetNone( u64 *src, u16 x, u16 i, u8 palette )
+typedef u32 (*GetTexelFunc)( u64 *src, u16 x, u16 i, const u32 *palette );
+
+inline u32 GetNone( u64 *src, u16 x, u16 i, const u32 *palette )
 {
 	return 0x00000000;
 }
 
-inline u32 GetCI4IA_RGBA4444( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetCI4IA_RGBA4444( u64 *src, u16 x, u16 i, const u32 *palette )
 {
 	u8 color4B;
 
 	color4B = ((u8*)src)[(x>>1)^(i<<1)];
 
 	if (x & 1)
-		return IA88_RGBA4444( *(u16*)&TMEM[256 + (palette << 4) + (color4B & 0x0F)] );
+		return RGBA8888_RGBA4444( palette[color4B & 0x0F] );
 	else
-		return IA88_RGBA4444( *(u16*)&TMEM[256 + (palette << 4) + (color4B >> 4)] );
+		return RGBA8888_RGBA4444( palette[color4B >> 4] );
 }
 
-inline u32 GetCI4IA_RGBA8888( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetCI4IA_RGBA8888( u64 *src, u16 x, u16 i, const u32 *palette )
 {
 	u8 color4B;
 
@@ -42,12 +45,12 @@ inline u32 GetCI4IA_RGBA8888( u64 *src, u16 x, u16 i, u8 palette )
 	color4B = ((u8*)src)[(x>>1)^(i<<1)];
 
 	if (x & 1)
-		return IA88_RGBA8888( *(u16*)&TMEM[256 + (palette << 4) + (color4B & 0x0F)] );
+		return palette[color4B & 0x0F];
 	else
-		return IA88_RGBA8888( *(u16*)&TMEM[256 + (palette << 4) + (color4B >> 4)] );
+		return palette[color4B >> 4];
 }
 
-inline u32 GetCI4RGBA_RGBA5551( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetCI4RGBA_RGBA5551( u64 *src, u16 x, u16 i, const u32 *palette )
 {
 	u8 color4B;
 
@@ -55,12 +58,12 @@ inline u32 GetCI4RGBA_RGBA5551( u64 *src, u16 x, u16 i, u8 palette )
 	color4B = ((u8*)src)[(x>>1)^(i<<1)];
 
 	if (x & 1)
-		return RGBA5551_RGBA5551( *(u16*)&TMEM[256 + (palette << 4) + (color4B & 0x0F)] );
+		return RGBA8888_RGBA5551( palette[color4B & 0x0F] );
 	else
-		return RGBA5551_RGBA5551( *(u16*)&TMEM[256 + (palette << 4) + (color4B >> 4)] );
+		return RGBA8888_RGBA5551( palette[color4B >> 4] );
 }
 
-inline u32 GetCI4RGBA_RGBA8888( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetCI4RGBA_RGBA8888( u64 *src, u16 x, u16 i, const u32 *palette )
 {
 	u8 color4B;
 
@@ -70,12 +73,12 @@ inline u32 GetCI4RGBA_RGBA8888( u64 *src, u16 x, u16 i, u8 palette )
 	color4B = ((u8*)src)[(x>>1)^(i<<1)];
 
 	if (x & 1)
-		return RGBA5551_RGBA8888( *(u16*)&TMEM[256 + (palette << 4) + (color4B & 0x0F)] );
+		return palette[color4B & 0x0F];
 	else
-		return RGBA5551_RGBA8888( *(u16*)&TMEM[256 + (palette << 4) + (color4B >> 4)] );
+		return palette[color4B >> 4];
 }
 
-inline u32 GetIA31_RGBA8888( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetIA31_RGBA8888( u64 *src, u16 x, u16 i, const u32 *palette )
 {
 	u8 color4B;
 
@@ -84,7 +87,7 @@ inline u32 GetIA31_RGBA8888( u64 *src, u16 x, u16 i, u8 palette )
 	return IA31_RGBA8888( (x & 1) ? (color4B & 0x0F) : (color4B >> 4) );
 }
 
-inline u32 GetIA31_RGBA4444( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetIA31_RGBA4444( u64 *src, u16 x, u16 i, const u32 *palette )
 {
 	u8 color4B;
 
@@ -93,7 +96,7 @@ inline u32 GetIA31_RGBA4444( u64 *src, u16 x, u16 i, u8 palette )
 	return IA31_RGBA4444( (x & 1) ? (color4B & 0x0F) : (color4B >> 4) );
 }
 
-inline u32 GetI4_RGBA8888( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetI4_RGBA8888( u64 *src, u16 x, u16 i, const u32 *palette )
 {
 	u8 color4B;
 
@@ -102,7 +105,7 @@ inline u32 GetI4_RGBA8888( u64 *src, u16 x, u16 i, u8 palette )
 	return I4_RGBA8888( (x & 1) ? (color4B & 0x0F) : (color4B >> 4) );
 }
 
-inline u32 GetI4_RGBA4444( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetI4_RGBA4444( u64 *src, u16 x, u16 i, const u32 *palette )
 {
 	u8 color4B;
 
@@ -111,72 +114,72 @@ inline u32 GetI4_RGBA4444( u64 *src, u16 x, u16 i, u8 palette )
 	return I4_RGBA4444( (x & 1) ? (color4B & 0x0F) : (color4B >> 4) );
 }
 
-inline u32 GetCI8IA_RGBA4444( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetCI8IA_RGBA4444( u64 *src, u16 x, u16 i, const u32 *palette )
 {
-	return IA88_RGBA4444( *(u16*)&TMEM[256 + ((u8*)src)[x^(i<<1)]] );
+	return RGBA8888_RGBA4444( palette[((u8*)src)[x^(i<<1)]] );
 }
 
-inline u32 GetCI8IA_RGBA8888( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetCI8IA_RGBA8888( u64 *src, u16 x, u16 i, const u32 *palette )
 {
-	return IA88_RGBA8888( *(u16*)&TMEM[256 + ((u8*)src)[x^(i<<1)]] );
+	return palette[((u8*)src)[x^(i<<1)]];
 }
 
-inline u32 GetCI8RGBA_RGBA5551( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetCI8RGBA_RGBA5551( u64 *src, u16 x, u16 i, const u32 *palette )
 {
-	return RGBA5551_RGBA5551( *(u16*)&TMEM[256 + ((u8*)src)[x^(i<<1)]] );
+	return RGBA8888_RGBA5551( palette[((u8*)src)[x^(i<<1)]] );
 }
 
-inline u32 GetCI8RGBA_RGBA8888( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetCI8RGBA_RGBA8888( u64 *src, u16 x, u16 i, const u32 *palette )
 {
-	return RGBA5551_RGBA8888( *(u16*)&TMEM[256 + ((u8*)src)[x^(i<<1)]] );
+	return palette[((u8*)src)[x^(i<<1)]];
 }
 
-inline u32 GetIA44_RGBA8888( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetIA44_RGBA8888( u64 *src, u16 x, u16 i, const u32 *palette )
 {
 	return IA44_RGBA8888(((u8*)src)[x^(i<<1)]);
 }
 
-inline u32 GetIA44_RGBA4444( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetIA44_RGBA4444( u64 *src, u16 x, u16 i, const u32 *palette )
 {
 	return IA44_RGBA4444(((u8*)src)[x^(i<<1)]);
 }
 
-inline u32 GetI8_RGBA8888( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetI8_RGBA8888( u64 *src, u16 x, u16 i, const u32 *palette )
 {
 	return I8_RGBA8888(((u8*)src)[x^(i<<1)]);
 }
 
-inline u32 GetI8_RGBA4444( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetI8_RGBA4444( u64 *src, u16 x, u16 i, const u32 *palette )
 {
 	return I8_RGBA4444(((u8*)src)[x^(i<<1)]);
 }
 
-inline u32 GetRGBA5551_RGBA8888( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetRGBA5551_RGBA8888( u64 *src, u16 x, u16 i, const u32 *palette )
 {
 	return RGBA5551_RGBA8888( ((u16*)src)[x^i] );
 }
 
-inline u32 GetRGBA5551_RGBA5551( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetRGBA5551_RGBA5551( u64 *src, u16 x, u16 i, const u32 *palette )
 {
 	return RGBA5551_RGBA5551( ((u16*)src)[x^i] );
 }
 
-inline u32 GetIA88_RGBA8888( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetIA88_RGBA8888( u64 *src, u16 x, u16 i, const u32 *palette )
 {
 	return IA88_RGBA8888(((u16*)src)[x^i]);
 }
 
-inline u32 GetIA88_RGBA4444( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetIA88_RGBA4444( u64 *src, u16 x, u16 i, const u32 *palette )
 {
 	return IA88_RGBA4444(((u16*)src)[x^i]);
 }
 
-inline u32 GetRGBA8888_RGBA8888( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetRGBA8888_RGBA8888( u64 *src, u16 x, u16 i, const u32 *palette )
 {
 	return ((u32*)src)[x^i];
 }
 
-inline u32 GetRGBA8888_RGBA4444( u64 *src, u16 x, u16 i, u8 palette )
+inline u32 GetRGBA8888_RGBA4444( u64 *src, u16 x, u16 i, const u32 *palette )
 {
 	return RGBA8888_RGBA4444(((u32*)src)[x^i]);
 }
@@ -218,17 +221,31 @@ const struct
 	}
 };
 
-int32_t TextureCache_GetTexel(gDPTile *tile, int32_t s, int32_t t) {
+// Palette-indexed getters are handed the expanded 16-entry bank (for CI4) or the whole 256-entry
+// palette (for CI8) rather than looking it up themselves.
+static const u32 *TextureCache_PaletteForGetter(const uint32_t *palette, uint8_t size, uint8_t bank) {
+    return size == G_IM_SIZ_4b ? &palette[(bank & 0xf) << 4] : palette;
+}
+
+int32_t TextureCache_GetTexel(gDPTile *tile,
+                              const uint64_t *tmem,
+                              const uint32_t *palette,
+                              int32_t s,
+                              int32_t t) {
     uint32_t line = tile->line;
     if (tile->size == G_IM_SIZ_32b)
         line <<= 1;
-    uint64_t *src = &TMEM[tile->tmem] + line * t;
+    uint64_t *src = (uint64_t *)&tmem[tile->tmem] + line * t;
     int32_t i = (t & 1) << 1;
 #ifdef VC_TEXTURE_SPEW
     if (tile->format == G_IM_FMT_IA && tile->size == G_IM_SIZ_4b)
         fprintf(stderr, "getting texel (%d,%d) ", (int)s, (int)t);
 #endif
-    int32_t texel = imageFormat[tile->size][tile->format].Get32(src, s, i, tile->palette);
+    int32_t texel = imageFormat[tile->size][tile->format].Get32(
+            src,
+            s,
+            i,
+            TextureCache_PaletteForGetter(palette, tile->size, tile->palette));
 #ifdef VC_TEXTURE_SPEW
     if (tile->format == G_IM_FMT_IA && tile->size == G_IM_SIZ_4b)
         fprintf(stderr, "\n");
@@ -236,11 +253,51 @@ int32_t TextureCache_GetTexel(gDPTile *tile, int32_t s, int32_t t) {
     return texel;
 }
 
-int32_t TextureCache_GetTexelFromBGImage(uint8_t *swapped, int32_t s, int32_t t) {
-    uint32_t bpp = TextureCache_SizeToBPP(gSP.bgImage.size);
-    uint32_t line = gSP.bgImage.width * bpp / 8;
-    uint64_t *src = (uint64_t *)(swapped + line * t);
-    return imageFormat[gSP.bgImage.size][gSP.bgImage.format].Get32(src, s, 0, gSP.bgImage.palette);
+// Rehashes and re-expands every 16-entry TLUT bank overlapping the given range of TMEM (in
+// 64-bit words). Banks whose contents haven't changed are left alone.
+void TextureCache_UpdatePalettes(uint32_t tmemStart, uint32_t tmemEnd) {
+    if (tmemEnd <= 256)
+        return;
+    if (tmemStart < 256)
+        tmemStart = 256;
+    if (tmemEnd > 512)
+        tmemEnd = 512;
+
+    for (uint32_t bank = (tmemStart - 256) >> 4; bank <= (tmemEnd - 257) >> 4; bank++) {
+        uint16_t colors[16];
+        for (uint32_t entry = 0; entry < 16; entry++)
+            memcpy(&colors[entry], &TMEM[256 + (bank << 4) + entry], sizeof(uint16_t));
+
+        XXH32_hash_t hash = XXH32(colors, sizeof(colors), PALETTE_HASH_SEED);
+        if (hash == gDP.paletteHash16[bank])
+            continue;
+        gDP.paletteHash16[bank] = hash;
+
+        for (uint32_t entry = 0; entry < 16; entry++) {
+            gDP.paletteRGBA[(bank << 4) + entry] = RGBA5551_RGBA8888(colors[entry]);
+            gDP.paletteIA[(bank << 4) + entry] = IA88_RGBA8888(colors[entry]);
+        }
+    }
+
+    gDP.paletteHash256 = XXH32(gDP.paletteHash16, sizeof(gDP.paletteHash16), PALETTE_HASH_SEED);
+}
+
+// The expanded TLUT that palette-indexed textures look colors up in: the TLUT type decides
+// whether its entries are RGBA5551 or IA88.
+const uint32_t *TextureCache_CurrentPalette() {
+    return gDP.otherMode.textureLUT == G_TT_IA16 ? gDP.paletteIA : gDP.paletteRGBA;
+}
+
+// Decodes a single already-unswapped scanline of the current background image into RGBA8888
+// texels. The getter is looked up once per row rather than once per texel.
+void TextureCache_DecodeBGImageRow(uint8_t *swappedRow, uint32_t width, uint32_t *dest) {
+    GetTexelFunc getTexel = imageFormat[gSP.bgImage.size][gSP.bgImage.format].Get32;
+    const u32 *palette =
+        TextureCache_PaletteForGetter(TextureCache_CurrentPalette(),
+                                      gSP.bgImage.size,
+                                      gSP.bgImage.palette);
+    for (uint32_t s = 0; s < width; s++)
+        dest[s] = getTexel((uint64_t *)swappedRow, s, 0, palette);
 }
 
 #if 0
@@ -14,8 +14,14 @@ inline uint8_t TextureCache_SizeToBPP(uint8_t size) {
     }
 }
 
-int32_t TextureCache_GetTexel(gDPTile *tile, int32_t s, int32_t t);
-int32_t TextureCache_GetTexelFromBGImage(uint8_t *swapped, int32_t s, int32_t t);
+int32_t TextureCache_GetTexel(gDPTile *tile,
+                              const uint64_t *tmem,
+                              const uint32_t *palette,
+                              int32_t s,
+                              int32_t t);
+void TextureCache_UpdatePalettes(uint32_t tmemStart, uint32_t tmemEnd);
+const uint32_t *TextureCache_CurrentPalette();
+void TextureCache_DecodeBGImageRow(uint8_t *swappedRow, uint32_t width, uint32_t *dest);
 
 #endif
 
@@ -11,50 +11,103 @@
 #include "N64.h"
 #include "Textures.h"
 #include "VCAtlas.h"
+#include "VCConfig.h"
 #include "VCGL.h"
 #include "VCGeometry.h"
 #include "VCRenderer.h"
+#include "VCUtils.h"
 #include "convert.h"
 #include "gDP.h"
 #include "gSP.h"
+#include "stb_image.h"
+#include "stb_image_write.h"
 
 #define BYTES_PER_PIXEL                     4
+#define BYTES_PER_PIXEL_16                  2
 #define HASH_SEED                           0xdeadbeef
+#define REPLACEMENT_HASH_SEED               0x48445458
+#define TEXTURE_PACK_HASH_SEED              0x56435450
+#define INITIAL_CACHED_TEXTURE_SLOTS_LENGTH 256
+#define MIN_COALESCED_UPLOAD_COVERAGE       50
 #define INITIAL_STORED_TEXTURES_CAPACITY    16
-#define MAX_TEXTURE_BYTES_USED              (4 * 1024 * 1024)
+#define BG_IMAGE_SAMPLED_ROWS               8
+#define BG_IMAGE_DECODE_CHUNK_TEXELS        VC_ATLAS_TEXTURE_SIZE
 
 #define S8  3
 #define S16 1
 
-static void VCAtlas_InitFreeList(VCAtlas *atlas) {
-    atlas->freeList = (VCRectus *)malloc(sizeof(VCRectus));
-    atlas->freeListSize = 1;
-    atlas->freeListCapacity = 1;
-    atlas->freeList[0].origin.x = atlas->freeList[0].origin.y = 0;
-    atlas->freeList[0].size.width = atlas->freeList[0].size.height = VC_ATLAS_TEXTURE_SIZE;
+// Everything needed to decode a tile texture, copied out of the RDP state at the time the texture
+// was first seen so that it can be decoded later on a worker thread. Jobs for HD replacements
+// point at the image in the (memory-mapped) replacement pack instead.
+struct VCTextureDecodeJob {
+    VCCachedTexture *cachedTexture;
+    uint8_t rawFormat;
+    uint8_t pageFormat;
+    gDPTile tile;
+    VCSize2us size;
+    uint64_t tmem[512];
+    uint32_t palette[256];
+    const uint8_t *replacementData;
+    uint32_t replacementLength;
+
+    // If set, the decoded pixels are appended to this atlas's texture pack under the record.
+    VCAtlas *texturePackAtlas;
+    VCTexturePackRecord texturePackRecord;
+};
+
+// A compact copy of the TMEM words and palette entries a tile texture was decoded from, kept in
+// place of the decoded pixels when `textures.retainDecodedPixels` is off. The tile is rebased so
+// that its texels start at word 0 and, for CI4, its palette bank is bank 0.
+struct VCTextureSource {
+    gDPTile tile;
+    VCSize2us size;
+    uint8_t rawFormat;
+    uint8_t pageFormat;
+    uint32_t tmemLength;
+    uint32_t paletteLength;
+    uint64_t *tmem;
+    uint32_t *palette;
+};
+
+static uint32_t VCAtlas_BytesPerPixelForPageFormat(uint8_t pageFormat) {
+    switch (pageFormat) {
+    case VC_ATLAS_PAGE_FORMAT_RGBA4444:
+    case VC_ATLAS_PAGE_FORMAT_RGBA5551:
+        return BYTES_PER_PIXEL_16;
+    default:
+        return BYTES_PER_PIXEL;
+    }
 }
 
-void VCAtlas_Create(VCAtlas *atlas) {
-    atlas->cachedTextures = NULL;
-    for (uint32_t i = 0; i < VC_ATLAS_TILE_COUNT; i++)
-        atlas->cachedTileTextures[i] = NULL;
-
-    atlas->textureBytesUsed = 0;
+static GLenum VCAtlas_GLTypeForPageFormat(uint8_t pageFormat) {
+    switch (pageFormat) {
+    case VC_ATLAS_PAGE_FORMAT_RGBA4444:
+        return GL_UNSIGNED_SHORT_4_4_4_4;
+    case VC_ATLAS_PAGE_FORMAT_RGBA5551:
+        return GL_UNSIGNED_SHORT_5_5_5_1;
+    default:
+        return GL_UNSIGNED_BYTE;
+    }
+}
 
-    VCAtlas_InitFreeList(atlas);
+// Creates the GL texture for a page, or respecifies it if the page has been reused for textures
+// of a different format. Called on the render thread.
+static void VCAtlasPage_PrepareTexture(VCAtlasPage *page, uint8_t pageFormat) {
+    if (page->texture != 0 && page->textureFormat == pageFormat)
+        return;
 
-    atlas->hashState = XXH32_createState();
+    if (page->texture == 0)
+        GL(glGenTextures(1, &page->texture));
+    page->textureFormat = pageFormat;
 
-    GL(glGenTextures(1, &atlas->texture));
     GL(glActiveTexture(GL_TEXTURE0));
-    GL(glBindTexture(GL_TEXTURE_2D, atlas->texture));
-    char *pixels = (char *)malloc(VC_ATLAS_TEXTURE_SIZE * VC_ATLAS_TEXTURE_SIZE * BYTES_PER_PIXEL);
-    for (int i = 0; i < VC_ATLAS_TEXTURE_SIZE * VC_ATLAS_TEXTURE_SIZE; i++) {
-        pixels[i * BYTES_PER_PIXEL + 0] = 0xff;
-        pixels[i * BYTES_PER_PIXEL + 1] = 0xff;
-        pixels[i * BYTES_PER_PIXEL + 2] = 0xff;
-        pixels[i * BYTES_PER_PIXEL + 3] = 0xff;
-    }
+    GL(glBindTexture(GL_TEXTURE_2D, page->texture));
+    size_t length = VC_ATLAS_TEXTURE_SIZE * VC_ATLAS_TEXTURE_SIZE *
+        VCAtlas_BytesPerPixelForPageFormat(pageFormat);
+    char *pixels = (char *)malloc(length);
+    if (pixels == NULL)
+        abort();
+    memset(pixels, 0xff, length);
     GL(glTexImage2D(GL_TEXTURE_2D,
                     0,
                     GL_RGBA,
@@ -62,7 +115,7 @@ void VCAtlas_Create(VCAtlas *atlas) {
                     VC_ATLAS_TEXTURE_SIZE,
                     0,
                     GL_RGBA,
-                    GL_UNSIGNED_BYTE,
+                    VCAtlas_GLTypeForPageFormat(pageFormat),
                     pixels));
     free(pixels);
     GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
@@ -71,118 +124,683 @@ void VCAtlas_Create(VCAtlas *atlas) {
     GL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
 }
 
-bool VCAtlas_Allocate(VCAtlas *atlas, VCPoint2us *result, VCSize2us *size) {
-    if (atlas->freeListSize == 0)
-        return false;
+static uint32_t VCAtlas_ParseGPUDecodeFormats(const char *formatList) {
+    static const char *formatNames[VC_RAW_TEXTURE_FORMAT_COUNT] = {
+        NULL, "i4", "ia4", "ci4", "i8", "ia8", "ci8", "ia16"
+    };
 
-    size_t bestIndex = 0;
-    uint32_t best_area = UINT_MAX;
-    for (size_t i = 0; i < atlas->freeListSize; i++) {
-        VCRectus *candidate = &atlas->freeList[i];
-        uint32_t candidate_area = (uint32_t)candidate->size.width *
-            (uint32_t)candidate->size.height;
-        if (candidate->size.width >= size->width &&
-                candidate->size.height >= size->height &&
-                candidate_area < best_area) {
-            bestIndex = i;
-            best_area = candidate_area;
+    uint32_t formats = 0;
+    char *formatListCopy = strdup(formatList), *remaining = formatListCopy, *formatName;
+    while ((formatName = xstrsep(&remaining, ", ")) != NULL) {
+        if (formatName[0] == '\0')
+            continue;
+        if (strcmp(formatName, "all") == 0) {
+            formats |= ~1u & ((1u << VC_RAW_TEXTURE_FORMAT_COUNT) - 1);
+            continue;
+        }
+        uint8_t rawFormat;
+        for (rawFormat = 1; rawFormat < VC_RAW_TEXTURE_FORMAT_COUNT; rawFormat++) {
+            if (strcmp(formatName, formatNames[rawFormat]) == 0)
+                break;
         }
+        if (rawFormat == VC_RAW_TEXTURE_FORMAT_COUNT) {
+            fprintf(stderr,
+                    "video warning: unknown texture format `%s` in `textures.gpuDecodeFormats`\n",
+                    formatName);
+            continue;
+        }
+        formats |= 1 << rawFormat;
     }
-    if (best_area == UINT_MAX)
-        return false;
+    free(formatListCopy);
+    return formats;
+}
+
+static uint8_t VCAtlas_ParsePacker(const char *packerName) {
+    if (strcmp(packerName, "maxrects") == 0)
+        return VC_ATLAS_PACKER_MAXRECTS;
+    if (strcmp(packerName, "guillotine") != 0) {
+        fprintf(stderr,
+                "video warning: unknown packer `%s` in `textures.atlasPacker`\n",
+                packerName);
+    }
+    return VC_ATLAS_PACKER_GUILLOTINE;
+}
+
+void VCAtlas_Create(VCAtlas *atlas) {
+    atlas->cachedTextureSlots = NULL;
+    atlas->cachedTextureSlotsLength = 0;
+    atlas->cachedTexturesLength = 0;
+    atlas->leastRecentlyUsedTexture = NULL;
+    atlas->mostRecentlyUsedTexture = NULL;
+    atlas->usedTextures = NULL;
+    atlas->usedTexturesEpoch = 0;
+    atlas->texturesNeedingUpload = NULL;
+    for (uint32_t i = 0; i < VC_ATLAS_TILE_COUNT; i++)
+        atlas->cachedTileTextures[i] = NULL;
+    memset(atlas->cachedBGImages, '\0', sizeof(atlas->cachedBGImages));
 
-    VCRectus chosenRect = atlas->freeList[bestIndex];
-    *result = chosenRect.origin;
+    atlas->textureBytesUsed = 0;
+    atlas->maxTextureBytesUsed = (size_t)VCConfig_SharedConfig()->textureCacheSizeKB * 1024;
+    atlas->retainDecodedPixels = VCConfig_SharedConfig()->retainDecodedPixels;
 
-    // Guillotine to right.
-    atlas->freeList[bestIndex].origin.x = chosenRect.origin.x + size->width;
-    atlas->freeList[bestIndex].origin.y = chosenRect.origin.y;
-    atlas->freeList[bestIndex].size.width = chosenRect.size.width - size->width;
-    atlas->freeList[bestIndex].size.height = size->height;
+    // The texture pack is opened once the ROM is known.
+    memset(&atlas->texturePack, '\0', sizeof(atlas->texturePack));
+    atlas->texturePack.fd = -1;
+    atlas->texturePackMutex = SDL_CreateMutex();
+    atlas->texturePackHashState = XXH64_createState();
 
-    // Guillotine to bottom.
-    if (atlas->freeListSize + 1 > atlas->freeListCapacity) {
-        atlas->freeListCapacity *= 2;
-        atlas->freeList = (VCRectus *)realloc(atlas->freeList,
-                                              sizeof(VCRectus) * atlas->freeListCapacity);
-    }
+    atlas->hashState = XXH32_createState();
 
-    atlas->freeList[atlas->freeListSize].origin.x = chosenRect.origin.x;
-    atlas->freeList[atlas->freeListSize].origin.y = chosenRect.origin.y + size->height;
-    atlas->freeList[atlas->freeListSize].size.width = chosenRect.size.width;
-    atlas->freeList[atlas->freeListSize].size.height = chosenRect.size.height - size->height;
-    atlas->freeListSize++;
-    return true;
+    VCTextureDecoder_Create(&atlas->decoder, VCConfig_SharedConfig()->textureDecodeThreads);
+
+    // The replacement pack is opened once the ROM is known too.
+    memset(&atlas->replacementPack, '\0', sizeof(atlas->replacementPack));
+    VCTextureDecoder_Create(&atlas->replacementDecoder, 1);
+    atlas->gpuDecodeFormats =
+        VCAtlas_ParseGPUDecodeFormats(VCConfig_SharedConfig()->gpuTextureDecodeFormats);
+    atlas->trace = NULL;
+
+    // Pages are created on demand, as textures that need them turn up.
+    memset(atlas->pages, '\0', sizeof(atlas->pages));
+    atlas->pagesLength = 0;
+    // A frame may need a page of every format, and with fewer pages than that, pages of different
+    // formats would keep evicting each other.
+    int maxPages = VCConfig_SharedConfig()->maxAtlasPages;
+    if (maxPages < VC_ATLAS_PAGE_FORMAT_COUNT)
+        maxPages = VC_ATLAS_PAGE_FORMAT_COUNT;
+    else if (maxPages > VC_ATLAS_MAX_PAGES)
+        maxPages = VC_ATLAS_MAX_PAGES;
+    atlas->maxPages = (uint8_t)maxPages;
+    atlas->packer = VCAtlas_ParsePacker(VCConfig_SharedConfig()->atlasPacker);
+    atlas->pageEvictionCount = 0;
 }
 
 static VCCachedTexture *VCAtlas_LookUpTextureByTMEMHash(VCAtlas *atlas, XXH32_hash_t tmemHash) {
-    VCCachedTexture *cachedTexture = NULL;
-    HASH_FIND_INT(atlas->cachedTextures, &tmemHash, cachedTexture);
-    if (cachedTexture == NULL)
+    if (atlas->cachedTextureSlotsLength == 0)
         return NULL;
-    
-    // Move the item to the end of the list to maintain LRU sorting.
-    HASH_DEL(atlas->cachedTextures, cachedTexture);
-    HASH_ADD_INT(atlas->cachedTextures, tmemHash, cachedTexture);
-    return cachedTexture;
+    size_t mask = atlas->cachedTextureSlotsLength - 1;
+    for (size_t index = tmemHash & mask; ; index = (index + 1) & mask) {
+        VCCachedTextureSlot *slot = &atlas->cachedTextureSlots[index];
+        if (slot->cachedTexture == NULL)
+            return NULL;
+        if (slot->tmemHash == tmemHash)
+            return slot->cachedTexture;
+    }
+}
+
+static void VCAtlas_InsertTextureSlot(VCCachedTextureSlot *slots,
+                                      size_t slotsLength,
+                                      VCCachedTexture *cachedTexture) {
+    size_t mask = slotsLength - 1;
+    size_t index = cachedTexture->tmemHash & mask;
+    while (slots[index].cachedTexture != NULL)
+        index = (index + 1) & mask;
+    slots[index].tmemHash = cachedTexture->tmemHash;
+    slots[index].cachedTexture = cachedTexture;
 }
 
-#if 0
-static void VCAtlas_Clear(VCAtlas *atlas) {
-    VCCachedTexture *currentCachedTexture, *temp_allocated_texture;
-    HASH_ITER(hh, atlas->cachedTextures, currentCachedTexture, temp_allocated_texture) {
-        HASH_DEL(atlas->cachedTextures, currentCachedTexture);
-        free(currentCachedTexture);
+// Doubles the number of slots, keeping the table at most half full so that probes stay short.
+static void VCAtlas_GrowTextureSlots(VCAtlas *atlas) {
+    size_t newSlotsLength = atlas->cachedTextureSlotsLength == 0 ?
+        INITIAL_CACHED_TEXTURE_SLOTS_LENGTH : atlas->cachedTextureSlotsLength * 2;
+    VCCachedTextureSlot *newSlots =
+        (VCCachedTextureSlot *)calloc(newSlotsLength, sizeof(VCCachedTextureSlot));
+    if (newSlots == NULL)
+        abort();
+    for (size_t i = 0; i < atlas->cachedTextureSlotsLength; i++) {
+        VCCachedTexture *cachedTexture = atlas->cachedTextureSlots[i].cachedTexture;
+        if (cachedTexture != NULL)
+            VCAtlas_InsertTextureSlot(newSlots, newSlotsLength, cachedTexture);
     }
+    free(atlas->cachedTextureSlots);
+    atlas->cachedTextureSlots = newSlots;
+    atlas->cachedTextureSlotsLength = newSlotsLength;
+}
 
-    free(atlas->freeList);
-    VCAtlas_InitFreeList(atlas);
+static void VCAtlas_AppendToLRUList(VCAtlas *atlas, VCCachedTexture *cachedTexture) {
+    cachedTexture->lruPrev = atlas->mostRecentlyUsedTexture;
+    cachedTexture->lruNext = NULL;
+    if (atlas->mostRecentlyUsedTexture != NULL)
+        atlas->mostRecentlyUsedTexture->lruNext = cachedTexture;
+    else
+        atlas->leastRecentlyUsedTexture = cachedTexture;
+    atlas->mostRecentlyUsedTexture = cachedTexture;
 }
-#endif
 
-static void VCAtlas_ClearAtlasTexture(VCAtlas *atlas) {
-    VCCachedTexture *cachedTexture = NULL, *tempCachedTexture = NULL;
-    HASH_ITER(hh, atlas->cachedTextures, cachedTexture, tempCachedTexture) {
-        cachedTexture->info.uvValid = false;
+static void VCAtlas_RemoveFromLRUList(VCAtlas *atlas, VCCachedTexture *cachedTexture) {
+    if (cachedTexture->lruPrev != NULL)
+        cachedTexture->lruPrev->lruNext = cachedTexture->lruNext;
+    else
+        atlas->leastRecentlyUsedTexture = cachedTexture->lruNext;
+    if (cachedTexture->lruNext != NULL)
+        cachedTexture->lruNext->lruPrev = cachedTexture->lruPrev;
+    else
+        atlas->mostRecentlyUsedTexture = cachedTexture->lruPrev;
+}
+
+// Puts the texture on the list of textures used this frame, starting a new list if the frame has
+// moved on since the list was last added to.
+static void VCAtlas_AppendToUsedTextures(VCAtlas *atlas,
+                                         VCCachedTexture *cachedTexture,
+                                         uint32_t currentEpoch) {
+    if (atlas->usedTexturesEpoch != currentEpoch) {
+        atlas->usedTextures = NULL;
+        atlas->usedTexturesEpoch = currentEpoch;
     }
+    cachedTexture->nextUsedTexture = atlas->usedTextures;
+    atlas->usedTextures = cachedTexture;
+}
 
-    free(atlas->freeList);
-    VCAtlas_InitFreeList(atlas);
+static VCCachedTexture *VCAtlas_GetUsedTextures(VCAtlas *atlas, uint32_t currentEpoch) {
+    return atlas->usedTexturesEpoch == currentEpoch ? atlas->usedTextures : NULL;
 }
 
-void VCAtlas_AllocateTexturesInAtlas(VCAtlas *atlas,
-                                     const VCRenderer *renderer,
-                                     bool clearAndRetryOnOverflow) {
-    VCCachedTexture *cachedTexture = NULL, *tempCachedTexture = NULL;
-    HASH_ITER(hh, atlas->cachedTextures, cachedTexture, tempCachedTexture) {
-        if (cachedTexture->info.uvValid)
+// Records that the texture is used this frame. The first use in a frame moves it to the most
+// recently used end of the LRU list, which keeps the list sorted by `lastUsedEpoch`.
+static void VCAtlas_MarkTextureUsed(VCAtlas *atlas,
+                                    VCCachedTexture *cachedTexture,
+                                    uint32_t currentEpoch) {
+    if (cachedTexture->lastUsedEpoch == currentEpoch)
+        return;
+    cachedTexture->lastUsedEpoch = currentEpoch;
+    VCAtlas_RemoveFromLRUList(atlas, cachedTexture);
+    VCAtlas_AppendToLRUList(atlas, cachedTexture);
+    VCAtlas_AppendToUsedTextures(atlas, cachedTexture, currentEpoch);
+}
+
+// Adds a texture first used this frame to the cache.
+static void VCAtlas_AddTextureToCache(VCAtlas *atlas,
+                                      VCCachedTexture *cachedTexture,
+                                      uint32_t currentEpoch) {
+    if ((atlas->cachedTexturesLength + 1) * 2 > atlas->cachedTextureSlotsLength)
+        VCAtlas_GrowTextureSlots(atlas);
+    VCAtlas_InsertTextureSlot(atlas->cachedTextureSlots,
+                              atlas->cachedTextureSlotsLength,
+                              cachedTexture);
+    atlas->cachedTexturesLength++;
+
+    cachedTexture->lastUsedEpoch = currentEpoch;
+    cachedTexture->nextTextureNeedingUpload = NULL;
+    VCAtlas_AppendToLRUList(atlas, cachedTexture);
+    VCAtlas_AppendToUsedTextures(atlas, cachedTexture, currentEpoch);
+}
+
+// Removes the texture from the cache. Entries after it in its probe sequence are shifted back
+// into the hole, so that lookups never need tombstones.
+static void VCAtlas_RemoveTextureFromCache(VCAtlas *atlas, VCCachedTexture *cachedTexture) {
+    size_t mask = atlas->cachedTextureSlotsLength - 1;
+    size_t hole = cachedTexture->tmemHash & mask;
+    while (atlas->cachedTextureSlots[hole].cachedTexture != cachedTexture)
+        hole = (hole + 1) & mask;
+
+    for (size_t index = (hole + 1) & mask;
+            atlas->cachedTextureSlots[index].cachedTexture != NULL;
+            index = (index + 1) & mask) {
+        // An entry can fill the hole only if the hole lies between its home slot and its slot.
+        size_t home = atlas->cachedTextureSlots[index].tmemHash & mask;
+        if (((index - home) & mask) >= ((index - hole) & mask)) {
+            atlas->cachedTextureSlots[hole] = atlas->cachedTextureSlots[index];
+            hole = index;
+        }
+    }
+    atlas->cachedTextureSlots[hole].cachedTexture = NULL;
+    atlas->cachedTexturesLength--;
+
+    VCAtlas_RemoveFromLRUList(atlas, cachedTexture);
+}
+
+// HD replacements can't be placed or thrown away while they're being decoded, and are never used if
+// decoding them failed.
+static bool VCCachedTexture_IsReady(VCCachedTexture *cachedTexture) {
+    return SDL_AtomicGet(&cachedTexture->replacementDecodesPending) == 0 &&
+        !cachedTexture->replacementFailed;
+}
+
+static VCRectus VCTextureInfo_UVIncludingBorder(VCTextureInfo *info);
+
+static uint32_t VCTextureInfo_BorderPixels(VCTextureInfo *info) {
+    return 2 * ((uint32_t)info->uv.size.width + (uint32_t)info->uv.size.height) + 4;
+}
+
+// Gives the texture's space in the atlas, border included, back to its page. The texture stays in
+// the cache and is placed again the next time it's used.
+static void VCAtlas_EvictTextureFromPage(VCAtlas *atlas, VCCachedTexture *cachedTexture) {
+    if (!cachedTexture->info.uvValid)
+        return;
+    VCRectus uv = VCTextureInfo_UVIncludingBorder(&cachedTexture->info);
+    VCAtlasPage *page = &atlas->pages[cachedTexture->info.page];
+    VCAtlasPage_Free(page, &uv);
+    page->borderPixelsUsed -= VCTextureInfo_BorderPixels(&cachedTexture->info);
+    cachedTexture->info.uvValid = false;
+    if (atlas->trace != NULL) {
+        fprintf(atlas->trace,
+                "f %u %u\n",
+                (unsigned)cachedTexture->info.page,
+                (unsigned)uv.origin.y * VC_ATLAS_TEXTURE_SIZE + uv.origin.x);
+    }
+
+    VCDebugger *debugger = VCRenderer_SharedRenderer()->debugger;
+    VCDebugger_IncrementSample(debugger, &debugger->stats.atlasTextureEvictions);
+}
+
+// Throws away everything in a page and hands it over to textures of the given format.
+static void VCAtlas_EvictAtlasPage(VCAtlas *atlas, uint8_t pageIndex, uint8_t pageFormat) {
+    for (VCCachedTexture *cachedTexture = atlas->leastRecentlyUsedTexture;
+            cachedTexture != NULL;
+            cachedTexture = cachedTexture->lruNext) {
+        if (cachedTexture->info.uvValid && cachedTexture->info.page == pageIndex)
+            cachedTexture->info.uvValid = false;
+    }
+
+    VCAtlasPage *page = &atlas->pages[pageIndex];
+    free(page->freeList);
+    free(page->usedList);
+    VCAtlasPage_InitFreeList(page);
+    page->format = pageFormat;
+    page->packer = atlas->packer;
+    if (atlas->trace != NULL)
+        fprintf(atlas->trace, "e %u\n", (unsigned)pageIndex);
+}
+
+// Finds a page to put a texture of the given format in when none of the existing pages of that
+// format have room. A new page is added if we're below the limit; otherwise the least recently
+// used page is evicted. Returns true if the evicted page had textures used this frame in it.
+static bool VCAtlas_AcquirePage(VCAtlas *atlas,
+                                VCRenderer *renderer,
+                                uint8_t pageFormat,
+                                uint8_t *pageIndex) {
+    if (atlas->pagesLength < atlas->maxPages) {
+        *pageIndex = atlas->pagesLength;
+        atlas->pagesLength++;
+
+        VCAtlasPage *page = &atlas->pages[*pageIndex];
+        VCAtlasPage_InitFreeList(page);
+        page->format = pageFormat;
+        page->packer = atlas->packer;
+        page->lastUsedEpoch = renderer->currentEpoch;
+        return false;
+    }
+
+    uint8_t victimIndex = 0;
+    for (uint8_t i = 1; i < atlas->pagesLength; i++) {
+        if (atlas->pages[i].lastUsedEpoch < atlas->pages[victimIndex].lastUsedEpoch)
+            victimIndex = i;
+    }
+
+    bool usedThisFrame = atlas->pages[victimIndex].lastUsedEpoch == renderer->currentEpoch;
+    VCAtlas_EvictAtlasPage(atlas, victimIndex, pageFormat);
+    atlas->pages[victimIndex].lastUsedEpoch = renderer->currentEpoch;
+    VCDebugger_IncrementSample(renderer->debugger, &renderer->debugger->stats.atlasPageEvictions);
+    atlas->pageEvictionTimes[atlas->pageEvictionCount % VC_ATLAS_PAGE_EVICTION_HISTORY] =
+        SDL_GetTicks();
+    atlas->pageEvictionCount++;
+
+    *pageIndex = victimIndex;
+    return usedThisFrame;
+}
+
+static bool VCAtlas_AllocateTextureInPage(VCAtlas *atlas,
+                                          uint8_t pageIndex,
+                                          VCCachedTexture *cachedTexture,
+                                          uint32_t currentEpoch) {
+    VCAtlasPage *page = &atlas->pages[pageIndex];
+    if (page->format != cachedTexture->info.pageFormat)
+        return false;
+
+    VCPoint2us originIncludingBorder = { 0, 0 };
+    VCSize2us sizeIncludingBorder = {
+        (uint16_t)(cachedTexture->info.uv.size.width + 2),
+        (uint16_t)(cachedTexture->info.uv.size.height + 2),
+    };
+    if (!VCAtlasPage_Allocate(page, &originIncludingBorder, &sizeIncludingBorder))
+        return false;
+    if (atlas->trace != NULL) {
+        // The allocation's origin identifies it until it's freed.
+        fprintf(atlas->trace,
+                "a %u %u %u %u\n",
+                (unsigned)pageIndex,
+                (unsigned)originIncludingBorder.y * VC_ATLAS_TEXTURE_SIZE +
+                originIncludingBorder.x,
+                (unsigned)sizeIncludingBorder.width,
+                (unsigned)sizeIncludingBorder.height);
+    }
+
+    cachedTexture->info.uv.origin.x = originIncludingBorder.x + 1;
+    cachedTexture->info.uv.origin.y = originIncludingBorder.y + 1;
+    cachedTexture->info.page = pageIndex;
+    cachedTexture->info.uvValid = true;
+    page->borderPixelsUsed += VCTextureInfo_BorderPixels(&cachedTexture->info);
+    if (!cachedTexture->info.needsUpload) {
+        cachedTexture->nextTextureNeedingUpload = atlas->texturesNeedingUpload;
+        atlas->texturesNeedingUpload = cachedTexture;
+        cachedTexture->info.needsUpload = true;
+    }
+    page->lastUsedEpoch = currentEpoch;
+    return true;
+}
+
+// Makes room for a texture by evicting the least recently used textures from a single page of its
+// format, stopping as soon as the texture fits. Textures used this frame are left alone. The page
+// is the one with the most room once those textures are gone, and nothing is evicted if even that
+// isn't enough, so that textures on other pages aren't thrown away for nothing.
+static bool VCAtlas_EvictTexturesToFit(VCAtlas *atlas,
+                                       VCCachedTexture *cachedTexture,
+                                       uint32_t currentEpoch) {
+    uint32_t neededArea = (uint32_t)(cachedTexture->info.uv.size.width + 2) *
+        (uint32_t)(cachedTexture->info.uv.size.height + 2);
+    uint32_t reclaimableArea[VC_ATLAS_MAX_PAGES] = { 0 };
+    for (uint8_t pageIndex = 0; pageIndex < atlas->pagesLength; pageIndex++) {
+        reclaimableArea[pageIndex] =
+            VC_ATLAS_TEXTURE_SIZE * VC_ATLAS_TEXTURE_SIZE - atlas->pages[pageIndex].pixelsUsed;
+    }
+
+    // Everything in the LRU list from the first texture used this frame on has been used this
+    // frame too.
+    for (VCCachedTexture *victim = atlas->leastRecentlyUsedTexture;
+            victim != NULL && victim->lastUsedEpoch != currentEpoch;
+            victim = victim->lruNext) {
+        if (!victim->info.uvValid)
             continue;
-        if (cachedTexture->lastUsedEpoch != renderer->currentEpoch)
+        VCRectus uv = VCTextureInfo_UVIncludingBorder(&victim->info);
+        reclaimableArea[victim->info.page] += (uint32_t)uv.size.width * (uint32_t)uv.size.height;
+    }
+
+    bool found = false;
+    uint8_t targetPageIndex = 0;
+    for (uint8_t pageIndex = 0; pageIndex < atlas->pagesLength; pageIndex++) {
+        if (atlas->pages[pageIndex].format != cachedTexture->info.pageFormat ||
+                reclaimableArea[pageIndex] < neededArea) {
             continue;
+        }
+        if (!found || reclaimableArea[pageIndex] > reclaimableArea[targetPageIndex]) {
+            targetPageIndex = pageIndex;
+            found = true;
+        }
+    }
+    if (!found)
+        return false;
 
-        VCPoint2us originIncludingBorder = { 0, 0 };
-        VCSize2us sizeIncludingBorder = {
-            (uint16_t)(cachedTexture->info.uv.size.width + 2),
-            (uint16_t)(cachedTexture->info.uv.size.height + 2),
-        };
-        if (VCAtlas_Allocate(atlas, &originIncludingBorder, &sizeIncludingBorder)) {
-            cachedTexture->info.uv.origin.x = originIncludingBorder.x + 1;
-            cachedTexture->info.uv.origin.y = originIncludingBorder.y + 1;
-            cachedTexture->info.uvValid = true;
-            cachedTexture->info.needsUpload = true;
+    uint32_t freeArea = VC_ATLAS_TEXTURE_SIZE * VC_ATLAS_TEXTURE_SIZE -
+        atlas->pages[targetPageIndex].pixelsUsed;
+    VCCachedTexture *nextVictim = NULL;
+    for (VCCachedTexture *victim = atlas->leastRecentlyUsedTexture;
+            victim != NULL && victim->lastUsedEpoch != currentEpoch;
+            victim = nextVictim) {
+        nextVictim = victim->lruNext;
+        if (!victim->info.uvValid || victim->info.page != targetPageIndex)
+            continue;
+
+        VCRectus uv = VCTextureInfo_UVIncludingBorder(&victim->info);
+        VCAtlas_EvictTextureFromPage(atlas, victim);
+        freeArea += (uint32_t)uv.size.width * (uint32_t)uv.size.height;
+        if (freeArea < neededArea)
+            continue;
+
+        // Retry only once enough space has been freed to possibly fit the texture.
+        if (VCAtlas_AllocateTextureInPage(atlas, targetPageIndex, cachedTexture, currentEpoch))
+            return true;
+    }
+    return false;
+}
+
+// Textures that can't be placed are looked at again every frame they're used, so only warn once.
+static void VCAtlas_WarnTextureDoesntFit(VCCachedTexture *cachedTexture) {
+    if (cachedTexture->warnedDoesntFit)
+        return;
+    cachedTexture->warnedDoesntFit = true;
+    fprintf(stderr,
+            "video warning: %dx%d texture doesn't fit in the atlas; skipping it\n",
+            (int)cachedTexture->info.uv.size.width,
+            (int)cachedTexture->info.uv.size.height);
+}
+
+// Evicting a page holding textures that were already placed this frame means those textures have
+// to be placed again, so start over. `retriesLeft` keeps a working set that can't fit in the atlas
+// from looping forever; once it runs out, textures that can't be placed are drawn with whatever
+// their stale coordinates point at this frame and placed again the next.
+static void VCAtlas_AllocateTexturesInPages(VCAtlas *atlas,
+                                            VCRenderer *renderer,
+                                            uint32_t retriesLeft) {
+    uint32_t currentEpoch = renderer->currentEpoch;
+    for (VCCachedTexture *cachedTexture = VCAtlas_GetUsedTextures(atlas, currentEpoch);
+            cachedTexture != NULL;
+            cachedTexture = cachedTexture->nextUsedTexture) {
+        if (cachedTexture->info.uvValid || !VCCachedTexture_IsReady(cachedTexture))
+            continue;
+
+        // A texture bigger than a page, border included, would never fit, so don't evict
+        // anything for it.
+        if ((uint32_t)cachedTexture->info.uv.size.width + 2 > VC_ATLAS_TEXTURE_SIZE ||
+                (uint32_t)cachedTexture->info.uv.size.height + 2 > VC_ATLAS_TEXTURE_SIZE) {
+            VCAtlas_WarnTextureDoesntFit(cachedTexture);
             continue;
         }
 
-        if (!clearAndRetryOnOverflow) {
-            fprintf(stderr, "Couldn't allocate texture in atlas!\n");
-            abort();
+        bool allocated = false;
+        for (uint8_t pageIndex = 0; pageIndex < atlas->pagesLength && !allocated; pageIndex++)
+            allocated = VCAtlas_AllocateTextureInPage(atlas, pageIndex, cachedTexture, currentEpoch);
+        if (allocated)
+            continue;
+
+        // Out of room in the pages of this format. Add a page if we can; otherwise evict textures
+        // from those pages, and only if that doesn't free up enough room, a whole page.
+        if (atlas->pagesLength == atlas->maxPages &&
+                VCAtlas_EvictTexturesToFit(atlas, cachedTexture, currentEpoch)) {
+            continue;
+        }
+
+        uint8_t pageIndex = 0;
+        bool evictedTexturesUsedThisFrame =
+            VCAtlas_AcquirePage(atlas, renderer, cachedTexture->info.pageFormat, &pageIndex);
+        if (!VCAtlas_AllocateTextureInPage(atlas, pageIndex, cachedTexture, currentEpoch)) {
+            VCAtlas_WarnTextureDoesntFit(cachedTexture);
+            continue;
+        }
+
+        if (evictedTexturesUsedThisFrame && retriesLeft > 0) {
+            VCAtlas_AllocateTexturesInPages(atlas, renderer, retriesLeft - 1);
+            return;
+        }
+    }
+}
+
+// A texture or free rectangle to draw in the heatmap, copied out so that the heatmap can be drawn
+// and written on its own thread.
+struct VCAtlasHeatmapRect {
+    VCRectus uv;
+    uint8_t page;
+    bool free;
+
+    // How many frames ago the texture was last used, saturated.
+    uint8_t age;
+};
+
+struct VCAtlasHeatmap {
+    uint32_t epoch;
+    uint8_t pagesLength;
+    VCAtlasHeatmapRect *rects;
+    size_t rectsLength;
+};
+
+static SDL_atomic_t heatmapDumpInProgress;
+
+// Time the decoder threads have spent decoding or packing textures since the last frame, in
+// microseconds, so that CPU and GPU decoding can be compared.
+static SDL_atomic_t decodeMicroseconds;
+
+static void VCAtlasHeatmap_FillRect(uint8_t *pixels, VCRectus *rect, const uint8_t color[4]) {
+    for (uint32_t y = rect->origin.y; y < (uint32_t)rect->origin.y + rect->size.height; y++) {
+        for (uint32_t x = rect->origin.x; x < (uint32_t)rect->origin.x + rect->size.width; x++)
+            memcpy(&pixels[(y * VC_ATLAS_TEXTURE_SIZE + x) * 4], color, 4);
+    }
+}
+
+// Draws one PNG per page: free space dark gray, texture borders red, and texture interiors green
+// fading to blue the longer it's been since they were used. Black is space lost to fragmentation
+// (neither free nor holding a texture).
+static int VCAtlasHeatmap_ThreadMain(void *userData) {
+    VCAtlasHeatmap *heatmap = (VCAtlasHeatmap *)userData;
+    uint8_t *pixels = (uint8_t *)malloc(VC_ATLAS_TEXTURE_SIZE * VC_ATLAS_TEXTURE_SIZE * 4);
+    if (pixels == NULL)
+        abort();
+
+    for (uint8_t page = 0; page < heatmap->pagesLength; page++) {
+        memset(pixels, '\0', VC_ATLAS_TEXTURE_SIZE * VC_ATLAS_TEXTURE_SIZE * 4);
+        for (size_t i = 0; i < heatmap->rectsLength; i++) {
+            VCAtlasHeatmapRect *rect = &heatmap->rects[i];
+            if (rect->page != page)
+                continue;
+            if (rect->free) {
+                static const uint8_t freeColor[4] = { 0x40, 0x40, 0x40, 0xff };
+                VCAtlasHeatmap_FillRect(pixels, &rect->uv, freeColor);
+                continue;
+            }
+
+            static const uint8_t borderColor[4] = { 0xff, 0x00, 0x00, 0xff };
+            VCAtlasHeatmap_FillRect(pixels, &rect->uv, borderColor);
+            VCRectus interior = rect->uv;
+            interior.origin.x++;
+            interior.origin.y++;
+            interior.size.width -= 2;
+            interior.size.height -= 2;
+            uint8_t interiorColor[4] = { 0x00, (uint8_t)(0xff - rect->age), rect->age, 0xff };
+            VCAtlasHeatmap_FillRect(pixels, &interior, interiorColor);
+        }
+
+        char path[256];
+        snprintf(path, sizeof(path), "atlas-heatmap-%06u-%d.png", heatmap->epoch, (int)page);
+        stbi_write_png(path,
+                       VC_ATLAS_TEXTURE_SIZE,
+                       VC_ATLAS_TEXTURE_SIZE,
+                       4,
+                       pixels,
+                       VC_ATLAS_TEXTURE_SIZE * 4);
+    }
+
+    free(pixels);
+    free(heatmap->rects);
+    free(heatmap);
+    SDL_AtomicSet(&heatmapDumpInProgress, 0);
+    return 0;
+}
+
+// Snapshots the atlas layout and hands it to a thread that writes it out as heatmap images. Does
+// nothing if the previous dump hasn't finished yet.
+static void VCAtlas_DumpHeatmap(VCAtlas *atlas, uint32_t currentEpoch) {
+    if (!SDL_AtomicCAS(&heatmapDumpInProgress, 0, 1))
+        return;
+
+    VCAtlasHeatmap *heatmap = (VCAtlasHeatmap *)malloc(sizeof(VCAtlasHeatmap));
+    if (heatmap == NULL)
+        abort();
+    heatmap->epoch = currentEpoch;
+    heatmap->pagesLength = atlas->pagesLength;
+    size_t rectsCapacity = atlas->cachedTexturesLength;
+    for (uint8_t page = 0; page < atlas->pagesLength; page++)
+        rectsCapacity += atlas->pages[page].freeListSize;
+    heatmap->rects = (VCAtlasHeatmapRect *)malloc(sizeof(VCAtlasHeatmapRect) * (rectsCapacity + 1));
+    if (heatmap->rects == NULL)
+        abort();
+    heatmap->rectsLength = 0;
+
+    for (uint8_t page = 0; page < atlas->pagesLength; page++) {
+        for (size_t i = 0; i < atlas->pages[page].freeListSize; i++) {
+            VCAtlasHeatmapRect *rect = &heatmap->rects[heatmap->rectsLength++];
+            rect->uv = atlas->pages[page].freeList[i];
+            rect->page = page;
+            rect->free = true;
+            rect->age = 0;
         }
+    }
+    for (VCCachedTexture *cachedTexture = atlas->leastRecentlyUsedTexture;
+            cachedTexture != NULL;
+            cachedTexture = cachedTexture->lruNext) {
+        if (!cachedTexture->info.uvValid)
+            continue;
+        uint32_t age = currentEpoch - cachedTexture->lastUsedEpoch;
+        VCAtlasHeatmapRect *rect = &heatmap->rects[heatmap->rectsLength++];
+        rect->uv = VCTextureInfo_UVIncludingBorder(&cachedTexture->info);
+        rect->page = cachedTexture->info.page;
+        rect->free = false;
+        rect->age = age > 0xff ? 0xff : (uint8_t)age;
+    }
 
-        //fprintf(stderr, "clearing atlas texture!\n");
-        VCAtlas_ClearAtlasTexture(atlas);
-        VCAtlas_AllocateTexturesInAtlas(atlas, renderer, false);
+    SDL_Thread *thread = SDL_CreateThread(VCAtlasHeatmap_ThreadMain, "VCAtlasHeatmap", heatmap);
+    if (thread == NULL) {
+        free(heatmap->rects);
+        free(heatmap);
+        SDL_AtomicSet(&heatmapDumpInProgress, 0);
         return;
     }
+    SDL_DetachThread(thread);
+}
+
+void VCAtlas_AllocateTexturesInAtlas(VCAtlas *atlas, VCRenderer *renderer) {
+    // Mark the pages that hold textures in use this frame, so that they're the last to go.
+    for (VCCachedTexture *cachedTexture = VCAtlas_GetUsedTextures(atlas, renderer->currentEpoch);
+            cachedTexture != NULL;
+            cachedTexture = cachedTexture->nextUsedTexture) {
+        if (cachedTexture->info.uvValid)
+            atlas->pages[cachedTexture->info.page].lastUsedEpoch = renderer->currentEpoch;
+    }
+
+    VCAtlas_AllocateTexturesInPages(atlas, renderer, atlas->maxPages);
+
+    VCDebugger *debugger = renderer->debugger;
+    VCDebugStat *occupancyStats[VC_ATLAS_PAGE_FORMAT_COUNT] = {
+        &debugger->stats.atlasOccupancyRGBA8888,
+        &debugger->stats.atlasOccupancyRGBA4444,
+        &debugger->stats.atlasOccupancyRGBA5551,
+        &debugger->stats.atlasOccupancyHD,
+    };
+    uint64_t pixelsUsed[VC_ATLAS_PAGE_FORMAT_COUNT] = { 0 };
+    uint64_t pixelsAvailable[VC_ATLAS_PAGE_FORMAT_COUNT] = { 0 };
+    uint64_t bytesUsed = 0, borderBytesUsed = 0;
+    uint32_t largestFreeRectArea = 0, freeRectCount = 0;
+    for (uint8_t pageIndex = 0; pageIndex < atlas->pagesLength; pageIndex++) {
+        VCAtlasPage *page = &atlas->pages[pageIndex];
+        pixelsUsed[page->format] += page->pixelsUsed;
+        pixelsAvailable[page->format] += VC_ATLAS_TEXTURE_SIZE * VC_ATLAS_TEXTURE_SIZE;
+
+        uint32_t bytesPerPixel = VCAtlas_BytesPerPixelForPageFormat(page->format);
+        bytesUsed += (uint64_t)page->pixelsUsed * bytesPerPixel;
+        borderBytesUsed += (uint64_t)page->borderPixelsUsed * bytesPerPixel;
+        freeRectCount += page->freeListSize;
+        for (size_t i = 0; i < page->freeListSize; i++) {
+            uint32_t area = (uint32_t)page->freeList[i].size.width * page->freeList[i].size.height;
+            if (area > largestFreeRectArea)
+                largestFreeRectArea = area;
+        }
+    }
+    for (uint8_t pageFormat = 0; pageFormat < VC_ATLAS_PAGE_FORMAT_COUNT; pageFormat++) {
+        uint32_t occupancy = 0;
+        if (pixelsAvailable[pageFormat] != 0)
+            occupancy = (uint32_t)(pixelsUsed[pageFormat] * 100 / pixelsAvailable[pageFormat]);
+        VCDebugger_AddSample(debugger, occupancyStats[pageFormat], occupancy);
+    }
+    VCDebugger_AddSample(debugger, &debugger->stats.atlasPages, atlas->pagesLength);
+    VCDebugger_AddSample(debugger, &debugger->stats.atlasKBAllocated, (uint32_t)(bytesUsed / 1024));
+    VCDebugger_AddSample(debugger,
+                         &debugger->stats.atlasKBBorders,
+                         (uint32_t)(borderBytesUsed / 1024));
+    VCDebugger_AddSample(debugger, &debugger->stats.atlasLargestFreeKpx, largestFreeRectArea / 1024);
+    VCDebugger_AddSample(debugger, &debugger->stats.atlasFreeRects, freeRectCount);
+    VCDebugger_AddSample(debugger,
+                         &debugger->stats.textureDecodeMicroseconds,
+                         (uint32_t)SDL_AtomicSet(&decodeMicroseconds, 0));
+
+    uint32_t now = SDL_GetTicks(), recentEvictions = 0;
+    for (uint32_t i = 0;
+            i < atlas->pageEvictionCount && i < VC_ATLAS_PAGE_EVICTION_HISTORY;
+            i++) {
+        if (now - atlas->pageEvictionTimes[i] < 60 * 1000)
+            recentEvictions++;
+    }
+    VCDebugger_AddSample(debugger, &debugger->stats.atlasClearsPerMinute, recentEvictions);
+
+    uint32_t heatmapInterval = VCConfig_SharedConfig()->debugAtlasHeatmapInterval;
+    if (heatmapInterval != 0 && renderer->currentEpoch % heatmapInterval == 0)
+        VCAtlas_DumpHeatmap(atlas, renderer->currentEpoch);
 }
 
 static VCRectus VCTextureInfo_UVIncludingBorder(VCTextureInfo *info)  {
@@ -194,115 +812,366 @@ static VCRectus VCTextureInfo_UVIncludingBorder(VCTextureInfo *info)  {
     return uv;
 }
 
-void VCAtlas_EnqueueCommandsToUploadTextures(VCAtlas *atlas, VCRenderer *renderer) {
-    VCCachedTexture *cachedTexture = NULL, *tempCachedTexture = NULL;
-    HASH_ITER(hh, atlas->cachedTextures, cachedTexture, tempCachedTexture) {
-        if (!cachedTexture->info.needsUpload)
-            continue;
+static size_t VCTextureInfo_PixelsSize(VCTextureInfo *info) {
+    return (info->uv.size.width + 2) * (info->uv.size.height + 2) *
+        VCAtlas_BytesPerPixelForPageFormat(info->pageFormat);
+}
 
-        VCRenderCommand command;
-        command.command = VC_RENDER_COMMAND_UPLOAD_TEXTURE;
-        command.uv = VCTextureInfo_UVIncludingBorder(&cachedTexture->info);
-        command.pixels = cachedTexture->info.pixels;
-        VCRenderer_EnqueueCommand(renderer, &command);
+static size_t VCTextureSource_Size(VCTextureSource *source) {
+    return sizeof(VCTextureSource) + source->tmemLength * sizeof(source->tmem[0]) +
+        source->paletteLength * sizeof(source->palette[0]);
+}
 
-        cachedTexture->info.needsUpload = false;
+static VCTextureDecodeJob *VCAtlas_CreateDecodeJobFromSource(VCCachedTexture *cachedTexture,
+                                                             VCTextureSource *source);
+static void VCAtlas_StartReplacementDecode(VCAtlas *atlas,
+                                           VCTextureDecoder *decoder,
+                                           VCCachedTexture *replacement);
+
+static void VCRectus_Union(VCRectus *rect, const VCRectus *other) {
+    uint16_t right = rect->origin.x + rect->size.width;
+    uint16_t bottom = rect->origin.y + rect->size.height;
+    uint16_t otherRight = other->origin.x + other->size.width;
+    uint16_t otherBottom = other->origin.y + other->size.height;
+    if (other->origin.x < rect->origin.x)
+        rect->origin.x = other->origin.x;
+    if (other->origin.y < rect->origin.y)
+        rect->origin.y = other->origin.y;
+    rect->size.width = (otherRight > right ? otherRight : right) - rect->origin.x;
+    rect->size.height = (otherBottom > bottom ? otherBottom : bottom) - rect->origin.y;
+}
+
+static uint8_t VCAtlas_TexturePackFlags(VCTextureInfo *info) {
+    return (info->repeatX ? VC_TEXTURE_PACK_FLAG_REPEAT_X : 0) |
+        (info->repeatY ? VC_TEXTURE_PACK_FLAG_REPEAT_Y : 0) |
+        (info->mirrorX ? VC_TEXTURE_PACK_FLAG_MIRROR_X : 0) |
+        (info->mirrorY ? VC_TEXTURE_PACK_FLAG_MIRROR_Y : 0);
+}
+
+// The texture pack's key for a tile texture. This is a 64-bit hash of everything the decoded
+// pixels depend on, computed independently of the 32-bit TMEM hash: a collision in the pack would
+// be written to disk and handed out in every later session, rather than lasting until eviction.
+static uint64_t VCAtlas_TexturePackKey(VCAtlas *atlas,
+                                       gDPTile *tile,
+                                       const uint8_t *texels,
+                                       size_t texelsLength,
+                                       uint8_t rawFormat,
+                                       uint8_t pageFormat) {
+    uint8_t format = tile->format, size = tile->size;
+    XXH64_reset(atlas->texturePackHashState, TEXTURE_PACK_HASH_SEED);
+    XXH64_update(atlas->texturePackHashState, &format, sizeof(format));
+    XXH64_update(atlas->texturePackHashState, &size, sizeof(size));
+    XXH64_update(atlas->texturePackHashState, texels, texelsLength);
+    if ((format == G_IM_FMT_CI || format == G_IM_FMT_RGBA) &&
+            (size == G_IM_SIZ_4b || size == G_IM_SIZ_8b)) {
+        uint8_t textureLUT = gDP.otherMode.textureLUT;
+        const uint32_t *palette = TextureCache_CurrentPalette();
+        XXH64_update(atlas->texturePackHashState, &textureLUT, sizeof(textureLUT));
+        if (size == G_IM_SIZ_4b) {
+            XXH64_update(atlas->texturePackHashState,
+                         &palette[(tile->palette & 0xf) << 4],
+                         16 * sizeof(u32));
+        } else {
+            XXH64_update(atlas->texturePackHashState, palette, 256 * sizeof(u32));
+        }
     }
+    XXH64_update(atlas->texturePackHashState, &rawFormat, sizeof(rawFormat));
+    XXH64_update(atlas->texturePackHashState, &pageFormat, sizeof(pageFormat));
+    return XXH64_digest(atlas->texturePackHashState);
 }
 
-static VCCachedTexture *VCAtlas_CacheTexture(VCAtlas *atlas,
-                                             VCSize2us *size,
-                                             XXH32_hash_t tmemHash,
-                                             uint8_t *pixels,
-                                             uint32_t currentEpoch,
-                                             bool repeatX,
-                                             bool repeatY,
-                                             bool mirrorX,
-                                             bool mirrorY) {
-    VCCachedTexture *cachedTexture = (VCCachedTexture *)malloc(sizeof(VCCachedTexture));
-    cachedTexture->lastUsedEpoch = currentEpoch;
+// Fills in a newly cached texture's pixels from the texture pack, if it has a record for the
+// texture laid out the same way.
+static bool VCAtlas_LoadTextureFromPack(VCAtlas *atlas,
+                                        VCCachedTexture *cachedTexture,
+                                        uint64_t key) {
+    SDL_LockMutex(atlas->texturePackMutex);
+    const VCTexturePackRecord *record = VCTexturePack_Find(&atlas->texturePack, key);
+    VCTextureInfo *info = &cachedTexture->info;
+    bool found = record != NULL && record->width == info->uv.size.width &&
+        record->height == info->uv.size.height &&
+        record->texelWidth == info->texelSize.width &&
+        record->texelHeight == info->texelSize.height &&
+        record->pageFormat == info->pageFormat && record->rawFormat == info->rawFormat &&
+        record->flags == VCAtlas_TexturePackFlags(info) &&
+        record->pixelsLength == VCTextureInfo_PixelsSize(info);
+    if (found)
+        memcpy(info->pixels, VCTexturePackRecord_Pixels(record), record->pixelsLength);
+    SDL_UnlockMutex(atlas->texturePackMutex);
+    return found;
+}
 
-    VCSize2us mirrorFactors = { (uint16_t)(mirrorX ? 2 : 1), (uint16_t)(mirrorY ? 2 : 1) };
-    VCSize2us sizeIncludingMirror = {
-        (uint16_t)(size->width * mirrorFactors.width),
-        (uint16_t)(size->height * mirrorFactors.height)
-    };
-    VCSize2us sizeIncludingBorder = {
-        (uint16_t)(sizeIncludingMirror.width + 2),
-        (uint16_t)(sizeIncludingMirror.height + 2)
-    };
+// Has the decode job append the texture to the texture pack once it's decoded, so that the RSP
+// thread doesn't wait on the write.
+static void VCAtlas_StoreTextureInPackWhenDecoded(VCAtlas *atlas,
+                                                  VCTextureDecodeJob *job,
+                                                  uint64_t key) {
+    VCTextureInfo *info = &job->cachedTexture->info;
+    VCTexturePackRecord *record = &job->texturePackRecord;
+    record->key = key;
+    record->width = info->uv.size.width;
+    record->height = info->uv.size.height;
+    record->texelWidth = info->texelSize.width;
+    record->texelHeight = info->texelSize.height;
+    record->pageFormat = info->pageFormat;
+    record->rawFormat = info->rawFormat;
+    record->flags = VCAtlas_TexturePackFlags(info);
+    record->pixelsLength = (uint32_t)VCTextureInfo_PixelsSize(info);
+    job->texturePackAtlas = atlas;
+}
 
-    cachedTexture->tmemHash = tmemHash;
-    HASH_ADD_INT(atlas->cachedTextures, tmemHash, cachedTexture);
-    
-    // Add a border to prevent bleed.
-    size_t dataSize = sizeIncludingBorder.width * sizeIncludingBorder.height * BYTES_PER_PIXEL;
-    uint8_t *pixelsWithBorder = (uint8_t *)malloc(dataSize);
-    atlas->textureBytesUsed += dataSize;
+// Called on the decoder threads.
+static void VCAtlas_StoreTextureInPack(VCAtlas *atlas,
+                                       VCTexturePackRecord *record,
+                                       const uint8_t *pixels) {
+    SDL_LockMutex(atlas->texturePackMutex);
+    VCTexturePack_Append(&atlas->texturePack, record, pixels);
+    SDL_UnlockMutex(atlas->texturePackMutex);
+}
 
-    uint32_t stride = size->width * BYTES_PER_PIXEL;
-    uint32_t strideWithBorder = sizeIncludingBorder.width * BYTES_PER_PIXEL;
-    for (uint32_t y = 0; y < size->height; y++) {
-        memcpy(&pixelsWithBorder[(y + 1) * strideWithBorder + 4], &pixels[y * stride], stride);
-
-        // Replicate a mirrored strip along X if necessary.
-        if (mirrorX) {
-            for (uint32_t x = 0; x < size->width; x++) {
-                memcpy(&pixelsWithBorder[(y + 1) * strideWithBorder + (1 + size->width + x) * 4],
-                       &pixelsWithBorder[(y + 1) * strideWithBorder + (size->width - x) * 4],
-                       4);
-            }
+void VCAtlas_OpenTexturePack(VCAtlas *atlas, const uint8_t *romHeader) {
+    VCConfig *config = VCConfig_SharedConfig();
+    if (!config->diskTextureCache || romHeader == NULL)
+        return;
+    VCAtlas_CloseTexturePack(atlas);
+    char *path = VCUtils_CachePathForROM(romHeader, "vctex");
+    VCTexturePack_Open(&atlas->texturePack,
+                       path,
+                       (size_t)config->diskTextureCacheSizeMB * 1024 * 1024);
+    free(path);
+}
+
+void VCAtlas_CloseTexturePack(VCAtlas *atlas) {
+    if (!VCTexturePack_IsOpen(&atlas->texturePack))
+        return;
+
+    // Let any pending appends finish first.
+    VCAtlas_WaitForPendingDecodes(atlas);
+    VCTexturePack_Close(&atlas->texturePack);
+}
+
+// Whether the texture's pixels can be dropped after upload and decoded again when needed: from its
+// source, or for HD replacements, from the replacement pack.
+static bool VCAtlas_CanDecodeAgain(VCAtlas *atlas, VCCachedTexture *cachedTexture) {
+    if (cachedTexture->info.pageFormat == VC_ATLAS_PAGE_FORMAT_HD)
+        return !atlas->retainDecodedPixels;
+    return cachedTexture->source != NULL;
+}
+
+// Drops the texture's pixels once they've been handed off for upload, if they can be decoded
+// again.
+static void VCAtlas_DropPixelsIfPossible(VCAtlas *atlas, VCCachedTexture *cachedTexture) {
+    if (!VCAtlas_CanDecodeAgain(atlas, cachedTexture))
+        return;
+    size_t pixelsSize = VCTextureInfo_PixelsSize(&cachedTexture->info);
+    assert(atlas->textureBytesUsed >= pixelsSize);
+    atlas->textureBytesUsed -= pixelsSize;
+    cachedTexture->info.pixels = NULL;
+}
+
+static void VCAtlas_EnqueueUpload(VCAtlas *atlas,
+                                  VCRenderer *renderer,
+                                  VCCachedTexture *cachedTexture) {
+    VCRenderCommand command;
+    command.command = VC_RENDER_COMMAND_UPLOAD_TEXTURE;
+    command.uv = VCTextureInfo_UVIncludingBorder(&cachedTexture->info);
+    command.pixels = cachedTexture->info.pixels;
+    command.texturePage = cachedTexture->info.page;
+    command.texturePageFormat = cachedTexture->info.pageFormat;
+
+    // If the texture can be decoded again, the render thread takes the pixels and frees them once
+    // they're uploaded.
+    command.freePixelsAfterUpload = VCAtlas_CanDecodeAgain(atlas, cachedTexture);
+    VCAtlas_DropPixelsIfPossible(atlas, cachedTexture);
+    VCRenderer_EnqueueCommand(renderer, &command);
+
+    cachedTexture->info.needsUpload = false;
+}
+
+// Copies a page's uploads into one staging buffer covering `bounds`, and uploads that with a
+// single call. Parts of the staging buffer no texture lands in are left uninitialized; they only
+// overwrite free space.
+static void VCAtlas_EnqueueCoalescedUpload(VCAtlas *atlas,
+                                           VCRenderer *renderer,
+                                           uint8_t pageIndex,
+                                           VCRectus *bounds,
+                                           VCCachedTexture **cachedTextures,
+                                           size_t cachedTexturesLength) {
+    uint8_t pageFormat = atlas->pages[pageIndex].format;
+    uint32_t bytesPerPixel = VCAtlas_BytesPerPixelForPageFormat(pageFormat);
+    uint32_t stagingStride = bounds->size.width * bytesPerPixel;
+    uint8_t *staging = (uint8_t *)malloc(stagingStride * bounds->size.height);
+    if (staging == NULL)
+        abort();
+
+    for (size_t i = 0; i < cachedTexturesLength; i++) {
+        VCCachedTexture *cachedTexture = cachedTextures[i];
+        VCRectus uv = VCTextureInfo_UVIncludingBorder(&cachedTexture->info);
+        uint32_t stride = uv.size.width * bytesPerPixel;
+        uint8_t *dest = &staging[(uv.origin.y - bounds->origin.y) * stagingStride +
+                                 (uv.origin.x - bounds->origin.x) * bytesPerPixel];
+        for (uint32_t y = 0; y < uv.size.height; y++)
+            memcpy(&dest[y * stagingStride], &cachedTexture->info.pixels[y * stride], stride);
+
+        if (VCAtlas_CanDecodeAgain(atlas, cachedTexture)) {
+            free(cachedTexture->info.pixels);
+            VCAtlas_DropPixelsIfPossible(atlas, cachedTexture);
         }
+        cachedTexture->info.needsUpload = false;
+    }
 
-        // The RDP is weird here: we never bilerp on the top or left sides of a texture, even if
-        // repeating is on.
-        memcpy(&pixelsWithBorder[(y + 1) * strideWithBorder],
-               &pixels[y * stride],
-               4);
-        if (repeatX) {
-            memcpy(&pixelsWithBorder[(y + 1) * strideWithBorder +
-                                     (sizeIncludingMirror.width + 1) * 4],
-                   &pixels[y * stride],
-                   4);
-        } else {
-            memcpy(&pixelsWithBorder[(y + 1) * strideWithBorder +
-                                     (sizeIncludingMirror.width + 1) * 4],
-                   &pixels[y * stride + (sizeIncludingMirror.width - 1) * 4],
-                   4);
+    VCRenderCommand command;
+    command.command = VC_RENDER_COMMAND_UPLOAD_TEXTURE;
+    command.uv = *bounds;
+    command.pixels = staging;
+    command.texturePage = pageIndex;
+    command.texturePageFormat = pageFormat;
+    command.freePixelsAfterUpload = true;
+    VCRenderer_EnqueueCommand(renderer, &command);
+}
+
+void VCAtlas_EnqueueCommandsToUploadTextures(VCAtlas *atlas, VCRenderer *renderer) {
+    // Textures whose pixels were dropped after they were last uploaded have to be decoded again
+    // before they can be uploaded to their new spot.
+    // Textures on the upload list may have lost their spot again since they were placed.
+    bool decodesPending = false;
+    for (VCCachedTexture *cachedTexture = atlas->texturesNeedingUpload;
+            cachedTexture != NULL;
+            cachedTexture = cachedTexture->nextTextureNeedingUpload) {
+        if (!cachedTexture->info.uvValid || cachedTexture->info.pixels != NULL)
+            continue;
+
+        // HD replacements were in use last frame, so they have to be drawn this frame, even if
+        // that means decoding them here and now.
+        if (cachedTexture->info.pageFormat == VC_ATLAS_PAGE_FORMAT_HD) {
+            VCAtlas_StartReplacementDecode(atlas, &atlas->decoder, cachedTexture);
+            decodesPending = true;
+            continue;
         }
+        assert(cachedTexture->source != NULL);
+
+        size_t pixelsSize = VCTextureInfo_PixelsSize(&cachedTexture->info);
+        cachedTexture->info.pixels = (uint8_t *)malloc(pixelsSize);
+        if (cachedTexture->info.pixels == NULL)
+            abort();
+        atlas->textureBytesUsed += pixelsSize;
+
+        VCTextureDecoder_Enqueue(&atlas->decoder,
+                                 VCAtlas_CreateDecodeJobFromSource(cachedTexture,
+                                                                   cachedTexture->source));
+        decodesPending = true;
     }
+    if (decodesPending)
+        VCAtlas_WaitForPendingDecodes(atlas);
+
+    // Gather up each page's uploads, and find the area they span.
+    VCCachedTexture **pageUploads[VC_ATLAS_MAX_PAGES] = { NULL };
+    size_t pageUploadsLength[VC_ATLAS_MAX_PAGES] = { 0 };
+    VCRectus pageUploadBounds[VC_ATLAS_MAX_PAGES];
+    uint32_t pageUploadArea[VC_ATLAS_MAX_PAGES] = { 0 };
+    for (VCCachedTexture *cachedTexture = atlas->texturesNeedingUpload;
+            cachedTexture != NULL;
+            cachedTexture = cachedTexture->nextTextureNeedingUpload) {
+        if (!cachedTexture->info.uvValid)
+            continue;
 
-    // Replicate Y if necessary.
-    if (mirrorY) {
-        for (uint32_t y = 0; y < size->height; y++) {
-            memcpy(&pixelsWithBorder[(sizeIncludingMirror.height - 1 - y + 1) * strideWithBorder],
-                   &pixelsWithBorder[(y + 1) * strideWithBorder],
-                   strideWithBorder);
+        uint8_t pageIndex = cachedTexture->info.page;
+        size_t length = pageUploadsLength[pageIndex];
+        if ((length & (length - 1)) == 0) {
+            pageUploads[pageIndex] = (VCCachedTexture **)realloc(
+                    pageUploads[pageIndex],
+                    sizeof(VCCachedTexture *) * (length == 0 ? 1 : length * 2));
+            if (pageUploads[pageIndex] == NULL)
+                abort();
         }
+        pageUploads[pageIndex][length] = cachedTexture;
+        pageUploadsLength[pageIndex]++;
+
+        VCRectus uv = VCTextureInfo_UVIncludingBorder(&cachedTexture->info);
+        pageUploadArea[pageIndex] += (uint32_t)uv.size.width * (uint32_t)uv.size.height;
+        if (length == 0)
+            pageUploadBounds[pageIndex] = uv;
+        else
+            VCRectus_Union(&pageUploadBounds[pageIndex], &uv);
     }
 
-    // See above: replicate the strange bilerp quirk.
-    memcpy(&pixelsWithBorder[4], &pixels[0], stride);
-    if (repeatY) {
-        memcpy(&pixelsWithBorder[(sizeIncludingMirror.height + 1) * strideWithBorder + 4],
-               &pixels[0],
-               stride);
-    } else {
-        memcpy(&pixelsWithBorder[(sizeIncludingMirror.height + 1) * strideWithBorder + 4],
-               &pixels[(sizeIncludingMirror.height - 1) * stride],
-               stride);
+    // A page's uploads can be done as one if the area they span is mostly made up of them, and
+    // the rest of it is free space, which it doesn't matter if we overwrite. The latter holds if
+    // the only space the page's allocator has handed out within that area is the uploads' own.
+    bool coalesce[VC_ATLAS_MAX_PAGES];
+    for (uint8_t pageIndex = 0; pageIndex < VC_ATLAS_MAX_PAGES; pageIndex++) {
+        VCRectus *bounds = &pageUploadBounds[pageIndex];
+        coalesce[pageIndex] = pageUploadsLength[pageIndex] >= 2 &&
+            (uint64_t)pageUploadArea[pageIndex] * 100 >=
+            (uint64_t)bounds->size.width * bounds->size.height * MIN_COALESCED_UPLOAD_COVERAGE &&
+            VCAtlasPage_AllocatedAreaWithin(&atlas->pages[pageIndex], bounds) ==
+            pageUploadArea[pageIndex];
     }
 
-    // Zero out corners.
-    memset(&pixelsWithBorder[0], '\0', 4);
-    memset(&pixelsWithBorder[strideWithBorder - 4], '\0', 4);
-    memset(&pixelsWithBorder[(sizeIncludingMirror.height + 1) * strideWithBorder], '\0', 4);
-    memset(&pixelsWithBorder[(sizeIncludingMirror.height + 2) * strideWithBorder - 4], '\0', 4);
+    for (uint8_t pageIndex = 0; pageIndex < VC_ATLAS_MAX_PAGES; pageIndex++) {
+        if (coalesce[pageIndex]) {
+            VCAtlas_EnqueueCoalescedUpload(atlas,
+                                           renderer,
+                                           pageIndex,
+                                           &pageUploadBounds[pageIndex],
+                                           pageUploads[pageIndex],
+                                           pageUploadsLength[pageIndex]);
+        } else {
+            for (size_t i = 0; i < pageUploadsLength[pageIndex]; i++)
+                VCAtlas_EnqueueUpload(atlas, renderer, pageUploads[pageIndex][i]);
+        }
+        free(pageUploads[pageIndex]);
+    }
+
+    // Textures that lost their spot before they could be uploaded are dropped from the list too;
+    // they'll be put back on it when they're placed again.
+    for (VCCachedTexture *cachedTexture = atlas->texturesNeedingUpload;
+            cachedTexture != NULL;
+            cachedTexture = cachedTexture->nextTextureNeedingUpload) {
+        cachedTexture->info.needsUpload = false;
+    }
+    atlas->texturesNeedingUpload = NULL;
+
+    VCDebugger_AddSample(renderer->debugger,
+                         &renderer->debugger->stats.textureKBResident,
+                         (uint32_t)(atlas->textureBytesUsed / 1024));
+}
+
+// Creates a cache entry with room for the texture plus its border, but doesn't fill in any
+// pixels.
+static VCCachedTexture *VCAtlas_CreateCachedTexture(VCAtlas *atlas,
+                                                    VCSize2us *sizeIncludingMirror,
+                                                    uint8_t pageFormat,
+                                                    XXH32_hash_t tmemHash,
+                                                    uint32_t currentEpoch,
+                                                    bool repeatX,
+                                                    bool repeatY,
+                                                    bool mirrorX,
+                                                    bool mirrorY) {
+    VCCachedTexture *cachedTexture = (VCCachedTexture *)malloc(sizeof(VCCachedTexture));
+    if (cachedTexture == NULL)
+        abort();
+
+    cachedTexture->tmemHash = tmemHash;
+    cachedTexture->source = NULL;
+    cachedTexture->replacementEntry = NULL;
+    cachedTexture->replacementHash = 0;
+    SDL_AtomicSet(&cachedTexture->replacementDecodesPending, 0);
+    cachedTexture->replacementFailed = false;
+    cachedTexture->warnedDoesntFit = false;
+    VCAtlas_AddTextureToCache(atlas, cachedTexture, currentEpoch);
+
+    // Add a border to prevent bleed.
+    size_t dataSize = (sizeIncludingMirror->width + 2) * (sizeIncludingMirror->height + 2) *
+        VCAtlas_BytesPerPixelForPageFormat(pageFormat);
+    uint8_t *pixelsWithBorder = (uint8_t *)malloc(dataSize);
+    if (pixelsWithBorder == NULL)
+        abort();
+    atlas->textureBytesUsed += dataSize;
 
     cachedTexture->info.uv.origin.x = 0;
     cachedTexture->info.uv.origin.y = 0;
-    cachedTexture->info.uv.size.width = sizeIncludingMirror.width;
-    cachedTexture->info.uv.size.height = sizeIncludingMirror.height;
+    cachedTexture->info.uv.size = *sizeIncludingMirror;
     cachedTexture->info.repeatX = repeatX;
     cachedTexture->info.repeatY = repeatY;
     cachedTexture->info.mirrorX = mirrorX;
@@ -310,19 +1179,30 @@ static VCCachedTexture *VCAtlas_CacheTexture(VCAtlas *atlas,
     cachedTexture->info.pixels = pixelsWithBorder;
     cachedTexture->info.uvValid = false;
     cachedTexture->info.needsUpload = false;
+    cachedTexture->info.rawFormat = VC_RAW_TEXTURE_FORMAT_NONE;
+    cachedTexture->info.pageFormat = pageFormat;
+    cachedTexture->info.page = 0;
+    cachedTexture->info.texelSize = *sizeIncludingMirror;
     return cachedTexture;
 }
 
-void VCAtlas_Bind(VCAtlas *atlas) {
-    GL(glBindTexture(GL_TEXTURE_2D, atlas->texture));
+void VCAtlas_Bind(VCAtlas *atlas, uint8_t page) {
+    GL(glBindTexture(GL_TEXTURE_2D, atlas->pages[page].texture));
 }
 
-GLint VCAtlas_GetGLTexture(VCAtlas *atlas) {
-    return atlas->texture;
+GLint VCAtlas_GetGLTexture(VCAtlas *atlas, uint8_t page) {
+    return atlas->pages[page].texture;
 }
 
 void VCAtlas_ProcessUploadCommand(VCAtlas *atlas, VCRenderCommand *command) {
-    GL(glBindTexture(GL_TEXTURE_2D, atlas->texture));
+    VCAtlasPage *page = &atlas->pages[command->texturePage];
+    VCAtlasPage_PrepareTexture(page, command->texturePageFormat);
+    GL(glActiveTexture(GL_TEXTURE0));
+    GL(glBindTexture(GL_TEXTURE_2D, page->texture));
+
+    // Rows of 16-bit pixels are only 2-byte aligned.
+    GL(glPixelStorei(GL_UNPACK_ALIGNMENT,
+                     VCAtlas_BytesPerPixelForPageFormat(page->textureFormat)));
     GL(glTexSubImage2D(GL_TEXTURE_2D,
                        0,
                        command->uv.origin.x,
@@ -330,99 +1210,807 @@ void VCAtlas_ProcessUploadCommand(VCAtlas *atlas, VCRenderCommand *command) {
                        command->uv.size.width,
                        command->uv.size.height,
                        GL_RGBA,
-                       GL_UNSIGNED_BYTE,
+                       VCAtlas_GLTypeForPageFormat(page->textureFormat),
                        command->pixels));
+    if (command->freePixelsAfterUpload)
+        free(command->pixels);
+
+    VCDebugger *debugger = VCRenderer_SharedRenderer()->debugger;
+    VCDebugger_IncrementSample(debugger, &debugger->stats.textureUploadCalls);
+    VCDebugger_AddToSample(debugger,
+                           &debugger->stats.textureUploadBytes,
+                           (uint32_t)command->uv.size.width * command->uv.size.height *
+                           VCAtlas_BytesPerPixelForPageFormat(page->textureFormat));
 }
 
-static uint8_t *VCAtlas_ConvertTextureToRGBA(VCSize2us *textureSize, gDPTile *tile) {
-    uint32_t maskSMask = tile->masks != 0 ? (1 << tile->masks) - 1 : 0xffff;
-    uint32_t mirrorSBit = tile->masks != 0 && tile->mirrors ? 1 << tile->masks : 0;
-    uint32_t maskTMask = tile->maskt != 0 ? (1 << tile->maskt) - 1 : 0xffff;
-    uint32_t mirrorTBit = tile->maskt != 0 && tile->mirrort ? 1 << tile->maskt : 0;
+// Maps a coordinate along one axis of the texture as laid out in the atlas (including any mirrored
+// copy) to the texel it samples from TMEM.
+static uint32_t VCAtlas_SourceTexelCoordinate(uint32_t u,
+                                              uint32_t size,
+                                              bool mirrored,
+                                              uint8_t mask,
+                                              bool maskMirrored) {
+    if (mirrored && u >= size)
+        u = 2 * size - 1 - u;
+    if (mask == 0)
+        return u;
+    uint32_t maskMask = (1 << mask) - 1;
+    uint32_t result = u & maskMask;
+    if (maskMirrored && (u & (1 << mask)) != 0)
+        result ^= maskMask;
+    return result;
+}
 
-    uint8_t *result = (uint8_t *)malloc(textureSize->width * textureSize->height * 4);
-    if (result == NULL)
+// Decodes the texture straight into its buffer in the pixel format of the page it's destined for,
+// laid out with the border and any mirrored copies. 16-bit pages are packed down from the RGBA8888
+// texels, which keeps them identical to what an RGBA8888 page would hold for the formats routed to
+// them.
+static void VCAtlas_DecodeTextureWithBorder(VCTextureInfo *info,
+                                            VCSize2us *textureSize,
+                                            gDPTile *tile,
+                                            const uint64_t *tmem,
+                                            const uint32_t *palette) {
+    uint32_t width = info->uv.size.width, height = info->uv.size.height;
+    uint32_t bytesPerPixel = VCAtlas_BytesPerPixelForPageFormat(info->pageFormat);
+    uint32_t strideWithBorder = (width + 2) * bytesPerPixel;
+
+    // The RDP is weird here: we never bilerp on the top or left sides of a texture, even if
+    // repeating is on. So the left and top borders always sample the first texel, and the right
+    // and bottom ones wrap around to it if repeating or clamp to the last one otherwise.
+    uint16_t *sourceS = (uint16_t *)malloc((width + 2) * sizeof(uint16_t));
+    if (sourceS == NULL)
         abort();
+    for (uint32_t x = 0; x < width + 2; x++) {
+        uint32_t u = x == 0 ? 0 : x == width + 1 ? (info->repeatX ? 0 : width - 1) : x - 1;
+        sourceS[x] = VCAtlas_SourceTexelCoordinate(u,
+                                                   textureSize->width,
+                                                   info->mirrorX,
+                                                   tile->masks,
+                                                   tile->mirrors);
+    }
 
-    for (uint32_t v = 0; v < textureSize->height; v++) {
-        uint32_t t = v & maskTMask;
-        if (t & mirrorTBit)
-            t ^= maskTMask;
-        for (uint32_t u = 0; u < textureSize->width; u++) {
-            uint32_t s = u & maskSMask;
-            if (u & mirrorSBit)
-                s ^= maskSMask;
-            int32_t color = TextureCache_GetTexel(tile, s, t);
-            result[(v * textureSize->width + u) * 4 + 0] = color;
-            result[(v * textureSize->width + u) * 4 + 1] = color >> 8;
-            result[(v * textureSize->width + u) * 4 + 2] = color >> 16;
-            result[(v * textureSize->width + u) * 4 + 3] = color >> 24;
+    for (uint32_t y = 0; y < height + 2; y++) {
+        uint32_t v = y == 0 ? 0 : y == height + 1 ? (info->repeatY ? 0 : height - 1) : y - 1;
+        uint32_t t = VCAtlas_SourceTexelCoordinate(v,
+                                                   textureSize->height,
+                                                   info->mirrorY,
+                                                   tile->maskt,
+                                                   tile->mirrort);
+        bool borderRow = y == 0 || y == height + 1;
+        uint8_t *row = &info->pixels[y * strideWithBorder];
+        for (uint32_t x = 0; x < width + 2; x++) {
+            // Zero out corners.
+            uint32_t color = 0;
+            if (!borderRow || (x != 0 && x != width + 1))
+                color = TextureCache_GetTexel(tile, tmem, palette, sourceS[x], t);
+            switch (info->pageFormat) {
+            case VC_ATLAS_PAGE_FORMAT_RGBA4444:
+                ((uint16_t *)row)[x] = RGBA8888_RGBA4444(color);
+                break;
+            case VC_ATLAS_PAGE_FORMAT_RGBA5551:
+                ((uint16_t *)row)[x] = RGBA8888_RGBA5551(color);
+                break;
+            default:
+                row[x * 4 + 0] = color;
+                row[x * 4 + 1] = color >> 8;
+                row[x * 4 + 2] = color >> 16;
+                row[x * 4 + 3] = color >> 24;
+            }
         }
     }
-    return result;
+
+    free(sourceS);
 }
 
-static uint8_t *VCAtlas_ConvertBGImageTextureToRGBA(VCSize2us *textureSize) {
-    uint32_t bpp = TextureCache_SizeToBPP(gSP.bgImage.size);
-    uint32_t length = textureSize->width * textureSize->height * bpp / 8;
-    uint8_t *swapped = (uint8_t *)malloc(length);
-    if (swapped == NULL)
+// Returns the format of the atlas page to store a CPU-decoded texture in. A 16-bit page is chosen
+// only if the source format has no more precision than it.
+static uint8_t VCAtlas_PageFormatForTile(gDPTile *tile) {
+    switch (tile->size) {
+    case G_IM_SIZ_4b:
+    case G_IM_SIZ_8b:
+        if (tile->format == G_IM_FMT_IA ||
+                (tile->format == G_IM_FMT_I && tile->size == G_IM_SIZ_4b)) {
+            return VC_ATLAS_PAGE_FORMAT_RGBA4444;
+        }
+        if ((tile->format == G_IM_FMT_CI || tile->format == G_IM_FMT_RGBA) &&
+                gDP.otherMode.textureLUT == G_TT_RGBA16) {
+            return VC_ATLAS_PAGE_FORMAT_RGBA5551;
+        }
+        break;
+    case G_IM_SIZ_16b:
+        if (tile->format == G_IM_FMT_RGBA)
+            return VC_ATLAS_PAGE_FORMAT_RGBA5551;
+        break;
+    }
+    return VC_ATLAS_PAGE_FORMAT_RGBA8888;
+}
+
+// Returns the format the texture would be stored in if left for the GPU to decode, or
+// `VC_RAW_TEXTURE_FORMAT_NONE` if it has to be decoded on the CPU.
+static uint8_t VCAtlas_RawTextureFormatForTile(VCAtlas *atlas,
+                                               gDPTile *tile,
+                                               VCSize2us *textureSize) {
+    uint8_t rawFormat = VC_RAW_TEXTURE_FORMAT_NONE;
+    switch (tile->size) {
+    case G_IM_SIZ_4b:
+        if (tile->format == G_IM_FMT_I)
+            rawFormat = VC_RAW_TEXTURE_FORMAT_I4;
+        else if (tile->format == G_IM_FMT_IA)
+            rawFormat = VC_RAW_TEXTURE_FORMAT_IA4;
+        else if (tile->format == G_IM_FMT_CI || tile->format == G_IM_FMT_RGBA)
+            rawFormat = VC_RAW_TEXTURE_FORMAT_CI4;
+        break;
+    case G_IM_SIZ_8b:
+        if (tile->format == G_IM_FMT_I)
+            rawFormat = VC_RAW_TEXTURE_FORMAT_I8;
+        else if (tile->format == G_IM_FMT_IA)
+            rawFormat = VC_RAW_TEXTURE_FORMAT_IA8;
+        else if (tile->format == G_IM_FMT_CI || tile->format == G_IM_FMT_RGBA)
+            rawFormat = VC_RAW_TEXTURE_FORMAT_CI8;
+        break;
+    case G_IM_SIZ_16b:
+        if (tile->format == G_IM_FMT_IA)
+            rawFormat = VC_RAW_TEXTURE_FORMAT_IA16;
+        break;
+    }
+    if ((atlas->gpuDecodeFormats & (1 << rawFormat)) == 0)
+        return VC_RAW_TEXTURE_FORMAT_NONE;
+
+    // The shader only knows how to wrap at the edges of the texture, so leave textures that wrap
+    // partway through (because the tile is bigger than its mask) to the CPU.
+    if ((tile->masks != 0 && textureSize->width > (1 << tile->masks)) ||
+            (tile->maskt != 0 && textureSize->height > (1 << tile->maskt))) {
+        return VC_RAW_TEXTURE_FORMAT_NONE;
+    }
+    return rawFormat;
+}
+
+static uint32_t VCAtlas_RawTexelsPerPixel(uint8_t rawFormat) {
+    if (rawFormat <= VC_RAW_TEXTURE_FORMAT_CI4)
+        return 8;
+    if (rawFormat <= VC_RAW_TEXTURE_FORMAT_CI8)
+        return 4;
+    return 2;
+}
+
+static uint32_t VCAtlas_RawPaletteSize(uint8_t rawFormat) {
+    if (rawFormat == VC_RAW_TEXTURE_FORMAT_CI4)
+        return 16;
+    if (rawFormat == VC_RAW_TEXTURE_FORMAT_CI8)
+        return 256;
+    return 0;
+}
+
+// Returns the size of the area of the atlas needed to hold the packed texels of a raw texture,
+// plus a row for the palette if it has one.
+static VCSize2us VCAtlas_RawTextureAtlasSize(uint8_t rawFormat, VCSize2us *textureSize) {
+    uint32_t texelsPerPixel = VCAtlas_RawTexelsPerPixel(rawFormat);
+    uint32_t paletteSize = VCAtlas_RawPaletteSize(rawFormat);
+    uint32_t width = (textureSize->width + texelsPerPixel - 1) / texelsPerPixel;
+    if (width < paletteSize)
+        width = paletteSize;
+    VCSize2us size = {
+        (uint16_t)width,
+        (uint16_t)(textureSize->height + (paletteSize != 0 ? 1 : 0))
+    };
+    return size;
+}
+
+// Copies texels out of the TMEM snapshot without decoding them, undoing only the interleaving of
+// odd rows. 4- and 8-bit texels are packed one after another; 16-bit IA texels are stored as an
+// intensity byte followed by an alpha byte. The palette, already expanded to RGBA8888, goes in the
+// row after the texels.
+static void VCAtlas_PackRawTexture(VCTextureDecodeJob *job) {
+    VCTextureInfo *info = &job->cachedTexture->info;
+    gDPTile *tile = &job->tile;
+    uint32_t strideWithBorder = (info->uv.size.width + 2) * BYTES_PER_PIXEL;
+    memset(info->pixels, '\0', strideWithBorder * (info->uv.size.height + 2));
+
+    uint32_t bpp = TextureCache_SizeToBPP(tile->size);
+    for (uint32_t t = 0; t < job->size.height; t++) {
+        const uint8_t *src = (const uint8_t *)&job->tmem[tile->tmem + tile->line * t];
+        uint8_t *dest = &info->pixels[(t + 1) * strideWithBorder + BYTES_PER_PIXEL];
+        uint32_t i = (t & 1) << 1;
+        switch (bpp) {
+        case 4:
+            for (uint32_t s = 0; s < job->size.width; s += 2)
+                dest[s >> 1] = src[(s >> 1) ^ (i << 1)];
+            break;
+        case 8:
+            for (uint32_t s = 0; s < job->size.width; s++)
+                dest[s] = src[s ^ (i << 1)];
+            break;
+        case 16:
+            for (uint32_t s = 0; s < job->size.width; s++) {
+                uint16_t color = ((const uint16_t *)src)[s ^ i];
+                dest[s * 2 + 0] = color & 0xff;
+                dest[s * 2 + 1] = color >> 8;
+            }
+            break;
+        }
+    }
+
+    uint32_t paletteSize = VCAtlas_RawPaletteSize(job->rawFormat);
+    if (paletteSize != 0) {
+        const uint32_t *palette = paletteSize == 16 ?
+            &job->palette[(tile->palette & 0xf) << 4] : job->palette;
+        memcpy(&info->pixels[(job->size.height + 1) * strideWithBorder + BYTES_PER_PIXEL],
+               palette,
+               paletteSize * sizeof(palette[0]));
+    }
+}
+
+// Decodes an HD replacement from the replacement pack, box-filters it down to the size it's kept
+// at, and lays it out with its border and mirrored copies by the same rules as
+// `VCAtlas_DecodeTextureWithBorder()`.
+static void VCAtlas_DecodeReplacementTexture(VCTextureDecodeJob *job) {
+    VCCachedTexture *cachedTexture = job->cachedTexture;
+    VCTextureInfo *info = &cachedTexture->info;
+    int imageWidth = 0, imageHeight = 0, components = 0;
+    uint8_t *image = stbi_load_from_memory(job->replacementData,
+                                           (int)job->replacementLength,
+                                           &imageWidth,
+                                           &imageHeight,
+                                           &components,
+                                           4);
+    if (image == NULL) {
+        fprintf(stderr,
+                "video warning: couldn't decode HD texture %08x: %s\n",
+                (unsigned)cachedTexture->replacementEntry->key,
+                stbi_failure_reason());
+        cachedTexture->replacementFailed = true;
+        SDL_AtomicAdd(&cachedTexture->replacementDecodesPending, -1);
+        return;
+    }
+
+    uint32_t width = info->uv.size.width / (info->mirrorX ? 2 : 1);
+    uint32_t height = info->uv.size.height / (info->mirrorY ? 2 : 1);
+    uint8_t *scaled = (uint8_t *)malloc(width * height * BYTES_PER_PIXEL);
+    if (scaled == NULL)
         abort();
+    for (uint32_t y = 0; y < height; y++) {
+        uint32_t top = y * imageHeight / height, bottom = (y + 1) * imageHeight / height;
+        if (bottom <= top)
+            bottom = top + 1;
+        for (uint32_t x = 0; x < width; x++) {
+            uint32_t left = x * imageWidth / width, right = (x + 1) * imageWidth / width;
+            if (right <= left)
+                right = left + 1;
+            uint32_t sum[4] = { 0, 0, 0, 0 };
+            for (uint32_t imageY = top; imageY < bottom; imageY++) {
+                const uint8_t *pixel = &image[(imageY * imageWidth + left) * BYTES_PER_PIXEL];
+                for (uint32_t imageX = left; imageX < right; imageX++, pixel += BYTES_PER_PIXEL) {
+                    for (uint32_t channel = 0; channel < 4; channel++)
+                        sum[channel] += pixel[channel];
+                }
+            }
+            uint32_t count = (bottom - top) * (right - left);
+            for (uint32_t channel = 0; channel < 4; channel++)
+                scaled[(y * width + x) * BYTES_PER_PIXEL + channel] = sum[channel] / count;
+        }
+    }
+    stbi_image_free(image);
+
+    uint32_t widthIncludingMirror = info->uv.size.width;
+    uint32_t heightIncludingMirror = info->uv.size.height;
+    uint32_t strideWithBorder = (widthIncludingMirror + 2) * BYTES_PER_PIXEL;
+    for (uint32_t y = 0; y < heightIncludingMirror + 2; y++) {
+        uint32_t v = y == 0 ? 0 : y == heightIncludingMirror + 1 ?
+            (info->repeatY ? 0 : heightIncludingMirror - 1) : y - 1;
+        uint32_t t = VCAtlas_SourceTexelCoordinate(v, height, info->mirrorY, 0, false);
+        bool borderRow = y == 0 || y == heightIncludingMirror + 1;
+        uint8_t *row = &info->pixels[y * strideWithBorder];
+        for (uint32_t x = 0; x < widthIncludingMirror + 2; x++) {
+            // Zero out corners.
+            if (borderRow && (x == 0 || x == widthIncludingMirror + 1)) {
+                memset(&row[x * BYTES_PER_PIXEL], '\0', BYTES_PER_PIXEL);
+                continue;
+            }
+            uint32_t u = x == 0 ? 0 : x == widthIncludingMirror + 1 ?
+                (info->repeatX ? 0 : widthIncludingMirror - 1) : x - 1;
+            uint32_t s = VCAtlas_SourceTexelCoordinate(u, width, info->mirrorX, 0, false);
+            memcpy(&row[x * BYTES_PER_PIXEL],
+                   &scaled[(t * width + s) * BYTES_PER_PIXEL],
+                   BYTES_PER_PIXEL);
+        }
+    }
+    free(scaled);
 
-    UnswapCopy(&RDRAM[gSP.bgImage.address], swapped, length);
+    // Publishes the pixels to the RSP thread.
+    SDL_AtomicAdd(&cachedTexture->replacementDecodesPending, -1);
+}
+
+void VCAtlas_DecodeTexture(VCTextureDecodeJob *job) {
+    if (job->replacementData != NULL) {
+        VCAtlas_DecodeReplacementTexture(job);
+        return;
+    }
+    uint64_t startTime = SDL_GetPerformanceCounter();
+    if (job->rawFormat != VC_RAW_TEXTURE_FORMAT_NONE) {
+        VCAtlas_PackRawTexture(job);
+    } else {
+        VCAtlas_DecodeTextureWithBorder(&job->cachedTexture->info,
+                                        &job->size,
+                                        &job->tile,
+                                        job->tmem,
+                                        job->palette);
+    }
+    SDL_AtomicAdd(&decodeMicroseconds,
+                  (int)((SDL_GetPerformanceCounter() - startTime) * 1000000 /
+                        SDL_GetPerformanceFrequency()));
+
+    if (job->texturePackAtlas != NULL) {
+        VCAtlas_StoreTextureInPack(job->texturePackAtlas,
+                                   &job->texturePackRecord,
+                                   job->cachedTexture->info.pixels);
+    }
+}
+
+// Copies just the TMEM words the tile's texels occupy, and the palette entries it uses.
+static VCTextureSource *VCAtlas_CreateTextureSource(gDPTile *tile,
+                                                    VCSize2us *size,
+                                                    uint8_t rawFormat,
+                                                    uint8_t pageFormat) {
+    uint32_t line = tile->line;
+    if (tile->size == G_IM_SIZ_32b)
+        line <<= 1;
+    uint32_t wordsPerRow = (size->width * TextureCache_SizeToBPP(tile->size) + 63) / 64;
+    uint32_t tmemLength = line * (size->height - 1) + (line > wordsPerRow ? line : wordsPerRow);
+    if (tmemLength > 512)
+        tmemLength = 512;
+
+    uint32_t paletteLength = 0;
+    if ((tile->format == G_IM_FMT_CI || tile->format == G_IM_FMT_RGBA) &&
+            (tile->size == G_IM_SIZ_4b || tile->size == G_IM_SIZ_8b)) {
+        paletteLength = tile->size == G_IM_SIZ_4b ? 16 : 256;
+    }
 
-    uint8_t *result = (uint8_t *)malloc(textureSize->width * textureSize->height * 4);
-    if (result == NULL)
+    VCTextureSource *source = (VCTextureSource *)malloc(sizeof(VCTextureSource) +
+                                                        tmemLength * sizeof(uint64_t) +
+                                                        paletteLength * sizeof(uint32_t));
+    if (source == NULL)
         abort();
+    source->tile = *tile;
+    source->tile.tmem = 0;
+    source->tile.palette = 0;
+    source->size = *size;
+    source->rawFormat = rawFormat;
+    source->pageFormat = pageFormat;
+    source->tmemLength = tmemLength;
+    source->paletteLength = paletteLength;
+    source->tmem = (uint64_t *)&source[1];
+    source->palette = (uint32_t *)&source->tmem[tmemLength];
+
+    // TMEM addresses wrap around.
+    for (uint32_t i = 0; i < tmemLength; i++)
+        source->tmem[i] = TMEM[(tile->tmem + i) & 511];
+    const uint32_t *palette = TextureCache_CurrentPalette();
+    if (paletteLength == 16)
+        memcpy(source->palette, &palette[(tile->palette & 0xf) << 4], 16 * sizeof(u32));
+    else if (paletteLength == 256)
+        memcpy(source->palette, palette, 256 * sizeof(u32));
+    return source;
+}
+
+static VCTextureDecodeJob *VCAtlas_CreateDecodeJobFromSource(VCCachedTexture *cachedTexture,
+                                                             VCTextureSource *source) {
+    VCTextureDecodeJob *job = (VCTextureDecodeJob *)malloc(sizeof(VCTextureDecodeJob));
+    if (job == NULL)
+        abort();
+    job->cachedTexture = cachedTexture;
+    job->rawFormat = source->rawFormat;
+    job->pageFormat = source->pageFormat;
+    job->tile = source->tile;
+    job->size = source->size;
+    memcpy(job->tmem, source->tmem, source->tmemLength * sizeof(source->tmem[0]));
+    memset(&job->tmem[source->tmemLength],
+           '\0',
+           (512 - source->tmemLength) * sizeof(source->tmem[0]));
+    memcpy(job->palette, source->palette, source->paletteLength * sizeof(source->palette[0]));
+    job->replacementData = NULL;
+    job->replacementLength = 0;
+    job->texturePackAtlas = NULL;
+    return job;
+}
+
+void VCAtlas_WaitForPendingDecodes(VCAtlas *atlas) {
+    VCTextureDecoder_WaitForJobs(&atlas->decoder);
+}
 
-    for (uint32_t v = 0; v < textureSize->height; v++) {
-        uint32_t t = v;
-        for (uint32_t u = 0; u < textureSize->width; u++) {
-            uint32_t s = u;
-            int32_t color = TextureCache_GetTexelFromBGImage(swapped, s, t);
-            result[(v * textureSize->width + u) * 4 + 0] = color;
-            result[(v * textureSize->width + u) * 4 + 1] = color >> 8;
-            result[(v * textureSize->width + u) * 4 + 2] = color >> 16;
-            result[(v * textureSize->width + u) * 4 + 3] = color >> 24;
+// Stops the decoder threads at the end of a session. The next session's `VCAtlas_Create()`
+// starts them afresh.
+void VCAtlas_DestroyDecoders(VCAtlas *atlas) {
+    VCAtlas_WaitForPendingDecodes(atlas);
+    VCTextureDecoder_Destroy(&atlas->decoder);
+    VCTextureDecoder_Destroy(&atlas->replacementDecoder);
+}
+
+// Returns the size to keep an HD replacement at, not counting any mirrored copy: no more than
+// `textures.hdMaxSize` on either side, and small enough to fit in a page with its mirrored copies
+// and border. Both sides are scaled by the same factor, keeping the aspect ratio.
+static VCSize2us VCAtlas_ReplacementSize(const VCHDTextureEntry *entry,
+                                         bool mirrorX,
+                                         bool mirrorY) {
+    uint32_t maxSize = VCConfig_SharedConfig()->hdTextureMaxSize;
+    uint32_t maxWidth = (VC_ATLAS_TEXTURE_SIZE - 2) / (mirrorX ? 2 : 1);
+    uint32_t maxHeight = (VC_ATLAS_TEXTURE_SIZE - 2) / (mirrorY ? 2 : 1);
+    if (maxWidth > maxSize)
+        maxWidth = maxSize;
+    if (maxHeight > maxSize)
+        maxHeight = maxSize;
+
+    uint32_t width = entry->width, height = entry->height;
+    if (width > maxWidth) {
+        height = height * maxWidth / width;
+        width = maxWidth;
+    }
+    if (height > maxHeight) {
+        width = width * maxHeight / height;
+        height = maxHeight;
+    }
+    VCSize2us size = {
+        (uint16_t)(width != 0 ? width : 1),
+        (uint16_t)(height != 0 ? height : 1)
+    };
+    return size;
+}
+
+static VCTextureDecodeJob *VCAtlas_CreateReplacementDecodeJob(VCAtlas *atlas,
+                                                              VCCachedTexture *replacement) {
+    VCTextureDecodeJob *job = (VCTextureDecodeJob *)malloc(sizeof(VCTextureDecodeJob));
+    if (job == NULL)
+        abort();
+    job->cachedTexture = replacement;
+    job->rawFormat = VC_RAW_TEXTURE_FORMAT_NONE;
+    job->pageFormat = VC_ATLAS_PAGE_FORMAT_HD;
+    job->replacementData = VCHDTexturePack_EntryData(&atlas->replacementPack,
+                                                     replacement->replacementEntry);
+    job->replacementLength = replacement->replacementEntry->length;
+    job->texturePackAtlas = NULL;
+    return job;
+}
+
+static void VCAtlas_StartReplacementDecode(VCAtlas *atlas,
+                                           VCTextureDecoder *decoder,
+                                           VCCachedTexture *replacement) {
+    if (replacement->info.pixels == NULL) {
+        size_t pixelsSize = VCTextureInfo_PixelsSize(&replacement->info);
+        replacement->info.pixels = (uint8_t *)malloc(pixelsSize);
+        if (replacement->info.pixels == NULL)
+            abort();
+        atlas->textureBytesUsed += pixelsSize;
+    }
+    SDL_AtomicAdd(&replacement->replacementDecodesPending, 1);
+    VCTextureDecoder_Enqueue(decoder, VCAtlas_CreateReplacementDecodeJob(atlas, replacement));
+}
+
+// Adds a cache entry for the texture's HD replacement, laid out like the texture (repeating and
+// mirroring the same way), and starts decoding it in the background. The entry isn't placed in
+// the atlas until decoding is done.
+static void VCAtlas_CreateReplacementTexture(VCAtlas *atlas,
+                                             VCCachedTexture *cachedTexture,
+                                             uint32_t currentEpoch) {
+    VCTextureInfo *info = &cachedTexture->info;
+    VCSize2us size = VCAtlas_ReplacementSize(cachedTexture->replacementEntry,
+                                             info->mirrorX,
+                                             info->mirrorY);
+    VCSize2us sizeIncludingMirror = {
+        (uint16_t)(size.width * (info->mirrorX ? 2 : 1)),
+        (uint16_t)(size.height * (info->mirrorY ? 2 : 1))
+    };
+    VCCachedTexture *replacement = VCAtlas_CreateCachedTexture(atlas,
+                                                               &sizeIncludingMirror,
+                                                               VC_ATLAS_PAGE_FORMAT_HD,
+                                                               cachedTexture->replacementHash,
+                                                               currentEpoch,
+                                                               info->repeatX,
+                                                               info->repeatY,
+                                                               info->mirrorX,
+                                                               info->mirrorY);
+    replacement->info.texelSize = info->texelSize;
+    replacement->replacementEntry = cachedTexture->replacementEntry;
+    VCAtlas_StartReplacementDecode(atlas, &atlas->replacementDecoder, replacement);
+}
+
+// Marks the texture used and returns it, or returns its HD replacement in its place once the
+// replacement is decoded. Until then, the texture itself stands in for it.
+static VCCachedTexture *VCAtlas_UseTextureOrReplacement(VCAtlas *atlas,
+                                                        VCCachedTexture *cachedTexture,
+                                                        uint32_t currentEpoch) {
+    VCCachedTexture *replacement = NULL;
+    if (cachedTexture->replacementEntry != NULL) {
+        replacement = VCAtlas_LookUpTextureByTMEMHash(atlas, cachedTexture->replacementHash);
+        if (replacement == NULL) {
+            VCAtlas_CreateReplacementTexture(atlas, cachedTexture, currentEpoch);
+        } else if (!VCCachedTexture_IsReady(replacement)) {
+            replacement = NULL;
+        } else if (!replacement->info.uvValid && replacement->info.pixels == NULL) {
+            VCAtlas_StartReplacementDecode(atlas, &atlas->replacementDecoder, replacement);
+            replacement = NULL;
         }
     }
 
-    free(swapped);
-    return result;
+    VCCachedTexture *usedTexture = replacement != NULL ? replacement : cachedTexture;
+    VCAtlas_MarkTextureUsed(atlas, usedTexture, currentEpoch);
+    return usedTexture;
+}
+
+void VCAtlas_OpenReplacementPack(VCAtlas *atlas, const uint8_t *romHeader) {
+    const char *directory = VCConfig_SharedConfig()->hdTextureDirectory;
+    if (directory[0] == '\0' || romHeader == NULL)
+        return;
+    VCAtlas_CloseReplacementPack(atlas);
+    VCHDTexturePack_OpenForROM(&atlas->replacementPack, directory, romHeader);
+}
+
+// Replacement decodes in flight read from the pack, so they have to finish before it's unmapped.
+void VCAtlas_CloseReplacementPack(VCAtlas *atlas) {
+    if (!VCHDTexturePack_IsOpen(&atlas->replacementPack))
+        return;
+    VCTextureDecoder_WaitForJobs(&atlas->replacementDecoder);
+    VCHDTexturePack_Close(&atlas->replacementPack);
+}
+
+// The trace starts over with each session, as the atlas does.
+void VCAtlas_OpenTrace(VCAtlas *atlas) {
+    const char *path = VCConfig_SharedConfig()->debugAtlasTrace;
+    if (path[0] == '\0' || atlas->trace != NULL)
+        return;
+    atlas->trace = fopen(path, "w");
+    if (atlas->trace == NULL)
+        fprintf(stderr, "video warning: couldn't open the atlas trace `%s`\n", path);
+}
+
+void VCAtlas_CloseTrace(VCAtlas *atlas) {
+    if (atlas->trace == NULL)
+        return;
+    fclose(atlas->trace);
+    atlas->trace = NULL;
+}
+
+static void VCAtlas_GetCurrentBGImageDescriptor(VCBGImageDescriptor *descriptor) {
+    descriptor->address = gSP.bgImage.address;
+    descriptor->width = gSP.bgImage.width;
+    descriptor->height = gSP.bgImage.height;
+    descriptor->format = gSP.bgImage.format;
+    descriptor->size = gSP.bgImage.size;
+    descriptor->palette = gSP.bgImage.palette;
+    descriptor->paletteHash = 0;
+    descriptor->textureLUT = 0;
+    if (descriptor->format == G_IM_FMT_CI) {
+        descriptor->paletteHash = descriptor->size == G_IM_SIZ_4b ?
+            gDP.paletteHash16[descriptor->palette & 0xf] : gDP.paletteHash256;
+        descriptor->textureLUT = gDP.otherMode.textureLUT;
+    }
+}
+
+static bool VCBGImageDescriptor_Equal(VCBGImageDescriptor *a, VCBGImageDescriptor *b) {
+    return a->address == b->address &&
+        a->width == b->width &&
+        a->height == b->height &&
+        a->format == b->format &&
+        a->size == b->size &&
+        a->palette == b->palette &&
+        a->paletteHash == b->paletteHash &&
+        a->textureLUT == b->textureLUT;
+}
+
+static uint32_t VCBGImageDescriptor_Line(VCBGImageDescriptor *descriptor) {
+    return descriptor->width * TextureCache_SizeToBPP(descriptor->size) / 8;
+}
+
+static XXH32_hash_t VCAtlas_HashBGImage(VCAtlas *atlas, VCBGImageDescriptor *descriptor) {
+    // Background images are stored contiguously in RDRAM, so they can be hashed in place.
+    uint8_t format = descriptor->format, size = descriptor->size;
+    uint16_t width = descriptor->width;
+    XXH32_reset(atlas->hashState, HASH_SEED);
+    XXH32_update(atlas->hashState, &format, sizeof(format));
+    XXH32_update(atlas->hashState, &size, sizeof(size));
+    XXH32_update(atlas->hashState, &width, sizeof(width));
+    XXH32_update(atlas->hashState,
+                 &RDRAM[descriptor->address],
+                 VCBGImageDescriptor_Line(descriptor) * descriptor->height);
+    if (format == G_IM_FMT_CI) {
+        XXH32_update(atlas->hashState,
+                     &descriptor->paletteHash,
+                     sizeof(descriptor->paletteHash));
+        XXH32_update(atlas->hashState,
+                     &descriptor->textureLUT,
+                     sizeof(descriptor->textureLUT));
+    }
+    return XXH32_digest(atlas->hashState);
+}
+
+// Hashes a few whole rows spread evenly down the image, first and last included. This is the
+// cheap check that an unchanged background passes every epoch; it catches anything that rewrites
+// or scrolls whole rows, and the periodic full hash catches the rest.
+static XXH32_hash_t VCAtlas_HashBGImageSampledRows(VCAtlas *atlas,
+                                                   VCBGImageDescriptor *descriptor) {
+    uint32_t line = VCBGImageDescriptor_Line(descriptor);
+    uint32_t rows = descriptor->height < BG_IMAGE_SAMPLED_ROWS ?
+        descriptor->height : BG_IMAGE_SAMPLED_ROWS;
+    XXH32_reset(atlas->hashState, HASH_SEED);
+    for (uint32_t i = 0; i < rows; i++) {
+        uint32_t t = rows > 1 ? i * (descriptor->height - 1) / (rows - 1) : 0;
+        XXH32_update(atlas->hashState, &RDRAM[descriptor->address + t * line], line);
+    }
+    return XXH32_digest(atlas->hashState);
+}
+
+// Decodes the background image one scanline at a time straight into the bordered buffer that
+// gets uploaded. Background images are always clamped, so the border is just the edge texels.
+static VCCachedTexture *VCAtlas_CacheBGImageTexture(VCAtlas *atlas,
+                                                    VCBGImageDescriptor *descriptor,
+                                                    XXH32_hash_t hash,
+                                                    uint32_t currentEpoch) {
+    VCSize2us size = { (uint16_t)descriptor->width, (uint16_t)descriptor->height };
+    VCCachedTexture *cachedTexture =
+        VCAtlas_CreateCachedTexture(atlas,
+                                    &size,
+                                    VC_ATLAS_PAGE_FORMAT_RGBA8888,
+                                    hash,
+                                    currentEpoch,
+                                    false,
+                                    false,
+                                    false,
+                                    false);
+    uint8_t *pixelsWithBorder = cachedTexture->info.pixels;
+
+    // Rows are decoded in chunks of whole 64-bit words, so that the buffer can be bounded however
+    // wide the image is. Leave a little slack at the end, as the texel getters work in terms of
+    // 64-bit words.
+    uint8_t rowBuffer[BG_IMAGE_DECODE_CHUNK_TEXELS * 4 + 8];
+    uint32_t bpp = TextureCache_SizeToBPP(descriptor->size);
+    uint32_t line = VCBGImageDescriptor_Line(descriptor);
+
+    uint32_t stride = size.width * BYTES_PER_PIXEL;
+    uint32_t strideWithBorder = (size.width + 2) * BYTES_PER_PIXEL;
+    for (uint32_t t = 0; t < size.height; t++) {
+        uint8_t *row = &pixelsWithBorder[(t + 1) * strideWithBorder];
+        for (uint32_t s = 0; s < size.width; s += BG_IMAGE_DECODE_CHUNK_TEXELS) {
+            uint32_t texels = size.width - s < BG_IMAGE_DECODE_CHUNK_TEXELS ?
+                size.width - s : BG_IMAGE_DECODE_CHUNK_TEXELS;
+            uint32_t offset = s * bpp / 8;
+            uint32_t bytes = line - offset < BG_IMAGE_DECODE_CHUNK_TEXELS * bpp / 8 ?
+                line - offset : BG_IMAGE_DECODE_CHUNK_TEXELS * bpp / 8;
+            UnswapCopy(&RDRAM[descriptor->address + t * line + offset], rowBuffer, bytes);
+            TextureCache_DecodeBGImageRow(rowBuffer, texels, (uint32_t *)&row[4 + s * 4]);
+        }
+        memcpy(&row[0], &row[4], 4);
+        memcpy(&row[(size.width + 1) * 4], &row[size.width * 4], 4);
+    }
+
+    memcpy(&pixelsWithBorder[4], &pixelsWithBorder[strideWithBorder + 4], stride);
+    memcpy(&pixelsWithBorder[(size.height + 1) * strideWithBorder + 4],
+           &pixelsWithBorder[size.height * strideWithBorder + 4],
+           stride);
+
+    // Zero out corners.
+    memset(&pixelsWithBorder[0], '\0', 4);
+    memset(&pixelsWithBorder[strideWithBorder - 4], '\0', 4);
+    memset(&pixelsWithBorder[(size.height + 1) * strideWithBorder], '\0', 4);
+    memset(&pixelsWithBorder[(size.height + 2) * strideWithBorder - 4], '\0', 4);
+    return cachedTexture;
+}
+
+static VCCachedTexture *VCAtlas_GetOrUploadBGImageTexture(VCAtlas *atlas, VCRenderer *renderer) {
+    uint32_t currentEpoch = renderer->currentEpoch;
+    VCBGImageDescriptor descriptor;
+    VCAtlas_GetCurrentBGImageDescriptor(&descriptor);
+
+    // Look for a background we've already seen at this address with this layout. The plugin gets
+    // no notice of RDRAM writes, and games rewrite background buffers in place, so a match has to
+    // be checked against RDRAM; the check is kept cheap so that an unchanged background costs
+    // next to nothing:
+    //
+    // * Nothing writes RDRAM while a display list is processed, so a match already checked this
+    //   epoch is trusted as is. Backgrounds drawn as many rectangles are checked once.
+    //
+    // * Otherwise, a few sampled rows are hashed. If they're unchanged, the match is trusted,
+    //   except that every `VC_ATLAS_BG_IMAGE_FULL_HASH_INTERVAL` epochs the whole image is hashed
+    //   anyway, so that a change the samples miss is drawn stale for a bounded time.
+    //
+    // * If the samples changed or the full hash is due, the whole image is hashed and looked up
+    //   in the texture cache.
+    VCCachedBGImage *slot = NULL;
+    for (uint32_t i = 0; i < VC_ATLAS_BG_IMAGE_COUNT; i++) {
+        VCCachedBGImage *candidate = &atlas->cachedBGImages[i];
+        if (candidate->cachedTexture == NULL) {
+            if (slot == NULL || slot->cachedTexture != NULL)
+                slot = candidate;
+            continue;
+        }
+        if (VCBGImageDescriptor_Equal(&candidate->descriptor, &descriptor)) {
+            slot = candidate;
+            break;
+        }
+        if (slot == NULL ||
+                (slot->cachedTexture != NULL &&
+                 candidate->lastCheckedEpoch < slot->lastCheckedEpoch)) {
+            slot = candidate;
+        }
+    }
+
+    if (slot->cachedTexture != NULL &&
+            slot->lastCheckedEpoch == currentEpoch &&
+            VCBGImageDescriptor_Equal(&slot->descriptor, &descriptor)) {
+        VCAtlas_MarkTextureUsed(atlas, slot->cachedTexture, currentEpoch);
+        return slot->cachedTexture;
+    }
+
+    bool descriptorMatches = slot->cachedTexture != NULL &&
+        VCBGImageDescriptor_Equal(&slot->descriptor, &descriptor);
+    XXH32_hash_t sampledRowsHash = VCAtlas_HashBGImageSampledRows(atlas, &descriptor);
+    if (descriptorMatches &&
+            slot->sampledRowsHash == sampledRowsHash &&
+            currentEpoch - slot->lastFullyHashedEpoch < VC_ATLAS_BG_IMAGE_FULL_HASH_INTERVAL) {
+        slot->lastCheckedEpoch = currentEpoch;
+        VCAtlas_MarkTextureUsed(atlas, slot->cachedTexture, currentEpoch);
+        return slot->cachedTexture;
+    }
+
+    XXH32_hash_t hash = VCAtlas_HashBGImage(atlas, &descriptor);
+    slot->sampledRowsHash = sampledRowsHash;
+    slot->lastFullyHashedEpoch = currentEpoch;
+    if (descriptorMatches && slot->cachedTexture->tmemHash == hash) {
+        slot->lastCheckedEpoch = currentEpoch;
+        VCAtlas_MarkTextureUsed(atlas, slot->cachedTexture, currentEpoch);
+        return slot->cachedTexture;
+    }
+
+    VCCachedTexture *cachedTexture = NULL;
+    if ((cachedTexture = VCAtlas_LookUpTextureByTMEMHash(atlas, hash)) == NULL) {
+#ifdef VC_TEXTURE_SPEW
+        fprintf(stderr,
+                "bg image cache miss: format=%d size=%d size=%dx%d\n",
+                (int)descriptor.format,
+                (int)descriptor.size,
+                (int)descriptor.width,
+                (int)descriptor.height);
+#endif
+        cachedTexture = VCAtlas_CacheBGImageTexture(atlas, &descriptor, hash, currentEpoch);
+        VCDebugger_IncrementSample(renderer->debugger,
+                                   &renderer->debugger->stats.texturesUploaded);
+    }
+
+    slot->descriptor = descriptor;
+    slot->lastCheckedEpoch = currentEpoch;
+    slot->cachedTexture = cachedTexture;
+
+    VCAtlas_MarkTextureUsed(atlas, cachedTexture, currentEpoch);
+    return cachedTexture;
 }
 
 VCCachedTexture *VCAtlas_GetOrUploadTexture(VCAtlas *atlas, VCRenderer *renderer, gDPTile *tile) {
+    if (gDP.textureMode == TEXTUREMODE_BGIMAGE)
+        return VCAtlas_GetOrUploadBGImageTexture(atlas, renderer);
+
     uint8_t tileIndex = (uint8_t)((ptrdiff_t)(tile - &gDP.tiles[0]) / sizeof(gDP.tiles[0]));
     uint32_t currentEpoch = renderer->currentEpoch;
-    if (gDP.textureMode != TEXTUREMODE_BGIMAGE && atlas->cachedTileTextures[tileIndex] != NULL) {
-        VCCachedTexture *cachedTexture = atlas->cachedTileTextures[tileIndex];
-        cachedTexture->lastUsedEpoch = currentEpoch;
-        return cachedTexture;
+    if (atlas->cachedTileTextures[tileIndex] != NULL) {
+        return VCAtlas_UseTextureOrReplacement(atlas,
+                                               atlas->cachedTileTextures[tileIndex],
+                                               currentEpoch);
     }
 
     VCSize2us textureSize;
-    if (gDP.textureMode != TEXTUREMODE_BGIMAGE) {
-        textureSize.width = abs((int32_t)tile->lrs - (int32_t)tile->uls) + 1;
-        textureSize.height = abs((int32_t)tile->lrt - (int32_t)tile->ult) + 1;
-    } else {
-        textureSize.width = gSP.bgImage.width;
-        textureSize.height = gSP.bgImage.height;
-    }
-    
-    uint8_t size = gDP.textureMode != TEXTUREMODE_BGIMAGE ? tile->size : gSP.bgImage.size;
+    textureSize.width = abs((int32_t)tile->lrs - (int32_t)tile->uls) + 1;
+    textureSize.height = abs((int32_t)tile->lrt - (int32_t)tile->ult) + 1;
+
+    uint8_t format = tile->format;
+    uint8_t size = tile->size;
     uint32_t bpp = TextureCache_SizeToBPP(size);
 
-    uint32_t line;
-    if (gDP.textureMode != TEXTUREMODE_BGIMAGE) {
-        line = tile->line;
-        if (size == G_IM_SIZ_32b)
-            line <<= 1;
-    } else {
-        line = textureSize.width * bpp / 8;
-    }
+    uint32_t line = tile->line;
+    if (size == G_IM_SIZ_32b)
+        line <<= 1;
+
+    uint8_t rawFormat = VCAtlas_RawTextureFormatForTile(atlas, tile, &textureSize);
+    uint8_t pageFormat = rawFormat != VC_RAW_TEXTURE_FORMAT_NONE ?
+        VC_ATLAS_PAGE_FORMAT_RGBA8888 : VCAtlas_PageFormatForTile(tile);
 
     XXH32_reset(atlas->hashState, HASH_SEED);
-    XXH32_update(atlas->hashState, &tile->format, sizeof(tile->format));
+    XXH32_update(atlas->hashState, &format, sizeof(format));
     XXH32_update(atlas->hashState, &size, sizeof(size));
 
     static uint8_t *buffer = NULL;
@@ -437,79 +2025,131 @@ VCCachedTexture *VCAtlas_GetOrUploadTexture(VCAtlas *atlas, VCRenderer *renderer
 
     // Hash the texture data.
     assert(textureSize.width < 1024 && textureSize.height < 1024);
-    if (gDP.textureMode != TEXTUREMODE_BGIMAGE) {
-        for (uint32_t t = 0; t < textureSize.height; t++) {
-            uint64_t *scanlineStart = &TMEM[tile->tmem] + t * line;
-            memcpy(&buffer[t * textureSize.width * bpp / 8],
-                   scanlineStart,
-                   textureSize.width * bpp / 8);
-        }
-    } else {
-        for (int t = 0; t < textureSize.height; t++) {
-            uint64_t *scanlineStart = (uint64_t *)(&RDRAM[gSP.bgImage.address] + t * line);
-            memcpy(&buffer[t * textureSize.width * bpp / 8],
-                   scanlineStart,
-                   textureSize.width * bpp / 8);
-        }
+    for (uint32_t t = 0; t < textureSize.height; t++) {
+        uint64_t *scanlineStart = &TMEM[tile->tmem] + t * line;
+        memcpy(&buffer[t * textureSize.width * bpp / 8],
+               scanlineStart,
+               textureSize.width * bpp / 8);
     }
     XXH32_update(atlas->hashState, buffer, neededSize);
 
-    // Hash the palette too, if applicable.
-    uint32_t palette =
-        gDP.textureMode != TEXTUREMODE_BGIMAGE ? tile->palette : gSP.bgImage.palette;
-    if (tile->format == G_IM_FMT_CI) {
-        uint16_t paletteBuffer[16];
-        for (uint32_t entry = 0; entry < 16; entry++)
-            paletteBuffer[entry] = *(uint16_t *)&TMEM[256 + (palette << 4) + entry];
-        XXH32_update(atlas->hashState, paletteBuffer, sizeof(paletteBuffer));
+    // Hash the palette too, if applicable. The TLUT hashes are kept up to date as TMEM is loaded,
+    // so we don't have to touch the palette itself here, but they don't cover the TLUT type.
+    if (format == G_IM_FMT_CI) {
+        uint32_t paletteHash =
+            size == G_IM_SIZ_4b ? gDP.paletteHash16[tile->palette & 0xf] : gDP.paletteHash256;
+        uint8_t textureLUT = gDP.otherMode.textureLUT;
+        XXH32_update(atlas->hashState, &paletteHash, sizeof(paletteHash));
+        XXH32_update(atlas->hashState, &textureLUT, sizeof(textureLUT));
     }
 
+    // HD replacements are keyed on the texture's contents alone, so that packs work no matter how
+    // the texture ends up being stored; the cache key takes that into account too.
+    XXH32_hash_t replacementKey = XXH32_digest(atlas->hashState);
+    XXH32_update(atlas->hashState, &rawFormat, sizeof(rawFormat));
+    XXH32_update(atlas->hashState, &pageFormat, sizeof(pageFormat));
     XXH32_hash_t tmemHash = XXH32_digest(atlas->hashState);
     VCCachedTexture *cachedTexture = NULL;
     if ((cachedTexture = VCAtlas_LookUpTextureByTMEMHash(atlas, tmemHash)) == NULL) {
 #ifdef VC_TEXTURE_SPEW
         fprintf(stderr,
-                "cache miss: format=%d size=%d line=%d size=%dx%d\n",
+                "cache miss: format=%d size=%d line=%d size=%dx%d key=%08x\n",
                 (int)tile->format,
                 (int)tile->size,
                 (int)tile->line,
                 (int)textureSize.width,
-                (int)textureSize.height);
+                (int)textureSize.height,
+                (unsigned)replacementKey);
 #endif
         if (gDP.textureMode == TEXTUREMODE_FRAMEBUFFER) {
             fprintf(stderr, "*** framebuffer image detected! expect corruption.\n");
         }
 
-        uint8_t *texturePixels;
-        if (gDP.textureMode != TEXTUREMODE_BGIMAGE)
-            texturePixels = VCAtlas_ConvertTextureToRGBA(&textureSize, tile);
-        else
-            texturePixels = VCAtlas_ConvertBGImageTextureToRGBA(&textureSize);
-
-        bool repeatsX = gDP.textureMode != TEXTUREMODE_BGIMAGE && (tile->cms & G_TX_CLAMP) == 0;
-        bool repeatsY = gDP.textureMode != TEXTUREMODE_BGIMAGE && (tile->cmt & G_TX_CLAMP) == 0;
-        bool mirrorX = gDP.textureMode != TEXTUREMODE_BGIMAGE && tile->mirrors && tile->masks != 0;
-        bool mirrorY = gDP.textureMode != TEXTUREMODE_BGIMAGE && tile->mirrort && tile->maskt != 0;
-        cachedTexture = VCAtlas_CacheTexture(atlas,
-                                             &textureSize,
-                                             tmemHash,
-                                             texturePixels,
-                                             renderer->currentEpoch,
-                                             repeatsX,
-                                             repeatsY,
-                                             mirrorX,
-                                             mirrorY);
+        bool repeatsX = (tile->cms & G_TX_CLAMP) == 0;
+        bool repeatsY = (tile->cmt & G_TX_CLAMP) == 0;
+        bool mirrorX = tile->mirrors && tile->masks != 0;
+        bool mirrorY = tile->mirrort && tile->maskt != 0;
+        VCSize2us sizeIncludingMirror = {
+            (uint16_t)(textureSize.width * (mirrorX ? 2 : 1)),
+            (uint16_t)(textureSize.height * (mirrorY ? 2 : 1))
+        };
+        VCSize2us atlasSize = sizeIncludingMirror;
+        if (rawFormat != VC_RAW_TEXTURE_FORMAT_NONE)
+            atlasSize = VCAtlas_RawTextureAtlasSize(rawFormat, &textureSize);
+        cachedTexture = VCAtlas_CreateCachedTexture(atlas,
+                                                    &atlasSize,
+                                                    pageFormat,
+                                                    tmemHash,
+                                                    renderer->currentEpoch,
+                                                    repeatsX,
+                                                    repeatsY,
+                                                    mirrorX,
+                                                    mirrorY);
         assert(cachedTexture != NULL);
-        free(texturePixels);
+        cachedTexture->info.rawFormat = rawFormat;
+        cachedTexture->info.texelSize = sizeIncludingMirror;
+
+        const VCHDTextureEntry *replacementEntry =
+            VCHDTexturePack_Find(&atlas->replacementPack, replacementKey);
+        if (replacementEntry != NULL && replacementEntry->width != 0 &&
+                replacementEntry->height != 0) {
+            cachedTexture->replacementEntry = replacementEntry;
+            cachedTexture->replacementHash =
+                XXH32(&replacementKey, sizeof(replacementKey), REPLACEMENT_HASH_SEED);
+        }
+
+        // A texture seen in an earlier session may already be in the texture pack, decoded.
+        bool usesTexturePack = VCTexturePack_IsOpen(&atlas->texturePack);
+        uint64_t texturePackKey = 0;
+        bool loadedFromTexturePack = false;
+        if (usesTexturePack) {
+            texturePackKey =
+                VCAtlas_TexturePackKey(atlas, tile, buffer, neededSize, rawFormat, pageFormat);
+            loadedFromTexturePack =
+                VCAtlas_LoadTextureFromPack(atlas, cachedTexture, texturePackKey);
+        }
+        if (loadedFromTexturePack) {
+            VCDebugger_IncrementSample(renderer->debugger,
+                                       &renderer->debugger->stats.texturePackHits);
+        }
+
+        // The pixels aren't needed until upload time, so hand the decode off to the worker
+        // threads along with a snapshot of TMEM and the palette. If we're not keeping the pixels
+        // around after upload, keep the (much smaller) source instead and decode from that.
+        VCTextureDecodeJob *job = NULL;
+        if (!atlas->retainDecodedPixels) {
+            cachedTexture->source =
+                VCAtlas_CreateTextureSource(tile, &textureSize, rawFormat, pageFormat);
+            atlas->textureBytesUsed += VCTextureSource_Size(cachedTexture->source);
+            if (!loadedFromTexturePack)
+                job = VCAtlas_CreateDecodeJobFromSource(cachedTexture, cachedTexture->source);
+        } else if (!loadedFromTexturePack) {
+            job = (VCTextureDecodeJob *)malloc(sizeof(VCTextureDecodeJob));
+            if (job == NULL)
+                abort();
+            job->cachedTexture = cachedTexture;
+            job->rawFormat = rawFormat;
+            job->pageFormat = pageFormat;
+            job->tile = *tile;
+            job->size = textureSize;
+            memcpy(job->tmem, TMEM, sizeof(job->tmem));
+            memcpy(job->palette, TextureCache_CurrentPalette(), sizeof(job->palette));
+            job->replacementData = NULL;
+            job->replacementLength = 0;
+            job->texturePackAtlas = NULL;
+        }
+        if (job != NULL) {
+            if (usesTexturePack)
+                VCAtlas_StoreTextureInPackWhenDecoded(atlas, job, texturePackKey);
+            VCTextureDecoder_Enqueue(&atlas->decoder, job);
+        }
 
         VCDebugger_IncrementSample(renderer->debugger,
                                    &renderer->debugger->stats.texturesUploaded);
     }
 
-    cachedTexture->lastUsedEpoch = currentEpoch;
-    if (gDP.textureMode != TEXTUREMODE_BGIMAGE)
-        atlas->cachedTileTextures[tileIndex] = cachedTexture;
-    return cachedTexture;
+    atlas->cachedTileTextures[tileIndex] = cachedTexture;
+    return VCAtlas_UseTextureOrReplacement(atlas, cachedTexture, currentEpoch);
 }
 
 void VCAtlas_InvalidateCache(VCAtlas *atlas) {
@@ -521,23 +2161,38 @@ static void VCCachedTexture_Destroy(VCCachedTexture *cachedTexture) {
     if (cachedTexture == NULL)
         return;
     free(cachedTexture->info.pixels);
+    free(cachedTexture->source);
     free(cachedTexture);
 }
 
 void VCAtlas_Trim(VCAtlas *atlas, uint32_t currentEpoch) {
-    VCCachedTexture *cachedTexture = NULL, *tempCachedTexture = NULL;
     bool cacheNeedsInvalidation = false;
-    HASH_ITER(hh, atlas->cachedTextures, cachedTexture, tempCachedTexture) {
-        if (atlas->textureBytesUsed <= MAX_TEXTURE_BYTES_USED)
-            return;
+    VCCachedTexture *cachedTexture = atlas->leastRecentlyUsedTexture, *nextCachedTexture = NULL;
+    for (; cachedTexture != NULL; cachedTexture = nextCachedTexture) {
+        nextCachedTexture = cachedTexture->lruNext;
+        if (atlas->textureBytesUsed <= atlas->maxTextureBytesUsed)
+            break;
+
+        // Everything from here on has been used this frame.
         if (cachedTexture->lastUsedEpoch == currentEpoch)
+            break;
+        if (SDL_AtomicGet(&cachedTexture->replacementDecodesPending) != 0)
             continue;
-        VCRectus uv = VCTextureInfo_UVIncludingBorder(&cachedTexture->info);
-        size_t bytesUsedByTexture = uv.size.width * uv.size.height * BYTES_PER_PIXEL;
+        size_t bytesUsedByTexture = 0;
+        if (cachedTexture->info.pixels != NULL)
+            bytesUsedByTexture += VCTextureInfo_PixelsSize(&cachedTexture->info);
+        if (cachedTexture->source != NULL)
+            bytesUsedByTexture += VCTextureSource_Size(cachedTexture->source);
         assert(atlas->textureBytesUsed >= bytesUsedByTexture);
         atlas->textureBytesUsed -= bytesUsedByTexture;
+        VCAtlas_EvictTextureFromPage(atlas, cachedTexture);
+
+        for (uint32_t i = 0; i < VC_ATLAS_BG_IMAGE_COUNT; i++) {
+            if (atlas->cachedBGImages[i].cachedTexture == cachedTexture)
+                atlas->cachedBGImages[i].cachedTexture = NULL;
+        }
 
-        HASH_DEL(atlas->cachedTextures, cachedTexture);
+        VCAtlas_RemoveTextureFromCache(atlas, cachedTexture);
         VCCachedTexture_Destroy(cachedTexture);
         cacheNeedsInvalidation = true;
     }
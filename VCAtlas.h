@@ -5,18 +5,57 @@
 #ifndef VC_ATLAS_H
 #define VC_ATLAS_H
 
+#include <stdio.h>
 #include <stdlib.h>
 #include "VCGL.h"
 #include "VCGeometry.h"
-#include "uthash.h"
+#include "VCHDTexturePack.h"
+#include "VCTextureDecoder.h"
+#include "VCTexturePack.h"
 #include "xxhash.h"
 
 #define VC_ATLAS_TEXTURE_SIZE   1024
 #define VC_ATLAS_TILE_COUNT     8
+#define VC_ATLAS_BG_IMAGE_COUNT 4
+
+// How many epochs a background image can go on matching its sampled rows before it's hashed in
+// full again.
+#define VC_ATLAS_BG_IMAGE_FULL_HASH_INTERVAL    30
+#define VC_ATLAS_MAX_PAGES      16
+
+// How many page evictions are remembered for the clears-per-minute statistic.
+#define VC_ATLAS_PAGE_EVICTION_HISTORY  64
+
+#define VC_ATLAS_PACKER_GUILLOTINE  0
+#define VC_ATLAS_PACKER_MAXRECTS    1
+
+// Formats that can be left undecoded in the atlas and decoded by the fragment shader instead. Keep
+// in sync with `SampleTexture()` in `n64.inc.fs.glsl`.
+#define VC_RAW_TEXTURE_FORMAT_NONE  0
+#define VC_RAW_TEXTURE_FORMAT_I4    1
+#define VC_RAW_TEXTURE_FORMAT_IA4   2
+#define VC_RAW_TEXTURE_FORMAT_CI4   3
+#define VC_RAW_TEXTURE_FORMAT_I8    4
+#define VC_RAW_TEXTURE_FORMAT_IA8   5
+#define VC_RAW_TEXTURE_FORMAT_CI8   6
+#define VC_RAW_TEXTURE_FORMAT_IA16  7
+#define VC_RAW_TEXTURE_FORMAT_COUNT 8
+
+// Pixel formats of the atlas pages. Textures whose source format has no more precision than a
+// 16-bit format are stored in a page of that format, halving their upload and sampling bandwidth.
+// HD replacements are RGBA8888 too, but get pages of their own so that they don't crowd out the
+// game's textures.
+#define VC_ATLAS_PAGE_FORMAT_RGBA8888   0
+#define VC_ATLAS_PAGE_FORMAT_RGBA4444   1
+#define VC_ATLAS_PAGE_FORMAT_RGBA5551   2
+#define VC_ATLAS_PAGE_FORMAT_HD         3
+#define VC_ATLAS_PAGE_FORMAT_COUNT      4
 
 struct VCN64Vertex;
 struct VCRenderCommand;
 struct VCRenderer;
+struct VCTextureDecodeJob;
+struct VCTextureSource;
 struct gDPTile;
 
 struct VCTextureInfo {
@@ -28,24 +67,142 @@ struct VCTextureInfo {
     bool mirrorY;
     bool uvValid;
     bool needsUpload;
+
+    // For raw textures, `uv` is the area of the atlas holding the packed texels (and palette), and
+    // `texelSize` is the size of the texture as the shader sees it, including any mirrored copy.
+    // For HD replacements, `texelSize` is the size of the texture they replace, which texture
+    // coordinates are in terms of.
+    uint8_t rawFormat;
+    VCSize2us texelSize;
+
+    // One of `VC_ATLAS_PAGE_FORMAT_*`, and the index of the page in `VCAtlas::pages` holding the
+    // texture (only meaningful if `uvValid` is set).
+    uint8_t pageFormat;
+    uint8_t page;
 };
 
 struct VCCachedTexture {
     VCTextureInfo info;
+
+    // If set, `info.pixels` is dropped after each upload and decoded again from this as needed.
+    VCTextureSource *source;
     XXH32_hash_t tmemHash;
+
+    // For textures with an HD replacement, the image it's decoded from and the key of its own
+    // cache entry. For the replacements themselves, the image they're decoded from, how many
+    // decodes of it are still in flight on the replacement decoder, and whether decoding failed.
+    const VCHDTextureEntry *replacementEntry;
+    XXH32_hash_t replacementHash;
+    SDL_atomic_t replacementDecodesPending;
+    bool replacementFailed;
+    bool warnedDoesntFit;
     uint32_t lastUsedEpoch;
-    UT_hash_handle hh;
+
+    // Links in `VCAtlas::leastRecentlyUsedTexture`'s list, and in the per-frame lists of textures
+    // used this frame and textures waiting to be uploaded.
+    VCCachedTexture *lruPrev;
+    VCCachedTexture *lruNext;
+    VCCachedTexture *nextUsedTexture;
+    VCCachedTexture *nextTextureNeedingUpload;
 };
 
-struct VCAtlas {
-    GLuint texture;
-    VCCachedTexture *cachedTileTextures[VC_ATLAS_TILE_COUNT];
-    VCCachedTexture *cachedTextures;
+// A slot in the texture cache's open-addressed hash table. The hash is stored alongside so that
+// probing doesn't have to touch the textures themselves.
+struct VCCachedTextureSlot {
+    XXH32_hash_t tmemHash;
+    VCCachedTexture *cachedTexture;
+};
+
+// Identifies a background image by where it lives in RDRAM and how it's laid out, so that an
+// unchanged background can be found again without a texture cache lookup.
+struct VCBGImageDescriptor {
+    uint32_t address;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t size;
+    uint32_t palette;
+    XXH32_hash_t paletteHash;
+    uint32_t textureLUT;
+};
+
+struct VCCachedBGImage {
+    VCBGImageDescriptor descriptor;
+    XXH32_hash_t sampledRowsHash;
+    uint32_t lastCheckedEpoch;
+    uint32_t lastFullyHashedEpoch;
+    VCCachedTexture *cachedTexture;
+};
+
+struct VCAtlasPage {
+    // For RSP thread only.
+    uint8_t format;
+    uint8_t packer;
     VCRectus *freeList;
     size_t freeListSize;
     size_t freeListCapacity;
+
+    // MaxRects pages only: the rectangles handed out, which bound the free space again when one
+    // of them is freed.
+    VCRectus *usedList;
+    size_t usedListSize;
+    size_t usedListCapacity;
+    uint32_t pixelsUsed;
+    uint32_t borderPixelsUsed;
+    uint32_t lastUsedEpoch;
+
+    // For render thread only. The GL texture is created, and respecified whenever the page is
+    // handed over to a different format, when the first texture is uploaded to it.
+    GLuint texture;
+    uint8_t textureFormat;
+};
+
+struct VCAtlas {
+    VCAtlasPage pages[VC_ATLAS_MAX_PAGES];
+    uint8_t pagesLength;
+    uint8_t maxPages;
+    uint8_t packer;
+    uint32_t pageEvictionTimes[VC_ATLAS_PAGE_EVICTION_HISTORY];
+    uint32_t pageEvictionCount;
+    VCCachedTexture *cachedTileTextures[VC_ATLAS_TILE_COUNT];
+    VCCachedBGImage cachedBGImages[VC_ATLAS_BG_IMAGE_COUNT];
+
+    // The texture cache, keyed by TMEM hash. Every cached texture is also on the LRU list, least
+    // recently used first. Only the textures used in `usedTexturesEpoch` are on the used list, and
+    // only those with `needsUpload` set are on the upload list, so per-frame work scales with the
+    // textures touched rather than with the size of the cache.
+    VCCachedTextureSlot *cachedTextureSlots;
+    size_t cachedTextureSlotsLength;
+    size_t cachedTexturesLength;
+    VCCachedTexture *leastRecentlyUsedTexture;
+    VCCachedTexture *mostRecentlyUsedTexture;
+    VCCachedTexture *usedTextures;
+    uint32_t usedTexturesEpoch;
+    VCCachedTexture *texturesNeedingUpload;
+
     size_t textureBytesUsed;
+    size_t maxTextureBytesUsed;
+    bool retainDecodedPixels;
     XXH32_state_t *hashState;
+
+    // Textures are looked up in the texture pack on the RSP thread and appended to it on the
+    // decoder threads, once decoded, so the pack is only touched with `texturePackMutex` held.
+    VCTexturePack texturePack;
+    SDL_mutex *texturePackMutex;
+    XXH64_state_t *texturePackHashState;
+    VCTextureDecoder decoder;
+
+    // HD replacements are decoded on a decoder of their own, which is never waited on, so that
+    // decoding them never holds up a frame.
+    VCHDTexturePack replacementPack;
+    VCTextureDecoder replacementDecoder;
+
+    // Bitmask of `VC_RAW_TEXTURE_FORMAT_*` formats that are decoded on the GPU.
+    uint32_t gpuDecodeFormats;
+
+    // If `debug.atlasTrace` is set, where page allocations and frees are recorded for
+    // `vcatlaspack`.
+    FILE *trace;
 };
 
 inline void VCAtlas_FillTextureBounds(VCRects *textureBounds, VCTextureInfo *textureInfo) {
@@ -53,6 +210,15 @@ inline void VCAtlas_FillTextureBounds(VCRects *textureBounds, VCTextureInfo *tex
     textureBounds->origin.y = (int16_t)textureInfo->uv.origin.y;
     textureBounds->size.width = (int16_t)textureInfo->uv.size.width;
     textureBounds->size.height = (int16_t)textureInfo->uv.size.height;
+    if (textureInfo->rawFormat != VC_RAW_TEXTURE_FORMAT_NONE) {
+        // Raw textures are addressed in texels by the fragment shader. The format and mirroring
+        // ride along in the otherwise-unused high bits of the origin.
+        textureBounds->origin.x += VC_ATLAS_TEXTURE_SIZE * textureInfo->rawFormat;
+        textureBounds->origin.y += VC_ATLAS_TEXTURE_SIZE *
+            ((textureInfo->mirrorX ? 1 : 0) | (textureInfo->mirrorY ? 2 : 0));
+        textureBounds->size.width = (int16_t)textureInfo->texelSize.width;
+        textureBounds->size.height = (int16_t)textureInfo->texelSize.height;
+    }
     if (textureInfo->repeatX)
         textureBounds->size.width = -textureBounds->size.width;
     if (textureInfo->repeatY)
@@ -60,18 +226,28 @@ inline void VCAtlas_FillTextureBounds(VCRects *textureBounds, VCTextureInfo *tex
 }
 
 void VCAtlas_Create(VCAtlas *atlas);
-bool VCAtlas_Allocate(VCAtlas *atlas, VCRectus *result, VCSize2us *size);
-void VCAtlas_Bind(VCAtlas *atlas);
-GLint VCAtlas_GetGLTexture(VCAtlas *atlas);
+void VCAtlasPage_InitFreeList(VCAtlasPage *page);
+bool VCAtlasPage_Allocate(VCAtlasPage *page, VCPoint2us *result, VCSize2us *size);
+void VCAtlasPage_Free(VCAtlasPage *page, VCRectus *rect);
+uint32_t VCAtlasPage_AllocatedAreaWithin(VCAtlasPage *page, const VCRectus *bounds);
+void VCAtlas_Bind(VCAtlas *atlas, uint8_t page);
+GLint VCAtlas_GetGLTexture(VCAtlas *atlas, uint8_t page);
 void VCAtlas_FillTextureBounds(VCRects *textureBounds, VCTextureInfo *textureInfo);
-void VCAtlas_AllocateTexturesInAtlas(VCAtlas *atlas,
-                                     const VCRenderer *renderer,
-                                     bool clearAndRetryOnOverflow);
+void VCAtlas_AllocateTexturesInAtlas(VCAtlas *atlas, VCRenderer *renderer);
 void VCAtlas_EnqueueCommandsToUploadTextures(VCAtlas *atlas, VCRenderer *renderer);
 void VCAtlas_ProcessUploadCommand(VCAtlas *atlas, VCRenderCommand *command);
 VCCachedTexture *VCAtlas_GetOrUploadTexture(VCAtlas *atlas, VCRenderer *renderer, gDPTile *tile);
 void VCAtlas_InvalidateCache(VCAtlas *atlas);
 void VCAtlas_Trim(VCAtlas *atlas, uint32_t currentEpoch);
+void VCAtlas_DecodeTexture(VCTextureDecodeJob *job);
+void VCAtlas_WaitForPendingDecodes(VCAtlas *atlas);
+void VCAtlas_DestroyDecoders(VCAtlas *atlas);
+void VCAtlas_OpenTexturePack(VCAtlas *atlas, const uint8_t *romHeader);
+void VCAtlas_CloseTexturePack(VCAtlas *atlas);
+void VCAtlas_OpenReplacementPack(VCAtlas *atlas, const uint8_t *romHeader);
+void VCAtlas_CloseReplacementPack(VCAtlas *atlas);
+void VCAtlas_OpenTrace(VCAtlas *atlas);
+void VCAtlas_CloseTrace(VCAtlas *atlas);
 
 #endif
 
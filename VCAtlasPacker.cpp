@@ -0,0 +1,363 @@
+// mupen64plus-video-videocore/VCAtlasPacker.cpp
+//
+// Copyright (c) 2016 The mupen64plus-video-videocore Authors
+//
+// The rectangle packers that place textures in atlas pages. They only touch the page's free space
+// bookkeeping, so `vcatlaspack` can replay allocations against them without a GL context.
+
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+#include "VCAtlas.h"
+#include "VCGeometry.h"
+
+#define INITIAL_FREE_LIST_CAPACITY  16
+
+void VCAtlasPage_InitFreeList(VCAtlasPage *page) {
+    page->freeList = (VCRectus *)malloc(sizeof(VCRectus) * INITIAL_FREE_LIST_CAPACITY);
+    if (page->freeList == NULL)
+        abort();
+    page->freeListSize = 1;
+    page->freeListCapacity = INITIAL_FREE_LIST_CAPACITY;
+    page->freeList[0].origin.x = page->freeList[0].origin.y = 0;
+    page->freeList[0].size.width = page->freeList[0].size.height = VC_ATLAS_TEXTURE_SIZE;
+    page->usedList = NULL;
+    page->usedListSize = 0;
+    page->usedListCapacity = 0;
+    page->pixelsUsed = 0;
+    page->borderPixelsUsed = 0;
+}
+
+static void VCAtlasPage_AppendFreeRect(VCAtlasPage *page, VCRectus *rect) {
+    if (rect->size.width == 0 || rect->size.height == 0)
+        return;
+    if (page->freeListSize + 1 > page->freeListCapacity) {
+        page->freeListCapacity *= 2;
+        page->freeList = (VCRectus *)realloc(page->freeList,
+                                             sizeof(VCRectus) * page->freeListCapacity);
+        if (page->freeList == NULL)
+            abort();
+    }
+    page->freeList[page->freeListSize++] = *rect;
+}
+
+// Guillotine packer: best area fit, splitting the chosen free rectangle in two. Freed rectangles
+// are merged back with the free rectangles they line up with; see `VCAtlasPage_Free()`.
+static bool VCAtlasPage_AllocateGuillotine(VCAtlasPage *page,
+                                           VCPoint2us *result,
+                                           VCSize2us *size) {
+    if (page->freeListSize == 0)
+        return false;
+
+    size_t bestIndex = 0;
+    uint32_t best_area = UINT_MAX;
+    for (size_t i = 0; i < page->freeListSize; i++) {
+        VCRectus *candidate = &page->freeList[i];
+        uint32_t candidate_area = (uint32_t)candidate->size.width *
+            (uint32_t)candidate->size.height;
+        if (candidate->size.width >= size->width &&
+                candidate->size.height >= size->height &&
+                candidate_area < best_area) {
+            bestIndex = i;
+            best_area = candidate_area;
+        }
+    }
+    if (best_area == UINT_MAX)
+        return false;
+
+    VCRectus chosenRect = page->freeList[bestIndex];
+    *result = chosenRect.origin;
+
+    // Guillotine to right.
+    page->freeList[bestIndex].origin.x = chosenRect.origin.x + size->width;
+    page->freeList[bestIndex].origin.y = chosenRect.origin.y;
+    page->freeList[bestIndex].size.width = chosenRect.size.width - size->width;
+    page->freeList[bestIndex].size.height = size->height;
+    if (page->freeList[bestIndex].size.width == 0)
+        page->freeList[bestIndex] = page->freeList[--page->freeListSize];
+
+    // Guillotine to bottom.
+    VCRectus bottomRect;
+    bottomRect.origin.x = chosenRect.origin.x;
+    bottomRect.origin.y = chosenRect.origin.y + size->height;
+    bottomRect.size.width = chosenRect.size.width;
+    bottomRect.size.height = chosenRect.size.height - size->height;
+    VCAtlasPage_AppendFreeRect(page, &bottomRect);
+    return true;
+}
+
+// Splits every free rectangle that `placed` overlaps around it, keeping the free list the set of
+// maximal free rectangles. Returns true if any were split.
+static bool VCAtlasPage_SplitFreeRects(VCAtlasPage *page, const VCRectus *placed) {
+    size_t originalFreeListSize = page->freeListSize;
+    for (size_t i = 0; i < originalFreeListSize; i++) {
+        VCRectus freeRect = page->freeList[i];
+        if (!VCRectus_Intersects(&freeRect, placed))
+            continue;
+
+        uint16_t freeRight = freeRect.origin.x + freeRect.size.width;
+        uint16_t freeBottom = freeRect.origin.y + freeRect.size.height;
+        uint16_t placedRight = placed->origin.x + placed->size.width;
+        uint16_t placedBottom = placed->origin.y + placed->size.height;
+        VCRectus piece;
+        if (placed->origin.x > freeRect.origin.x) {
+            piece = freeRect;
+            piece.size.width = placed->origin.x - freeRect.origin.x;
+            VCAtlasPage_AppendFreeRect(page, &piece);
+        }
+        if (placedRight < freeRight) {
+            piece = freeRect;
+            piece.origin.x = placedRight;
+            piece.size.width = freeRight - placedRight;
+            VCAtlasPage_AppendFreeRect(page, &piece);
+        }
+        if (placed->origin.y > freeRect.origin.y) {
+            piece = freeRect;
+            piece.size.height = placed->origin.y - freeRect.origin.y;
+            VCAtlasPage_AppendFreeRect(page, &piece);
+        }
+        if (placedBottom < freeBottom) {
+            piece = freeRect;
+            piece.origin.y = placedBottom;
+            piece.size.height = freeBottom - placedBottom;
+            VCAtlasPage_AppendFreeRect(page, &piece);
+        }
+
+        // Mark the split rectangle for removal.
+        page->freeList[i].size.width = 0;
+    }
+
+    size_t destIndex = 0, firstNewIndex = 0;
+    for (size_t i = 0; i < page->freeListSize; i++) {
+        if (i == originalFreeListSize)
+            firstNewIndex = destIndex;
+        if (page->freeList[i].size.width != 0)
+            page->freeList[destIndex++] = page->freeList[i];
+    }
+    if (originalFreeListSize == page->freeListSize)
+        firstNewIndex = destIndex;
+    bool split = destIndex != page->freeListSize;
+    page->freeListSize = destIndex;
+
+    // Drop new pieces that lie entirely within another free rectangle. The untouched rectangles
+    // were maximal already, so they can't be inside anything.
+    for (size_t i = firstNewIndex; i < page->freeListSize; i++) {
+        for (size_t j = 0; j < page->freeListSize; j++) {
+            if (i != j && VCRectus_Contains(&page->freeList[j], &page->freeList[i])) {
+                page->freeList[i--] = page->freeList[--page->freeListSize];
+                break;
+            }
+        }
+    }
+    return split;
+}
+
+// MaxRects packer: the free list holds every maximal free rectangle, which may overlap. Textures
+// go in the free rectangle they fit most snugly along their shorter leftover side, and every free
+// rectangle they overlap is split around them.
+static bool VCAtlasPage_AllocateMaxRects(VCAtlasPage *page, VCPoint2us *result, VCSize2us *size) {
+    size_t bestIndex = 0;
+    uint32_t bestShortSide = UINT_MAX, bestLongSide = UINT_MAX;
+    for (size_t i = 0; i < page->freeListSize; i++) {
+        VCRectus *candidate = &page->freeList[i];
+        if (candidate->size.width < size->width || candidate->size.height < size->height)
+            continue;
+        uint32_t leftoverX = candidate->size.width - size->width;
+        uint32_t leftoverY = candidate->size.height - size->height;
+        uint32_t shortSide = leftoverX < leftoverY ? leftoverX : leftoverY;
+        uint32_t longSide = leftoverX < leftoverY ? leftoverY : leftoverX;
+        if (shortSide < bestShortSide ||
+                (shortSide == bestShortSide && longSide < bestLongSide)) {
+            bestIndex = i;
+            bestShortSide = shortSide;
+            bestLongSide = longSide;
+        }
+    }
+    if (bestShortSide == UINT_MAX)
+        return false;
+
+    VCRectus placed;
+    placed.origin = page->freeList[bestIndex].origin;
+    placed.size = *size;
+    *result = placed.origin;
+    VCAtlasPage_SplitFreeRects(page, &placed);
+
+    if (page->usedListSize + 1 > page->usedListCapacity) {
+        page->usedListCapacity = page->usedListCapacity == 0 ? INITIAL_FREE_LIST_CAPACITY :
+            page->usedListCapacity * 2;
+        page->usedList = (VCRectus *)realloc(page->usedList,
+                                             sizeof(VCRectus) * page->usedListCapacity);
+        if (page->usedList == NULL)
+            abort();
+    }
+    page->usedList[page->usedListSize++] = placed;
+    return true;
+}
+
+// Returns the smallest rectangle covering every free rectangle of the page.
+static VCRectus VCAtlasPage_FreeListBounds(VCAtlasPage *page) {
+    uint16_t left = VC_ATLAS_TEXTURE_SIZE, top = VC_ATLAS_TEXTURE_SIZE, right = 0, bottom = 0;
+    for (size_t i = 0; i < page->freeListSize; i++) {
+        VCRectus *freeRect = &page->freeList[i];
+        if (freeRect->origin.x < left)
+            left = freeRect->origin.x;
+        if (freeRect->origin.y < top)
+            top = freeRect->origin.y;
+        if (freeRect->origin.x + freeRect->size.width > right)
+            right = freeRect->origin.x + freeRect->size.width;
+        if (freeRect->origin.y + freeRect->size.height > bottom)
+            bottom = freeRect->origin.y + freeRect->size.height;
+    }
+    VCRectus bounds = { { left, top }, { (uint16_t)(right - left), (uint16_t)(bottom - top) } };
+    return bounds;
+}
+
+// Frees a rectangle on a MaxRects page. The maximal free rectangles that don't overlap it are
+// still maximal, except those that now extend into it; the ones that do overlap it are found by
+// splitting the whole page around every rectangle still in use, keeping only the pieces that
+// overlap it. Those replace any old free rectangles they contain.
+static void VCAtlasPage_FreeMaxRects(VCAtlasPage *page, VCRectus *rect) {
+    for (size_t i = 0; i < page->usedListSize; i++) {
+        VCRectus *usedRect = &page->usedList[i];
+        if (usedRect->origin.x == rect->origin.x && usedRect->origin.y == rect->origin.y &&
+                usedRect->size.width == rect->size.width &&
+                usedRect->size.height == rect->size.height) {
+            *usedRect = page->usedList[--page->usedListSize];
+            break;
+        }
+    }
+
+    VCAtlasPage pieces;
+    pieces.freeList = (VCRectus *)malloc(sizeof(VCRectus) * INITIAL_FREE_LIST_CAPACITY);
+    if (pieces.freeList == NULL)
+        abort();
+    pieces.freeListSize = 1;
+    pieces.freeListCapacity = INITIAL_FREE_LIST_CAPACITY;
+    pieces.freeList[0].origin.x = pieces.freeList[0].origin.y = 0;
+    pieces.freeList[0].size.width = pieces.freeList[0].size.height = VC_ATLAS_TEXTURE_SIZE;
+    // The rectangles level with the freed one bound the pieces the most, so move them to the front
+    // to split around first; most of the others then miss the pieces entirely.
+    size_t levelCount = 0;
+    for (size_t i = 0; i < page->usedListSize; i++) {
+        VCRectus usedRect = page->usedList[i];
+        if ((usedRect.origin.x < rect->origin.x + rect->size.width &&
+                    rect->origin.x < usedRect.origin.x + usedRect.size.width) ||
+                (usedRect.origin.y < rect->origin.y + rect->size.height &&
+                    rect->origin.y < usedRect.origin.y + usedRect.size.height)) {
+            page->usedList[i] = page->usedList[levelCount];
+            page->usedList[levelCount++] = usedRect;
+        }
+    }
+
+    VCRectus bounds = pieces.freeList[0];
+    for (size_t i = 0; i < page->usedListSize; i++) {
+        if (!VCRectus_Intersects(&page->usedList[i], &bounds) ||
+                !VCAtlasPage_SplitFreeRects(&pieces, &page->usedList[i])) {
+            continue;
+        }
+
+        // A piece clear of the freed rectangle only ever splits into more pieces clear of it.
+        for (size_t j = 0; j < pieces.freeListSize; j++) {
+            if (!VCRectus_Intersects(&pieces.freeList[j], rect))
+                pieces.freeList[j--] = pieces.freeList[--pieces.freeListSize];
+        }
+        bounds = VCAtlasPage_FreeListBounds(&pieces);
+    }
+
+    // Only old free rectangles within the pieces' bounds can be inside one of them.
+    for (size_t i = 0; i < page->freeListSize; i++) {
+        if (!VCRectus_Contains(&bounds, &page->freeList[i]))
+            continue;
+        for (size_t j = 0; j < pieces.freeListSize; j++) {
+            if (VCRectus_Contains(&pieces.freeList[j], &page->freeList[i])) {
+                page->freeList[i--] = page->freeList[--page->freeListSize];
+                break;
+            }
+        }
+    }
+    for (size_t i = 0; i < pieces.freeListSize; i++)
+        VCAtlasPage_AppendFreeRect(page, &pieces.freeList[i]);
+    free(pieces.freeList);
+}
+
+// Grows `rect` to cover `other` if the two share a whole edge.
+static bool VCRectus_MergeAdjacent(VCRectus *rect, const VCRectus *other) {
+    if (rect->origin.y == other->origin.y && rect->size.height == other->size.height) {
+        if (rect->origin.x + rect->size.width == other->origin.x) {
+            rect->size.width += other->size.width;
+            return true;
+        }
+        if (other->origin.x + other->size.width == rect->origin.x) {
+            rect->origin.x = other->origin.x;
+            rect->size.width += other->size.width;
+            return true;
+        }
+    } else if (rect->origin.x == other->origin.x && rect->size.width == other->size.width) {
+        if (rect->origin.y + rect->size.height == other->origin.y) {
+            rect->size.height += other->size.height;
+            return true;
+        }
+        if (other->origin.y + other->size.height == rect->origin.y) {
+            rect->origin.y = other->origin.y;
+            rect->size.height += other->size.height;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns a rectangle to the page's free space. Guillotine pages merge it with any free rectangles
+// it lines up with. Only the returned rectangle grows, but once it has, it may line up with one
+// already passed over, so the scan starts over after each merge; that makes this quadratic in the
+// size of the free list at worst, though a rectangle rarely merges more than a few times.
+void VCAtlasPage_Free(VCAtlasPage *page, VCRectus *rect) {
+    uint32_t area = (uint32_t)rect->size.width * (uint32_t)rect->size.height;
+    assert(page->pixelsUsed >= area);
+    page->pixelsUsed -= area;
+
+    if (page->packer == VC_ATLAS_PACKER_MAXRECTS) {
+        VCAtlasPage_FreeMaxRects(page, rect);
+        return;
+    }
+
+    VCRectus freedRect = *rect;
+    for (size_t i = 0; i < page->freeListSize; i++) {
+        if (!VCRectus_MergeAdjacent(&freedRect, &page->freeList[i]))
+            continue;
+        page->freeList[i] = page->freeList[--page->freeListSize];
+        i = (size_t)-1;
+    }
+    VCAtlasPage_AppendFreeRect(page, &freedRect);
+}
+
+// Returns how much of the given area of the page has been handed out. MaxRects pages add up their
+// allocations; guillotine pages, whose free rectangles don't overlap and cover everything not
+// handed out, subtract their free space instead.
+uint32_t VCAtlasPage_AllocatedAreaWithin(VCAtlasPage *page, const VCRectus *bounds) {
+    if (page->packer == VC_ATLAS_PACKER_MAXRECTS) {
+        uint32_t allocatedArea = 0;
+        for (size_t i = 0; i < page->usedListSize; i++)
+            allocatedArea += VCRectus_IntersectionArea(&page->usedList[i], bounds);
+        return allocatedArea;
+    }
+
+    uint32_t freeArea = 0;
+    for (size_t i = 0; i < page->freeListSize; i++)
+        freeArea += VCRectus_IntersectionArea(&page->freeList[i], bounds);
+    return (uint32_t)bounds->size.width * (uint32_t)bounds->size.height - freeArea;
+}
+
+bool VCAtlasPage_Allocate(VCAtlasPage *page, VCPoint2us *result, VCSize2us *size) {
+    bool allocated;
+    switch (page->packer) {
+    case VC_ATLAS_PACKER_MAXRECTS:
+        allocated = VCAtlasPage_AllocateMaxRects(page, result, size);
+        break;
+    default:
+        allocated = VCAtlasPage_AllocateGuillotine(page, result, size);
+        break;
+    }
+    if (allocated)
+        page->pixelsUsed += (uint32_t)size->width * (uint32_t)size->height;
+    return allocated;
+}
@@ -0,0 +1,593 @@
+// mupen64plus-video-videocore/VCAtlasPackerTool.cpp
+//
+// Copyright (c) 2016 The mupen64plus-video-videocore Authors
+//
+// `vcatlaspack`: replays traces of atlas allocations, such as the ones `debug.atlasTrace` records
+// or `vcatlaspack random` generates, against each of the atlas packers, and reports how full they
+// get the pages and how long they take, or checks their free lists against the live allocations.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "VCAtlas.h"
+
+#define VC_ATLAS_PACKER_TOOL_MAX_LINE_LENGTH    256
+
+#define VC_ATLAS_PACKER_TOOL_MIN_RANDOM_SIZE    3
+#define VC_ATLAS_PACKER_TOOL_MAX_RANDOM_SIZE    66
+#define VC_ATLAS_PACKER_TOOL_DEFAULT_SEED       1
+
+#define VC_ATLAS_PACKER_TOOL_DEFAULT_CHECK_INTERVAL 100
+
+#define VC_ATLAS_PACKER_TOOL_EVENT_ALLOCATE     'a'
+#define VC_ATLAS_PACKER_TOOL_EVENT_FREE         'f'
+#define VC_ATLAS_PACKER_TOOL_EVENT_EVICT_PAGE   'e'
+
+// One line of a trace. For frees, `allocation` is the index of the event that allocated the
+// rectangle being freed.
+struct VCAtlasPackerToolEvent {
+    char type;
+    uint8_t page;
+    VCSize2us size;
+    size_t allocation;
+};
+
+struct VCAtlasPackerToolTrace {
+    VCAtlasPackerToolEvent *events;
+    size_t eventsLength;
+    size_t eventsCapacity;
+};
+
+// Maps the page and ID of each live allocation to the event that made it, while reading a trace.
+struct VCAtlasPackerToolAllocationSlot {
+    uint64_t key;
+    size_t event;
+    bool used;
+    bool live;
+};
+
+struct VCAtlasPackerToolResult {
+    size_t allocations;
+    size_t failedAllocations;
+    size_t frees;
+    double occupancyAtFirstFailure;
+    double peakOccupancy;
+    double allocationMicroseconds;
+    double freeMicroseconds;
+    size_t freeRects;
+    size_t checks;
+    bool checkFailed;
+};
+
+// What `vcatlaspack check` compares a page's free list with: which pixels are covered by live
+// allocations, and a summed-area table of that (and then of the free list's coverage) for
+// constant-time area queries.
+struct VCAtlasPackerToolChecker {
+    uint8_t *pixelsUsed[VC_ATLAS_MAX_PAGES];
+    uint32_t *sums;
+};
+
+static void VCAtlasPackerTool_Usage() {
+    fprintf(stderr, "usage: vcatlaspack replay TRACE\n");
+    fprintf(stderr, "       vcatlaspack check TRACE [INTERVAL]\n");
+    fprintf(stderr, "       vcatlaspack random ALLOCATIONS [FREE-PERCENT [SEED]]\n");
+    fprintf(stderr, "TRACE may be `-` for standard input.\n");
+    exit(1);
+}
+
+static double VCAtlasPackerTool_GetMicroseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1000000.0 + (double)now.tv_nsec / 1000.0;
+}
+
+static VCAtlasPackerToolAllocationSlot *VCAtlasPackerTool_FindSlot(
+        VCAtlasPackerToolAllocationSlot *slots,
+        size_t slotsLength,
+        uint64_t key) {
+    size_t mask = slotsLength - 1;
+    size_t index = (size_t)(key * 0x9e3779b97f4a7c15ULL >> 32) & mask;
+    while (slots[index].used && slots[index].key != key)
+        index = (index + 1) & mask;
+    return &slots[index];
+}
+
+static void VCAtlasPackerTool_AppendEvent(VCAtlasPackerToolTrace *trace,
+                                          VCAtlasPackerToolEvent *event) {
+    if (trace->eventsLength == trace->eventsCapacity) {
+        trace->eventsCapacity = trace->eventsCapacity == 0 ? 1024 : trace->eventsCapacity * 2;
+        trace->events = (VCAtlasPackerToolEvent *)realloc(
+                trace->events,
+                sizeof(VCAtlasPackerToolEvent) * trace->eventsCapacity);
+        if (trace->events == NULL)
+            abort();
+    }
+    trace->events[trace->eventsLength++] = *event;
+}
+
+// Reads a trace: one event per line, `a PAGE ID WIDTH HEIGHT` for an allocation (border
+// included), `f PAGE ID` for a free, and `e PAGE` for the eviction of a whole page. IDs only need
+// to be unique among a page's live allocations.
+static bool VCAtlasPackerTool_ReadTrace(const char *path, VCAtlasPackerToolTrace *trace) {
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "vcatlaspack: couldn't open `%s`\n", path);
+        return false;
+    }
+
+    size_t slotsLength = 1024, slotsUsed = 0;
+    VCAtlasPackerToolAllocationSlot *slots = (VCAtlasPackerToolAllocationSlot *)calloc(
+            slotsLength,
+            sizeof(VCAtlasPackerToolAllocationSlot));
+    if (slots == NULL)
+        abort();
+
+    char line[VC_ATLAS_PACKER_TOOL_MAX_LINE_LENGTH];
+    size_t lineNumber = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file) != NULL) {
+        lineNumber++;
+        if (line[strspn(line, " \t\r\n")] == '\0' || line[0] == '#')
+            continue;
+
+        char type = '\0';
+        unsigned page = 0, id = 0, width = 0, height = 0;
+        int fieldCount = sscanf(line, " %c %u %u %u %u", &type, &page, &id, &width, &height);
+        ok = page < VC_ATLAS_MAX_PAGES &&
+            ((type == VC_ATLAS_PACKER_TOOL_EVENT_ALLOCATE && fieldCount == 5 && width > 0 &&
+              height > 0 && width <= VC_ATLAS_TEXTURE_SIZE && height <= VC_ATLAS_TEXTURE_SIZE) ||
+             (type == VC_ATLAS_PACKER_TOOL_EVENT_FREE && fieldCount == 3) ||
+             (type == VC_ATLAS_PACKER_TOOL_EVENT_EVICT_PAGE && fieldCount == 2));
+        if (!ok) {
+            fprintf(stderr, "vcatlaspack: %s:%zu: bad event\n", path, lineNumber);
+            break;
+        }
+
+        VCAtlasPackerToolEvent event;
+        event.type = type;
+        event.page = (uint8_t)page;
+        event.size.width = (uint16_t)width;
+        event.size.height = (uint16_t)height;
+        event.allocation = 0;
+
+        uint64_t key = ((uint64_t)page << 32) | id;
+        if (type == VC_ATLAS_PACKER_TOOL_EVENT_ALLOCATE) {
+            if ((slotsUsed + 1) * 2 > slotsLength) {
+                size_t newSlotsLength = slotsLength * 2;
+                VCAtlasPackerToolAllocationSlot *newSlots =
+                    (VCAtlasPackerToolAllocationSlot *)calloc(
+                            newSlotsLength,
+                            sizeof(VCAtlasPackerToolAllocationSlot));
+                if (newSlots == NULL)
+                    abort();
+                for (size_t i = 0; i < slotsLength; i++) {
+                    if (slots[i].used)
+                        *VCAtlasPackerTool_FindSlot(newSlots, newSlotsLength, slots[i].key) =
+                            slots[i];
+                }
+                free(slots);
+                slots = newSlots;
+                slotsLength = newSlotsLength;
+            }
+            VCAtlasPackerToolAllocationSlot *slot =
+                VCAtlasPackerTool_FindSlot(slots, slotsLength, key);
+            if (!slot->used)
+                slotsUsed++;
+            slot->key = key;
+            slot->event = trace->eventsLength;
+            slot->used = true;
+            slot->live = true;
+        } else if (type == VC_ATLAS_PACKER_TOOL_EVENT_FREE) {
+            VCAtlasPackerToolAllocationSlot *slot =
+                VCAtlasPackerTool_FindSlot(slots, slotsLength, key);
+            if (!slot->used || !slot->live) {
+                fprintf(stderr, "vcatlaspack: %s:%zu: free of an unknown ID\n", path, lineNumber);
+                ok = false;
+                break;
+            }
+            event.allocation = slot->event;
+            slot->live = false;
+        } else {
+            for (size_t i = 0; i < slotsLength; i++) {
+                if (slots[i].used && (uint8_t)(slots[i].key >> 32) == page)
+                    slots[i].live = false;
+            }
+        }
+        VCAtlasPackerTool_AppendEvent(trace, &event);
+    }
+
+    free(slots);
+    if (file != stdin)
+        fclose(file);
+    return ok;
+}
+
+static double VCAtlasPackerTool_Occupancy(VCAtlasPage *pages, bool *pagesUsed) {
+    uint64_t pixelsUsed = 0, pixelsAvailable = 0;
+    for (uint8_t i = 0; i < VC_ATLAS_MAX_PAGES; i++) {
+        if (!pagesUsed[i])
+            continue;
+        pixelsUsed += pages[i].pixelsUsed;
+        pixelsAvailable += VC_ATLAS_TEXTURE_SIZE * VC_ATLAS_TEXTURE_SIZE;
+    }
+    return pixelsAvailable == 0 ? 0.0 : 100.0 * (double)pixelsUsed / (double)pixelsAvailable;
+}
+
+static void VCAtlasPackerTool_MarkPixels(VCAtlasPackerToolChecker *checker,
+                                         uint8_t page,
+                                         VCRectus *rect,
+                                         uint8_t value) {
+    uint8_t *pixelsUsed = checker->pixelsUsed[page];
+    for (uint32_t y = rect->origin.y; y < (uint32_t)rect->origin.y + rect->size.height; y++) {
+        memset(&pixelsUsed[y * VC_ATLAS_TEXTURE_SIZE + rect->origin.x],
+               value,
+               rect->size.width);
+    }
+}
+
+// `sums` is `VC_ATLAS_TEXTURE_SIZE + 1` entries square, with a row and column of zeroes first.
+static void VCAtlasPackerTool_SumTable(uint32_t *sums) {
+    const uint32_t stride = VC_ATLAS_TEXTURE_SIZE + 1;
+    for (uint32_t y = 1; y < stride; y++) {
+        for (uint32_t x = 1; x < stride; x++) {
+            sums[y * stride + x] += sums[(y - 1) * stride + x] + sums[y * stride + x - 1] -
+                sums[(y - 1) * stride + x - 1];
+        }
+    }
+}
+
+// The sum over a rectangle, which may lie partly outside the page; that part counts as used.
+static uint32_t VCAtlasPackerTool_SumRect(uint32_t *sums,
+                                          int32_t x0,
+                                          int32_t y0,
+                                          int32_t x1,
+                                          int32_t y1) {
+    if (x0 < 0 || y0 < 0 || x1 > VC_ATLAS_TEXTURE_SIZE || y1 > VC_ATLAS_TEXTURE_SIZE)
+        return 1;
+    const uint32_t stride = VC_ATLAS_TEXTURE_SIZE + 1;
+    return sums[y1 * stride + x1] - sums[y0 * stride + x1] - sums[y1 * stride + x0] +
+        sums[y0 * stride + x0];
+}
+
+// Checks that every free rectangle of the page is free, that together they cover all the free
+// pixels, and that MaxRects rectangles are maximal and guillotine ones disjoint. Prints what's
+// wrong and returns false if any of that doesn't hold.
+static bool VCAtlasPackerTool_CheckPage(VCAtlasPackerToolChecker *checker,
+                                        VCAtlasPage *page,
+                                        uint8_t pageIndex,
+                                        size_t eventIndex) {
+    const uint32_t stride = VC_ATLAS_TEXTURE_SIZE + 1;
+    uint32_t *sums = checker->sums;
+    uint8_t *pixelsUsed = checker->pixelsUsed[pageIndex];
+    memset(sums, '\0', sizeof(uint32_t) * stride * stride);
+    for (uint32_t y = 0; y < VC_ATLAS_TEXTURE_SIZE; y++) {
+        for (uint32_t x = 0; x < VC_ATLAS_TEXTURE_SIZE; x++)
+            sums[(y + 1) * stride + x + 1] = pixelsUsed[y * VC_ATLAS_TEXTURE_SIZE + x];
+    }
+    VCAtlasPackerTool_SumTable(sums);
+
+    const char *problem = NULL;
+    size_t problemRect = 0;
+    for (size_t i = 0; i < page->freeListSize && problem == NULL; i++) {
+        VCRectus *rect = &page->freeList[i];
+        int32_t x0 = rect->origin.x, y0 = rect->origin.y;
+        int32_t x1 = x0 + rect->size.width, y1 = y0 + rect->size.height;
+        problemRect = i;
+        if (rect->size.width == 0 || rect->size.height == 0) {
+            problem = "is empty";
+        } else if (VCAtlasPackerTool_SumRect(sums, x0, y0, x1, y1) != 0) {
+            problem = "overlaps a live allocation or leaves the page";
+        } else if (page->packer == VC_ATLAS_PACKER_MAXRECTS &&
+                   (VCAtlasPackerTool_SumRect(sums, x0 - 1, y0, x0, y1) == 0 ||
+                    VCAtlasPackerTool_SumRect(sums, x1, y0, x1 + 1, y1) == 0 ||
+                    VCAtlasPackerTool_SumRect(sums, x0, y0 - 1, x1, y0) == 0 ||
+                    VCAtlasPackerTool_SumRect(sums, x0, y1, x1, y1 + 1) == 0)) {
+            problem = "isn't maximal";
+        }
+        for (size_t j = 0; j < page->freeListSize && problem == NULL; j++) {
+            if (j == i)
+                continue;
+            if (page->packer == VC_ATLAS_PACKER_MAXRECTS &&
+                    VCRectus_Contains(&page->freeList[j], rect)) {
+                problem = "is contained in another free rectangle";
+            } else if (page->packer == VC_ATLAS_PACKER_GUILLOTINE &&
+                       VCRectus_Intersects(&page->freeList[j], rect)) {
+                problem = "overlaps another free rectangle";
+            }
+        }
+    }
+    if (problem != NULL) {
+        VCRectus *rect = &page->freeList[problemRect];
+        fprintf(stderr,
+                "vcatlaspack: after event %zu, free rectangle %u,%u %ux%u of page %u %s\n",
+                eventIndex + 1,
+                (unsigned)rect->origin.x,
+                (unsigned)rect->origin.y,
+                (unsigned)rect->size.width,
+                (unsigned)rect->size.height,
+                (unsigned)pageIndex,
+                problem);
+        return false;
+    }
+
+    // Count how many free rectangles cover each pixel by summing deltas at their corners. Deltas
+    // past the far edge of the page would only affect pixels off it, so they're left out.
+    memset(sums, '\0', sizeof(uint32_t) * stride * stride);
+    for (size_t i = 0; i < page->freeListSize; i++) {
+        VCRectus *rect = &page->freeList[i];
+        uint32_t x0 = rect->origin.x + 1, y0 = rect->origin.y + 1;
+        uint32_t x1 = x0 + rect->size.width, y1 = y0 + rect->size.height;
+        sums[y0 * stride + x0]++;
+        if (x1 < stride)
+            sums[y0 * stride + x1]--;
+        if (y1 < stride)
+            sums[y1 * stride + x0]--;
+        if (x1 < stride && y1 < stride)
+            sums[y1 * stride + x1]++;
+    }
+    VCAtlasPackerTool_SumTable(sums);
+    for (uint32_t y = 0; y < VC_ATLAS_TEXTURE_SIZE; y++) {
+        for (uint32_t x = 0; x < VC_ATLAS_TEXTURE_SIZE; x++) {
+            if (pixelsUsed[y * VC_ATLAS_TEXTURE_SIZE + x] == 0 &&
+                    sums[(y + 1) * stride + x + 1] == 0) {
+                fprintf(stderr,
+                        "vcatlaspack: after event %zu, free pixel %u,%u of page %u isn't in the "
+                        "free list\n",
+                        eventIndex + 1,
+                        (unsigned)x,
+                        (unsigned)y,
+                        (unsigned)pageIndex);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Replays the trace against the packer. If `checkInterval` isn't zero, the page each event
+// touches is checked after every `checkInterval` events, and the replay stops at the first
+// problem.
+static void VCAtlasPackerTool_Replay(VCAtlasPackerToolTrace *trace,
+                                     uint8_t packer,
+                                     size_t checkInterval,
+                                     VCAtlasPackerToolResult *result) {
+    memset(result, '\0', sizeof(*result));
+    result->occupancyAtFirstFailure = -1.0;
+
+    VCAtlasPage pages[VC_ATLAS_MAX_PAGES];
+    bool pagesUsed[VC_ATLAS_MAX_PAGES] = { false };
+
+    // Where each allocation ended up, if it fit.
+    VCRectus *placements = (VCRectus *)malloc(sizeof(VCRectus) * (trace->eventsLength + 1));
+    bool *placed = (bool *)calloc(trace->eventsLength + 1, sizeof(bool));
+    if (placements == NULL || placed == NULL)
+        abort();
+
+    VCAtlasPackerToolChecker checker;
+    memset(&checker, '\0', sizeof(checker));
+    if (checkInterval != 0) {
+        checker.sums = (uint32_t *)malloc(sizeof(uint32_t) * (VC_ATLAS_TEXTURE_SIZE + 1) *
+                                          (VC_ATLAS_TEXTURE_SIZE + 1));
+        if (checker.sums == NULL)
+            abort();
+    }
+
+    for (size_t i = 0; i < trace->eventsLength && !result->checkFailed; i++) {
+        VCAtlasPackerToolEvent *event = &trace->events[i];
+        VCAtlasPage *page = &pages[event->page];
+        if (!pagesUsed[event->page]) {
+            VCAtlasPage_InitFreeList(page);
+            page->packer = packer;
+            pagesUsed[event->page] = true;
+            if (checkInterval != 0) {
+                checker.pixelsUsed[event->page] =
+                    (uint8_t *)calloc(VC_ATLAS_TEXTURE_SIZE * VC_ATLAS_TEXTURE_SIZE, 1);
+                if (checker.pixelsUsed[event->page] == NULL)
+                    abort();
+            }
+        }
+
+        double startTime = VCAtlasPackerTool_GetMicroseconds();
+        switch (event->type) {
+        case VC_ATLAS_PACKER_TOOL_EVENT_ALLOCATE:
+            placements[i].size = event->size;
+            placed[i] = VCAtlasPage_Allocate(page, &placements[i].origin, &event->size);
+            result->allocationMicroseconds += VCAtlasPackerTool_GetMicroseconds() - startTime;
+            result->allocations++;
+            if (placed[i] && checkInterval != 0)
+                VCAtlasPackerTool_MarkPixels(&checker, event->page, &placements[i], 1);
+            if (!placed[i]) {
+                if (result->failedAllocations == 0) {
+                    result->occupancyAtFirstFailure =
+                        VCAtlasPackerTool_Occupancy(pages, pagesUsed);
+                }
+                result->failedAllocations++;
+            }
+            break;
+        case VC_ATLAS_PACKER_TOOL_EVENT_FREE:
+            // Allocations that didn't fit with this packer have nothing to free.
+            if (!placed[event->allocation])
+                break;
+            VCAtlasPage_Free(page, &placements[event->allocation]);
+            result->freeMicroseconds += VCAtlasPackerTool_GetMicroseconds() - startTime;
+            placed[event->allocation] = false;
+            result->frees++;
+            if (checkInterval != 0) {
+                VCAtlasPackerTool_MarkPixels(&checker,
+                                             event->page,
+                                             &placements[event->allocation],
+                                             0);
+            }
+            break;
+        case VC_ATLAS_PACKER_TOOL_EVENT_EVICT_PAGE:
+            for (size_t j = 0; j < i; j++) {
+                if (placed[j] && trace->events[j].page == event->page)
+                    placed[j] = false;
+            }
+            free(page->freeList);
+            free(page->usedList);
+            VCAtlasPage_InitFreeList(page);
+            page->packer = packer;
+            if (checkInterval != 0) {
+                memset(checker.pixelsUsed[event->page],
+                       '\0',
+                       VC_ATLAS_TEXTURE_SIZE * VC_ATLAS_TEXTURE_SIZE);
+            }
+            break;
+        }
+
+        double occupancy = VCAtlasPackerTool_Occupancy(pages, pagesUsed);
+        if (occupancy > result->peakOccupancy)
+            result->peakOccupancy = occupancy;
+
+        if (checkInterval != 0 && ((i + 1) % checkInterval == 0 || i + 1 == trace->eventsLength)) {
+            result->checks++;
+            if (!VCAtlasPackerTool_CheckPage(&checker, page, event->page, i))
+                result->checkFailed = true;
+        }
+    }
+
+    for (uint8_t i = 0; i < VC_ATLAS_MAX_PAGES; i++) {
+        if (!pagesUsed[i])
+            continue;
+        result->freeRects += pages[i].freeListSize;
+        free(pages[i].freeList);
+        free(pages[i].usedList);
+        free(checker.pixelsUsed[i]);
+    }
+    free(checker.sums);
+    free(placements);
+    free(placed);
+}
+
+static int VCAtlasPackerTool_ReplayTrace(int argc, char **argv) {
+    VCAtlasPackerToolTrace trace = { NULL, 0, 0 };
+    if (!VCAtlasPackerTool_ReadTrace(argv[2], &trace))
+        return 1;
+
+    static const uint8_t packers[] = { VC_ATLAS_PACKER_GUILLOTINE, VC_ATLAS_PACKER_MAXRECTS };
+    static const char *packerNames[] = { "guillotine", "maxrects" };
+    printf("packer      allocations  failed  first-failure  peak-occupancy  us/alloc  us/free"
+           "  free-rects\n");
+    for (size_t i = 0; i < sizeof(packers) / sizeof(packers[0]); i++) {
+        VCAtlasPackerToolResult result;
+        VCAtlasPackerTool_Replay(&trace, packers[i], 0, &result);
+        char firstFailure[16] = "-";
+        if (result.failedAllocations != 0)
+            snprintf(firstFailure, sizeof(firstFailure), "%.1f%%", result.occupancyAtFirstFailure);
+        printf("%-10s  %11zu  %6zu  %13s  %13.1f%%  %8.3f  %7.3f  %10zu\n",
+               packerNames[i],
+               result.allocations,
+               result.failedAllocations,
+               firstFailure,
+               result.peakOccupancy,
+               result.allocations == 0 ? 0.0 :
+                   result.allocationMicroseconds / (double)result.allocations,
+               result.frees == 0 ? 0.0 : result.freeMicroseconds / (double)result.frees,
+               result.freeRects);
+    }
+    free(trace.events);
+    return 0;
+}
+
+static int VCAtlasPackerTool_CheckTrace(int argc, char **argv) {
+    size_t checkInterval = VC_ATLAS_PACKER_TOOL_DEFAULT_CHECK_INTERVAL;
+    if (argc == 4) {
+        char *end = NULL;
+        long interval = strtol(argv[3], &end, 10);
+        if (end == argv[3] || *end != '\0' || interval <= 0)
+            VCAtlasPackerTool_Usage();
+        checkInterval = (size_t)interval;
+    }
+
+    VCAtlasPackerToolTrace trace = { NULL, 0, 0 };
+    if (!VCAtlasPackerTool_ReadTrace(argv[2], &trace))
+        return 1;
+
+    static const uint8_t packers[] = { VC_ATLAS_PACKER_GUILLOTINE, VC_ATLAS_PACKER_MAXRECTS };
+    static const char *packerNames[] = { "guillotine", "maxrects" };
+    int status = 0;
+    for (size_t i = 0; i < sizeof(packers) / sizeof(packers[0]); i++) {
+        VCAtlasPackerToolResult result;
+        double startTime = VCAtlasPackerTool_GetMicroseconds();
+        VCAtlasPackerTool_Replay(&trace, packers[i], checkInterval, &result);
+        double seconds = (VCAtlasPackerTool_GetMicroseconds() - startTime) / 1000000.0;
+        printf("%-10s  %s after %zu checks, %zu allocations and %zu frees (%.2fs)\n",
+               packerNames[i],
+               result.checkFailed ? "FAILED" : "ok",
+               result.checks,
+               result.allocations,
+               result.frees,
+               seconds);
+        if (result.checkFailed)
+            status = 1;
+    }
+    free(trace.events);
+    return status;
+}
+
+// xorshift32, so that a seed gives the same trace everywhere.
+static uint32_t VCAtlasPackerTool_Random(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// Writes a trace of allocations of random sizes into page 0, each followed by a free of a random
+// live allocation with the given probability.
+static int VCAtlasPackerTool_RandomTrace(int argc, char **argv) {
+    char *end = NULL;
+    long allocationCount = strtol(argv[2], &end, 10);
+    if (end == argv[2] || *end != '\0' || allocationCount <= 0)
+        VCAtlasPackerTool_Usage();
+    long freePercent = 0;
+    if (argc >= 4) {
+        freePercent = strtol(argv[3], &end, 10);
+        if (end == argv[3] || *end != '\0' || freePercent < 0 || freePercent > 100)
+            VCAtlasPackerTool_Usage();
+    }
+    uint32_t state = VC_ATLAS_PACKER_TOOL_DEFAULT_SEED;
+    if (argc == 5) {
+        state = (uint32_t)strtoul(argv[4], &end, 10);
+        if (end == argv[4] || *end != '\0' || state == 0)
+            VCAtlasPackerTool_Usage();
+    }
+
+    uint32_t *liveIDs = (uint32_t *)malloc(sizeof(uint32_t) * allocationCount);
+    if (liveIDs == NULL)
+        abort();
+    size_t liveIDsLength = 0;
+    uint32_t sizeRange = VC_ATLAS_PACKER_TOOL_MAX_RANDOM_SIZE -
+        VC_ATLAS_PACKER_TOOL_MIN_RANDOM_SIZE + 1;
+    for (uint32_t id = 0; id < (uint32_t)allocationCount; id++) {
+        uint32_t width = VC_ATLAS_PACKER_TOOL_MIN_RANDOM_SIZE +
+            VCAtlasPackerTool_Random(&state) % sizeRange;
+        uint32_t height = VC_ATLAS_PACKER_TOOL_MIN_RANDOM_SIZE +
+            VCAtlasPackerTool_Random(&state) % sizeRange;
+        printf("a 0 %u %u %u\n", id, width, height);
+        liveIDs[liveIDsLength++] = id;
+
+        if (VCAtlasPackerTool_Random(&state) % 100 < (uint32_t)freePercent) {
+            size_t index = VCAtlasPackerTool_Random(&state) % liveIDsLength;
+            printf("f 0 %u\n", liveIDs[index]);
+            liveIDs[index] = liveIDs[--liveIDsLength];
+        }
+    }
+    free(liveIDs);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3 && strcmp(argv[1], "replay") == 0)
+        return VCAtlasPackerTool_ReplayTrace(argc, argv);
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "check") == 0)
+        return VCAtlasPackerTool_CheckTrace(argc, argv);
+    if (argc >= 3 && argc <= 5 && strcmp(argv[1], "random") == 0)
+        return VCAtlasPackerTool_RandomTrace(argc, argv);
+    VCAtlasPackerTool_Usage();
+    return 1;
+}
@@ -2,8 +2,9 @@
 //
 // Copyright (c) 2016 The mupen64plus-video-videocore Authors
 
-#include "Combiner.h"
+#include <string.h>
 #include "GBI.h"
+#include "gDP.h"
 #include "VCCombiner.h"
 
 #if 0
@@ -145,57 +146,104 @@ static const char *aAText[] =
 	"SHADE",			"ENVIRONMENT",		"1",				"0",
 };
 
-void VCCombiner_UnpackCurrentRGBCombiner(VCUnpackedCombiner *cycle0, VCUnpackedCombiner *cycle1) {
-    switch (gDP.otherMode.cycleType) {
+// Unpacks the combiner modes packed in `muxs0` and `muxs1`, as `gDPSetCombine` receives them, for
+// both cycles. Copy and fill mode ignore the combiner.
+void VCCombiner_UnpackCombiner(uint32_t muxs0,
+                               uint32_t muxs1,
+                               uint32_t cycleType,
+                               VCUnpackedCombiner *cycle0,
+                               VCUnpackedCombiner *cycle1) {
+    switch (cycleType) {
     case G_CYC_COPY:
         cycle0->saRGB = cycle1->saRGB = VC_COMBINER_CCMUX_0;
         cycle0->sbRGB = cycle1->sbRGB = VC_COMBINER_CCMUX_0;
         cycle0->mRGB = cycle1->mRGB = VC_COMBINER_CCMUX_0;
         cycle0->aRGB = cycle1->aRGB = VC_COMBINER_CCMUX_TEXEL0;
-        return;
-    case G_CYC_FILL:
-        cycle0->saRGB = cycle1->saRGB = VC_COMBINER_CCMUX_0;
-        cycle0->sbRGB = cycle1->sbRGB = VC_COMBINER_CCMUX_0;
-        cycle0->mRGB = cycle1->mRGB = VC_COMBINER_CCMUX_0;
-        cycle0->aRGB = cycle1->aRGB = VC_COMBINER_CCMUX_SHADE;
-        return;
-    default:
-        cycle0->saRGB = saRGBMapping[gDP.combine.saRGB0];
-        cycle0->sbRGB = sbRGBMapping[gDP.combine.sbRGB0];
-        cycle0->mRGB = mRGBMapping[gDP.combine.mRGB0];
-        cycle0->aRGB = aRGBMapping[gDP.combine.aRGB0];
-
-        cycle1->saRGB = saRGBMapping[gDP.combine.saRGB1];
-        cycle1->sbRGB = sbRGBMapping[gDP.combine.sbRGB1];
-        cycle1->mRGB = mRGBMapping[gDP.combine.mRGB1];
-        cycle1->aRGB = aRGBMapping[gDP.combine.aRGB1];
-    }
-}
-
-void VCCombiner_UnpackCurrentACombiner(VCUnpackedCombiner *cycle0, VCUnpackedCombiner *cycle1) {
-    switch (gDP.otherMode.cycleType) {
-    case G_CYC_COPY:
         cycle0->saA = cycle1->saA = VC_COMBINER_ACMUX_0;
         cycle0->sbA = cycle1->sbA = VC_COMBINER_ACMUX_0;
         cycle0->mA = cycle1->mA = VC_COMBINER_ACMUX_0;
         cycle0->aA = cycle1->aA = VC_COMBINER_ACMUX_TEXEL0;
         return;
     case G_CYC_FILL:
+        cycle0->saRGB = cycle1->saRGB = VC_COMBINER_CCMUX_0;
+        cycle0->sbRGB = cycle1->sbRGB = VC_COMBINER_CCMUX_0;
+        cycle0->mRGB = cycle1->mRGB = VC_COMBINER_CCMUX_0;
+        cycle0->aRGB = cycle1->aRGB = VC_COMBINER_CCMUX_SHADE;
         cycle0->saA = cycle1->saA = VC_COMBINER_ACMUX_0;
         cycle0->sbA = cycle1->sbA = VC_COMBINER_ACMUX_0;
         cycle0->mA = cycle1->mA = VC_COMBINER_ACMUX_0;
         cycle0->aA = cycle1->aA = VC_COMBINER_ACMUX_1;
         return;
-    default:
-        cycle0->saA = saAMapping[gDP.combine.saA0];
-        cycle0->sbA = sbAMapping[gDP.combine.sbA0];
-        cycle0->mA = mAMapping[gDP.combine.mA0];
-        cycle0->aA = aAMapping[gDP.combine.aA0];
-
-        cycle1->saA = saAMapping[gDP.combine.saA1];
-        cycle1->sbA = sbAMapping[gDP.combine.sbA1];
-        cycle1->mA = mAMapping[gDP.combine.mA1];
-        cycle1->aA = aAMapping[gDP.combine.aA1];
     }
+
+    gDPCombine combine;
+    combine.muxs0 = muxs0;
+    combine.muxs1 = muxs1;
+
+    cycle0->saRGB = saRGBMapping[combine.saRGB0];
+    cycle0->sbRGB = sbRGBMapping[combine.sbRGB0];
+    cycle0->mRGB = mRGBMapping[combine.mRGB0];
+    cycle0->aRGB = aRGBMapping[combine.aRGB0];
+    cycle0->saA = saAMapping[combine.saA0];
+    cycle0->sbA = sbAMapping[combine.sbA0];
+    cycle0->mA = mAMapping[combine.mA0];
+    cycle0->aA = aAMapping[combine.aA0];
+
+    cycle1->saRGB = saRGBMapping[combine.saRGB1];
+    cycle1->sbRGB = sbRGBMapping[combine.sbRGB1];
+    cycle1->mRGB = mRGBMapping[combine.mRGB1];
+    cycle1->aRGB = aRGBMapping[combine.aRGB1];
+    cycle1->saA = saAMapping[combine.saA1];
+    cycle1->sbA = sbAMapping[combine.sbA1];
+    cycle1->mA = mAMapping[combine.mA1];
+    cycle1->aA = aAMapping[combine.aA1];
+}
+
+static const char *cycleTypeNames[] = { "1cycle", "2cycle", "copy", "fill" };
+
+static const char *triangleModeNames[] = { "normal", "texrect", "rectfill" };
+
+static bool VCCombiner_ParseName(const char *string,
+                                 const char **names,
+                                 size_t nameCount,
+                                 uint32_t *value) {
+    for (size_t nameIndex = 0; nameIndex < nameCount; nameIndex++) {
+        if (strcmp(string, names[nameIndex]) == 0) {
+            *value = (uint32_t)nameIndex;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Parses a combiner mode line, as `VCCombiner_WriteMode` writes them: `MUXS0 MUXS1 CYCLE-TYPE
+// [TRIANGLE-MODE]`, with the mux words in hex. The triangle mode defaults to `normal`.
+bool VCCombiner_ParseMode(const char *line, VCCombinerMode *mode) {
+    unsigned muxs0, muxs1;
+    char cycleTypeName[16], triangleModeName[16] = "normal";
+    int fieldCount = sscanf(line,
+                            "%x %x %15s %15s",
+                            &muxs0,
+                            &muxs1,
+                            cycleTypeName,
+                            triangleModeName);
+    uint32_t triangleMode;
+    if (fieldCount < 3 ||
+            !VCCombiner_ParseName(cycleTypeName, cycleTypeNames, 4, &mode->cycleType) ||
+            !VCCombiner_ParseName(triangleModeName, triangleModeNames, 3, &triangleMode)) {
+        return false;
+    }
+    mode->muxs0 = muxs0;
+    mode->muxs1 = muxs1;
+    mode->triangleMode = (uint8_t)triangleMode;
+    return true;
 }
 
+void VCCombiner_WriteMode(FILE *file, VCCombinerMode *mode) {
+    fprintf(file,
+            "%08x %08x %-6s %-8s",
+            mode->muxs0,
+            mode->muxs1,
+            cycleTypeNames[mode->cycleType & 3],
+            triangleModeNames[mode->triangleMode < 3 ? mode->triangleMode : 0]);
+}
@@ -6,6 +6,7 @@
 #define VCCOMBINER_H
 
 #include <stdint.h>
+#include <stdio.h>
 
 #define VC_COMBINER_CCMUX_COMBINED		0
 #define VC_COMBINER_CCMUX_TEXEL0			1
@@ -54,8 +55,22 @@ struct VCUnpackedCombiner {
     uint8_t aA;
 };
 
-void VCCombiner_UnpackCurrentRGBCombiner(VCUnpackedCombiner *cycle0, VCUnpackedCombiner *cycle1);
-void VCCombiner_UnpackCurrentACombiner(VCUnpackedCombiner *cycle0, VCUnpackedCombiner *cycle1);
+// A combiner mode as `gDPSetCombine` and the cycle type set it, and the triangle mode it's drawn
+// with (one of `VC_TRIANGLE_MODE_*`).
+struct VCCombinerMode {
+    uint32_t muxs0;
+    uint32_t muxs1;
+    uint32_t cycleType;
+    uint8_t triangleMode;
+};
+
+bool VCCombiner_ParseMode(const char *line, VCCombinerMode *mode);
+void VCCombiner_WriteMode(FILE *file, VCCombinerMode *mode);
+void VCCombiner_UnpackCombiner(uint32_t muxs0,
+                               uint32_t muxs1,
+                               uint32_t cycleType,
+                               VCUnpackedCombiner *cycle0,
+                               VCUnpackedCombiner *cycle1);
 
 #if 0
 void VCCombiner_FillCombiner(VCCombiner *combiner, VCColorf *shade);
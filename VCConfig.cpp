@@ -11,17 +11,54 @@
 #include <stdlib.h>
 #include <string.h>
 #include "VCConfig.h"
+#include "VCShaderCompiler.h"
 #include "VCUtils.h"
 #include "toml.h"
 
 #define VC_DEFAULT_DISPLAY_WIDTH        1920
 #define VC_DEFAULT_DISPLAY_HEIGHT       1080
 #define VC_DEFAULT_DEBUG_DISPLAY        false
+#define VC_DEFAULT_DEBUG_ATLAS_HEATMAP_INTERVAL 0
+#define VC_DEFAULT_DEBUG_COMBINER_LOG   ""
+#define VC_DEFAULT_DEBUG_ATLAS_TRACE    ""
+#define VC_DEFAULT_TEXTURE_DECODE_THREADS   2
+#define VC_DEFAULT_GPU_TEXTURE_DECODE_FORMATS   ""
+#define VC_DEFAULT_MAX_ATLAS_PAGES      4
+#define VC_DEFAULT_ATLAS_PACKER         "maxrects"
+#define VC_DEFAULT_TEXTURE_CACHE_SIZE_KB    4096
+#define VC_DEFAULT_RETAIN_DECODED_PIXELS    true
+#define VC_DEFAULT_DISK_TEXTURE_CACHE       false
+#define VC_DEFAULT_DISK_TEXTURE_CACHE_SIZE_MB   256
+#define VC_DEFAULT_HD_TEXTURE_DIRECTORY     ""
+#define VC_DEFAULT_HD_TEXTURE_MAX_SIZE      512
+#define VC_DEFAULT_DISK_SHADER_CACHE        true
+#define VC_DEFAULT_ASYNC_SHADER_COMPILE     true
+#define VC_DEFAULT_FOLD_COMBINER_COLORS     true
+#define VC_DEFAULT_MAX_SUBPROGRAMS_PER_PROGRAM  8
+#define VC_DEFAULT_SHADER_OVERRIDE_DIRECTORY    ""
 
 static VCConfig sharedConfig = {
     VC_DEFAULT_DISPLAY_WIDTH,
     VC_DEFAULT_DISPLAY_HEIGHT,
     VC_DEFAULT_DEBUG_DISPLAY,
+    VC_DEFAULT_DEBUG_ATLAS_HEATMAP_INTERVAL,
+    (char *)VC_DEFAULT_DEBUG_COMBINER_LOG,
+    (char *)VC_DEFAULT_DEBUG_ATLAS_TRACE,
+    VC_DEFAULT_TEXTURE_DECODE_THREADS,
+    (char *)VC_DEFAULT_GPU_TEXTURE_DECODE_FORMATS,
+    VC_DEFAULT_MAX_ATLAS_PAGES,
+    (char *)VC_DEFAULT_ATLAS_PACKER,
+    VC_DEFAULT_TEXTURE_CACHE_SIZE_KB,
+    VC_DEFAULT_RETAIN_DECODED_PIXELS,
+    VC_DEFAULT_DISK_TEXTURE_CACHE,
+    VC_DEFAULT_DISK_TEXTURE_CACHE_SIZE_MB,
+    (char *)VC_DEFAULT_HD_TEXTURE_DIRECTORY,
+    VC_DEFAULT_HD_TEXTURE_MAX_SIZE,
+    VC_DEFAULT_DISK_SHADER_CACHE,
+    VC_DEFAULT_ASYNC_SHADER_COMPILE,
+    VC_DEFAULT_FOLD_COMBINER_COLORS,
+    VC_DEFAULT_MAX_SUBPROGRAMS_PER_PROGRAM,
+    (char *)VC_DEFAULT_SHADER_OVERRIDE_DIRECTORY,
 };
 
 VCConfig *VCConfig_SharedConfig() {
@@ -117,5 +154,73 @@ void VCConfig_Read(VCConfig *config) {
     config->debugDisplay = VCConfig_GetBool(topValue,
                                             "debug.display",
                                             VC_DEFAULT_DEBUG_DISPLAY);
+    config->debugAtlasHeatmapInterval = VCConfig_GetInt(topValue,
+                                                        "debug.atlasHeatmapInterval",
+                                                        VC_DEFAULT_DEBUG_ATLAS_HEATMAP_INTERVAL);
+    if (config->debugAtlasHeatmapInterval < 0)
+        config->debugAtlasHeatmapInterval = 0;
+    config->debugCombinerLog = VCConfig_GetString(topValue,
+                                                  "debug.combinerLog",
+                                                  VC_DEFAULT_DEBUG_COMBINER_LOG);
+    config->debugAtlasTrace = VCConfig_GetString(topValue,
+                                                 "debug.atlasTrace",
+                                                 VC_DEFAULT_DEBUG_ATLAS_TRACE);
+    config->textureDecodeThreads = VCConfig_GetInt(topValue,
+                                                   "textures.decodeThreads",
+                                                   VC_DEFAULT_TEXTURE_DECODE_THREADS);
+    if (config->textureDecodeThreads < 0)
+        config->textureDecodeThreads = 0;
+    config->gpuTextureDecodeFormats = VCConfig_GetString(topValue,
+                                                         "textures.gpuDecodeFormats",
+                                                         VC_DEFAULT_GPU_TEXTURE_DECODE_FORMATS);
+    config->maxAtlasPages = VCConfig_GetInt(topValue,
+                                            "textures.maxAtlasPages",
+                                            VC_DEFAULT_MAX_ATLAS_PAGES);
+    config->atlasPacker = VCConfig_GetString(topValue,
+                                             "textures.atlasPacker",
+                                             VC_DEFAULT_ATLAS_PACKER);
+    config->textureCacheSizeKB = VCConfig_GetInt(topValue,
+                                                 "textures.cacheSizeKB",
+                                                 VC_DEFAULT_TEXTURE_CACHE_SIZE_KB);
+    if (config->textureCacheSizeKB < 0)
+        config->textureCacheSizeKB = 0;
+    config->retainDecodedPixels = VCConfig_GetBool(topValue,
+                                                   "textures.retainDecodedPixels",
+                                                   VC_DEFAULT_RETAIN_DECODED_PIXELS);
+    config->diskTextureCache = VCConfig_GetBool(topValue,
+                                                "textures.diskCache",
+                                                VC_DEFAULT_DISK_TEXTURE_CACHE);
+    config->diskTextureCacheSizeMB = VCConfig_GetInt(topValue,
+                                                     "textures.diskCacheSizeMB",
+                                                     VC_DEFAULT_DISK_TEXTURE_CACHE_SIZE_MB);
+    if (config->diskTextureCacheSizeMB < 0)
+        config->diskTextureCacheSizeMB = 0;
+    config->hdTextureDirectory = VCConfig_GetString(topValue,
+                                                    "textures.hdTextureDirectory",
+                                                    VC_DEFAULT_HD_TEXTURE_DIRECTORY);
+    config->hdTextureMaxSize = VCConfig_GetInt(topValue,
+                                               "textures.hdMaxSize",
+                                               VC_DEFAULT_HD_TEXTURE_MAX_SIZE);
+    if (config->hdTextureMaxSize < 1)
+        config->hdTextureMaxSize = 1;
+    config->diskShaderCache = VCConfig_GetBool(topValue,
+                                               "shaders.diskCache",
+                                               VC_DEFAULT_DISK_SHADER_CACHE);
+    config->asyncShaderCompile = VCConfig_GetBool(topValue,
+                                                  "shaders.asyncCompile",
+                                                  VC_DEFAULT_ASYNC_SHADER_COMPILE);
+    config->foldCombinerColors = VCConfig_GetBool(topValue,
+                                                  "shaders.foldConstantColors",
+                                                  VC_DEFAULT_FOLD_COMBINER_COLORS);
+    config->maxSubprogramsPerProgram = VCConfig_GetInt(topValue,
+                                                       "shaders.maxSubprogramsPerProgram",
+                                                       VC_DEFAULT_MAX_SUBPROGRAMS_PER_PROGRAM);
+    if (config->maxSubprogramsPerProgram < 1)
+        config->maxSubprogramsPerProgram = 1;
+    if (config->maxSubprogramsPerProgram > VC_SHADER_MAX_SUBPROGRAMS_PER_PROGRAM)
+        config->maxSubprogramsPerProgram = VC_SHADER_MAX_SUBPROGRAMS_PER_PROGRAM;
+    config->shaderOverrideDirectory = VCConfig_GetString(topValue,
+                                                         "shaders.overrideDirectory",
+                                                         VC_DEFAULT_SHADER_OVERRIDE_DIRECTORY);
 }
 
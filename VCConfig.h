@@ -9,6 +9,24 @@ struct VCConfig {
     int displayWidth;
     int displayHeight;
     bool debugDisplay;
+    int debugAtlasHeatmapInterval;
+    char *debugCombinerLog;
+    char *debugAtlasTrace;
+    int textureDecodeThreads;
+    char *gpuTextureDecodeFormats;
+    int maxAtlasPages;
+    char *atlasPacker;
+    int textureCacheSizeKB;
+    bool retainDecodedPixels;
+    bool diskTextureCache;
+    int diskTextureCacheSizeMB;
+    char *hdTextureDirectory;
+    int hdTextureMaxSize;
+    bool diskShaderCache;
+    bool asyncShaderCompile;
+    bool foldCombinerColors;
+    int maxSubprogramsPerProgram;
+    char *shaderOverrideDirectory;
 };
 
 VCConfig *VCConfig_SharedConfig();
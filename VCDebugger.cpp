@@ -20,7 +20,7 @@
 #define CELL_WIDTH                  12
 #define GLYPHS_PER_FONT             100
 
-#define DEBUG_COUNTERS              7
+#define DEBUG_COUNTERS              29
 #define TAB_STOP                    24
 #define WINDOW_WIDTH                82
 
@@ -224,9 +224,32 @@ void VCDebugger_Init(VCDebugger *debugger, VCRenderer *renderer) {
     VCDebugger_InitStat(&debugger->stats.batches);
     VCDebugger_InitStat(&debugger->stats.texturesUploaded);
     VCDebugger_InitStat(&debugger->stats.programsCreated);
+    VCDebugger_InitStat(&debugger->stats.ubershaderBatches);
+    VCDebugger_InitStat(&debugger->stats.programsCreatedPerMinute);
+    VCDebugger_InitStat(&debugger->stats.programsReusedPerMinute);
+    VCDebugger_InitStat(&debugger->stats.combinerStates);
+    VCDebugger_InitStat(&debugger->stats.subprograms);
+    VCDebugger_InitStat(&debugger->stats.programsResident);
     VCDebugger_InitStat(&debugger->stats.prepareTime);
     VCDebugger_InitStat(&debugger->stats.drawTime);
     VCDebugger_InitStat(&debugger->stats.viRate);
+    VCDebugger_InitStat(&debugger->stats.atlasOccupancyRGBA8888);
+    VCDebugger_InitStat(&debugger->stats.atlasOccupancyRGBA4444);
+    VCDebugger_InitStat(&debugger->stats.atlasOccupancyRGBA5551);
+    VCDebugger_InitStat(&debugger->stats.atlasOccupancyHD);
+    VCDebugger_InitStat(&debugger->stats.atlasPages);
+    VCDebugger_InitStat(&debugger->stats.atlasPageEvictions);
+    VCDebugger_InitStat(&debugger->stats.textureKBResident);
+    VCDebugger_InitStat(&debugger->stats.textureUploadCalls);
+    VCDebugger_InitStat(&debugger->stats.textureUploadBytes);
+    VCDebugger_InitStat(&debugger->stats.textureDecodeMicroseconds);
+    VCDebugger_InitStat(&debugger->stats.texturePackHits);
+    VCDebugger_InitStat(&debugger->stats.atlasKBAllocated);
+    VCDebugger_InitStat(&debugger->stats.atlasKBBorders);
+    VCDebugger_InitStat(&debugger->stats.atlasLargestFreeKpx);
+    VCDebugger_InitStat(&debugger->stats.atlasFreeRects);
+    VCDebugger_InitStat(&debugger->stats.atlasClearsPerMinute);
+    VCDebugger_InitStat(&debugger->stats.atlasTextureEvictions);
 
     VCDebugger_ResetVertices(debugger);
 
@@ -455,6 +478,50 @@ void VCDebugger_DrawDebugOverlay(VCDebugger *debugger, const VCSize2u *windowSiz
                              3,
                              5,
                              &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "uber draws",
+                             VCDebugger_MovingAverageOfStat(debugger,
+                                                            &debugger->stats.ubershaderBatches),
+                             1,
+                             10,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "shaders new/min",
+                             VCDebugger_MovingAverageOfStat(
+                                 debugger,
+                                 &debugger->stats.programsCreatedPerMinute),
+                             10,
+                             30,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "shaders reused/min",
+                             VCDebugger_MovingAverageOfStat(
+                                 debugger,
+                                 &debugger->stats.programsReusedPerMinute),
+                             10,
+                             30,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "combiner states",
+                             VCDebugger_MovingAverageOfStat(debugger,
+                                                            &debugger->stats.combinerStates),
+                             256,
+                             1024,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "subprograms",
+                             VCDebugger_MovingAverageOfStat(debugger,
+                                                            &debugger->stats.subprograms),
+                             128,
+                             512,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "shaders resident",
+                             VCDebugger_MovingAverageOfStat(debugger,
+                                                            &debugger->stats.programsResident),
+                             48,
+                             64,
+                             &position);
     VCDebugger_DrawDebugStat(debugger,
                              "draw calls",
                              VCDebugger_MovingAverageOfStat(debugger,
@@ -469,6 +536,141 @@ void VCDebugger_DrawDebugOverlay(VCDebugger *debugger, const VCSize2u *windowSiz
                              3000,
                              4000,
                              &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "% atlas 8888",
+                             VCDebugger_MovingAverageOfStat(
+                                 debugger,
+                                 &debugger->stats.atlasOccupancyRGBA8888),
+                             75,
+                             90,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "% atlas 4444",
+                             VCDebugger_MovingAverageOfStat(
+                                 debugger,
+                                 &debugger->stats.atlasOccupancyRGBA4444),
+                             75,
+                             90,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "% atlas 5551",
+                             VCDebugger_MovingAverageOfStat(
+                                 debugger,
+                                 &debugger->stats.atlasOccupancyRGBA5551),
+                             75,
+                             90,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "% atlas HD",
+                             VCDebugger_MovingAverageOfStat(
+                                 debugger,
+                                 &debugger->stats.atlasOccupancyHD),
+                             75,
+                             90,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "atlas pages",
+                             VCDebugger_MovingAverageOfStat(debugger,
+                                                            &debugger->stats.atlasPages),
+                             8,
+                             12,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "page evictions",
+                             VCDebugger_MovingAverageOfStat(
+                                 debugger,
+                                 &debugger->stats.atlasPageEvictions),
+                             1,
+                             2,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "page clears/min",
+                             VCDebugger_MovingAverageOfStat(
+                                 debugger,
+                                 &debugger->stats.atlasClearsPerMinute),
+                             2,
+                             10,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "texture evictions",
+                             VCDebugger_MovingAverageOfStat(
+                                 debugger,
+                                 &debugger->stats.atlasTextureEvictions),
+                             7,
+                             15,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "KB atlas used",
+                             VCDebugger_MovingAverageOfStat(
+                                 debugger,
+                                 &debugger->stats.atlasKBAllocated),
+                             8192,
+                             12288,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "KB atlas borders",
+                             VCDebugger_MovingAverageOfStat(
+                                 debugger,
+                                 &debugger->stats.atlasKBBorders),
+                             512,
+                             1024,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "Kpx largest free",
+                             VCDebugger_MovingAverageOfStat(
+                                 debugger,
+                                 &debugger->stats.atlasLargestFreeKpx),
+                             -64,
+                             -16,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "free rects",
+                             VCDebugger_MovingAverageOfStat(
+                                 debugger,
+                                 &debugger->stats.atlasFreeRects),
+                             256,
+                             1024,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "KB textures",
+                             VCDebugger_MovingAverageOfStat(
+                                 debugger,
+                                 &debugger->stats.textureKBResident),
+                             3072,
+                             4096,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "texture uploads",
+                             VCDebugger_MovingAverageOfStat(
+                                 debugger,
+                                 &debugger->stats.textureUploadCalls),
+                             7,
+                             15,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "KB uploaded",
+                             VCDebugger_MovingAverageOfStat(
+                                 debugger,
+                                 &debugger->stats.textureUploadBytes) / 1024,
+                             256,
+                             1024,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "us decoding",
+                             VCDebugger_MovingAverageOfStat(
+                                 debugger,
+                                 &debugger->stats.textureDecodeMicroseconds),
+                             2000,
+                             8000,
+                             &position);
+    VCDebugger_DrawDebugStat(debugger,
+                             "disk texture hits",
+                             VCDebugger_MovingAverageOfStat(
+                                 debugger,
+                                 &debugger->stats.texturePackHits),
+                             7,
+                             15,
+                             &position);
     VCDebugger_DrawVertices(debugger);
 }
 
@@ -484,9 +686,32 @@ void VCDebugger_NewFrame(VCDebugger *debugger) {
         VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.batches);
         VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.texturesUploaded);
         VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.programsCreated);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.ubershaderBatches);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.programsCreatedPerMinute);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.programsReusedPerMinute);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.combinerStates);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.subprograms);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.programsResident);
         VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.prepareTime);
         VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.drawTime);
         VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.viRate);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.atlasOccupancyRGBA8888);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.atlasOccupancyRGBA4444);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.atlasOccupancyRGBA5551);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.atlasOccupancyHD);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.atlasPages);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.atlasPageEvictions);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.textureKBResident);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.textureUploadCalls);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.textureUploadBytes);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.textureDecodeMicroseconds);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.texturePackHits);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.atlasKBAllocated);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.atlasKBBorders);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.atlasLargestFreeKpx);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.atlasFreeRects);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.atlasClearsPerMinute);
+        VCDebugger_AdvanceSampleWindow(debugger, &debugger->stats.atlasTextureEvictions);
     }
 }
 
@@ -500,3 +725,8 @@ void VCDebugger_IncrementSample(VCDebugger *debugger, VCDebugStat *stat) {
     stat->sum++;
 }
 
+void VCDebugger_AddToSample(VCDebugger *debugger, VCDebugStat *stat, uint32_t amount) {
+    stat->samples[debugger->stats.sampleCount % VC_SAMPLES_IN_WINDOW] += amount;
+    stat->sum += amount;
+}
+
@@ -23,9 +23,32 @@ struct VCDebugStats {
     VCDebugStat batches;
     VCDebugStat texturesUploaded;
     VCDebugStat programsCreated;
+    VCDebugStat ubershaderBatches;
+    VCDebugStat programsCreatedPerMinute;
+    VCDebugStat programsReusedPerMinute;
+    VCDebugStat combinerStates;
+    VCDebugStat subprograms;
+    VCDebugStat programsResident;
     VCDebugStat prepareTime;
     VCDebugStat drawTime;
     VCDebugStat viRate;
+    VCDebugStat atlasOccupancyRGBA8888;
+    VCDebugStat atlasOccupancyRGBA4444;
+    VCDebugStat atlasOccupancyRGBA5551;
+    VCDebugStat atlasOccupancyHD;
+    VCDebugStat atlasPages;
+    VCDebugStat atlasPageEvictions;
+    VCDebugStat textureKBResident;
+    VCDebugStat textureUploadCalls;
+    VCDebugStat textureUploadBytes;
+    VCDebugStat textureDecodeMicroseconds;
+    VCDebugStat texturePackHits;
+    VCDebugStat atlasKBAllocated;
+    VCDebugStat atlasKBBorders;
+    VCDebugStat atlasLargestFreeKpx;
+    VCDebugStat atlasFreeRects;
+    VCDebugStat atlasClearsPerMinute;
+    VCDebugStat atlasTextureEvictions;
     uint32_t sampleCount;
 };
 
@@ -50,6 +73,7 @@ void VCDebugger_DrawDebugOverlay(VCDebugger *debugger, const VCSize2u *windowSiz
 void VCDebugger_NewFrame(VCDebugger *debugger);
 void VCDebugger_AddSample(VCDebugger *debugger, VCDebugStat *stat, uint32_t newSample);
 void VCDebugger_IncrementSample(VCDebugger *debugger, VCDebugStat *stat);
+void VCDebugger_AddToSample(VCDebugger *debugger, VCDebugStat *stat, uint32_t amount);
 
 #endif
 
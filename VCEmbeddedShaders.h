@@ -0,0 +1,21 @@
+// mupen64plus-video-videocore/VCEmbeddedShaders.h
+//
+// Copyright (c) 2016 The mupen64plus-video-videocore Authors
+
+#ifndef VCEMBEDDEDSHADERS_H
+#define VCEMBEDDEDSHADERS_H
+
+#include <stddef.h>
+
+// A shader compiled into the plugin. `VCEmbeddedShaders.cpp` is generated from the `.glsl` files by
+// the Makefile.
+struct VCEmbeddedShader {
+    const char *filename;
+    const char *source;
+};
+
+extern const VCEmbeddedShader VCEmbeddedShaders[];
+extern const size_t VCEmbeddedShaderCount;
+
+#endif
+
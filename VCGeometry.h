@@ -120,6 +120,32 @@ inline VCColor VCColor_ColorFToColor(VCColorf colorf) {
     return color;
 }
 
+inline bool VCRectus_Intersects(const VCRectus *a, const VCRectus *b) {
+    return a->origin.x < b->origin.x + b->size.width &&
+        b->origin.x < a->origin.x + a->size.width &&
+        a->origin.y < b->origin.y + b->size.height &&
+        b->origin.y < a->origin.y + a->size.height;
+}
+
+inline bool VCRectus_Contains(const VCRectus *outer, const VCRectus *inner) {
+    return inner->origin.x >= outer->origin.x &&
+        inner->origin.y >= outer->origin.y &&
+        inner->origin.x + inner->size.width <= outer->origin.x + outer->size.width &&
+        inner->origin.y + inner->size.height <= outer->origin.y + outer->size.height;
+}
+
+inline uint32_t VCRectus_IntersectionArea(const VCRectus *a, const VCRectus *b) {
+    uint32_t aRight = a->origin.x + a->size.width, aBottom = a->origin.y + a->size.height;
+    uint32_t bRight = b->origin.x + b->size.width, bBottom = b->origin.y + b->size.height;
+    uint32_t left = a->origin.x > b->origin.x ? a->origin.x : b->origin.x;
+    uint32_t top = a->origin.y > b->origin.y ? a->origin.y : b->origin.y;
+    uint32_t right = aRight < bRight ? aRight : bRight;
+    uint32_t bottom = aBottom < bBottom ? aBottom : bBottom;
+    if (right <= left || bottom <= top)
+        return 0;
+    return (right - left) * (bottom - top);
+}
+
 VCPoint3f VCPoint3f_Cross(const VCPoint3f *a, const VCPoint3f *b);
 VCPoint3f VCPoint3f_Sub(const VCPoint3f *a, const VCPoint3f *b);
 VCPoint3f VCPoint4f_Dehomogenize(const VCPoint4f *a);
@@ -0,0 +1,287 @@
+// mupen64plus-video-videocore/VCHDTexturePack.cpp
+//
+// Copyright (c) 2016 The mupen64plus-video-videocore Authors
+
+#ifdef __linux__
+#include <linux/limits.h>
+#endif
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "VCHDTexturePack.h"
+#include "stb_image.h"
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define VC_HD_TEXTURE_PACK_MAGIC    0x44484356  // "VCHD"
+#define VC_HD_TEXTURE_PACK_VERSION  1
+
+struct VCHDTexturePackHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entriesLength;
+    uint32_t reserved;
+};
+
+bool VCHDTexturePack_IsOpen(VCHDTexturePack *pack) {
+    return pack->mapping != NULL;
+}
+
+const VCHDTextureEntry *VCHDTexturePack_Find(VCHDTexturePack *pack, uint32_t key) {
+    if (!VCHDTexturePack_IsOpen(pack))
+        return NULL;
+    uint32_t low = 0, high = pack->entriesLength;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (pack->entries[middle].key < key)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    if (low < pack->entriesLength && pack->entries[low].key == key)
+        return &pack->entries[low];
+    return NULL;
+}
+
+const uint8_t *VCHDTexturePack_EntryData(VCHDTexturePack *pack, const VCHDTextureEntry *entry) {
+    return &pack->mapping[entry->offset];
+}
+
+#ifndef _WIN32
+
+// Opens `DIRECTORY/CRC1-CRC2.vchd` for the ROM with the given header, if there is one.
+bool VCHDTexturePack_OpenForROM(VCHDTexturePack *pack,
+                                const char *directory,
+                                const uint8_t *romHeader) {
+    memset(pack, '\0', sizeof(*pack));
+
+    uint32_t crc1, crc2;
+    memcpy(&crc1, &romHeader[0x10], sizeof(crc1));
+    memcpy(&crc2, &romHeader[0x14], sizeof(crc2));
+    char *path = (char *)malloc(PATH_MAX + 1);
+    if (path == NULL)
+        abort();
+    snprintf(path, PATH_MAX, "%s/%08X-%08X.vchd", directory, crc1, crc2);
+
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0)
+            close(fd);
+        free(path);
+        return false;
+    }
+
+    size_t length = (size_t)info.st_size;
+    uint8_t *mapping = NULL;
+    if (length >= sizeof(VCHDTexturePackHeader))
+        mapping = (uint8_t *)mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == NULL || mapping == MAP_FAILED) {
+        fprintf(stderr, "video warning: couldn't map HD texture pack `%s`\n", path);
+        free(path);
+        return false;
+    }
+
+    const VCHDTexturePackHeader *header = (const VCHDTexturePackHeader *)mapping;
+    size_t indexEnd = sizeof(VCHDTexturePackHeader) +
+        (size_t)header->entriesLength * sizeof(VCHDTextureEntry);
+    if (header->magic != VC_HD_TEXTURE_PACK_MAGIC ||
+            header->version != VC_HD_TEXTURE_PACK_VERSION || indexEnd > length) {
+        fprintf(stderr, "video warning: `%s` isn't a valid HD texture pack\n", path);
+        munmap(mapping, length);
+        free(path);
+        return false;
+    }
+
+    // Drop entries whose data lies outside the file rather than checking on every lookup.
+    pack->mapping = mapping;
+    pack->mappingLength = length;
+    pack->entries = (const VCHDTextureEntry *)&mapping[sizeof(VCHDTexturePackHeader)];
+    pack->entriesLength = header->entriesLength;
+    while (pack->entriesLength > 0) {
+        const VCHDTextureEntry *entry = &pack->entries[pack->entriesLength - 1];
+        if ((size_t)entry->offset + entry->length <= length)
+            break;
+        pack->entriesLength--;
+    }
+
+    fprintf(stderr,
+            "video: using %u HD textures from `%s`\n",
+            (unsigned)pack->entriesLength,
+            path);
+    free(path);
+    return true;
+}
+
+void VCHDTexturePack_Close(VCHDTexturePack *pack) {
+    if (pack->mapping != NULL)
+        munmap(pack->mapping, pack->mappingLength);
+    memset(pack, '\0', sizeof(*pack));
+}
+
+struct VCHDTextureFile {
+    VCHDTextureEntry entry;
+    char *path;
+};
+
+static int VCHDTextureFile_Compare(const void *a, const void *b) {
+    uint32_t keyA = ((const VCHDTextureFile *)a)->entry.key;
+    uint32_t keyB = ((const VCHDTextureFile *)b)->entry.key;
+    return keyA < keyB ? -1 : keyA > keyB ? 1 : 0;
+}
+
+// Parses a file name of the form `KEY.png`, where `KEY` is the texture's key in hex.
+static bool VCHDTexturePack_ParseFileName(const char *name, uint32_t *key) {
+    if (strlen(name) != 12 || strcasecmp(&name[8], ".png") != 0)
+        return false;
+    for (int i = 0; i < 8; i++) {
+        if (!isxdigit((unsigned char)name[i]))
+            return false;
+    }
+    *key = (uint32_t)strtoul(name, NULL, 16);
+    return true;
+}
+
+static uint8_t *VCHDTexturePack_ReadFile(const char *path, size_t *length) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    long fileLength = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *data = fileLength > 0 ? (uint8_t *)malloc(fileLength) : NULL;
+    if (data != NULL && fread(data, 1, fileLength, file) != (size_t)fileLength) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *length = (size_t)fileLength;
+    return data;
+}
+
+// Writes a pack of all the `KEY.png` images in `directory`, with the index sorted by key.
+bool VCHDTexturePack_Build(const char *path, const char *directory, size_t *entriesWritten) {
+    DIR *dir = opendir(directory);
+    if (dir == NULL)
+        return false;
+
+    VCHDTextureFile *files = NULL;
+    size_t filesLength = 0, filesCapacity = 0;
+    struct dirent *dirEntry;
+    while ((dirEntry = readdir(dir)) != NULL) {
+        uint32_t key;
+        if (!VCHDTexturePack_ParseFileName(dirEntry->d_name, &key))
+            continue;
+        if (filesLength == filesCapacity) {
+            filesCapacity = filesCapacity == 0 ? 64 : filesCapacity * 2;
+            files = (VCHDTextureFile *)realloc(files, sizeof(VCHDTextureFile) * filesCapacity);
+            if (files == NULL)
+                abort();
+        }
+        VCHDTextureFile *file = &files[filesLength++];
+        memset(&file->entry, '\0', sizeof(file->entry));
+        file->entry.key = key;
+        file->path = (char *)malloc(strlen(directory) + strlen(dirEntry->d_name) + 2);
+        if (file->path == NULL)
+            abort();
+        sprintf(file->path, "%s/%s", directory, dirEntry->d_name);
+    }
+    closedir(dir);
+    qsort(files, filesLength, sizeof(VCHDTextureFile), VCHDTextureFile_Compare);
+
+    FILE *output = fopen(path, "wb");
+    if (output == NULL) {
+        for (size_t i = 0; i < filesLength; i++)
+            free(files[i].path);
+        free(files);
+        return false;
+    }
+
+    // Write the data first, after room for the header and index, then go back and fill those in.
+    size_t offset = sizeof(VCHDTexturePackHeader) + filesLength * sizeof(VCHDTextureEntry);
+    size_t entriesLength = 0;
+    bool ok = fseek(output, offset, SEEK_SET) == 0;
+    for (size_t i = 0; ok && i < filesLength; i++) {
+        size_t length = 0;
+        uint8_t *data = VCHDTexturePack_ReadFile(files[i].path, &length);
+        int width = 0, height = 0, components = 0;
+        if (data == NULL ||
+                !stbi_info_from_memory(data, (int)length, &width, &height, &components) ||
+                width > 0xffff || height > 0xffff) {
+            fprintf(stderr, "vctexpack: skipping `%s`\n", files[i].path);
+            free(data);
+            continue;
+        }
+
+        // Keys must stay unique for the binary search.
+        if (entriesLength > 0 && files[entriesLength - 1].entry.key == files[i].entry.key) {
+            free(data);
+            continue;
+        }
+
+        VCHDTextureEntry *entry = &files[entriesLength++].entry;
+        entry->key = files[i].entry.key;
+        entry->width = (uint16_t)width;
+        entry->height = (uint16_t)height;
+        entry->offset = (uint32_t)offset;
+        entry->length = (uint32_t)length;
+
+        static const uint8_t padding[4] = { 0 };
+        size_t paddingLength = (4 - length % 4) % 4;
+        ok = fwrite(data, 1, length, output) == length &&
+            fwrite(padding, 1, paddingLength, output) == paddingLength;
+        offset += length + paddingLength;
+        free(data);
+    }
+
+    VCHDTexturePackHeader header = {
+        VC_HD_TEXTURE_PACK_MAGIC,
+        VC_HD_TEXTURE_PACK_VERSION,
+        (uint32_t)entriesLength,
+        0
+    };
+    ok = ok && fseek(output, 0, SEEK_SET) == 0 &&
+        fwrite(&header, sizeof(header), 1, output) == 1;
+    for (size_t i = 0; ok && i < entriesLength; i++)
+        ok = fwrite(&files[i].entry, sizeof(VCHDTextureEntry), 1, output) == 1;
+    ok = fclose(output) == 0 && ok;
+
+    for (size_t i = 0; i < filesLength; i++)
+        free(files[i].path);
+    free(files);
+    if (entriesWritten != NULL)
+        *entriesWritten = entriesLength;
+    return ok;
+}
+
+#else
+
+bool VCHDTexturePack_OpenForROM(VCHDTexturePack *pack,
+                                const char *directory,
+                                const uint8_t *romHeader) {
+    memset(pack, '\0', sizeof(*pack));
+    fprintf(stderr, "video warning: HD texture packs aren't supported on this platform\n");
+    return false;
+}
+
+void VCHDTexturePack_Close(VCHDTexturePack *pack) {
+    memset(pack, '\0', sizeof(*pack));
+}
+
+bool VCHDTexturePack_Build(const char *path, const char *directory, size_t *entriesWritten) {
+    return false;
+}
+
+#endif
+
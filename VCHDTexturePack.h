@@ -0,0 +1,41 @@
+// mupen64plus-video-videocore/VCHDTexturePack.h
+//
+// Copyright (c) 2016 The mupen64plus-video-videocore Authors
+
+#ifndef VCHDTEXTUREPACK_H
+#define VCHDTEXTUREPACK_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// A replacement image in the pack. `width` and `height` are those of the image as stored, and
+// `offset` and `length` locate its (PNG) data in the file.
+struct VCHDTextureEntry {
+    uint32_t key;
+    uint16_t width;
+    uint16_t height;
+    uint32_t offset;
+    uint32_t length;
+};
+
+// A read-only, memory-mapped pack of high-resolution replacement textures for one ROM, keyed by
+// the texture's content. The index of entries, sorted by key, is built offline by
+// `vctexpack build-hd`, so opening a pack doesn't read anything but its header.
+struct VCHDTexturePack {
+    uint8_t *mapping;
+    size_t mappingLength;
+    const VCHDTextureEntry *entries;
+    uint32_t entriesLength;
+};
+
+bool VCHDTexturePack_OpenForROM(VCHDTexturePack *pack,
+                                const char *directory,
+                                const uint8_t *romHeader);
+void VCHDTexturePack_Close(VCHDTexturePack *pack);
+bool VCHDTexturePack_IsOpen(VCHDTexturePack *pack);
+const VCHDTextureEntry *VCHDTexturePack_Find(VCHDTexturePack *pack, uint32_t key);
+const uint8_t *VCHDTexturePack_EntryData(VCHDTexturePack *pack, const VCHDTextureEntry *entry);
+bool VCHDTexturePack_Build(const char *path, const char *directory, size_t *entriesWritten);
+
+#endif
+
@@ -13,6 +13,8 @@
 #define VC_RENDER_COMMAND_DRAW_BATCHES              2
 #define VC_RENDER_COMMAND_COMPILE_SHADER_PROGRAM    3
 #define VC_RENDER_COMMAND_DESTROY_SHADER_PROGRAM    4
+#define VC_RENDER_COMMAND_OPEN_SHADER_CACHE         5
+#define VC_RENDER_COMMAND_CLOSE_SHADER_CACHE        6
 
 #define VC_TRIANGLE_MODE_NORMAL             0
 #define VC_TRIANGLE_MODE_TEXTURE_RECTANGLE  1
@@ -27,15 +29,20 @@
 
 #define VC_INVALID_SUBPROGRAM_ID        ((uint32_t)~0)
 
+#define VC_SHADER_PROGRAM_HISTORY       256
+
 #include <SDL2/SDL.h>
 #include <stdint.h>
+#include <stdio.h>
 #include "VCAtlas.h"
 #include "VCDebugger.h"
 #include "VCGeometry.h"
 #include "VCShaderCompiler.h"
+#include "VCShaderWorker.h"
 
 struct Combiner;
 struct SPVertex;
+struct VCLoggedCombinerMode;
 struct VCShaderProgram;
 struct VCShaderProgramDescriptorLibrary;
 
@@ -75,25 +82,42 @@ struct VCBatch {
     size_t verticesCapacity;
     VCBlendFlags blendFlags;
     union {
-        VCShaderSubprogramSignatureTable table;
+        VCShaderSubprogramIDList subprogramIDs;
         uint32_t id;
     } program;
     bool programIDPresent;
+
+    // The atlas pages that textures 0 and 1 of every vertex in this batch live in.
+    uint8_t texturePages[2];
 };
 
 struct VCRenderCommand {
     uint8_t command;
     VCRectus uv;
     uint8_t *pixels;
+    uint8_t texturePage;
+    uint8_t texturePageFormat;
+    bool freePixelsAfterUpload;
     uint32_t elapsedTime;
     uint32_t shaderProgramID;
     VCShaderProgram *shaderProgram;
     VCBatch *batches;
     size_t batchesLength;
+    char *path;
+    uint32_t programsCreatedPerMinute;
+    uint32_t programsReusedPerMinute;
+    uint32_t combinerStates;
+    uint32_t subprograms;
+    uint32_t programs;
 };
 
+// `program` is valid once `ready`. Until then, batches using the program are drawn with the
+// ubershader, described by `ubershaderTable`.
 struct VCCompiledShaderProgram {
     VCProgram program;
+    GLuint ubershaderTable;
+    bool compiling;
+    bool ready;
 };
 
 struct VCRenderer {
@@ -138,13 +162,29 @@ struct VCRenderer {
     uint32_t currentSubprogramID;
     uint8_t triangleModeForCachedSubprogramID;
 
+    // For RSP thread only. Where combiner modes are written as they're first seen in a session, if
+    // `debug.combinerLog` is set, and the modes written so far. Subprograms outlive sessions, so
+    // which modes are new is tracked separately.
+    FILE *combinerLog;
+    VCLoggedCombinerMode *loggedCombinerModes;
+
+    // For RSP thread only. When the last `VC_SHADER_PROGRAM_HISTORY` programs were created, and
+    // when batches last made do with an existing program instead.
+    uint32_t programCreationTimes[VC_SHADER_PROGRAM_HISTORY];
+    uint32_t programCreationCount;
+    uint32_t programReuseTimes[VC_SHADER_PROGRAM_HISTORY];
+    uint32_t programReuseCount;
+
     VCProgram blitProgram;
     GLuint quadVBO;
 
     VCCompiledShaderProgram *shaderPrograms;
     size_t shaderProgramsLength;
     size_t shaderProgramsCapacity;
-    char *shaderPreamble;
+    VCString fragmentShaderPrefix;
+    char *n64VertexShaderSource;
+    VCProgram ubershaderProgram;
+    VCShaderWorker shaderWorker;
     GLuint n64VBO;
 
     GLuint fbo;
@@ -156,6 +196,8 @@ VCRenderer *VCRenderer_SharedRenderer();
 void VCRenderer_Start(VCRenderer *renderer);
 void VCRenderer_CreateProgram(GLuint *program, GLuint vertexShader, GLuint fragmentShader);
 void VCRenderer_CompileShader(GLuint *shader, GLint shaderType, const char *path);
+void VCRenderer_CompileShaderFromCString(GLuint *shader, GLint shaderType, const char *source);
+void VCRenderer_DestroyProgram(VCProgram *program);
 void VCRenderer_AddVertex(VCRenderer *renderer,
                           VCN64Vertex *vertex,
                           VCBlendFlags *blendFlags,
@@ -182,6 +224,10 @@ bool VCRenderer_ShouldCull(SPVertex *va,
                            bool cullBack);
 void VCRenderer_AllocateTexturesAndEnqueueTextureUploadCommands(VCRenderer *renderer);
 void VCRenderer_InvalidateCachedSubprogramID(VCRenderer *renderer);
+void VCRenderer_OpenShaderCache(VCRenderer *renderer, const uint8_t *romHeader);
+void VCRenderer_CloseShaderCache(VCRenderer *renderer);
+void VCRenderer_OpenCombinerLog(VCRenderer *renderer);
+void VCRenderer_CloseCombinerLog(VCRenderer *renderer);
 
 #endif
 
@@ -0,0 +1,344 @@
+// mupen64plus-video-videocore/VCShaderCache.cpp
+//
+// Copyright (c) 2016 The mupen64plus-video-videocore Authors
+
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "VCShaderCache.h"
+#include "VCUtils.h"
+#include "xxhash.h"
+
+#ifdef HAVE_OPENGLES2
+#include <GLES2/gl2ext.h>
+#endif
+
+#define VC_SHADER_CACHE_MAGIC               0x43534356  // "VCSC"
+#define VC_SHADER_CACHE_RECORD_MAGIC        0x52534356  // "VCSR"
+#define VC_SHADER_CACHE_VERSION             1
+#define VC_SHADER_CACHE_MAX_RECORD_LENGTH   (16 * 1024 * 1024)
+#define SOURCE_HASH_SEED                    0x53484452
+#define INITIAL_ENTRIES_CAPACITY            32
+
+// `glGetProgramBinary` and friends come from `GL_OES_get_program_binary` on GLES and from
+// `GL_ARB_get_program_binary` (core in 4.1) on the desktop. The legacy Apple context has neither.
+#if defined(HAVE_OPENGLES2) && defined(GL_OES_get_program_binary)
+static PFNGLGETPROGRAMBINARYOESPROC VCGetProgramBinary = NULL;
+static PFNGLPROGRAMBINARYOESPROC VCProgramBinary = NULL;
+#define VC_GL_PROGRAM_BINARY_LENGTH         GL_PROGRAM_BINARY_LENGTH_OES
+#define VC_GL_NUM_PROGRAM_BINARY_FORMATS    GL_NUM_PROGRAM_BINARY_FORMATS_OES
+#define VC_HAVE_PROGRAM_BINARIES
+#elif !defined(HAVE_OPENGLES2) && !defined(__APPLE__)
+#define VCGetProgramBinary                  glGetProgramBinary
+#define VCProgramBinary                     glProgramBinary
+#define VC_GL_PROGRAM_BINARY_LENGTH         GL_PROGRAM_BINARY_LENGTH
+#define VC_GL_NUM_PROGRAM_BINARY_FORMATS    GL_NUM_PROGRAM_BINARY_FORMATS
+#define VC_HAVE_PROGRAM_BINARIES
+#endif
+
+struct VCShaderCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t stamp;
+    uint32_t reserved;
+};
+
+// Followed by the source (without a terminator) and then the binary, if any.
+struct VCShaderCacheRecord {
+    uint32_t magic;
+    uint32_t key;
+    uint32_t sourceLength;
+    uint32_t binaryFormat;
+    uint32_t binaryLength;
+};
+
+uint32_t VCShaderCache_HashSource(const char *source) {
+    return XXH32(source, strlen(source), SOURCE_HASH_SEED);
+}
+
+// Identifies everything besides the combiner-specific part of the fragment shader that goes into
+// a program binary, so that a driver update or new plugin shaders invalidate the cache.
+uint32_t VCShaderCache_ComputeStamp(const char *vertexShaderSource,
+                                    const char *fragmentShaderPrefix) {
+    const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION };
+    VCString identity = VCString_Create();
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        const char *value = (const char *)glGetString(names[i]);
+        VCString_AppendFormat(&identity, "%s\n", value != NULL ? value : "");
+    }
+    VCString_AppendCString(&identity, vertexShaderSource);
+    VCString_AppendCString(&identity, fragmentShaderPrefix);
+    uint32_t stamp = XXH32(identity.ptr, identity.len, SOURCE_HASH_SEED);
+    VCString_Destroy(&identity);
+    return stamp;
+}
+
+static bool VCShaderCache_CheckProgramBinarySupport() {
+#ifdef VC_HAVE_PROGRAM_BINARIES
+#ifdef HAVE_OPENGLES2
+    if (!SDL_GL_ExtensionSupported("GL_OES_get_program_binary"))
+        return false;
+    VCGetProgramBinary =
+        (PFNGLGETPROGRAMBINARYOESPROC)SDL_GL_GetProcAddress("glGetProgramBinaryOES");
+    VCProgramBinary = (PFNGLPROGRAMBINARYOESPROC)SDL_GL_GetProcAddress("glProgramBinaryOES");
+    if (VCGetProgramBinary == NULL || VCProgramBinary == NULL)
+        return false;
+#else
+    if (!GLEW_ARB_get_program_binary)
+        return false;
+#endif
+    // Some drivers expose the entry points but no formats to save programs in.
+    GLint formatsLength = 0;
+    GL(glGetIntegerv(VC_GL_NUM_PROGRAM_BINARY_FORMATS, &formatsLength));
+    return formatsLength > 0;
+#else
+    return false;
+#endif
+}
+
+bool VCShaderCache_IsOpen(VCShaderCache *cache) {
+    return cache->entries != NULL;
+}
+
+// Entries are few and only looked up when a program is first needed, so a linear scan will do.
+VCShaderCacheEntry *VCShaderCache_Find(VCShaderCache *cache, uint32_t key, const char *source) {
+    for (size_t i = 0; i < cache->entriesLength; i++) {
+        VCShaderCacheEntry *entry = &cache->entries[i];
+        if (entry->key == key && strcmp(entry->source, source) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+static VCShaderCacheEntry *VCShaderCache_AppendEntry(VCShaderCache *cache,
+                                                     uint32_t key,
+                                                     char *source,
+                                                     uint32_t sourceLength) {
+    if (cache->entriesLength == cache->entriesCapacity) {
+        cache->entriesCapacity *= 2;
+        cache->entries = (VCShaderCacheEntry *)
+            realloc(cache->entries, sizeof(VCShaderCacheEntry) * cache->entriesCapacity);
+        if (cache->entries == NULL)
+            abort();
+    }
+    VCShaderCacheEntry *entry = &cache->entries[cache->entriesLength++];
+    memset(entry, '\0', sizeof(*entry));
+    entry->key = key;
+    entry->source = source;
+    entry->sourceLength = sourceLength;
+    return entry;
+}
+
+static void VCShaderCache_WriteEntry(VCShaderCache *cache, VCShaderCacheEntry *entry) {
+    if (cache->file == NULL)
+        return;
+    VCShaderCacheRecord record = {
+        VC_SHADER_CACHE_RECORD_MAGIC,
+        entry->key,
+        entry->sourceLength,
+        entry->binaryFormat,
+        entry->binary != NULL ? entry->binaryLength : 0
+    };
+    bool ok = fwrite(&record, sizeof(record), 1, cache->file) == 1 &&
+        fwrite(entry->source, 1, record.sourceLength, cache->file) == record.sourceLength &&
+        fwrite(entry->binary, 1, record.binaryLength, cache->file) == record.binaryLength;
+    if (!ok || fflush(cache->file) != 0) {
+        fprintf(stderr, "video warning: couldn't write to the shader cache; disabling writes\n");
+        fclose(cache->file);
+        cache->file = NULL;
+    }
+}
+
+// Reads records until the end of the file, keeping the newest one for each program. Returns false
+// if the file has anything in it that should be dropped, in which case it's rewritten.
+static bool VCShaderCache_ReadRecords(VCShaderCache *cache, FILE *file) {
+    bool clean = true;
+    VCShaderCacheRecord record;
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        if (record.magic != VC_SHADER_CACHE_RECORD_MAGIC ||
+                record.sourceLength > VC_SHADER_CACHE_MAX_RECORD_LENGTH ||
+                record.binaryLength > VC_SHADER_CACHE_MAX_RECORD_LENGTH) {
+            return false;
+        }
+
+        char *source = (char *)malloc(record.sourceLength + 1);
+        uint8_t *binary = record.binaryLength > 0 ? (uint8_t *)malloc(record.binaryLength) : NULL;
+        if (source == NULL || (record.binaryLength > 0 && binary == NULL))
+            abort();
+        source[record.sourceLength] = '\0';
+        if (fread(source, 1, record.sourceLength, file) != record.sourceLength ||
+                fread(binary, 1, record.binaryLength, file) != record.binaryLength ||
+                VCShaderCache_HashSource(source) != record.key) {
+            free(source);
+            free(binary);
+            return false;
+        }
+
+        VCShaderCacheEntry *entry = VCShaderCache_Find(cache, record.key, source);
+        if (entry != NULL) {
+            free(source);
+            free(entry->binary);
+            clean = false;
+        } else {
+            entry = VCShaderCache_AppendEntry(cache, record.key, source, record.sourceLength);
+        }
+        entry->binaryFormat = record.binaryFormat;
+        entry->binary = binary;
+        entry->binaryLength = record.binaryLength;
+    }
+    return clean && feof(file);
+}
+
+// Loads the cache at `path`, if it exists and was written with the same stamp, and opens it for
+// appending newly compiled programs.
+void VCShaderCache_Open(VCShaderCache *cache, const char *path, uint32_t stamp) {
+    memset(cache, '\0', sizeof(*cache));
+    cache->stamp = stamp;
+    cache->programBinariesSupported = VCShaderCache_CheckProgramBinarySupport();
+    cache->entriesCapacity = INITIAL_ENTRIES_CAPACITY;
+    cache->entries = (VCShaderCacheEntry *)malloc(sizeof(VCShaderCacheEntry) *
+                                                  cache->entriesCapacity);
+    if (cache->entries == NULL)
+        abort();
+
+    bool clean = false;
+    FILE *file = fopen(path, "rb");
+    if (file != NULL) {
+        VCShaderCacheHeader header;
+        if (fread(&header, sizeof(header), 1, file) == 1 &&
+                header.magic == VC_SHADER_CACHE_MAGIC &&
+                header.version == VC_SHADER_CACHE_VERSION &&
+                header.stamp == stamp) {
+            clean = VCShaderCache_ReadRecords(cache, file);
+        }
+        fclose(file);
+    }
+    cache->entriesLoaded = cache->entriesLength;
+
+    cache->file = fopen(path, clean ? "ab" : "wb");
+    if (cache->file == NULL) {
+        fprintf(stderr, "video warning: couldn't open shader cache `%s` for writing\n", path);
+    } else if (!clean) {
+        VCShaderCacheHeader header = {
+            VC_SHADER_CACHE_MAGIC,
+            VC_SHADER_CACHE_VERSION,
+            stamp,
+            0
+        };
+        if (fwrite(&header, sizeof(header), 1, cache->file) != 1) {
+            fclose(cache->file);
+            cache->file = NULL;
+        }
+        for (size_t i = 0; i < cache->entriesLength; i++)
+            VCShaderCache_WriteEntry(cache, &cache->entries[i]);
+    }
+
+    fprintf(stderr,
+            "video: loaded %u cached shader programs%s\n",
+            (unsigned)cache->entriesLength,
+            cache->programBinariesSupported ? "" : " (program binaries unsupported)");
+}
+
+void VCShaderCache_Close(VCShaderCache *cache) {
+    for (size_t i = 0; i < cache->entriesLength; i++) {
+        VCShaderCacheEntry *entry = &cache->entries[i];
+        if (entry->program != 0)
+            GL(glDeleteProgram(entry->program));
+        free(entry->source);
+        free(entry->binary);
+    }
+    free(cache->entries);
+    if (cache->file != NULL)
+        fclose(cache->file);
+    memset(cache, '\0', sizeof(*cache));
+}
+
+// Returns the next program from earlier sessions that hasn't been linked yet this session, if
+// any.
+VCShaderCacheEntry *VCShaderCache_NextEntryToPrewarm(VCShaderCache *cache) {
+    while (cache->entriesPrewarmed < cache->entriesLoaded) {
+        VCShaderCacheEntry *entry = &cache->entries[cache->entriesPrewarmed++];
+        if (!entry->linked)
+            return entry;
+    }
+    return NULL;
+}
+
+static void VCShaderCache_SaveProgramBinary(VCShaderCacheEntry *entry, GLuint program) {
+#ifdef VC_HAVE_PROGRAM_BINARIES
+    GLint length = 0;
+    GL(glGetProgramiv(program, VC_GL_PROGRAM_BINARY_LENGTH, &length));
+    if (length <= 0 || length > VC_SHADER_CACHE_MAX_RECORD_LENGTH)
+        return;
+    uint8_t *binary = (uint8_t *)malloc(length);
+    if (binary == NULL)
+        abort();
+    GLsizei binaryLength = 0;
+    GLenum binaryFormat = 0;
+    GL(VCGetProgramBinary(program, length, &binaryLength, &binaryFormat, binary));
+    if (binaryLength <= 0) {
+        free(binary);
+        return;
+    }
+    entry->binary = binary;
+    entry->binaryLength = (uint32_t)binaryLength;
+    entry->binaryFormat = (uint32_t)binaryFormat;
+#endif
+}
+
+// Records a successfully linked program, with its binary where possible.
+void VCShaderCache_Store(VCShaderCache *cache, uint32_t key, const char *source, GLuint program) {
+    if (!VCShaderCache_IsOpen(cache))
+        return;
+
+    VCShaderCacheEntry *entry = VCShaderCache_Find(cache, key, source);
+    bool newEntry = entry == NULL;
+    if (newEntry) {
+        size_t sourceLength = strlen(source);
+        char *sourceCopy = (char *)malloc(sourceLength + 1);
+        if (sourceCopy == NULL)
+            abort();
+        memcpy(sourceCopy, source, sourceLength + 1);
+        entry = VCShaderCache_AppendEntry(cache, key, sourceCopy, (uint32_t)sourceLength);
+    }
+    entry->linked = true;
+
+    if (entry->binary != NULL || !cache->programBinariesSupported) {
+        if (newEntry)
+            VCShaderCache_WriteEntry(cache, entry);
+        return;
+    }
+    VCShaderCache_SaveProgramBinary(entry, program);
+    if (newEntry || entry->binary != NULL)
+        VCShaderCache_WriteEntry(cache, entry);
+}
+
+// Links `program` from the entry's saved binary. Returns false, forgetting the binary, if there's
+// none or the driver rejects it, in which case the program must be compiled from source.
+bool VCShaderCache_LoadProgramBinary(VCShaderCache *cache,
+                                     VCShaderCacheEntry *entry,
+                                     GLuint program) {
+#ifdef VC_HAVE_PROGRAM_BINARIES
+    if (!cache->programBinariesSupported || entry->binary == NULL)
+        return false;
+    GL(VCProgramBinary(program, (GLenum)entry->binaryFormat, entry->binary, entry->binaryLength));
+    GLint linkStatus = GL_FALSE;
+    GL(glGetProgramiv(program, GL_LINK_STATUS, &linkStatus));
+    if (linkStatus == GL_TRUE)
+        return true;
+    free(entry->binary);
+    entry->binary = NULL;
+    entry->binaryLength = 0;
+#endif
+    return false;
+}
+
+// Call before linking a program that will be stored, so that its binary can be retrieved.
+void VCShaderCache_PrepareProgramForLink(VCShaderCache *cache, GLuint program) {
+#if defined(VC_HAVE_PROGRAM_BINARIES) && defined(GL_PROGRAM_BINARY_RETRIEVABLE_HINT)
+    if (cache->programBinariesSupported)
+        GL(glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+#endif
+}
+
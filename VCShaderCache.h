@@ -0,0 +1,57 @@
+// mupen64plus-video-videocore/VCShaderCache.h
+//
+// Copyright (c) 2016 The mupen64plus-video-videocore Authors
+
+#ifndef VCSHADERCACHE_H
+#define VCSHADERCACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "VCGL.h"
+
+// A combiner program seen in this or an earlier session. `key` is a hash of `source`, the
+// program's complete fragment shader; `binary`, if not NULL, is the linked program as the driver
+// returned it. `program` is a program linked ahead of time by prewarming, not yet handed out, and
+// `linked` is set once a program has been linked for the entry this session.
+struct VCShaderCacheEntry {
+    uint32_t key;
+    char *source;
+    uint32_t sourceLength;
+    uint32_t binaryFormat;
+    uint8_t *binary;
+    uint32_t binaryLength;
+    GLuint program;
+    bool linked;
+};
+
+// The combiner programs compiled for one ROM, kept in an append-only file under
+// `~/.cache/mupen64plus/videocore` so that later sessions can link them before they're needed.
+// `stamp` identifies the driver and the shader sources shared by every program; a file with a
+// different stamp is discarded. For use by the shader worker only.
+struct VCShaderCache {
+    FILE *file;
+    uint32_t stamp;
+    VCShaderCacheEntry *entries;
+    size_t entriesLength;
+    size_t entriesCapacity;
+    size_t entriesLoaded;
+    size_t entriesPrewarmed;
+    bool programBinariesSupported;
+};
+
+uint32_t VCShaderCache_HashSource(const char *source);
+uint32_t VCShaderCache_ComputeStamp(const char *vertexShaderSource,
+                                    const char *fragmentShaderPrefix);
+void VCShaderCache_Open(VCShaderCache *cache, const char *path, uint32_t stamp);
+void VCShaderCache_Close(VCShaderCache *cache);
+bool VCShaderCache_IsOpen(VCShaderCache *cache);
+VCShaderCacheEntry *VCShaderCache_Find(VCShaderCache *cache, uint32_t key, const char *source);
+VCShaderCacheEntry *VCShaderCache_NextEntryToPrewarm(VCShaderCache *cache);
+void VCShaderCache_Store(VCShaderCache *cache, uint32_t key, const char *source, GLuint program);
+bool VCShaderCache_LoadProgramBinary(VCShaderCache *cache,
+                                     VCShaderCacheEntry *entry,
+                                     GLuint program);
+void VCShaderCache_PrepareProgramForLink(VCShaderCache *cache, GLuint program);
+
+#endif
+
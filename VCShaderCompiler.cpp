@@ -1,1105 +1,1838 @@
-// mupen64plus-video-videocore/VCShaderCompiler.cpp
-//
-// Copyright (c) 2016 The mupen64plus-video-videocore Authors
-
-#include "Combiner.h"
-#include "VCCombiner.h"
-#include "VCShaderCompiler.h"
-#include "VCUtils.h"
-#include "uthash.h"
-#include <assert.h>
-#include <limits.h>
-#include <stdlib.h>
-
-#define VC_SHADER_INSTRUCTION_MOVE          0
-#define VC_SHADER_INSTRUCTION_ADD           1
-#define VC_SHADER_INSTRUCTION_SUB           2
-#define VC_SHADER_INSTRUCTION_MUL           3
-
-#define VC_SHADER_MAX_INSTRUCTIONS          16
-#define VC_SHADER_MAX_CONSTANTS             16
-
-#define VC_SHADER_COMPILER_REGISTER_VALUE           0x00
-#define VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE      0xf3
-#define VC_SHADER_COMPILER_ZERO_VALUE               0xf3
-#define VC_SHADER_COMPILER_ONE_VALUE                0xf4
-#define VC_SHADER_COMPILER_PRIMITIVE_VALUE          0xf5
-#define VC_SHADER_COMPILER_PRIMITIVE_ALPHA_VALUE    0xf6
-#define VC_SHADER_COMPILER_ENVIRONMENT_VALUE        0xf7
-#define VC_SHADER_COMPILER_ENVIRONMENT_ALPHA_VALUE  0xf8
-#define VC_SHADER_COMPILER_TEXEL0_VALUE             0xf9
-#define VC_SHADER_COMPILER_TEXEL0_ALPHA_VALUE       0xfa
-#define VC_SHADER_COMPILER_TEXEL1_VALUE             0xfb
-#define VC_SHADER_COMPILER_TEXEL1_ALPHA_VALUE       0xfc
-#define VC_SHADER_COMPILER_SHADE_VALUE              0xfd
-#define VC_SHADER_COMPILER_SHADE_ALPHA_VALUE        0xfe
-#define VC_SHADER_COMPILER_OUTPUT_VALUE             0xff
-
-#define VC_SHADER_COMPILER_MODE_RGB     0
-#define VC_SHADER_COMPILER_MODE_ALPHA   1
-
-#define VC_SHADER_COMPILER_MAX_PROGRAMS         64
-
-// SSA form instruction.
-struct VCShaderInstruction {
-    uint8_t operation;
-    uint8_t destination;
-    uint8_t operands[2];
-};
-
-struct VCShaderFunction {
-    VCShaderInstruction *instructions;
-    size_t instructionCount;
-};
-
-struct VCShaderSubprogram {
-    VCShaderSubprogramSource source;
-    VCShaderFunction rgb;
-    VCShaderFunction a;
-};
-
-struct VCShaderSubprogramEntry {
-    VCShaderSubprogramSignature signature;
-    VCShaderSubprogram *subprogram;
-    UT_hash_handle hh;
-};
-
-struct VCShaderSubprogramLibrary {
-    VCShaderSubprogramSignature *signatures;
-    VCShaderSubprogramEntry *subprograms;
-};
-
-struct VCShaderProgram {
-    VCShaderSubprogram **subprograms;
-    size_t subprogramCount;
-};
-
-struct VCUnpackedCombinerFunction {
-    uint8_t sa;
-    uint8_t sb;
-    uint8_t m;
-    uint8_t a;
-};
-
-struct VCShaderSubprogramSignatureTableEntry {
-    VCShaderSubprogramSignature signature;
-    uint16_t id;
-    UT_hash_handle hh;
-};
-
-struct VCShaderSubprogramSignatureListEntry {
-    VCShaderSubprogramSignature signature;
-};
-
-struct VCShaderProgramDescriptorLibrary {
-    VCShaderProgramDescriptor *shaderProgramDescriptors;
-    size_t shaderProgramDescriptorCount;
-};
-
-VCShaderProgramDescriptorLibrary *VCShaderCompiler_CreateShaderProgramDescriptorLibrary() {
-    VCShaderProgramDescriptorLibrary *library =
-        (VCShaderProgramDescriptorLibrary *)malloc(sizeof(VCShaderProgramDescriptorLibrary));
-    library->shaderProgramDescriptors = NULL;
-    library->shaderProgramDescriptorCount = 0;
-    return library;
-}
-
-static VCShaderProgramSignature VCShaderCompiler_CreateShaderProgramSignature(
-        VCShaderSubprogramSignatureList *list) {
-    VCShaderProgramSignature signature;
-    signature.serializedData = VCString_Create();
-    VCString_AppendBytes(&signature.serializedData, &list->length, sizeof(list->length));
-    for (size_t subprogramSignatureIndex = 0;
-         subprogramSignatureIndex < list->length;
-         subprogramSignatureIndex++) {
-        VCString_AppendString(&signature.serializedData,
-                              &list->entries[subprogramSignatureIndex].signature.serializedData);
-    }
-    return signature;
-}
-
-static void VCShaderCompiler_DestroyShaderProgramSignature(VCShaderProgramSignature *signature) {
-    VCString_Destroy(&signature->serializedData);
-}
-
-static VCShaderSubprogramSignatureList VCShaderCompiler_DuplicateShaderSubprogramSignatureList(
-        VCShaderSubprogramSignatureList *list) {
-    VCShaderSubprogramSignatureList newList;
-    newList.length = list->length;
-    size_t byteSize = sizeof(VCShaderSubprogramSignatureListEntry) * newList.length;
-    newList.entries = (VCShaderSubprogramSignatureListEntry *)malloc(byteSize);
-    memcpy(newList.entries, list->entries, byteSize);
-    return newList;
-}
-
-// Takes ownership of `programSignature`.
-static VCShaderProgramDescriptor *VCShaderCompiler_CreateShaderProgramDescriptor(
-        uint16_t id,
-        VCShaderProgramSignature *programSignature,
-        VCShaderSubprogramSignatureList *subprogramSignatures) {
-    VCShaderProgramDescriptor *programDescriptor =
-        (VCShaderProgramDescriptor *)malloc(sizeof(VCShaderProgramDescriptor));
-    programDescriptor->id = id;
-    programDescriptor->program = NULL;
-    programDescriptor->programSignature = *programSignature;
-    programDescriptor->subprogramSignatures =
-        VCShaderCompiler_DuplicateShaderSubprogramSignatureList(subprogramSignatures);
-    memset(programSignature, '\0', sizeof(*programSignature));
-    return programDescriptor;
-}
-
-#if 0
-static void VCShaderCompiler_DestroyShaderSubprogramSignature(
-        VCShaderSubprogramSignature *signature) {
-    VCString_Destroy(&signature->serializedData);
-    memset(&signature->source, '\0', sizeof(VCShaderSubprogramSource));
-}
-#endif
-
-// Does not destroy subprogram signatures, since they are weakly referenced by subprogram signature
-// lists.
-static void VCShaderCompiler_DestroyShaderSubprogramSignatureList(
-        VCShaderSubprogramSignatureList *list) {
-    free(list->entries);
-    list->entries = NULL;
-}
-
-#if 0
-static void VCShaderCompiler_DestroyShaderFunction(VCShaderFunction *function) {
-    free(function->instructions);
-    function->instructions = NULL;
-    function->instructionCount = 0;
-}
-
-static void VCShaderCompiler_DestroyShaderSubprogram(VCShaderSubprogram *subprogram) {
-    memset(&subprogram->source, '\0', sizeof(VCShaderSubprogramSource));
-    VCShaderCompiler_DestroyShaderFunction(&subprogram->rgb);
-    VCShaderCompiler_DestroyShaderFunction(&subprogram->a);
-}
-
-static void VCShaderCompiler_DestroyShaderProgram(VCShaderProgram *program) {
-    // Does not destroy subprograms since programs only hold weak references to them.
-    free(program->subprograms);
-    program->subprograms = NULL;
-}
-#endif
-
-static void VCShaderCompiler_DestroyShaderProgramDescriptor(
-        VCShaderProgramDescriptor *descriptor) {
-    // FIXME(tachi): This does not destroy programs, so they leak. We should really duplicate them
-    // over to the renderer thread.
-    VCShaderCompiler_DestroyShaderSubprogramSignatureList(&descriptor->subprogramSignatures);
-    VCShaderCompiler_DestroyShaderProgramSignature(&descriptor->programSignature);
-    descriptor->program = NULL;
-    descriptor->id = 0;
-}
-
-uint16_t VCShaderCompiler_GetOrCreateShaderProgramID(
-        VCShaderProgramDescriptorLibrary *library,
-        VCShaderSubprogramSignatureList *subprogramSignatures,
-        bool *newlyCreated) {
-    VCShaderProgramSignature programSignature =
-        VCShaderCompiler_CreateShaderProgramSignature(subprogramSignatures);
-    VCShaderProgramDescriptor *programDescriptor = NULL;
-    HASH_FIND(hh,
-              library->shaderProgramDescriptors,
-              programSignature.serializedData.ptr,
-              programSignature.serializedData.len,
-              programDescriptor);
-    *newlyCreated = programDescriptor == NULL;
-    if (programDescriptor != NULL) {
-        // Reinsert the program into the hash to maintain the LRU property.
-        HASH_DEL(library->shaderProgramDescriptors, programDescriptor);
-        HASH_ADD_KEYPTR(hh,
-                        library->shaderProgramDescriptors,
-                        programDescriptor->programSignature.serializedData.ptr,
-                        programDescriptor->programSignature.serializedData.len,
-                        programDescriptor);
-        VCShaderCompiler_DestroyShaderProgramSignature(&programSignature);
-        return programDescriptor->id;
-    }
-
-    uint16_t id = library->shaderProgramDescriptorCount;
-    library->shaderProgramDescriptorCount++;
-    programDescriptor = VCShaderCompiler_CreateShaderProgramDescriptor(id,
-                                                                       &programSignature,
-                                                                       subprogramSignatures);
-    HASH_ADD_KEYPTR(hh,
-                    library->shaderProgramDescriptors,
-                    programDescriptor->programSignature.serializedData.ptr,
-                    programDescriptor->programSignature.serializedData.len,
-                    programDescriptor);
-    return id;
-}
-
-bool VCShaderCompiler_ExpireOldProgramIfNecessary(VCShaderProgramDescriptorLibrary *library,
-                                                  uint16_t *shaderProgramIDToDelete) {
-    size_t programCount = HASH_COUNT(library->shaderProgramDescriptors);
-    if (programCount <= VC_SHADER_COMPILER_MAX_PROGRAMS)
-        return false;
-
-    assert(programCount > 0);
-    VCShaderProgramDescriptor *programDescriptorToDelete = library->shaderProgramDescriptors;
-    HASH_DEL(library->shaderProgramDescriptors, programDescriptorToDelete);
-    *shaderProgramIDToDelete = programDescriptorToDelete->id;
-    VCShaderCompiler_DestroyShaderProgramDescriptor(programDescriptorToDelete);
-    free(programDescriptorToDelete);
-    return true;
-}
-
-static uint8_t VCShaderCompiler_SpecialRGBValueOrConstant(VCColor *color, uint8_t specialValue) {
-    if (color->r == 0 && color->g == 0 && color->b == 0)
-        return VC_SHADER_COMPILER_ZERO_VALUE;
-    if (color->r == 255 && color->g == 255 && color->b == 255)
-        return VC_SHADER_COMPILER_ONE_VALUE;
-    return specialValue;
-}
-
-static uint8_t VCShaderCompiler_SpecialAlphaValueOrConstant(VCColor *color, uint8_t specialValue) {
-    if (color->a == 0)
-        return VC_SHADER_COMPILER_ZERO_VALUE;
-    if (color->a == 255)
-        return VC_SHADER_COMPILER_ONE_VALUE;
-    return specialValue;
-}
-
-static uint8_t VCShaderCompiler_GetRGBValue(VCShaderSubprogramContext *context,
-                                            VCShaderFunction *function,
-                                            uint8_t source,
-                                            bool allowCombined) {
-    switch (source) {
-    case VC_COMBINER_CCMUX_COMBINED:
-        if (allowCombined)
-            return VC_SHADER_COMPILER_REGISTER_VALUE | 2;
-        return VC_SHADER_COMPILER_ZERO_VALUE;
-    case VC_COMBINER_CCMUX_COMBINED_ALPHA:
-        // FIXME(tachi): Support VC_COMBINER_CCMUX_COMBINED_ALPHA!
-        fprintf(stderr, "FIXME: VC_COMBINER_CCMUX_COMBINED_ALPHA! Expect bad colors.\n");
-        return VC_SHADER_COMPILER_ONE_VALUE;
-    case VC_COMBINER_CCMUX_TEXEL0:
-        return VC_SHADER_COMPILER_TEXEL0_VALUE;
-    case VC_COMBINER_CCMUX_TEXEL0_ALPHA:
-        return VC_SHADER_COMPILER_TEXEL0_ALPHA_VALUE;
-    case VC_COMBINER_CCMUX_TEXEL1:
-        return VC_SHADER_COMPILER_TEXEL1_VALUE;
-    case VC_COMBINER_CCMUX_TEXEL1_ALPHA:
-        return VC_SHADER_COMPILER_TEXEL1_ALPHA_VALUE;
-    case VC_COMBINER_CCMUX_SHADE:
-        return VC_SHADER_COMPILER_SHADE_VALUE;
-    case VC_COMBINER_CCMUX_SHADE_ALPHA:
-        return VC_SHADER_COMPILER_SHADE_ALPHA_VALUE;
-    case VC_COMBINER_CCMUX_PRIMITIVE:
-        return VCShaderCompiler_SpecialRGBValueOrConstant(&context->primColor,
-                                                          VC_SHADER_COMPILER_PRIMITIVE_VALUE);
-    case VC_COMBINER_CCMUX_ENVIRONMENT:
-        return VCShaderCompiler_SpecialRGBValueOrConstant(&context->envColor,
-                                                          VC_SHADER_COMPILER_ENVIRONMENT_VALUE);
-    case VC_COMBINER_CCMUX_PRIMITIVE_ALPHA:
-        return VCShaderCompiler_SpecialAlphaValueOrConstant(
-            &context->primColor,
-            VC_SHADER_COMPILER_PRIMITIVE_ALPHA_VALUE);
-    case VC_COMBINER_CCMUX_ENV_ALPHA:
-        return VCShaderCompiler_SpecialAlphaValueOrConstant(
-            &context->envColor,
-            VC_SHADER_COMPILER_ENVIRONMENT_ALPHA_VALUE);
-    case VC_COMBINER_CCMUX_NOISE:
-        return VC_SHADER_COMPILER_ONE_VALUE;
-    case VC_COMBINER_CCMUX_0:
-        return VC_SHADER_COMPILER_ZERO_VALUE;
-    case VC_COMBINER_CCMUX_1:
-        return VC_SHADER_COMPILER_ONE_VALUE;
-    }
-    // FIXME(tachi): Support K4, K5!
-    return VC_SHADER_COMPILER_ZERO_VALUE;
-}
-
-static uint8_t VCShaderCompiler_GetAlphaValue(VCShaderSubprogramContext *context,
-                                              VCShaderFunction *function,
-                                              uint8_t source,
-                                              bool allowCombined) {
-    switch (source) {
-    case VC_COMBINER_ACMUX_COMBINED:
-        if (allowCombined)
-            return VC_SHADER_COMPILER_REGISTER_VALUE | 2;
-        return VC_SHADER_COMPILER_ZERO_VALUE;
-    case VC_COMBINER_ACMUX_TEXEL0:
-        return VC_SHADER_COMPILER_TEXEL0_VALUE;
-    case VC_COMBINER_ACMUX_TEXEL1:
-        return VC_SHADER_COMPILER_TEXEL1_VALUE;
-    case VC_COMBINER_ACMUX_SHADE:
-        return VC_SHADER_COMPILER_SHADE_VALUE;
-    case VC_COMBINER_ACMUX_PRIMITIVE:
-        return VCShaderCompiler_SpecialAlphaValueOrConstant(&context->primColor,
-                                                            VC_SHADER_COMPILER_PRIMITIVE_VALUE);
-    case VC_COMBINER_ACMUX_ENVIRONMENT:
-        return VCShaderCompiler_SpecialAlphaValueOrConstant(&context->envColor,
-                                                            VC_SHADER_COMPILER_ENVIRONMENT_VALUE);
-    case VC_COMBINER_ACMUX_0:
-        return VC_SHADER_COMPILER_ZERO_VALUE;
-    case VC_COMBINER_ACMUX_1:
-        return VC_SHADER_COMPILER_ONE_VALUE;
-    }
-    // FIXME(tachi): Support G_ACMUX_PRIM_LOD_FRAC!
-    return VC_SHADER_COMPILER_ZERO_VALUE;
-}
-
-static uint8_t VCShaderCompiler_GetValue(VCShaderSubprogramContext *context,
-                                         uint8_t mode,
-                                         VCShaderFunction *function,
-                                         uint8_t source,
-                                         bool allowCombined) {
-    switch (mode) {
-    case VC_SHADER_COMPILER_MODE_RGB:
-        return VCShaderCompiler_GetRGBValue(context, function, source, allowCombined);
-    case VC_SHADER_COMPILER_MODE_ALPHA:
-        return VCShaderCompiler_GetAlphaValue(context, function, source, allowCombined);
-    default:
-        assert(0 && "Unknown shader compiler mode!");
-        return 0;
-    }
-}
-
-static VCShaderInstruction *VCShaderCompiler_AllocateInstruction(VCShaderFunction *function) {
-    assert(function->instructionCount < VC_SHADER_MAX_INSTRUCTIONS);
-    VCShaderInstruction *instruction = &function->instructions[function->instructionCount];
-    function->instructionCount++;
-    return instruction;
-}
-
-static uint8_t VCShaderCompiler_GenerateInstructionsForCycle(VCShaderSubprogramContext *context,
-                                                             uint8_t mode,
-                                                             VCShaderFunction *function,
-                                                             VCUnpackedCombinerFunction *cycle,
-                                                             uint8_t firstRegister,
-                                                             bool allowCombined) {
-    VCShaderInstruction *instruction = VCShaderCompiler_AllocateInstruction(function);
-    instruction->operation = VC_SHADER_INSTRUCTION_SUB;
-    instruction->destination = firstRegister;
-    instruction->operands[0] = VCShaderCompiler_GetValue(context,
-                                                         mode,
-                                                         function,
-                                                         cycle->sa,
-                                                         allowCombined);
-    instruction->operands[1] = VCShaderCompiler_GetValue(context,
-                                                         mode,
-                                                         function,
-                                                         cycle->sb,
-                                                         allowCombined);
-
-    instruction = VCShaderCompiler_AllocateInstruction(function);
-    instruction->operation = VC_SHADER_INSTRUCTION_MUL;
-    instruction->destination = firstRegister + 1;
-    instruction->operands[0] = firstRegister;
-    instruction->operands[1] = VCShaderCompiler_GetValue(context,
-                                                         mode,
-                                                         function,
-                                                         cycle->m,
-                                                         allowCombined);
-
-    instruction = VCShaderCompiler_AllocateInstruction(function);
-    instruction->operation = VC_SHADER_INSTRUCTION_ADD;
-    instruction->destination = firstRegister + 2;
-    instruction->operands[0] = firstRegister + 1;
-    instruction->operands[1] = VCShaderCompiler_GetValue(context,
-                                                         mode,
-                                                         function,
-                                                         cycle->a,
-                                                         allowCombined);
-
-    return firstRegister + 2;
-}
-
-static bool VCShaderCompiler_CombineInstructions(VCShaderFunction *function) {
-    bool changed = false;
-    for (size_t instructionIndex = 0;
-         instructionIndex < function->instructionCount;
-         instructionIndex++) {
-        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
-        switch (instruction->operation) {
-        case VC_SHADER_INSTRUCTION_ADD:
-            if (instruction->operands[0] == VC_SHADER_COMPILER_ZERO_VALUE) {
-                instruction->operation = VC_SHADER_INSTRUCTION_MOVE;
-                instruction->operands[0] = instruction->operands[1];
-                instruction->operands[1] = VC_SHADER_COMPILER_ZERO_VALUE;
-                changed = true;
-            } else if (instruction->operands[1] == VC_SHADER_COMPILER_ZERO_VALUE) {
-                instruction->operation = VC_SHADER_INSTRUCTION_MOVE;
-                instruction->operands[1] = VC_SHADER_COMPILER_ZERO_VALUE;
-                changed = true;
-            }
-            break;
-        case VC_SHADER_INSTRUCTION_SUB:
-            if (instruction->operands[1] == VC_SHADER_COMPILER_ZERO_VALUE) {
-                instruction->operation = VC_SHADER_INSTRUCTION_MOVE;
-                instruction->operands[1] = VC_SHADER_COMPILER_ZERO_VALUE;
-                changed = true;
-            } else if (instruction->operands[0] == instruction->operands[1]) {
-                instruction->operation = VC_SHADER_INSTRUCTION_MOVE;
-                instruction->operands[0] = VC_SHADER_COMPILER_ZERO_VALUE;
-                instruction->operands[1] = VC_SHADER_COMPILER_ZERO_VALUE;
-                changed = true;
-            }
-            break;
-        case VC_SHADER_INSTRUCTION_MUL:
-            if (instruction->operands[0] == VC_SHADER_COMPILER_ONE_VALUE) {
-                instruction->operation = VC_SHADER_INSTRUCTION_MOVE;
-                instruction->operands[0] = instruction->operands[1];
-                instruction->operands[1] = VC_SHADER_COMPILER_ZERO_VALUE;
-                changed = true;
-            } else if (instruction->operands[1] == VC_SHADER_COMPILER_ONE_VALUE) {
-                instruction->operation = VC_SHADER_INSTRUCTION_MOVE;
-                instruction->operands[1] = VC_SHADER_COMPILER_ZERO_VALUE;
-                changed = true;
-            } else if (instruction->operands[0] == VC_SHADER_COMPILER_ZERO_VALUE ||
-                       instruction->operands[1] == VC_SHADER_COMPILER_ZERO_VALUE) {
-                instruction->operation = VC_SHADER_INSTRUCTION_MOVE;
-                instruction->operands[0] = VC_SHADER_COMPILER_ZERO_VALUE;
-                instruction->operands[1] = VC_SHADER_COMPILER_ZERO_VALUE;
-                changed = true;
-            }
-            break;
-        }
-    }
-    return changed;
-}
-
-// Forward constant propagation.
-static bool VCShaderCompiler_PropagateConstants(VCShaderFunction *function) {
-    bool changed = false;
-    for (size_t instructionIndex = 0;
-         instructionIndex < function->instructionCount;
-         instructionIndex++) {
-        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
-        if (instruction->operation != VC_SHADER_INSTRUCTION_MOVE)
-            continue;
-        if (instruction->operands[0] < VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE)
-            continue;
-        assert(instruction->destination != instruction->operands[0]);
-        assert(instruction->operands[1] == VC_SHADER_COMPILER_ZERO_VALUE);
-        for (size_t destinationInstructionIndex = instructionIndex + 1;
-             destinationInstructionIndex < function->instructionCount;
-             destinationInstructionIndex++) {
-            VCShaderInstruction *destinationInstruction =
-                &function->instructions[destinationInstructionIndex];
-            for (uint8_t operandIndex = 0; operandIndex < 2; operandIndex++) { 
-                uint8_t operand = destinationInstruction->operands[operandIndex];
-                if (operand != instruction->destination)
-                    continue;
-                destinationInstruction->operands[operandIndex] = instruction->operands[0];
-                changed = true;
-            }
-        }
-    }
-    return changed;
-}
-
-// Backward value propagation.
-static bool VCShaderCompiler_PropagateValues(VCShaderFunction *function) {
-    bool changed = false;
-    size_t instructionIndex = function->instructionCount;
-    while (instructionIndex > 1) {
-        instructionIndex--;
-        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
-        if (instruction->operation != VC_SHADER_INSTRUCTION_MOVE)
-            continue;
-        if (instruction->operands[0] >= VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE)
-            continue;
-        assert(instruction->destination != instruction->operands[0]);
-        assert(instruction->operands[1] == VC_SHADER_COMPILER_ZERO_VALUE);
-        size_t sourceInstructionIndex = instructionIndex;
-        while (true) {
-            assert(sourceInstructionIndex != 0);
-            sourceInstructionIndex--;
-            VCShaderInstruction *sourceInstruction =
-                &function->instructions[sourceInstructionIndex];
-            if (sourceInstruction->destination != instruction->operands[0])
-                continue;
-            instruction->operation = sourceInstruction->operation;
-            instruction->operands[0] = sourceInstruction->operands[0];
-            instruction->operands[1] = sourceInstruction->operands[1];
-            changed = true;
-            break;
-        }
-    }
-    return changed;
-}
-
-static size_t VCShaderCompiler_CountRegistersUsedInFunction(VCShaderFunction *function) {
-    size_t maxRegisterNumber = 0;
-    for (size_t instructionIndex = 0;
-         instructionIndex < function->instructionCount;
-         instructionIndex++) {
-        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
-        if (instruction->destination < VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE) {
-            uint8_t registerNumber = instruction->destination;
-            if (maxRegisterNumber < (uint8_t)(registerNumber + 1)) {
-                maxRegisterNumber = (uint8_t)(registerNumber + 1);
-            }
-        }
-    }
-    return maxRegisterNumber;
-}
-
-static bool VCShaderCompiler_EliminateDeadCode(VCShaderFunction *function) {
-    size_t registerCount = VCShaderCompiler_CountRegistersUsedInFunction(function);
-    bool *usedRegisters = (bool *)malloc(sizeof(bool) * registerCount);
-    for (size_t registerIndex = 0; registerIndex < registerCount; registerIndex++)
-        usedRegisters[registerIndex] = 0;
-
-    for (size_t instructionIndex = 0;
-         instructionIndex < function->instructionCount;
-         instructionIndex++) {
-        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
-        if (instruction->operands[0] < VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE)
-            usedRegisters[instruction->operands[0]] = true;
-        if (instruction->operands[1] < VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE)
-            usedRegisters[instruction->operands[1]] = true;
-    }
-
-    size_t destinationInstructionIndex = 0;
-    for (size_t instructionIndex = 0;
-         instructionIndex < function->instructionCount;
-         instructionIndex++) {
-        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
-        if (instruction->destination < VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE &&
-                !usedRegisters[instruction->destination]) {
-            // Zap this instruction.
-            continue;
-        }
-        function->instructions[destinationInstructionIndex] =
-            function->instructions[instructionIndex];
-        destinationInstructionIndex++;
-    }
-
-    free(usedRegisters);
-
-    bool changed = function->instructionCount != destinationInstructionIndex;
-    if (changed)
-        function->instructionCount = destinationInstructionIndex;
-    return changed;
-}
-
-static void VCShaderCompiler_RenumberRegisters(VCShaderFunction *function) {
-    size_t registerCount = VCShaderCompiler_CountRegistersUsedInFunction(function);
-    uint8_t *newRegisterMapping = (uint8_t *)malloc(sizeof(uint8_t) * registerCount);
-    memset(newRegisterMapping, 0xff, sizeof(uint8_t) * registerCount);
-
-    uint8_t newRegisterCount = 0;
-    for (size_t instructionIndex = 0;
-         instructionIndex < function->instructionCount;
-         instructionIndex++) {
-        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
-        for (uint8_t operandIndex = 0; operandIndex < 2; operandIndex++) {
-            uint8_t operand = instruction->operands[operandIndex];
-            if (operand >= VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE)
-                continue;
-            uint8_t newOperand = newRegisterMapping[operand];
-            assert(newOperand != 0xff);
-            instruction->operands[operandIndex] = newOperand;
-        }
-        if (instruction->destination >= VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE)
-            continue;
-        newRegisterMapping[instruction->destination] = newRegisterCount;
-        instruction->destination = newRegisterCount;
-        newRegisterCount++;
-    }
-
-    free(newRegisterMapping);
-}
-
-static void VCShaderCompiler_OptimizeFunction(VCShaderFunction *function) {
-    bool changed = true;
-    while (changed) {
-        changed = false;
-        changed = VCShaderCompiler_CombineInstructions(function);
-        changed = VCShaderCompiler_PropagateValues(function) || changed;
-        changed = VCShaderCompiler_PropagateConstants(function) || changed;
-        changed = VCShaderCompiler_EliminateDeadCode(function) || changed;
-    }
-
-    VCShaderCompiler_RenumberRegisters(function);
-}
-
-static VCShaderFunction VCShaderCompiler_GenerateFunction(VCShaderSubprogramContext *context,
-                                                          uint8_t mode,
-                                                          VCUnpackedCombinerFunction *cycle0,
-                                                          VCUnpackedCombinerFunction *cycle1) {
-    VCShaderFunction function;
-    function.instructions = (VCShaderInstruction *)malloc(sizeof(VCShaderInstruction) *
-                                                           VC_SHADER_MAX_INSTRUCTIONS);
-    function.instructionCount = 0;
-
-    uint8_t output = VCShaderCompiler_GenerateInstructionsForCycle(context,
-                                                                   mode,
-                                                                   &function,
-                                                                   cycle0,
-                                                                   0,
-                                                                   false);
-    if (cycle1 != NULL) {
-        output = VCShaderCompiler_GenerateInstructionsForCycle(context,
-                                                               mode,
-                                                               &function,
-                                                               cycle1,
-                                                               output + 1,
-                                                               true); 
-    }
-
-    VCShaderInstruction *outputInstruction = VCShaderCompiler_AllocateInstruction(&function);
-    outputInstruction->operation = VC_SHADER_INSTRUCTION_MOVE;
-    outputInstruction->destination = VC_SHADER_COMPILER_OUTPUT_VALUE;
-    outputInstruction->operands[0] = output;
-    outputInstruction->operands[1] = VC_SHADER_COMPILER_ZERO_VALUE;
-
-    return function;
-}
-
-static void VCShaderCompiler_CreateSubprogramForNormalTriangleMode(
-        VCShaderSubprogramSource *source,
-        VCShaderSubprogram *subprogram) {
-    VCUnpackedCombinerFunction cycle0Function;
-    cycle0Function.sa = source->cycle0.saRGB;
-    cycle0Function.sb = source->cycle0.sbRGB;
-    cycle0Function.m = source->cycle0.mRGB;
-    cycle0Function.a = source->cycle0.aRGB;
-    if (!source->context.secondCycleEnabled) {
-        subprogram->rgb = VCShaderCompiler_GenerateFunction(&source->context,
-                                                            VC_SHADER_COMPILER_MODE_RGB,
-                                                            &cycle0Function,
-                                                            NULL);
-    } else {
-        VCUnpackedCombinerFunction cycle1Function;
-        cycle1Function.sa = source->cycle1.saRGB;
-        cycle1Function.sb = source->cycle1.sbRGB;
-        cycle1Function.m = source->cycle1.mRGB;
-        cycle1Function.a = source->cycle1.aRGB;
-        subprogram->rgb = VCShaderCompiler_GenerateFunction(&source->context,
-                                                            VC_SHADER_COMPILER_MODE_RGB,
-                                                            &cycle0Function,
-                                                            &cycle1Function);
-    }
-
-    cycle0Function.sa = source->cycle0.saA;
-    cycle0Function.sb = source->cycle0.sbA;
-    cycle0Function.m = source->cycle0.mA;
-    cycle0Function.a = source->cycle0.aA;
-    if (!source->context.secondCycleEnabled) {
-        subprogram->a = VCShaderCompiler_GenerateFunction(&source->context,
-                                                          VC_SHADER_COMPILER_MODE_ALPHA,
-                                                          &cycle0Function,
-                                                          NULL);
-    } else {
-        VCUnpackedCombinerFunction cycle1Function;
-        cycle1Function.sa = source->cycle1.saA;
-        cycle1Function.sb = source->cycle1.sbA;
-        cycle1Function.m = source->cycle1.mA;
-        cycle1Function.a = source->cycle1.aA;
-        subprogram->a = VCShaderCompiler_GenerateFunction(&source->context,
-                                                          VC_SHADER_COMPILER_MODE_ALPHA,
-                                                          &cycle0Function,
-                                                          &cycle1Function);
-    }
-}
-
-static void VCShaderCompiler_CreateSubprogramForRectFillTriangleMode(
-        VCShaderSubprogramSource *source,
-        VCShaderSubprogram *subprogram) {
-    VCUnpackedCombinerFunction cycle0Function;
-    cycle0Function.sa = VC_COMBINER_CCMUX_SHADE;
-    cycle0Function.sb = VC_COMBINER_CCMUX_0;
-    cycle0Function.m = VC_COMBINER_CCMUX_1;
-    cycle0Function.a = VC_COMBINER_CCMUX_0;
-    subprogram->rgb = VCShaderCompiler_GenerateFunction(&source->context,
-                                                        VC_SHADER_COMPILER_MODE_RGB,
-                                                        &cycle0Function,
-                                                        NULL);
-
-    cycle0Function.sa = VC_COMBINER_ACMUX_SHADE;
-    cycle0Function.sb = VC_COMBINER_ACMUX_0;
-    cycle0Function.m = VC_COMBINER_ACMUX_1;
-    cycle0Function.a = VC_COMBINER_ACMUX_0;
-    subprogram->a = VCShaderCompiler_GenerateFunction(&source->context,
-                                                      VC_SHADER_COMPILER_MODE_ALPHA,
-                                                      &cycle0Function,
-                                                      NULL);
-}
-
-static VCShaderSubprogram *VCShaderCompiler_CreateSubprogram(VCShaderSubprogramSource *source) {
-    VCShaderSubprogram *subprogram = (VCShaderSubprogram *)malloc(sizeof(VCShaderSubprogram));
-    subprogram->source = *source;
-
-    switch (source->context.triangleMode) {
-    case VC_TRIANGLE_MODE_NORMAL:
-    case VC_TRIANGLE_MODE_TEXTURE_RECTANGLE:
-        VCShaderCompiler_CreateSubprogramForNormalTriangleMode(source, subprogram);
-        break;
-    case VC_TRIANGLE_MODE_RECT_FILL:
-        VCShaderCompiler_CreateSubprogramForRectFillTriangleMode(source, subprogram);
-        break;
-    default:
-        assert(0 && "Unknown triangle mode when creating subprogram!");
-    }
-
-    VCShaderCompiler_OptimizeFunction(&subprogram->rgb);
-    VCShaderCompiler_OptimizeFunction(&subprogram->a);
-
-    return subprogram;
-}
-
-static void VCShaderCompiler_GenerateGLSLForValue(VCString *shaderSource,
-                                                  VCShaderFunction *function,
-                                                  const char *outputLocation,
-                                                  uint8_t value) {
-    const char *staticString = NULL;
-    switch (value) {
-    case VC_SHADER_COMPILER_ZERO_VALUE:
-        staticString = "vec4(0.0)";
-        break;
-    case VC_SHADER_COMPILER_ONE_VALUE:
-        staticString = "vec4(1.0)";
-        break;
-    case VC_SHADER_COMPILER_PRIMITIVE_VALUE:
-        staticString = "vPrimitive";
-        break;
-    case VC_SHADER_COMPILER_PRIMITIVE_ALPHA_VALUE:
-        staticString = "vPrimitive.aaaa";
-        break;
-    case VC_SHADER_COMPILER_ENVIRONMENT_VALUE:
-        staticString = "vEnvironment";
-        break;
-    case VC_SHADER_COMPILER_ENVIRONMENT_ALPHA_VALUE:
-        staticString = "vEnvironment.aaaa";
-        break;
-    case VC_SHADER_COMPILER_TEXEL0_VALUE:
-        staticString = "texture0Color";
-        break;
-    case VC_SHADER_COMPILER_TEXEL0_ALPHA_VALUE:
-        staticString = "texture0Color.aaaa";
-        break;
-    case VC_SHADER_COMPILER_TEXEL1_VALUE:
-        staticString = "texture1Color";
-        break;
-    case VC_SHADER_COMPILER_TEXEL1_ALPHA_VALUE:
-        staticString = "texture1Color.aaaa";
-        break;
-    case VC_SHADER_COMPILER_SHADE_VALUE:
-        staticString = "vShade";
-        break;
-    case VC_SHADER_COMPILER_SHADE_ALPHA_VALUE:
-        staticString = "vShade.aaaa";
-        break;
-    case VC_SHADER_COMPILER_OUTPUT_VALUE:
-        staticString = outputLocation;
-        break;
-    }
-
-    if (staticString != NULL) {
-        VCString_AppendCString(shaderSource, staticString);
-        return;
-    }
-
-    assert(value < VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE);
-    VCString_AppendFormat(shaderSource, "r%d", (int)value);
-}
-
-static void VCShaderCompiler_GenerateGLSLForFunction(VCString *shaderSource,
-                                                     VCShaderFunction *function,
-                                                     const char *outputLocation) {
-    for (size_t instructionIndex = 0;
-         instructionIndex < function->instructionCount;
-         instructionIndex++) {
-        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
-        VCString_AppendCString(shaderSource, "        ");
-        VCShaderCompiler_GenerateGLSLForValue(shaderSource,
-                                              function,
-                                              outputLocation,
-                                              instruction->destination);
-        VCString_AppendCString(shaderSource, " = ");
-        VCShaderCompiler_GenerateGLSLForValue(shaderSource,
-                                              function,
-                                              outputLocation,
-                                              instruction->operands[0]);
-        if (instruction->operation != VC_SHADER_INSTRUCTION_MOVE) {
-            char glslOperator;
-            switch (instruction->operation) {
-            case VC_SHADER_INSTRUCTION_ADD:
-                glslOperator = '+';
-                break;
-            case VC_SHADER_INSTRUCTION_SUB:
-                glslOperator = '-';
-                break;
-            case VC_SHADER_INSTRUCTION_MUL:
-                glslOperator = '*';
-                break;
-            default:
-                fprintf(stderr, "Unexpected operation in shader compilation!");
-                abort();
-            }
-            VCString_AppendFormat(shaderSource, " %c ", glslOperator);
-            VCShaderCompiler_GenerateGLSLForValue(shaderSource,
-                                                  function,
-                                                  outputLocation,
-                                                  instruction->operands[1]);
-        }
-        VCString_AppendCString(shaderSource, ";\n");
-    }
-}
-
-static size_t VCShaderCompiler_CountRegistersUsedInProgram(VCShaderProgram *program) {
-    size_t maxRegisterCount = 0;
-    for (size_t subprogramIndex = 0;
-         subprogramIndex < program->subprogramCount;
-         subprogramIndex++) {
-        VCShaderSubprogram *subprogram = program->subprograms[subprogramIndex];
-        size_t registerCount = VCShaderCompiler_CountRegistersUsedInFunction(&subprogram->rgb);
-        if (maxRegisterCount < registerCount)
-            maxRegisterCount = registerCount;
-        registerCount = VCShaderCompiler_CountRegistersUsedInFunction(&subprogram->a);
-        if (maxRegisterCount < registerCount)
-            maxRegisterCount = registerCount;
-    }
-    return maxRegisterCount;
-}
-
-void VCShaderCompiler_GenerateGLSLFragmentShaderForProgram(VCString *shaderSource,
-                                                           VCShaderProgram *program) {
-    assert(program->subprogramCount > 0);
-    size_t registerCount = VCShaderCompiler_CountRegistersUsedInProgram(program);
-    VCString_AppendCString(shaderSource, "void main(void) {\n");
-    VCString_AppendCString(
-            shaderSource,
-            "    vec4 texture0Color = texture2D(uTexture0, AtlasUv(vTexture0Bounds));\n");
-    VCString_AppendCString(
-            shaderSource,
-            "    vec4 texture1Color = texture2D(uTexture1, AtlasUv(vTexture1Bounds));\n");
-    VCString_AppendCString(shaderSource, "    vec4 fragRGB;\n");
-    VCString_AppendCString(shaderSource, "    vec4 fragA;\n");
-    for (size_t i = 0; i < registerCount; i++)
-        VCString_AppendFormat(shaderSource, "    vec4 r%d;\n", (int)i);
-    for (size_t subprogramIndex = 0;
-         subprogramIndex < program->subprogramCount;
-         subprogramIndex++) {
-        VCShaderSubprogram *subprogram = program->subprograms[subprogramIndex];
-
-        // Add a fudge factor of 0.5 in each direction because the VideoCore IV sometimes adds some
-        // error (due to perspective correction, presumably) to varyings for polygons close to the
-        // camera.
-        if (subprogramIndex == 0) {
-            VCString_AppendCString(shaderSource, "    if (vControl.x < 0.5) {\n");
-        } else {
-            VCString_AppendFormat(shaderSource, "    } else if (vControl.x < %d.5) {\n",
-                                  (int)subprogramIndex);
-        }
-        VCShaderCompiler_GenerateGLSLForFunction(shaderSource, &subprogram->rgb, "fragRGB");
-        VCShaderCompiler_GenerateGLSLForFunction(shaderSource, &subprogram->a, "fragA");
-    }
-    VCString_AppendCString(shaderSource, "    } else {\n");
-    VCString_AppendCString(shaderSource, "        fragRGB = vec4(1.0, 0.0, 0.0, 1.0);\n");
-    VCString_AppendCString(shaderSource, "        fragA = vec4(1.0);\n");
-    VCString_AppendCString(shaderSource, "    }\n");
-    VCString_AppendCString(shaderSource, "    if (fragA.a * 255.0 < vControl.y)\n");
-    VCString_AppendCString(shaderSource, "        discard;\n");
-    VCString_AppendCString(shaderSource, "    if (vControl.z < 0.5)\n");
-    VCString_AppendCString(shaderSource, "        fragA.a = 1.0;\n");
-    VCString_AppendCString(shaderSource, "    else if (vControl.z < 1.5)\n");
-    VCString_AppendCString(shaderSource, "        fragA.a = 0.0;\n");
-    VCString_AppendCString(shaderSource, "    gl_FragColor = vec4(fragRGB.rgb, fragA.a);\n");
-    VCString_AppendCString(shaderSource, "}\n");
-}
-
-VCShaderSubprogramSignatureTable VCShaderCompiler_CreateSubprogramSignatureTable() {
-    VCShaderSubprogramSignatureTable table = { NULL };
-    return table;
-}
-
-void VCShaderCompiler_DestroySubprogramSignatureTable(VCShaderSubprogramSignatureTable *list) {
-    VCShaderSubprogramSignatureTableEntry *entry = NULL, *tempEntry = NULL;
-    HASH_ITER(hh, list->entries, entry, tempEntry) {
-        HASH_DEL(list->entries, entry);
-        free(entry);
-    }
-}
-
-static void VCShaderCompiler_AppendFunctionToSignature(VCString *signatureData,
-                                                       VCShaderFunction *function) {
-    VCString_AppendBytes(signatureData,
-                         function->instructions,
-                         function->instructionCount * sizeof(VCShaderInstruction));
-}
-
-static VCShaderSubprogramSignature *VCShaderCompiler_CreateSignatureForSubprogram(
-        VCShaderSubprogram *subprogram) {
-    VCShaderSubprogramSignature *signature = (VCShaderSubprogramSignature *)
-        malloc(sizeof(VCShaderSubprogramSignature));
-    signature->source = subprogram->source;
-    memset(&signature->hh, '\0', sizeof(signature->hh));
-
-    signature->serializedData = VCString_Create();
-    VCShaderCompiler_AppendFunctionToSignature(&signature->serializedData, &subprogram->rgb);
-    VCShaderCompiler_AppendFunctionToSignature(&signature->serializedData, &subprogram->a);
-    return signature;
-}
-
-VCShaderSubprogramContext VCShaderCompiler_CreateSubprogramContext(VCColor primColor,
-                                                                   VCColor envColor,
-                                                                   bool secondCycleEnabled,
-                                                                   uint8_t triangleMode) {
-    VCShaderSubprogramContext subprogramContext;
-    subprogramContext.primColor = primColor;
-    subprogramContext.envColor = envColor;
-    subprogramContext.secondCycleEnabled = secondCycleEnabled;
-    subprogramContext.triangleMode = triangleMode;
-    return subprogramContext;
-}
-
-static size_t VCShaderCompiler_GetSubprogramSignatureCount(
-        VCShaderSubprogramSignatureTable *table) {
-    return HASH_COUNT(table->entries);
-}
-
-uint16_t VCShaderCompiler_GetOrCreateSubprogramID(VCShaderSubprogramSignatureTable *table,
-                                                  VCShaderSubprogramSignature *signature) {
-    VCShaderSubprogramSignatureTableEntry *entry = NULL;
-    HASH_FIND(hh,
-              table->entries,
-              signature->serializedData.ptr,
-              signature->serializedData.len,
-              entry);
-    if (entry != NULL)
-        return entry->id;
-
-    entry = (VCShaderSubprogramSignatureTableEntry *)
-        malloc(sizeof(VCShaderSubprogramSignatureTableEntry));
-    entry->signature = *signature;
-    size_t id = VCShaderCompiler_GetSubprogramSignatureCount(table);
-    assert(id <= UINT16_MAX);
-    entry->id = (uint16_t)id;
-    memset(&entry->hh, '\0', sizeof(entry->hh));
-    HASH_ADD_KEYPTR(hh,
-                    table->entries,
-                    signature->serializedData.ptr,
-                    signature->serializedData.len,
-                    entry);
-    return entry->id;
-}
-
-static VCShaderSubprogram *VCShaderCompiler_GetSubprogramForSignature(
-        VCShaderSubprogramLibrary *library,
-        VCShaderSubprogramSignature *signature) {
-    VCShaderSubprogramEntry *subprogramEntry = NULL;
-    HASH_FIND(hh,
-              library->subprograms,
-              signature->serializedData.ptr,
-              signature->serializedData.len,
-              subprogramEntry);
-    assert(subprogramEntry != NULL);
-    return subprogramEntry->subprogram;
-}
-
-VCShaderProgram *VCShaderCompiler_GetOrCreateProgram(
-        VCShaderSubprogramLibrary *subprogramLibrary,
-        VCShaderProgramDescriptor *programDescriptor) {
-    if (programDescriptor->program != NULL)
-        return programDescriptor->program;
-
-    VCShaderProgram *program = (VCShaderProgram *)malloc(sizeof(VCShaderProgram));
-    program->subprogramCount = programDescriptor->subprogramSignatures.length;
-    program->subprograms = (VCShaderSubprogram **)
-        malloc(sizeof(VCShaderSubprogram *) * program->subprogramCount);
-
-    for (size_t subprogramID = 0; subprogramID < program->subprogramCount; subprogramID++) {
-        VCShaderSubprogramSignatureListEntry *entry =
-            &programDescriptor->subprogramSignatures.entries[subprogramID];
-        assert(subprogramID < program->subprogramCount);
-        program->subprograms[subprogramID] =
-            VCShaderCompiler_GetSubprogramForSignature(subprogramLibrary, &entry->signature);
-    }
-
-    programDescriptor->program = program;
-    return program;
-}
-
-VCShaderProgramDescriptor *VCShaderCompiler_GetShaderProgramDescriptorByID(
-        VCShaderProgramDescriptorLibrary *library,
-        uint16_t id) {
-    assert(id < library->shaderProgramDescriptorCount);
-    VCShaderProgramDescriptor *descriptor = NULL, *tempDescriptor = NULL;
-    HASH_ITER(hh, library->shaderProgramDescriptors, descriptor, tempDescriptor) {
-        if (descriptor->id == id)
-            return descriptor;
-    }
-    assert(0 && "Didn't find shader program descriptor with that ID!");
-    abort(); 
-}
-
-VCShaderSubprogramSignatureList VCShaderCompiler_ConvertSubprogramSignatureTableToList(
-        VCShaderSubprogramSignatureTable *table) {
-    VCShaderSubprogramSignatureList list = { NULL, 0 };
-    list.length = HASH_COUNT(table->entries);
-    list.entries = (VCShaderSubprogramSignatureListEntry *)
-        malloc(sizeof(VCShaderSubprogramSignatureListEntry) * list.length);
-    VCShaderSubprogramSignatureTableEntry *entry = NULL, *tempEntry = NULL;
-    HASH_ITER(hh, table->entries, entry, tempEntry) {
-        assert(entry->id < list.length);
-        list.entries[entry->id].signature = entry->signature;
-    }
-    return list;
-}
-
-void VCShaderCompiler_DestroySubprogramSignatureList(VCShaderSubprogramSignatureList *list) {
-    free(list->entries);
-    list->entries = NULL;
-    list->length = 0;
-}
-
-VCShaderSubprogramLibrary *VCShaderCompiler_CreateSubprogramLibrary() {
-    VCShaderSubprogramLibrary *library = (VCShaderSubprogramLibrary *)
-        malloc(sizeof(VCShaderSubprogramLibrary));
-    library->signatures = NULL;
-    library->subprograms = NULL;
-    return library;
-}
-
-static VCShaderSubprogramSignature VCShaderCompiler_DuplicateSignature(
-        VCShaderSubprogramSignature *signature) {
-    VCShaderSubprogramSignature newSignature;
-    newSignature.source = signature->source;
-    newSignature.serializedData = VCString_Duplicate(&signature->serializedData);
-    memset(&newSignature.hh, '\0', sizeof(newSignature.hh));
-    return newSignature;
-}
-
-VCShaderSubprogramSignature VCShaderCompiler_GetOrCreateSubprogramSignatureForCurrentCombiner(
-        VCShaderSubprogramLibrary *library,
-        VCShaderSubprogramContext *context) {
-    VCShaderSubprogramSource source;
-    VCCombiner_UnpackCurrentRGBCombiner(&source.cycle0, &source.cycle1);
-    VCCombiner_UnpackCurrentACombiner(&source.cycle0, &source.cycle1);
-    source.context = *context;
-
-    VCShaderSubprogramSignature *signature = NULL;
-    HASH_FIND(hh, library->signatures, &source, sizeof(VCShaderSubprogramSource), signature);
-    if (signature != NULL)
-        return *signature;
-
-    VCShaderSubprogram *subprogram = VCShaderCompiler_CreateSubprogram(&source);
-    signature = VCShaderCompiler_CreateSignatureForSubprogram(subprogram);
-    HASH_ADD(hh, library->signatures, source, sizeof(VCShaderSubprogramSource), signature);
-
-    VCShaderSubprogramEntry *entry = (VCShaderSubprogramEntry *)
-        malloc(sizeof(VCShaderSubprogramEntry));
-    entry->signature = VCShaderCompiler_DuplicateSignature(signature);
-    entry->subprogram = subprogram;
-    HASH_ADD_KEYPTR(hh, 
-                    library->subprograms,
-                    signature->serializedData.ptr,
-                    signature->serializedData.len, 
-                    entry);
-
-    return *signature;
-}
-
-void VCShaderCompiler_DestroySubprogramSignature(VCShaderSubprogramSignature *signature) {
-    VCString_Destroy(&signature->serializedData);
-    memset(signature, '\0', sizeof(*signature));
-}
-
+// mupen64plus-video-videocore/VCShaderCompiler.cpp
+//
+// Copyright (c) 2016 The mupen64plus-video-videocore Authors
+
+#include "VCCombiner.h"
+#include "VCRenderer.h"
+#include "VCShaderCompiler.h"
+#include "VCUtils.h"
+#include "uthash.h"
+#include <assert.h>
+#include <limits.h>
+#include <stdlib.h>
+
+#define VC_SHADER_INSTRUCTION_MOVE          0
+#define VC_SHADER_INSTRUCTION_ADD           1
+#define VC_SHADER_INSTRUCTION_SUB           2
+#define VC_SHADER_INSTRUCTION_MUL           3
+// `mix(operands[1], operands[0], operands[2])`, that is, `(operands[0] - operands[1]) *
+// operands[2] + operands[1]`: a whole combiner cycle.
+#define VC_SHADER_INSTRUCTION_LERP          4
+// Alpha functions only: the first component of `operands[0]` of the RGB function, a register or
+// the output, whose components are all the same.
+#define VC_SHADER_INSTRUCTION_MOVE_RGB      5
+
+#define VC_SHADER_MAX_CONSTANTS             16
+
+#define VC_SHADER_COMPILER_REGISTER_VALUE           0x00
+#define VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE      0xf3
+#define VC_SHADER_COMPILER_ZERO_VALUE               0xf3
+#define VC_SHADER_COMPILER_ONE_VALUE                0xf4
+#define VC_SHADER_COMPILER_PRIMITIVE_VALUE          0xf5
+#define VC_SHADER_COMPILER_PRIMITIVE_ALPHA_VALUE    0xf6
+#define VC_SHADER_COMPILER_ENVIRONMENT_VALUE        0xf7
+#define VC_SHADER_COMPILER_ENVIRONMENT_ALPHA_VALUE  0xf8
+#define VC_SHADER_COMPILER_TEXEL0_VALUE             0xf9
+#define VC_SHADER_COMPILER_TEXEL0_ALPHA_VALUE       0xfa
+#define VC_SHADER_COMPILER_TEXEL1_VALUE             0xfb
+#define VC_SHADER_COMPILER_TEXEL1_ALPHA_VALUE       0xfc
+#define VC_SHADER_COMPILER_SHADE_VALUE              0xfd
+#define VC_SHADER_COMPILER_SHADE_ALPHA_VALUE        0xfe
+#define VC_SHADER_COMPILER_OUTPUT_VALUE             0xff
+
+#define VC_SHADER_COMPILER_MODE_RGB     0
+#define VC_SHADER_COMPILER_MODE_ALPHA   1
+
+#define VC_SHADER_COMPILER_MAX_PROGRAMS         64
+
+#define VC_SHADER_UBERSHADER_COMBINED_SELECTOR  12
+
+// SSA form instruction. Operands past those the operation takes are zero.
+struct VCShaderInstruction {
+    uint8_t operation;
+    uint8_t destination;
+    uint8_t operands[3];
+};
+
+struct VCShaderFunction {
+    VCShaderInstruction *instructions;
+    size_t instructionCount;
+    size_t instructionCapacity;
+    uint8_t mode;
+};
+
+struct VCShaderSubprogram {
+    VCShaderSubprogramSource source;
+    uint64_t key;
+    VCShaderFunction rgb;
+    VCShaderFunction a;
+};
+
+struct VCShaderSubprogramSourceEntry {
+    VCShaderSubprogramSource source;
+    uint16_t id;
+    UT_hash_handle hh;
+};
+
+struct VCShaderSubprogramKeyEntry {
+    uint64_t key;
+    uint16_t id;
+    UT_hash_handle hh;
+};
+
+// Interns subprograms: each distinct key gets an ID, which indexes `subprograms`. `sources` caches
+// the ID of every combiner state seen so far, since many states share a key.
+struct VCShaderSubprogramLibrary {
+    VCShaderSubprogramSourceEntry *sources;
+    VCShaderSubprogramKeyEntry *keys;
+    VCShaderSubprogram **subprograms;
+    size_t subprogramsLength;
+    size_t subprogramsCapacity;
+};
+
+struct VCShaderProgram {
+    VCShaderSubprogram **subprograms;
+    size_t subprogramCount;
+};
+
+struct VCUnpackedCombinerFunction {
+    uint8_t sa;
+    uint8_t sb;
+    uint8_t m;
+    uint8_t a;
+};
+
+// A set of subprograms that no program has exactly but that a resident program has all of.
+struct VCShaderProgramAlias {
+    uint16_t *subprogramIDs;
+    uint16_t subprogramCount;
+    VCShaderProgramDescriptor *programDescriptor;
+    UT_hash_handle hh;
+};
+
+struct VCShaderProgramDescriptorLibrary {
+    VCShaderProgramDescriptor *shaderProgramDescriptors;
+    size_t shaderProgramDescriptorCount;
+    VCShaderProgramAlias *aliases;
+};
+
+VCShaderProgramDescriptorLibrary *VCShaderCompiler_CreateShaderProgramDescriptorLibrary() {
+    VCShaderProgramDescriptorLibrary *library =
+        (VCShaderProgramDescriptorLibrary *)malloc(sizeof(VCShaderProgramDescriptorLibrary));
+    library->shaderProgramDescriptors = NULL;
+    library->shaderProgramDescriptorCount = 0;
+    library->aliases = NULL;
+    return library;
+}
+
+static uint16_t *VCShaderCompiler_DuplicateSubprogramIDs(VCShaderSubprogramIDList *list) {
+    uint16_t *ids = (uint16_t *)malloc(sizeof(uint16_t) * list->length);
+    if (ids == NULL)
+        abort();
+    memcpy(ids, list->ids, sizeof(uint16_t) * list->length);
+    return ids;
+}
+
+// Takes a copy of the list's IDs.
+static VCShaderProgramDescriptor *VCShaderCompiler_CreateShaderProgramDescriptor(
+        uint16_t id,
+        VCShaderSubprogramIDList *subprogramIDs) {
+    VCShaderProgramDescriptor *programDescriptor =
+        (VCShaderProgramDescriptor *)malloc(sizeof(VCShaderProgramDescriptor));
+    if (programDescriptor == NULL)
+        abort();
+    programDescriptor->id = id;
+    programDescriptor->program = NULL;
+    programDescriptor->subprogramCount = subprogramIDs->length;
+    programDescriptor->subprogramIDs = VCShaderCompiler_DuplicateSubprogramIDs(subprogramIDs);
+    return programDescriptor;
+}
+
+static void VCShaderCompiler_DestroyShaderFunction(VCShaderFunction *function) {
+    free(function->instructions);
+    function->instructions = NULL;
+    function->instructionCount = 0;
+    function->instructionCapacity = 0;
+}
+
+static void VCShaderCompiler_DestroyShaderSubprogram(VCShaderSubprogram *subprogram) {
+    memset(&subprogram->source, '\0', sizeof(VCShaderSubprogramSource));
+    VCShaderCompiler_DestroyShaderFunction(&subprogram->rgb);
+    VCShaderCompiler_DestroyShaderFunction(&subprogram->a);
+}
+
+#if 0
+static void VCShaderCompiler_DestroyShaderProgram(VCShaderProgram *program) {
+    // Does not destroy subprograms since programs only hold weak references to them.
+    free(program->subprograms);
+    program->subprograms = NULL;
+}
+#endif
+
+static void VCShaderCompiler_DestroyShaderProgramDescriptor(
+        VCShaderProgramDescriptor *descriptor) {
+    // FIXME(tachi): This does not destroy programs, so they leak. We should really duplicate them
+    // over to the renderer thread.
+    free(descriptor->subprogramIDs);
+    descriptor->subprogramIDs = NULL;
+    descriptor->subprogramCount = 0;
+    descriptor->program = NULL;
+    descriptor->id = 0;
+}
+
+struct VCShaderSubprogramSortEntry {
+    uint64_t key;
+    uint16_t id;
+    uint16_t originalIndex;
+};
+
+static int VCShaderCompiler_CompareSubprogramSortEntries(const void *a, const void *b) {
+    uint64_t keyA = ((const VCShaderSubprogramSortEntry *)a)->key;
+    uint64_t keyB = ((const VCShaderSubprogramSortEntry *)b)->key;
+    return keyA < keyB ? -1 : keyA > keyB ? 1 : 0;
+}
+
+static uint64_t VCShaderCompiler_GetKeyOfSubprogramID(VCShaderSubprogramLibrary *subprogramLibrary,
+                                                      uint16_t id) {
+    assert(id < subprogramLibrary->subprogramsLength);
+    return subprogramLibrary->subprograms[id]->key;
+}
+
+// Reinserts the program into the hash to maintain the LRU property.
+static void VCShaderCompiler_TouchShaderProgramDescriptor(
+        VCShaderProgramDescriptorLibrary *library,
+        VCShaderProgramDescriptor *programDescriptor) {
+    HASH_DEL(library->shaderProgramDescriptors, programDescriptor);
+    HASH_ADD_KEYPTR(hh,
+                    library->shaderProgramDescriptors,
+                    programDescriptor->subprogramIDs,
+                    sizeof(uint16_t) * programDescriptor->subprogramCount,
+                    programDescriptor);
+}
+
+// Both lists of IDs must be sorted by subprogram key.
+static bool VCShaderCompiler_ShaderProgramHasSubprograms(
+        VCShaderSubprogramLibrary *subprogramLibrary,
+        VCShaderProgramDescriptor *programDescriptor,
+        VCShaderSubprogramIDList *subprogramIDs) {
+    if (programDescriptor->subprogramCount < subprogramIDs->length)
+        return false;
+    uint16_t programIndex = 0;
+    for (uint16_t index = 0; index < subprogramIDs->length; index++) {
+        uint64_t key = VCShaderCompiler_GetKeyOfSubprogramID(subprogramLibrary,
+                                                             subprogramIDs->ids[index]);
+        while (programIndex < programDescriptor->subprogramCount &&
+                VCShaderCompiler_GetKeyOfSubprogramID(
+                    subprogramLibrary,
+                    programDescriptor->subprogramIDs[programIndex]) < key) {
+            programIndex++;
+        }
+        if (programIndex == programDescriptor->subprogramCount ||
+                programDescriptor->subprogramIDs[programIndex] != subprogramIDs->ids[index]) {
+            return false;
+        }
+        programIndex++;
+    }
+    return true;
+}
+
+// Finds the smallest resident program with all of the given subprograms and remembers the match.
+static VCShaderProgramDescriptor *VCShaderCompiler_FindShaderProgramWithSubprograms(
+        VCShaderProgramDescriptorLibrary *library,
+        VCShaderSubprogramLibrary *subprogramLibrary,
+        VCShaderSubprogramIDList *subprogramIDs) {
+    VCShaderProgramDescriptor *bestDescriptor = NULL, *descriptor = NULL, *tempDescriptor = NULL;
+    HASH_ITER(hh, library->shaderProgramDescriptors, descriptor, tempDescriptor) {
+        if ((bestDescriptor == NULL ||
+                    descriptor->subprogramCount < bestDescriptor->subprogramCount) &&
+                VCShaderCompiler_ShaderProgramHasSubprograms(subprogramLibrary,
+                                                             descriptor,
+                                                             subprogramIDs)) {
+            bestDescriptor = descriptor;
+        }
+    }
+    if (bestDescriptor == NULL)
+        return NULL;
+
+    VCShaderProgramAlias *alias = (VCShaderProgramAlias *)malloc(sizeof(VCShaderProgramAlias));
+    if (alias == NULL)
+        abort();
+    alias->subprogramIDs = VCShaderCompiler_DuplicateSubprogramIDs(subprogramIDs);
+    alias->subprogramCount = subprogramIDs->length;
+    alias->programDescriptor = bestDescriptor;
+    HASH_ADD_KEYPTR(hh,
+                    library->aliases,
+                    alias->subprogramIDs,
+                    sizeof(uint16_t) * alias->subprogramCount,
+                    alias);
+    return bestDescriptor;
+}
+
+// Programs list their subprograms in ascending order of subprogram key, so the order batches
+// happen to use subprograms in doesn't matter, and the same set of subprograms generates the same
+// GLSL in every session, whatever order their IDs were handed out in. Finding a program takes no
+// allocation. A batch whose subprograms are all in a resident program reuses that program instead
+// of getting its own. `subprogramIndices` receives, for each subprogram index in the batch as it
+// was, the index of the same subprogram in the program; vertices must be updated to match.
+uint16_t VCShaderCompiler_GetOrCreateShaderProgramID(VCShaderProgramDescriptorLibrary *library,
+                                                     VCShaderSubprogramLibrary *subprogramLibrary,
+                                                     VCShaderSubprogramIDList *subprogramIDs,
+                                                     uint8_t *subprogramIndices,
+                                                     uint8_t *resolution) {
+    VCShaderSubprogramSortEntry sortEntries[VC_SHADER_MAX_SUBPROGRAMS_PER_PROGRAM];
+    for (uint16_t index = 0; index < subprogramIDs->length; index++) {
+        sortEntries[index].key =
+            VCShaderCompiler_GetKeyOfSubprogramID(subprogramLibrary, subprogramIDs->ids[index]);
+        sortEntries[index].id = subprogramIDs->ids[index];
+        sortEntries[index].originalIndex = index;
+    }
+    qsort(sortEntries,
+          subprogramIDs->length,
+          sizeof(VCShaderSubprogramSortEntry),
+          VCShaderCompiler_CompareSubprogramSortEntries);
+    for (uint16_t index = 0; index < subprogramIDs->length; index++)
+        subprogramIDs->ids[index] = sortEntries[index].id;
+
+    size_t keyLength = sizeof(uint16_t) * subprogramIDs->length;
+    VCShaderProgramDescriptor *programDescriptor = NULL;
+    HASH_FIND(hh,
+              library->shaderProgramDescriptors,
+              subprogramIDs->ids,
+              keyLength,
+              programDescriptor);
+    *resolution = VC_SHADER_PROGRAM_FOUND;
+    if (programDescriptor == NULL) {
+        VCShaderProgramAlias *alias = NULL;
+        HASH_FIND(hh, library->aliases, subprogramIDs->ids, keyLength, alias);
+        if (alias != NULL)
+            programDescriptor = alias->programDescriptor;
+    }
+    if (programDescriptor == NULL) {
+        programDescriptor = VCShaderCompiler_FindShaderProgramWithSubprograms(library,
+                                                                              subprogramLibrary,
+                                                                              subprogramIDs);
+        *resolution = VC_SHADER_PROGRAM_REUSED;
+    }
+
+    if (programDescriptor != NULL) {
+        VCShaderCompiler_TouchShaderProgramDescriptor(library, programDescriptor);
+    } else {
+        uint16_t id = library->shaderProgramDescriptorCount;
+        library->shaderProgramDescriptorCount++;
+        programDescriptor = VCShaderCompiler_CreateShaderProgramDescriptor(id, subprogramIDs);
+        HASH_ADD_KEYPTR(hh,
+                        library->shaderProgramDescriptors,
+                        programDescriptor->subprogramIDs,
+                        keyLength,
+                        programDescriptor);
+        *resolution = VC_SHADER_PROGRAM_CREATED;
+    }
+
+    // The program's subprograms are a superset of the batch's in the same order, so one pass
+    // finds them all.
+    uint16_t programIndex = 0;
+    for (uint16_t index = 0; index < subprogramIDs->length; index++) {
+        while (programDescriptor->subprogramIDs[programIndex] != sortEntries[index].id) {
+            programIndex++;
+            assert(programIndex < programDescriptor->subprogramCount);
+        }
+        subprogramIndices[sortEntries[index].originalIndex] = (uint8_t)programIndex;
+    }
+    return programDescriptor->id;
+}
+
+bool VCShaderCompiler_ExpireOldProgramIfNecessary(VCShaderProgramDescriptorLibrary *library,
+                                                  uint16_t *shaderProgramIDToDelete) {
+    size_t programCount = HASH_COUNT(library->shaderProgramDescriptors);
+    if (programCount <= VC_SHADER_COMPILER_MAX_PROGRAMS)
+        return false;
+
+    assert(programCount > 0);
+    VCShaderProgramDescriptor *programDescriptorToDelete = library->shaderProgramDescriptors;
+    HASH_DEL(library->shaderProgramDescriptors, programDescriptorToDelete);
+    *shaderProgramIDToDelete = programDescriptorToDelete->id;
+
+    VCShaderProgramAlias *alias = NULL, *tempAlias = NULL;
+    HASH_ITER(hh, library->aliases, alias, tempAlias) {
+        if (alias->programDescriptor != programDescriptorToDelete)
+            continue;
+        HASH_DEL(library->aliases, alias);
+        free(alias->subprogramIDs);
+        free(alias);
+    }
+
+    VCShaderCompiler_DestroyShaderProgramDescriptor(programDescriptorToDelete);
+    free(programDescriptorToDelete);
+    return true;
+}
+
+// Folds primitive and environment colors of all zeroes or ones to constants, unless the context
+// treats them as unknown.
+static uint8_t VCShaderCompiler_SpecialRGBValueOrConstant(VCShaderSubprogramContext *context,
+                                                          VCColor *color,
+                                                          uint8_t specialValue) {
+    if (!context->foldColors)
+        return specialValue;
+    if (color->r == 0 && color->g == 0 && color->b == 0)
+        return VC_SHADER_COMPILER_ZERO_VALUE;
+    if (color->r == 255 && color->g == 255 && color->b == 255)
+        return VC_SHADER_COMPILER_ONE_VALUE;
+    return specialValue;
+}
+
+static uint8_t VCShaderCompiler_SpecialAlphaValueOrConstant(VCShaderSubprogramContext *context,
+                                                            VCColor *color,
+                                                            uint8_t specialValue) {
+    if (!context->foldColors)
+        return specialValue;
+    if (color->a == 0)
+        return VC_SHADER_COMPILER_ZERO_VALUE;
+    if (color->a == 255)
+        return VC_SHADER_COMPILER_ONE_VALUE;
+    return specialValue;
+}
+
+static uint8_t VCShaderCompiler_GetRGBValue(VCShaderSubprogramContext *context,
+                                            VCShaderFunction *function,
+                                            uint8_t source,
+                                            bool allowCombined) {
+    switch (source) {
+    case VC_COMBINER_CCMUX_COMBINED:
+        if (allowCombined)
+            return VC_SHADER_COMPILER_REGISTER_VALUE | 2;
+        return VC_SHADER_COMPILER_ZERO_VALUE;
+    case VC_COMBINER_CCMUX_COMBINED_ALPHA:
+        // FIXME(tachi): Support VC_COMBINER_CCMUX_COMBINED_ALPHA!
+        fprintf(stderr, "FIXME: VC_COMBINER_CCMUX_COMBINED_ALPHA! Expect bad colors.\n");
+        return VC_SHADER_COMPILER_ONE_VALUE;
+    case VC_COMBINER_CCMUX_TEXEL0:
+        return VC_SHADER_COMPILER_TEXEL0_VALUE;
+    case VC_COMBINER_CCMUX_TEXEL0_ALPHA:
+        return VC_SHADER_COMPILER_TEXEL0_ALPHA_VALUE;
+    case VC_COMBINER_CCMUX_TEXEL1:
+        return VC_SHADER_COMPILER_TEXEL1_VALUE;
+    case VC_COMBINER_CCMUX_TEXEL1_ALPHA:
+        return VC_SHADER_COMPILER_TEXEL1_ALPHA_VALUE;
+    case VC_COMBINER_CCMUX_SHADE:
+        return VC_SHADER_COMPILER_SHADE_VALUE;
+    case VC_COMBINER_CCMUX_SHADE_ALPHA:
+        return VC_SHADER_COMPILER_SHADE_ALPHA_VALUE;
+    case VC_COMBINER_CCMUX_PRIMITIVE:
+        return VCShaderCompiler_SpecialRGBValueOrConstant(context,
+                                                          &context->primColor,
+                                                          VC_SHADER_COMPILER_PRIMITIVE_VALUE);
+    case VC_COMBINER_CCMUX_ENVIRONMENT:
+        return VCShaderCompiler_SpecialRGBValueOrConstant(context,
+                                                          &context->envColor,
+                                                          VC_SHADER_COMPILER_ENVIRONMENT_VALUE);
+    case VC_COMBINER_CCMUX_PRIMITIVE_ALPHA:
+        return VCShaderCompiler_SpecialAlphaValueOrConstant(
+            context,
+            &context->primColor,
+            VC_SHADER_COMPILER_PRIMITIVE_ALPHA_VALUE);
+    case VC_COMBINER_CCMUX_ENV_ALPHA:
+        return VCShaderCompiler_SpecialAlphaValueOrConstant(
+            context,
+            &context->envColor,
+            VC_SHADER_COMPILER_ENVIRONMENT_ALPHA_VALUE);
+    case VC_COMBINER_CCMUX_NOISE:
+        return VC_SHADER_COMPILER_ONE_VALUE;
+    case VC_COMBINER_CCMUX_0:
+        return VC_SHADER_COMPILER_ZERO_VALUE;
+    case VC_COMBINER_CCMUX_1:
+        return VC_SHADER_COMPILER_ONE_VALUE;
+    }
+    // FIXME(tachi): Support K4, K5!
+    return VC_SHADER_COMPILER_ZERO_VALUE;
+}
+
+static uint8_t VCShaderCompiler_GetAlphaValue(VCShaderSubprogramContext *context,
+                                              VCShaderFunction *function,
+                                              uint8_t source,
+                                              bool allowCombined) {
+    switch (source) {
+    case VC_COMBINER_ACMUX_COMBINED:
+        if (allowCombined)
+            return VC_SHADER_COMPILER_REGISTER_VALUE | 2;
+        return VC_SHADER_COMPILER_ZERO_VALUE;
+    case VC_COMBINER_ACMUX_TEXEL0:
+        return VC_SHADER_COMPILER_TEXEL0_VALUE;
+    case VC_COMBINER_ACMUX_TEXEL1:
+        return VC_SHADER_COMPILER_TEXEL1_VALUE;
+    case VC_COMBINER_ACMUX_SHADE:
+        return VC_SHADER_COMPILER_SHADE_VALUE;
+    case VC_COMBINER_ACMUX_PRIMITIVE:
+        return VCShaderCompiler_SpecialAlphaValueOrConstant(context,
+                                                            &context->primColor,
+                                                            VC_SHADER_COMPILER_PRIMITIVE_VALUE);
+    case VC_COMBINER_ACMUX_ENVIRONMENT:
+        return VCShaderCompiler_SpecialAlphaValueOrConstant(context,
+                                                            &context->envColor,
+                                                            VC_SHADER_COMPILER_ENVIRONMENT_VALUE);
+    case VC_COMBINER_ACMUX_0:
+        return VC_SHADER_COMPILER_ZERO_VALUE;
+    case VC_COMBINER_ACMUX_1:
+        return VC_SHADER_COMPILER_ONE_VALUE;
+    }
+    // FIXME(tachi): Support G_ACMUX_PRIM_LOD_FRAC!
+    return VC_SHADER_COMPILER_ZERO_VALUE;
+}
+
+static uint8_t VCShaderCompiler_GetValue(VCShaderSubprogramContext *context,
+                                         uint8_t mode,
+                                         VCShaderFunction *function,
+                                         uint8_t source,
+                                         bool allowCombined) {
+    switch (mode) {
+    case VC_SHADER_COMPILER_MODE_RGB:
+        return VCShaderCompiler_GetRGBValue(context, function, source, allowCombined);
+    case VC_SHADER_COMPILER_MODE_ALPHA:
+        return VCShaderCompiler_GetAlphaValue(context, function, source, allowCombined);
+    default:
+        assert(0 && "Unknown shader compiler mode!");
+        return 0;
+    }
+}
+
+static VCShaderInstruction *VCShaderCompiler_AllocateInstruction(VCShaderFunction *function) {
+    if (function->instructionCount == function->instructionCapacity) {
+        function->instructionCapacity = function->instructionCapacity == 0 ? 8 :
+            function->instructionCapacity * 2;
+        function->instructions = (VCShaderInstruction *)
+            realloc(function->instructions,
+                    sizeof(VCShaderInstruction) * function->instructionCapacity);
+        if (function->instructions == NULL)
+            abort();
+    }
+    VCShaderInstruction *instruction = &function->instructions[function->instructionCount];
+    function->instructionCount++;
+    memset(instruction->operands, VC_SHADER_COMPILER_ZERO_VALUE, sizeof(instruction->operands));
+    return instruction;
+}
+
+static uint8_t VCShaderCompiler_GetOperandCount(uint8_t operation) {
+    switch (operation) {
+    case VC_SHADER_INSTRUCTION_MOVE:
+        return 1;
+    case VC_SHADER_INSTRUCTION_ADD:
+    case VC_SHADER_INSTRUCTION_SUB:
+    case VC_SHADER_INSTRUCTION_MUL:
+        return 2;
+    case VC_SHADER_INSTRUCTION_LERP:
+        return 3;
+    }
+    // `VC_SHADER_INSTRUCTION_MOVE_RGB` reads a register of another function.
+    return 0;
+}
+
+static bool VCShaderCompiler_OperationIsCommutative(uint8_t operation) {
+    return operation == VC_SHADER_INSTRUCTION_ADD || operation == VC_SHADER_INSTRUCTION_MUL;
+}
+
+// Cost model: scalar ALU operations per component for each operation, on a GPU with multiply-add.
+// `mix` is a subtract and a multiply-add; moves and swizzles fold into whatever reads them.
+static const uint8_t VCShaderCompiler_OperationCosts[] = { 0, 1, 1, 1, 2, 0 };
+
+static uint32_t VCShaderCompiler_GetFunctionCost(VCShaderFunction *function,
+                                                 uint8_t componentCount) {
+    uint32_t cost = 0;
+    for (size_t instructionIndex = 0;
+         instructionIndex < function->instructionCount;
+         instructionIndex++) {
+        uint8_t operation = function->instructions[instructionIndex].operation;
+        cost += VCShaderCompiler_OperationCosts[operation] * componentCount;
+    }
+    return cost;
+}
+
+// Returns the instruction that defines the register, or NULL if none does.
+static VCShaderInstruction *VCShaderCompiler_FindDefinition(VCShaderFunction *function,
+                                                            uint8_t value) {
+    if (value >= VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE)
+        return NULL;
+    for (size_t instructionIndex = 0;
+         instructionIndex < function->instructionCount;
+         instructionIndex++) {
+        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
+        if (instruction->destination == value)
+            return instruction;
+    }
+    return NULL;
+}
+
+static size_t VCShaderCompiler_CountUses(VCShaderFunction *function, uint8_t value) {
+    size_t useCount = 0;
+    for (size_t instructionIndex = 0;
+         instructionIndex < function->instructionCount;
+         instructionIndex++) {
+        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
+        uint8_t operandCount = VCShaderCompiler_GetOperandCount(instruction->operation);
+        for (uint8_t operandIndex = 0; operandIndex < operandCount; operandIndex++) {
+            if (instruction->operands[operandIndex] == value)
+                useCount++;
+        }
+    }
+    return useCount;
+}
+
+static void VCShaderCompiler_MakeMove(VCShaderInstruction *instruction, uint8_t value) {
+    instruction->operation = VC_SHADER_INSTRUCTION_MOVE;
+    memset(instruction->operands, VC_SHADER_COMPILER_ZERO_VALUE, sizeof(instruction->operands));
+    instruction->operands[0] = value;
+}
+
+static uint8_t VCShaderCompiler_GenerateInstructionsForCycle(VCShaderSubprogramContext *context,
+                                                             uint8_t mode,
+                                                             VCShaderFunction *function,
+                                                             VCUnpackedCombinerFunction *cycle,
+                                                             uint8_t firstRegister,
+                                                             bool allowCombined) {
+    VCShaderInstruction *instruction = VCShaderCompiler_AllocateInstruction(function);
+    instruction->operation = VC_SHADER_INSTRUCTION_SUB;
+    instruction->destination = firstRegister;
+    instruction->operands[0] = VCShaderCompiler_GetValue(context,
+                                                         mode,
+                                                         function,
+                                                         cycle->sa,
+                                                         allowCombined);
+    instruction->operands[1] = VCShaderCompiler_GetValue(context,
+                                                         mode,
+                                                         function,
+                                                         cycle->sb,
+                                                         allowCombined);
+
+    instruction = VCShaderCompiler_AllocateInstruction(function);
+    instruction->operation = VC_SHADER_INSTRUCTION_MUL;
+    instruction->destination = firstRegister + 1;
+    instruction->operands[0] = firstRegister;
+    instruction->operands[1] = VCShaderCompiler_GetValue(context,
+                                                         mode,
+                                                         function,
+                                                         cycle->m,
+                                                         allowCombined);
+
+    instruction = VCShaderCompiler_AllocateInstruction(function);
+    instruction->operation = VC_SHADER_INSTRUCTION_ADD;
+    instruction->destination = firstRegister + 2;
+    instruction->operands[0] = firstRegister + 1;
+    instruction->operands[1] = VCShaderCompiler_GetValue(context,
+                                                         mode,
+                                                         function,
+                                                         cycle->a,
+                                                         allowCombined);
+
+    return firstRegister + 2;
+}
+
+static bool VCShaderCompiler_CombineInstructions(VCShaderFunction *function) {
+    bool changed = false;
+    for (size_t instructionIndex = 0;
+         instructionIndex < function->instructionCount;
+         instructionIndex++) {
+        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
+        switch (instruction->operation) {
+        case VC_SHADER_INSTRUCTION_ADD:
+            if (instruction->operands[0] == VC_SHADER_COMPILER_ZERO_VALUE) {
+                instruction->operation = VC_SHADER_INSTRUCTION_MOVE;
+                instruction->operands[0] = instruction->operands[1];
+                instruction->operands[1] = VC_SHADER_COMPILER_ZERO_VALUE;
+                changed = true;
+            } else if (instruction->operands[1] == VC_SHADER_COMPILER_ZERO_VALUE) {
+                instruction->operation = VC_SHADER_INSTRUCTION_MOVE;
+                instruction->operands[1] = VC_SHADER_COMPILER_ZERO_VALUE;
+                changed = true;
+            }
+            break;
+        case VC_SHADER_INSTRUCTION_SUB:
+            if (instruction->operands[1] == VC_SHADER_COMPILER_ZERO_VALUE) {
+                instruction->operation = VC_SHADER_INSTRUCTION_MOVE;
+                instruction->operands[1] = VC_SHADER_COMPILER_ZERO_VALUE;
+                changed = true;
+            } else if (instruction->operands[0] == instruction->operands[1]) {
+                instruction->operation = VC_SHADER_INSTRUCTION_MOVE;
+                instruction->operands[0] = VC_SHADER_COMPILER_ZERO_VALUE;
+                instruction->operands[1] = VC_SHADER_COMPILER_ZERO_VALUE;
+                changed = true;
+            }
+            break;
+        case VC_SHADER_INSTRUCTION_MUL:
+            if (instruction->operands[0] == VC_SHADER_COMPILER_ONE_VALUE) {
+                instruction->operation = VC_SHADER_INSTRUCTION_MOVE;
+                instruction->operands[0] = instruction->operands[1];
+                instruction->operands[1] = VC_SHADER_COMPILER_ZERO_VALUE;
+                changed = true;
+            } else if (instruction->operands[1] == VC_SHADER_COMPILER_ONE_VALUE) {
+                instruction->operation = VC_SHADER_INSTRUCTION_MOVE;
+                instruction->operands[1] = VC_SHADER_COMPILER_ZERO_VALUE;
+                changed = true;
+            } else if (instruction->operands[0] == VC_SHADER_COMPILER_ZERO_VALUE ||
+                       instruction->operands[1] == VC_SHADER_COMPILER_ZERO_VALUE) {
+                instruction->operation = VC_SHADER_INSTRUCTION_MOVE;
+                instruction->operands[0] = VC_SHADER_COMPILER_ZERO_VALUE;
+                instruction->operands[1] = VC_SHADER_COMPILER_ZERO_VALUE;
+                changed = true;
+            }
+            break;
+        }
+    }
+    return changed;
+}
+
+// Forward constant propagation.
+static bool VCShaderCompiler_PropagateConstants(VCShaderFunction *function) {
+    bool changed = false;
+    for (size_t instructionIndex = 0;
+         instructionIndex < function->instructionCount;
+         instructionIndex++) {
+        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
+        if (instruction->operation != VC_SHADER_INSTRUCTION_MOVE)
+            continue;
+        if (instruction->operands[0] < VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE)
+            continue;
+        assert(instruction->destination != instruction->operands[0]);
+        assert(instruction->operands[1] == VC_SHADER_COMPILER_ZERO_VALUE);
+        for (size_t destinationInstructionIndex = instructionIndex + 1;
+             destinationInstructionIndex < function->instructionCount;
+             destinationInstructionIndex++) {
+            VCShaderInstruction *destinationInstruction =
+                &function->instructions[destinationInstructionIndex];
+            uint8_t operandCount =
+                VCShaderCompiler_GetOperandCount(destinationInstruction->operation);
+            for (uint8_t operandIndex = 0; operandIndex < operandCount; operandIndex++) {
+                uint8_t operand = destinationInstruction->operands[operandIndex];
+                if (operand != instruction->destination)
+                    continue;
+                destinationInstruction->operands[operandIndex] = instruction->operands[0];
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+// Backward value propagation.
+static bool VCShaderCompiler_PropagateValues(VCShaderFunction *function) {
+    bool changed = false;
+    size_t instructionIndex = function->instructionCount;
+    while (instructionIndex > 1) {
+        instructionIndex--;
+        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
+        if (instruction->operation != VC_SHADER_INSTRUCTION_MOVE)
+            continue;
+        if (instruction->operands[0] >= VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE)
+            continue;
+        assert(instruction->destination != instruction->operands[0]);
+        assert(instruction->operands[1] == VC_SHADER_COMPILER_ZERO_VALUE);
+        size_t sourceInstructionIndex = instructionIndex;
+        while (true) {
+            assert(sourceInstructionIndex != 0);
+            sourceInstructionIndex--;
+            VCShaderInstruction *sourceInstruction =
+                &function->instructions[sourceInstructionIndex];
+            if (sourceInstruction->destination != instruction->operands[0])
+                continue;
+            instruction->operation = sourceInstruction->operation;
+            memcpy(instruction->operands,
+                   sourceInstruction->operands,
+                   sizeof(instruction->operands));
+            changed = true;
+            break;
+        }
+    }
+    return changed;
+}
+
+static size_t VCShaderCompiler_CountRegistersUsedInFunction(VCShaderFunction *function) {
+    size_t maxRegisterNumber = 0;
+    for (size_t instructionIndex = 0;
+         instructionIndex < function->instructionCount;
+         instructionIndex++) {
+        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
+        if (instruction->destination < VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE) {
+            uint8_t registerNumber = instruction->destination;
+            if (maxRegisterNumber < (uint8_t)(registerNumber + 1)) {
+                maxRegisterNumber = (uint8_t)(registerNumber + 1);
+            }
+        }
+    }
+    return maxRegisterNumber;
+}
+
+static bool VCShaderCompiler_EliminateDeadCode(VCShaderFunction *function) {
+    size_t registerCount = VCShaderCompiler_CountRegistersUsedInFunction(function);
+    bool *usedRegisters = (bool *)malloc(sizeof(bool) * registerCount);
+    for (size_t registerIndex = 0; registerIndex < registerCount; registerIndex++)
+        usedRegisters[registerIndex] = 0;
+
+    for (size_t instructionIndex = 0;
+         instructionIndex < function->instructionCount;
+         instructionIndex++) {
+        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
+        uint8_t operandCount = VCShaderCompiler_GetOperandCount(instruction->operation);
+        for (uint8_t operandIndex = 0; operandIndex < operandCount; operandIndex++) {
+            uint8_t operand = instruction->operands[operandIndex];
+            if (operand < VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE)
+                usedRegisters[operand] = true;
+        }
+    }
+
+    size_t destinationInstructionIndex = 0;
+    for (size_t instructionIndex = 0;
+         instructionIndex < function->instructionCount;
+         instructionIndex++) {
+        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
+        if (instruction->destination < VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE &&
+                !usedRegisters[instruction->destination]) {
+            // Zap this instruction.
+            continue;
+        }
+        function->instructions[destinationInstructionIndex] =
+            function->instructions[instructionIndex];
+        destinationInstructionIndex++;
+    }
+
+    free(usedRegisters);
+
+    bool changed = function->instructionCount != destinationInstructionIndex;
+    if (changed)
+        function->instructionCount = destinationInstructionIndex;
+    return changed;
+}
+
+static void VCShaderCompiler_RenumberRegisters(VCShaderFunction *function) {
+    size_t registerCount = VCShaderCompiler_CountRegistersUsedInFunction(function);
+    uint8_t *newRegisterMapping = (uint8_t *)malloc(sizeof(uint8_t) * registerCount);
+    memset(newRegisterMapping, 0xff, sizeof(uint8_t) * registerCount);
+
+    uint8_t newRegisterCount = 0;
+    for (size_t instructionIndex = 0;
+         instructionIndex < function->instructionCount;
+         instructionIndex++) {
+        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
+        uint8_t operandCount = VCShaderCompiler_GetOperandCount(instruction->operation);
+        for (uint8_t operandIndex = 0; operandIndex < operandCount; operandIndex++) {
+            uint8_t operand = instruction->operands[operandIndex];
+            if (operand >= VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE)
+                continue;
+            uint8_t newOperand = newRegisterMapping[operand];
+            assert(newOperand != 0xff);
+            instruction->operands[operandIndex] = newOperand;
+        }
+        if (instruction->destination >= VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE)
+            continue;
+        newRegisterMapping[instruction->destination] = newRegisterCount;
+        instruction->destination = newRegisterCount;
+        newRegisterCount++;
+    }
+
+    free(newRegisterMapping);
+}
+
+// Algebraic identities beyond those `VCShaderCompiler_CombineInstructions` applies: `(a - b) + b`
+// and `(a + b) - b` are `a`, and a `mix` with equal ends, a constant weight, or a zero start
+// needs no `mix`.
+static bool VCShaderCompiler_ApplyIdentities(VCShaderFunction *function) {
+    bool changed = false;
+    for (size_t instructionIndex = 0;
+         instructionIndex < function->instructionCount;
+         instructionIndex++) {
+        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
+        switch (instruction->operation) {
+        case VC_SHADER_INSTRUCTION_ADD:
+            for (uint8_t operandIndex = 0; operandIndex < 2; operandIndex++) {
+                VCShaderInstruction *definition =
+                    VCShaderCompiler_FindDefinition(function,
+                                                    instruction->operands[operandIndex]);
+                if (definition == NULL ||
+                        definition->operation != VC_SHADER_INSTRUCTION_SUB ||
+                        definition->operands[1] != instruction->operands[1 - operandIndex]) {
+                    continue;
+                }
+                VCShaderCompiler_MakeMove(instruction, definition->operands[0]);
+                changed = true;
+                break;
+            }
+            break;
+        case VC_SHADER_INSTRUCTION_SUB:
+            {
+                VCShaderInstruction *definition =
+                    VCShaderCompiler_FindDefinition(function, instruction->operands[0]);
+                if (definition == NULL || definition->operation != VC_SHADER_INSTRUCTION_ADD)
+                    break;
+                for (uint8_t operandIndex = 0; operandIndex < 2; operandIndex++) {
+                    if (definition->operands[operandIndex] != instruction->operands[1])
+                        continue;
+                    VCShaderCompiler_MakeMove(instruction, definition->operands[1 - operandIndex]);
+                    changed = true;
+                    break;
+                }
+                break;
+            }
+        case VC_SHADER_INSTRUCTION_LERP:
+            if (instruction->operands[0] == instruction->operands[1] ||
+                    instruction->operands[2] == VC_SHADER_COMPILER_ZERO_VALUE) {
+                VCShaderCompiler_MakeMove(instruction, instruction->operands[1]);
+            } else if (instruction->operands[2] == VC_SHADER_COMPILER_ONE_VALUE) {
+                VCShaderCompiler_MakeMove(instruction, instruction->operands[0]);
+            } else if (instruction->operands[1] == VC_SHADER_COMPILER_ZERO_VALUE) {
+                instruction->operation = VC_SHADER_INSTRUCTION_MUL;
+                instruction->operands[1] = instruction->operands[2];
+                instruction->operands[2] = VC_SHADER_COMPILER_ZERO_VALUE;
+            } else {
+                break;
+            }
+            changed = true;
+            break;
+        }
+    }
+    return changed;
+}
+
+// Matches `(a - b) * c + b`, with the difference and the product used nowhere else, and if so
+// fills in `a`, `b`, and `c` as the operands of the equivalent `mix`.
+static bool VCShaderCompiler_MatchLerp(VCShaderFunction *function,
+                                       VCShaderInstruction *instruction,
+                                       uint8_t *operands) {
+    if (instruction->operation != VC_SHADER_INSTRUCTION_ADD)
+        return false;
+    for (uint8_t addendIndex = 0; addendIndex < 2; addendIndex++) {
+        uint8_t product = instruction->operands[addendIndex];
+        VCShaderInstruction *multiply = VCShaderCompiler_FindDefinition(function, product);
+        if (multiply == NULL ||
+                multiply->operation != VC_SHADER_INSTRUCTION_MUL ||
+                VCShaderCompiler_CountUses(function, product) != 1) {
+            continue;
+        }
+        for (uint8_t factorIndex = 0; factorIndex < 2; factorIndex++) {
+            uint8_t difference = multiply->operands[factorIndex];
+            VCShaderInstruction *subtract = VCShaderCompiler_FindDefinition(function, difference);
+            if (subtract == NULL ||
+                    subtract->operation != VC_SHADER_INSTRUCTION_SUB ||
+                    subtract->operands[1] != instruction->operands[1 - addendIndex] ||
+                    VCShaderCompiler_CountUses(function, difference) != 1) {
+                continue;
+            }
+            operands[0] = subtract->operands[0];
+            operands[1] = subtract->operands[1];
+            operands[2] = multiply->operands[1 - factorIndex];
+            return true;
+        }
+    }
+    return false;
+}
+
+// Turns combiner cycles back into `mix`es where the cost model has a `mix` cheaper than the
+// subtract, multiply, and add it replaces. Those are left for dead code elimination.
+static bool VCShaderCompiler_RecognizeLerps(VCShaderFunction *function) {
+    const uint8_t *costs = VCShaderCompiler_OperationCosts;
+    if (costs[VC_SHADER_INSTRUCTION_LERP] >= costs[VC_SHADER_INSTRUCTION_SUB] +
+            costs[VC_SHADER_INSTRUCTION_MUL] + costs[VC_SHADER_INSTRUCTION_ADD]) {
+        return false;
+    }
+
+    bool changed = false;
+    for (size_t instructionIndex = 0;
+         instructionIndex < function->instructionCount;
+         instructionIndex++) {
+        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
+        uint8_t operands[3];
+        if (!VCShaderCompiler_MatchLerp(function, instruction, operands))
+            continue;
+        instruction->operation = VC_SHADER_INSTRUCTION_LERP;
+        memcpy(instruction->operands, operands, sizeof(instruction->operands));
+        changed = true;
+    }
+    return changed;
+}
+
+// The RGB value every component of which is the given alpha function value, if there is one.
+// `rgbRegisters` maps alpha registers to RGB registers known to hold the same value, with
+// `VC_SHADER_COMPILER_OUTPUT_VALUE`, which no operand can be, for none.
+static uint8_t VCShaderCompiler_GetSplatRGBValue(uint8_t alphaValue, uint8_t *rgbRegisters) {
+    switch (alphaValue) {
+    case VC_SHADER_COMPILER_ZERO_VALUE:
+    case VC_SHADER_COMPILER_ONE_VALUE:
+        return alphaValue;
+    case VC_SHADER_COMPILER_PRIMITIVE_VALUE:
+    case VC_SHADER_COMPILER_PRIMITIVE_ALPHA_VALUE:
+        return VC_SHADER_COMPILER_PRIMITIVE_ALPHA_VALUE;
+    case VC_SHADER_COMPILER_ENVIRONMENT_VALUE:
+    case VC_SHADER_COMPILER_ENVIRONMENT_ALPHA_VALUE:
+        return VC_SHADER_COMPILER_ENVIRONMENT_ALPHA_VALUE;
+    case VC_SHADER_COMPILER_TEXEL0_VALUE:
+    case VC_SHADER_COMPILER_TEXEL0_ALPHA_VALUE:
+        return VC_SHADER_COMPILER_TEXEL0_ALPHA_VALUE;
+    case VC_SHADER_COMPILER_TEXEL1_VALUE:
+    case VC_SHADER_COMPILER_TEXEL1_ALPHA_VALUE:
+        return VC_SHADER_COMPILER_TEXEL1_ALPHA_VALUE;
+    case VC_SHADER_COMPILER_SHADE_VALUE:
+    case VC_SHADER_COMPILER_SHADE_ALPHA_VALUE:
+        return VC_SHADER_COMPILER_SHADE_ALPHA_VALUE;
+    }
+    if (alphaValue < VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE)
+        return rgbRegisters[alphaValue];
+    return VC_SHADER_COMPILER_OUTPUT_VALUE;
+}
+
+// Whether `otherInstruction` computes what `instruction` does. If `rgbRegisters` isn't NULL,
+// `instruction` is in an alpha function and `otherInstruction` in the RGB one.
+static bool VCShaderCompiler_InstructionsMatch(VCShaderInstruction *instruction,
+                                               VCShaderInstruction *otherInstruction,
+                                               uint8_t *rgbRegisters) {
+    if (instruction->operation != otherInstruction->operation)
+        return false;
+    uint8_t operandCount = VCShaderCompiler_GetOperandCount(instruction->operation);
+    uint8_t operands[3];
+    for (uint8_t operandIndex = 0; operandIndex < operandCount; operandIndex++) {
+        operands[operandIndex] = instruction->operands[operandIndex];
+        if (rgbRegisters != NULL) {
+            operands[operandIndex] = VCShaderCompiler_GetSplatRGBValue(operands[operandIndex],
+                                                                       rgbRegisters);
+        }
+    }
+    if (memcmp(operands, otherInstruction->operands, operandCount) == 0)
+        return true;
+    return VCShaderCompiler_OperationIsCommutative(instruction->operation) &&
+        operands[0] == otherInstruction->operands[1] &&
+        operands[1] == otherInstruction->operands[0];
+}
+
+static void VCShaderCompiler_ReplaceUses(VCShaderFunction *function,
+                                         uint8_t value,
+                                         uint8_t newValue) {
+    for (size_t instructionIndex = 0;
+         instructionIndex < function->instructionCount;
+         instructionIndex++) {
+        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
+        uint8_t operandCount = VCShaderCompiler_GetOperandCount(instruction->operation);
+        for (uint8_t operandIndex = 0; operandIndex < operandCount; operandIndex++) {
+            if (instruction->operands[operandIndex] == value)
+                instruction->operands[operandIndex] = newValue;
+        }
+    }
+}
+
+// Common subexpression elimination. An instruction that repeats an earlier one gives way to the
+// earlier one's register. In an alpha function, one that computes what each component of a
+// register of the already optimized `rgbFunction` holds becomes a swizzle of it: the RGB function
+// often computes the alpha function's values splatted, as in `TEXEL0_ALPHA * SHADE_ALPHA`.
+static bool VCShaderCompiler_EliminateCommonSubexpressions(VCShaderFunction *function,
+                                                           VCShaderFunction *rgbFunction) {
+    uint8_t rgbRegisters[UINT8_MAX + 1];
+    memset(rgbRegisters, VC_SHADER_COMPILER_OUTPUT_VALUE, sizeof(rgbRegisters));
+
+    bool changed = false;
+    for (size_t instructionIndex = 0;
+         instructionIndex < function->instructionCount;
+         instructionIndex++) {
+        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
+        bool hasRegisterDestination =
+            instruction->destination < VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE;
+        if (instruction->operation == VC_SHADER_INSTRUCTION_MOVE_RGB) {
+            if (hasRegisterDestination)
+                rgbRegisters[instruction->destination] = instruction->operands[0];
+            continue;
+        }
+        if (VCShaderCompiler_GetOperandCount(instruction->operation) < 2)
+            continue;
+
+        bool replaced = false;
+        for (size_t earlierInstructionIndex = 0;
+             hasRegisterDestination && earlierInstructionIndex < instructionIndex;
+             earlierInstructionIndex++) {
+            VCShaderInstruction *earlierInstruction =
+                &function->instructions[earlierInstructionIndex];
+            if (earlierInstruction->destination >= VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE ||
+                    !VCShaderCompiler_InstructionsMatch(instruction, earlierInstruction, NULL)) {
+                continue;
+            }
+            VCShaderCompiler_ReplaceUses(function,
+                                         instruction->destination,
+                                         earlierInstruction->destination);
+            replaced = true;
+            break;
+        }
+        if (replaced) {
+            changed = true;
+            continue;
+        }
+
+        if (rgbFunction == NULL ||
+                VCShaderCompiler_OperationCosts[VC_SHADER_INSTRUCTION_MOVE_RGB] >=
+                VCShaderCompiler_OperationCosts[instruction->operation]) {
+            continue;
+        }
+        for (size_t rgbInstructionIndex = 0;
+             rgbInstructionIndex < rgbFunction->instructionCount;
+             rgbInstructionIndex++) {
+            VCShaderInstruction *rgbInstruction = &rgbFunction->instructions[rgbInstructionIndex];
+            if (!VCShaderCompiler_InstructionsMatch(instruction, rgbInstruction, rgbRegisters))
+                continue;
+            VCShaderCompiler_MakeMove(instruction, rgbInstruction->destination);
+            instruction->operation = VC_SHADER_INSTRUCTION_MOVE_RGB;
+            if (hasRegisterDestination)
+                rgbRegisters[instruction->destination] = rgbInstruction->destination;
+            changed = true;
+            break;
+        }
+    }
+    return changed;
+}
+
+static const char *VCShaderCompiler_OperationNames[] = {
+    "mov", "add", "sub", "mul", "lerp", "movrgb"
+};
+
+// Names for each special value from `VC_SHADER_COMPILER_ZERO_VALUE` on, for IR dumps.
+static const char *VCShaderCompiler_ValueNames[] = {
+    "0", "1", "prim", "primA", "env", "envA", "tex0", "tex0A", "tex1", "tex1A", "shade", "shadeA"
+};
+
+static void VCShaderCompiler_AppendValueName(VCString *string, uint8_t value) {
+    if (value == VC_SHADER_COMPILER_OUTPUT_VALUE)
+        VCString_AppendCString(string, "out");
+    else if (value >= VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE)
+        VCString_AppendCString(
+            string,
+            VCShaderCompiler_ValueNames[value - VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE]);
+    else
+        VCString_AppendFormat(string, "r%d", (int)value);
+}
+
+// One instruction per line, as in `r1 = lerp tex0, shade, envA`.
+static void VCShaderCompiler_AppendFunctionIR(VCString *string, VCShaderFunction *function) {
+    for (size_t instructionIndex = 0;
+         instructionIndex < function->instructionCount;
+         instructionIndex++) {
+        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
+        VCString_AppendCString(string, "    ");
+        VCShaderCompiler_AppendValueName(string, instruction->destination);
+        VCString_AppendFormat(string,
+                              " = %s ",
+                              VCShaderCompiler_OperationNames[instruction->operation]);
+        if (instruction->operation == VC_SHADER_INSTRUCTION_MOVE_RGB) {
+            VCString_AppendCString(string, "rgb.");
+            VCShaderCompiler_AppendValueName(string, instruction->operands[0]);
+        }
+        uint8_t operandCount = VCShaderCompiler_GetOperandCount(instruction->operation);
+        for (uint8_t operandIndex = 0; operandIndex < operandCount; operandIndex++) {
+            if (operandIndex > 0)
+                VCString_AppendCString(string, ", ");
+            VCShaderCompiler_AppendValueName(string, instruction->operands[operandIndex]);
+        }
+        VCString_AppendCString(string, "\n");
+    }
+}
+
+// Appends the function to `trace`, if there is one, after a step that changed it.
+static bool VCShaderCompiler_TracePass(VCString *trace,
+                                       VCShaderFunction *function,
+                                       const char *passName,
+                                       bool changed) {
+    if (changed && trace != NULL) {
+        VCString_AppendFormat(trace,
+                              "%s, %s:\n",
+                              function->mode == VC_SHADER_COMPILER_MODE_RGB ? "rgb" : "alpha",
+                              passName);
+        VCShaderCompiler_AppendFunctionIR(trace, function);
+    }
+    return changed;
+}
+
+// `rgbFunction` is the optimized RGB function of the same subprogram when optimizing the alpha
+// function, for common subexpression elimination, and NULL otherwise. If `trace` isn't NULL, the
+// function is appended to it as generated and after each pass that changes it.
+static void VCShaderCompiler_OptimizeFunction(VCShaderFunction *function,
+                                              VCShaderFunction *rgbFunction,
+                                              uint8_t passes,
+                                              VCString *trace) {
+    VCShaderCompiler_TracePass(trace, function, "generated", true);
+    bool changed = true;
+    while (changed) {
+        changed = VCShaderCompiler_TracePass(trace,
+                                             function,
+                                             "after CombineInstructions",
+                                             VCShaderCompiler_CombineInstructions(function));
+        if ((passes & VC_SHADER_OPTIMIZE_IDENTITIES) != 0) {
+            changed = VCShaderCompiler_TracePass(trace,
+                                                 function,
+                                                 "after ApplyIdentities",
+                                                 VCShaderCompiler_ApplyIdentities(function)) ||
+                changed;
+        }
+        changed = VCShaderCompiler_TracePass(trace,
+                                             function,
+                                             "after PropagateValues",
+                                             VCShaderCompiler_PropagateValues(function)) ||
+            changed;
+        changed = VCShaderCompiler_TracePass(trace,
+                                             function,
+                                             "after PropagateConstants",
+                                             VCShaderCompiler_PropagateConstants(function)) ||
+            changed;
+        if ((passes & VC_SHADER_OPTIMIZE_CSE) != 0) {
+            bool eliminated =
+                VCShaderCompiler_EliminateCommonSubexpressions(function, rgbFunction);
+            changed = VCShaderCompiler_TracePass(trace,
+                                                 function,
+                                                 "after EliminateCommonSubexpressions",
+                                                 eliminated) || changed;
+        }
+        if ((passes & VC_SHADER_OPTIMIZE_LERPS) != 0) {
+            changed = VCShaderCompiler_TracePass(trace,
+                                                 function,
+                                                 "after RecognizeLerps",
+                                                 VCShaderCompiler_RecognizeLerps(function)) ||
+                changed;
+        }
+        changed = VCShaderCompiler_TracePass(trace,
+                                             function,
+                                             "after EliminateDeadCode",
+                                             VCShaderCompiler_EliminateDeadCode(function)) ||
+            changed;
+    }
+
+    VCShaderCompiler_RenumberRegisters(function);
+    VCShaderCompiler_TracePass(trace, function, "after RenumberRegisters", true);
+}
+
+static VCShaderFunction VCShaderCompiler_GenerateFunction(VCShaderSubprogramContext *context,
+                                                          uint8_t mode,
+                                                          VCUnpackedCombinerFunction *cycle0,
+                                                          VCUnpackedCombinerFunction *cycle1) {
+    VCShaderFunction function;
+    function.instructions = NULL;
+    function.instructionCount = 0;
+    function.instructionCapacity = 0;
+    function.mode = mode;
+
+    uint8_t output = VCShaderCompiler_GenerateInstructionsForCycle(context,
+                                                                   mode,
+                                                                   &function,
+                                                                   cycle0,
+                                                                   0,
+                                                                   false);
+    if (cycle1 != NULL) {
+        output = VCShaderCompiler_GenerateInstructionsForCycle(context,
+                                                               mode,
+                                                               &function,
+                                                               cycle1,
+                                                               output + 1,
+                                                               true); 
+    }
+
+    VCShaderInstruction *outputInstruction = VCShaderCompiler_AllocateInstruction(&function);
+    outputInstruction->operation = VC_SHADER_INSTRUCTION_MOVE;
+    outputInstruction->destination = VC_SHADER_COMPILER_OUTPUT_VALUE;
+    outputInstruction->operands[0] = output;
+    outputInstruction->operands[1] = VC_SHADER_COMPILER_ZERO_VALUE;
+
+    return function;
+}
+
+static void VCShaderCompiler_CreateSubprogramForNormalTriangleMode(
+        VCShaderSubprogramSource *source,
+        VCShaderSubprogram *subprogram) {
+    VCUnpackedCombinerFunction cycle0Function;
+    cycle0Function.sa = source->cycle0.saRGB;
+    cycle0Function.sb = source->cycle0.sbRGB;
+    cycle0Function.m = source->cycle0.mRGB;
+    cycle0Function.a = source->cycle0.aRGB;
+    if (!source->context.secondCycleEnabled) {
+        subprogram->rgb = VCShaderCompiler_GenerateFunction(&source->context,
+                                                            VC_SHADER_COMPILER_MODE_RGB,
+                                                            &cycle0Function,
+                                                            NULL);
+    } else {
+        VCUnpackedCombinerFunction cycle1Function;
+        cycle1Function.sa = source->cycle1.saRGB;
+        cycle1Function.sb = source->cycle1.sbRGB;
+        cycle1Function.m = source->cycle1.mRGB;
+        cycle1Function.a = source->cycle1.aRGB;
+        subprogram->rgb = VCShaderCompiler_GenerateFunction(&source->context,
+                                                            VC_SHADER_COMPILER_MODE_RGB,
+                                                            &cycle0Function,
+                                                            &cycle1Function);
+    }
+
+    cycle0Function.sa = source->cycle0.saA;
+    cycle0Function.sb = source->cycle0.sbA;
+    cycle0Function.m = source->cycle0.mA;
+    cycle0Function.a = source->cycle0.aA;
+    if (!source->context.secondCycleEnabled) {
+        subprogram->a = VCShaderCompiler_GenerateFunction(&source->context,
+                                                          VC_SHADER_COMPILER_MODE_ALPHA,
+                                                          &cycle0Function,
+                                                          NULL);
+    } else {
+        VCUnpackedCombinerFunction cycle1Function;
+        cycle1Function.sa = source->cycle1.saA;
+        cycle1Function.sb = source->cycle1.sbA;
+        cycle1Function.m = source->cycle1.mA;
+        cycle1Function.a = source->cycle1.aA;
+        subprogram->a = VCShaderCompiler_GenerateFunction(&source->context,
+                                                          VC_SHADER_COMPILER_MODE_ALPHA,
+                                                          &cycle0Function,
+                                                          &cycle1Function);
+    }
+}
+
+static void VCShaderCompiler_CreateSubprogramForRectFillTriangleMode(
+        VCShaderSubprogramSource *source,
+        VCShaderSubprogram *subprogram) {
+    VCUnpackedCombinerFunction cycle0Function;
+    cycle0Function.sa = VC_COMBINER_CCMUX_SHADE;
+    cycle0Function.sb = VC_COMBINER_CCMUX_0;
+    cycle0Function.m = VC_COMBINER_CCMUX_1;
+    cycle0Function.a = VC_COMBINER_CCMUX_0;
+    subprogram->rgb = VCShaderCompiler_GenerateFunction(&source->context,
+                                                        VC_SHADER_COMPILER_MODE_RGB,
+                                                        &cycle0Function,
+                                                        NULL);
+
+    cycle0Function.sa = VC_COMBINER_ACMUX_SHADE;
+    cycle0Function.sb = VC_COMBINER_ACMUX_0;
+    cycle0Function.m = VC_COMBINER_ACMUX_1;
+    cycle0Function.a = VC_COMBINER_ACMUX_0;
+    subprogram->a = VCShaderCompiler_GenerateFunction(&source->context,
+                                                      VC_SHADER_COMPILER_MODE_ALPHA,
+                                                      &cycle0Function,
+                                                      NULL);
+}
+
+// Generates the subprogram's functions unoptimized.
+static void VCShaderCompiler_GenerateSubprogram(VCShaderSubprogramSource *source,
+                                                VCShaderSubprogram *subprogram) {
+    subprogram->source = *source;
+
+    switch (source->context.triangleMode) {
+    case VC_TRIANGLE_MODE_NORMAL:
+    case VC_TRIANGLE_MODE_TEXTURE_RECTANGLE:
+        VCShaderCompiler_CreateSubprogramForNormalTriangleMode(source, subprogram);
+        break;
+    case VC_TRIANGLE_MODE_RECT_FILL:
+        VCShaderCompiler_CreateSubprogramForRectFillTriangleMode(source, subprogram);
+        break;
+    default:
+        assert(0 && "Unknown triangle mode when creating subprogram!");
+    }
+}
+
+// The RGB function goes first, since the alpha function may end up reading its registers.
+static void VCShaderCompiler_OptimizeSubprogram(VCShaderSubprogram *subprogram,
+                                                uint8_t passes,
+                                                VCString *trace) {
+    VCShaderCompiler_OptimizeFunction(&subprogram->rgb, NULL, passes, trace);
+    VCShaderCompiler_OptimizeFunction(&subprogram->a, &subprogram->rgb, passes, trace);
+}
+
+static VCShaderSubprogram *VCShaderCompiler_CreateSubprogram(VCShaderSubprogramSource *source) {
+    VCShaderSubprogram *subprogram = (VCShaderSubprogram *)malloc(sizeof(VCShaderSubprogram));
+    if (subprogram == NULL)
+        abort();
+    VCShaderCompiler_GenerateSubprogram(source, subprogram);
+    VCShaderCompiler_OptimizeSubprogram(subprogram, VC_SHADER_OPTIMIZE_ALL, NULL);
+    return subprogram;
+}
+
+static uint8_t VCShaderCompiler_GetUbershaderSelector(VCShaderSubprogramContext *context,
+                                                      uint8_t mode,
+                                                      uint8_t source,
+                                                      bool allowCombined) {
+    uint8_t value = VCShaderCompiler_GetValue(context, mode, NULL, source, allowCombined);
+    if (value < VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE)
+        return VC_SHADER_UBERSHADER_COMBINED_SELECTOR;
+    return value - VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE;
+}
+
+// Describes a subprogram to the generic combiner program in `n64.fs.glsl` as four RGBA texels: the
+// A, B, C, and D inputs of the RGB and alpha functions of cycles 0 and 1. Inputs are numbered like
+// the special values, starting from zero, with `VC_SHADER_UBERSHADER_COMBINED_SELECTOR` standing
+// for the first cycle's output. A single-cycle subprogram passes that through in the second cycle.
+static void VCShaderCompiler_GenerateUbershaderRow(uint8_t *row, VCShaderSubprogramSource *source) {
+    VCUnpackedCombinerFunction functions[4] = {
+        { VC_COMBINER_CCMUX_SHADE, VC_COMBINER_CCMUX_0, VC_COMBINER_CCMUX_1, VC_COMBINER_CCMUX_0 },
+        { VC_COMBINER_ACMUX_SHADE, VC_COMBINER_ACMUX_0, VC_COMBINER_ACMUX_1, VC_COMBINER_ACMUX_0 },
+        {
+            VC_COMBINER_CCMUX_COMBINED,
+            VC_COMBINER_CCMUX_0,
+            VC_COMBINER_CCMUX_1,
+            VC_COMBINER_CCMUX_0
+        },
+        {
+            VC_COMBINER_ACMUX_COMBINED,
+            VC_COMBINER_ACMUX_0,
+            VC_COMBINER_ACMUX_1,
+            VC_COMBINER_ACMUX_0
+        },
+    };
+    if (source->context.triangleMode != VC_TRIANGLE_MODE_RECT_FILL) {
+        VCUnpackedCombinerFunction rgb0 = {
+            source->cycle0.saRGB, source->cycle0.sbRGB, source->cycle0.mRGB, source->cycle0.aRGB
+        };
+        VCUnpackedCombinerFunction a0 = {
+            source->cycle0.saA, source->cycle0.sbA, source->cycle0.mA, source->cycle0.aA
+        };
+        functions[0] = rgb0;
+        functions[1] = a0;
+        if (source->context.secondCycleEnabled) {
+            VCUnpackedCombinerFunction rgb1 = {
+                source->cycle1.saRGB, source->cycle1.sbRGB, source->cycle1.mRGB, source->cycle1.aRGB
+            };
+            VCUnpackedCombinerFunction a1 = {
+                source->cycle1.saA, source->cycle1.sbA, source->cycle1.mA, source->cycle1.aA
+            };
+            functions[2] = rgb1;
+            functions[3] = a1;
+        }
+    }
+
+    for (uint8_t functionIndex = 0; functionIndex < 4; functionIndex++) {
+        VCUnpackedCombinerFunction *function = &functions[functionIndex];
+        uint8_t mode = (functionIndex % 2 == 0) ? VC_SHADER_COMPILER_MODE_RGB :
+            VC_SHADER_COMPILER_MODE_ALPHA;
+        bool allowCombined = functionIndex >= 2;
+        uint8_t *texel = &row[functionIndex * 4];
+        texel[0] = VCShaderCompiler_GetUbershaderSelector(&source->context,
+                                                          mode,
+                                                          function->sa,
+                                                          allowCombined);
+        texel[1] = VCShaderCompiler_GetUbershaderSelector(&source->context,
+                                                          mode,
+                                                          function->sb,
+                                                          allowCombined);
+        texel[2] = VCShaderCompiler_GetUbershaderSelector(&source->context,
+                                                          mode,
+                                                          function->m,
+                                                          allowCombined);
+        texel[3] = VCShaderCompiler_GetUbershaderSelector(&source->context,
+                                                          mode,
+                                                          function->a,
+                                                          allowCombined);
+    }
+}
+
+// Fills `table`, which must hold `VC_SHADER_UBERSHADER_TABLE_SIZE` bytes, with a row per
+// subprogram of the program, indexed like the subprograms are in generated GLSL.
+void VCShaderCompiler_GenerateUbershaderTableForProgram(uint8_t *table, VCShaderProgram *program) {
+    memset(table, '\0', VC_SHADER_UBERSHADER_TABLE_SIZE);
+    for (size_t subprogramIndex = 0;
+         subprogramIndex < program->subprogramCount &&
+            subprogramIndex < VC_SHADER_UBERSHADER_TABLE_HEIGHT;
+         subprogramIndex++) {
+        VCShaderCompiler_GenerateUbershaderRow(
+            &table[subprogramIndex * VC_SHADER_UBERSHADER_TABLE_WIDTH * 4],
+            &program->subprograms[subprogramIndex]->source);
+    }
+}
+
+// GLSL for each special value from `VC_SHADER_COMPILER_ZERO_VALUE` on. RGB functions work on
+// `vec3`s and alpha functions on `float`s, so no instruction computes components nobody reads.
+static const char *VCShaderCompiler_RGBValueGLSL[] = {
+    "vec3(0.0)",
+    "vec3(1.0)",
+    "vPrimitive.rgb",
+    "vPrimitive.aaa",
+    "vEnvironment.rgb",
+    "vEnvironment.aaa",
+    "texture0Color.rgb",
+    "texture0Color.aaa",
+    "texture1Color.rgb",
+    "texture1Color.aaa",
+    "vShade.rgb",
+    "vShade.aaa",
+};
+
+static const char *VCShaderCompiler_AlphaValueGLSL[] = {
+    "0.0",
+    "1.0",
+    "vPrimitive.a",
+    "vPrimitive.a",
+    "vEnvironment.a",
+    "vEnvironment.a",
+    "texture0Color.a",
+    "texture0Color.a",
+    "texture1Color.a",
+    "texture1Color.a",
+    "vShade.a",
+    "vShade.a",
+};
+
+static void VCShaderCompiler_GenerateGLSLForValue(VCString *shaderSource,
+                                                  VCShaderFunction *function,
+                                                  const char *outputLocation,
+                                                  uint8_t value) {
+    bool rgb = function->mode == VC_SHADER_COMPILER_MODE_RGB;
+    if (value == VC_SHADER_COMPILER_OUTPUT_VALUE) {
+        VCString_AppendCString(shaderSource, outputLocation);
+    } else if (value >= VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE) {
+        uint8_t index = value - VC_SHADER_COMPILER_LEAST_SPECIAL_VALUE;
+        VCString_AppendCString(shaderSource,
+                               rgb ? VCShaderCompiler_RGBValueGLSL[index] :
+                               VCShaderCompiler_AlphaValueGLSL[index]);
+    } else {
+        VCString_AppendFormat(shaderSource, "%c%d", rgb ? 'c' : 'a', (int)value);
+    }
+}
+
+static void VCShaderCompiler_GenerateGLSLForFunction(VCString *shaderSource,
+                                                     VCShaderFunction *function,
+                                                     const char *outputLocation) {
+    for (size_t instructionIndex = 0;
+         instructionIndex < function->instructionCount;
+         instructionIndex++) {
+        VCShaderInstruction *instruction = &function->instructions[instructionIndex];
+        VCString_AppendCString(shaderSource, "        ");
+        VCShaderCompiler_GenerateGLSLForValue(shaderSource,
+                                              function,
+                                              outputLocation,
+                                              instruction->destination);
+        VCString_AppendCString(shaderSource, " = ");
+        switch (instruction->operation) {
+        case VC_SHADER_INSTRUCTION_MOVE:
+            VCShaderCompiler_GenerateGLSLForValue(shaderSource,
+                                                  function,
+                                                  outputLocation,
+                                                  instruction->operands[0]);
+            break;
+        case VC_SHADER_INSTRUCTION_ADD:
+        case VC_SHADER_INSTRUCTION_SUB:
+        case VC_SHADER_INSTRUCTION_MUL:
+            {
+                char glslOperator = '*';
+                if (instruction->operation == VC_SHADER_INSTRUCTION_ADD)
+                    glslOperator = '+';
+                else if (instruction->operation == VC_SHADER_INSTRUCTION_SUB)
+                    glslOperator = '-';
+                VCShaderCompiler_GenerateGLSLForValue(shaderSource,
+                                                      function,
+                                                      outputLocation,
+                                                      instruction->operands[0]);
+                VCString_AppendFormat(shaderSource, " %c ", glslOperator);
+                VCShaderCompiler_GenerateGLSLForValue(shaderSource,
+                                                      function,
+                                                      outputLocation,
+                                                      instruction->operands[1]);
+                break;
+            }
+        case VC_SHADER_INSTRUCTION_LERP:
+            VCString_AppendCString(shaderSource, "mix(");
+            VCShaderCompiler_GenerateGLSLForValue(shaderSource,
+                                                  function,
+                                                  outputLocation,
+                                                  instruction->operands[1]);
+            VCString_AppendCString(shaderSource, ", ");
+            VCShaderCompiler_GenerateGLSLForValue(shaderSource,
+                                                  function,
+                                                  outputLocation,
+                                                  instruction->operands[0]);
+            VCString_AppendCString(shaderSource, ", ");
+            VCShaderCompiler_GenerateGLSLForValue(shaderSource,
+                                                  function,
+                                                  outputLocation,
+                                                  instruction->operands[2]);
+            VCString_AppendCString(shaderSource, ")");
+            break;
+        case VC_SHADER_INSTRUCTION_MOVE_RGB:
+            if (instruction->operands[0] == VC_SHADER_COMPILER_OUTPUT_VALUE)
+                VCString_AppendCString(shaderSource, "fragRGB.x");
+            else
+                VCString_AppendFormat(shaderSource, "c%d.x", (int)instruction->operands[0]);
+            break;
+        default:
+            fprintf(stderr, "Unexpected operation in shader compilation!");
+            abort();
+        }
+        VCString_AppendCString(shaderSource, ";\n");
+    }
+}
+
+static size_t VCShaderCompiler_CountRegistersUsedInProgram(VCShaderProgram *program,
+                                                           uint8_t mode) {
+    size_t maxRegisterCount = 0;
+    for (size_t subprogramIndex = 0;
+         subprogramIndex < program->subprogramCount;
+         subprogramIndex++) {
+        VCShaderSubprogram *subprogram = program->subprograms[subprogramIndex];
+        VCShaderFunction *function =
+            mode == VC_SHADER_COMPILER_MODE_RGB ? &subprogram->rgb : &subprogram->a;
+        size_t registerCount = VCShaderCompiler_CountRegistersUsedInFunction(function);
+        if (maxRegisterCount < registerCount)
+            maxRegisterCount = registerCount;
+    }
+    return maxRegisterCount;
+}
+
+void VCShaderCompiler_GenerateGLSLFragmentShaderForProgram(VCString *shaderSource,
+                                                           VCShaderProgram *program) {
+    assert(program->subprogramCount > 0);
+    size_t rgbRegisterCount =
+        VCShaderCompiler_CountRegistersUsedInProgram(program, VC_SHADER_COMPILER_MODE_RGB);
+    size_t alphaRegisterCount =
+        VCShaderCompiler_CountRegistersUsedInProgram(program, VC_SHADER_COMPILER_MODE_ALPHA);
+    VCString_AppendCString(shaderSource, "void main(void) {\n");
+    VCString_AppendCString(shaderSource, "#ifdef VC_GPU_TEXTURE_DECODE\n");
+    VCString_AppendCString(
+            shaderSource,
+            "    vec4 texture0Color = "
+            "SampleTexture(uTexture0, vTexture0Bounds, vTextureDecode.xy);\n");
+    VCString_AppendCString(
+            shaderSource,
+            "    vec4 texture1Color = "
+            "SampleTexture(uTexture1, vTexture1Bounds, vTextureDecode.zw);\n");
+    VCString_AppendCString(shaderSource, "#else\n");
+    VCString_AppendCString(
+            shaderSource,
+            "    vec4 texture0Color = SampleTexture(uTexture0, vTexture0Bounds);\n");
+    VCString_AppendCString(
+            shaderSource,
+            "    vec4 texture1Color = SampleTexture(uTexture1, vTexture1Bounds);\n");
+    VCString_AppendCString(shaderSource, "#endif\n");
+    VCString_AppendCString(shaderSource, "    vec3 fragRGB;\n");
+    VCString_AppendCString(shaderSource, "    float fragA;\n");
+    for (size_t i = 0; i < rgbRegisterCount; i++)
+        VCString_AppendFormat(shaderSource, "    vec3 c%d;\n", (int)i);
+    for (size_t i = 0; i < alphaRegisterCount; i++)
+        VCString_AppendFormat(shaderSource, "    float a%d;\n", (int)i);
+    for (size_t subprogramIndex = 0;
+         subprogramIndex < program->subprogramCount;
+         subprogramIndex++) {
+        VCShaderSubprogram *subprogram = program->subprograms[subprogramIndex];
+
+        // Add a fudge factor of 0.5 in each direction because the VideoCore IV sometimes adds some
+        // error (due to perspective correction, presumably) to varyings for polygons close to the
+        // camera.
+        if (subprogramIndex == 0) {
+            VCString_AppendCString(shaderSource, "    if (vControl.x < 0.5) {\n");
+        } else {
+            VCString_AppendFormat(shaderSource, "    } else if (vControl.x < %d.5) {\n",
+                                  (int)subprogramIndex);
+        }
+        VCShaderCompiler_GenerateGLSLForFunction(shaderSource, &subprogram->rgb, "fragRGB");
+        VCShaderCompiler_GenerateGLSLForFunction(shaderSource, &subprogram->a, "fragA");
+    }
+    VCString_AppendCString(shaderSource, "    } else {\n");
+    VCString_AppendCString(shaderSource, "        fragRGB = vec3(1.0, 0.0, 0.0);\n");
+    VCString_AppendCString(shaderSource, "        fragA = 1.0;\n");
+    VCString_AppendCString(shaderSource, "    }\n");
+    VCString_AppendCString(shaderSource, "    if (fragA * 255.0 < vControl.y)\n");
+    VCString_AppendCString(shaderSource, "        discard;\n");
+    VCString_AppendCString(shaderSource, "    if (vControl.z < 0.5)\n");
+    VCString_AppendCString(shaderSource, "        fragA = 1.0;\n");
+    VCString_AppendCString(shaderSource, "    else if (vControl.z < 1.5)\n");
+    VCString_AppendCString(shaderSource, "        fragA = 0.0;\n");
+    VCString_AppendCString(shaderSource, "    gl_FragColor = vec4(fragRGB, fragA);\n");
+    VCString_AppendCString(shaderSource, "}\n");
+}
+
+// Without `foldColors`, the colors are left out, so that subprograms depend only on the combiner
+// mode, cycle type, and triangle mode, and the colors only ever reach shaders as varyings.
+VCShaderSubprogramContext VCShaderCompiler_CreateSubprogramContext(VCColor primColor,
+                                                                   VCColor envColor,
+                                                                   bool secondCycleEnabled,
+                                                                   uint8_t triangleMode,
+                                                                   bool foldColors) {
+    VCShaderSubprogramContext subprogramContext;
+    memset(&subprogramContext, '\0', sizeof(subprogramContext));
+    if (foldColors) {
+        subprogramContext.primColor = primColor;
+        subprogramContext.envColor = envColor;
+    }
+    subprogramContext.secondCycleEnabled = secondCycleEnabled;
+    subprogramContext.triangleMode = triangleMode;
+    subprogramContext.foldColors = foldColors;
+    return subprogramContext;
+}
+
+VCShaderProgram *VCShaderCompiler_GetOrCreateProgram(
+        VCShaderSubprogramLibrary *subprogramLibrary,
+        VCShaderProgramDescriptor *programDescriptor) {
+    if (programDescriptor->program != NULL)
+        return programDescriptor->program;
+
+    VCShaderProgram *program = (VCShaderProgram *)malloc(sizeof(VCShaderProgram));
+    program->subprogramCount = programDescriptor->subprogramCount;
+    program->subprograms = (VCShaderSubprogram **)
+        malloc(sizeof(VCShaderSubprogram *) * program->subprogramCount);
+
+    for (size_t subprogramIndex = 0;
+         subprogramIndex < program->subprogramCount;
+         subprogramIndex++) {
+        uint16_t subprogramID = programDescriptor->subprogramIDs[subprogramIndex];
+        assert(subprogramID < subprogramLibrary->subprogramsLength);
+        program->subprograms[subprogramIndex] = subprogramLibrary->subprograms[subprogramID];
+    }
+
+    programDescriptor->program = program;
+    return program;
+}
+
+VCShaderProgramDescriptor *VCShaderCompiler_GetShaderProgramDescriptorByID(
+        VCShaderProgramDescriptorLibrary *library,
+        uint16_t id) {
+    assert(id < library->shaderProgramDescriptorCount);
+    VCShaderProgramDescriptor *descriptor = NULL, *tempDescriptor = NULL;
+    HASH_ITER(hh, library->shaderProgramDescriptors, descriptor, tempDescriptor) {
+        if (descriptor->id == id)
+            return descriptor;
+    }
+    assert(0 && "Didn't find shader program descriptor with that ID!");
+    abort(); 
+}
+
+VCShaderSubprogramLibrary *VCShaderCompiler_CreateSubprogramLibrary() {
+    VCShaderSubprogramLibrary *library = (VCShaderSubprogramLibrary *)
+        malloc(sizeof(VCShaderSubprogramLibrary));
+    library->sources = NULL;
+    library->keys = NULL;
+    library->subprograms = NULL;
+    library->subprogramsLength = 0;
+    library->subprogramsCapacity = 0;
+    return library;
+}
+
+// Packs the ubershader row of a subprogram, whose 16 selectors each fit in 4 bits, into a key.
+// Since the row describes everything the subprogram computes, subprograms with equal keys can
+// stand in for each other.
+static uint64_t VCShaderCompiler_GetSubprogramKey(VCShaderSubprogramSource *source) {
+    uint8_t row[VC_SHADER_UBERSHADER_TABLE_WIDTH * 4];
+    VCShaderCompiler_GenerateUbershaderRow(row, source);
+    uint64_t key = 0;
+    for (size_t selectorIndex = 0; selectorIndex < sizeof(row); selectorIndex++) {
+        assert(row[selectorIndex] < 16);
+        key = (key << 4) | row[selectorIndex];
+    }
+    return key;
+}
+
+static uint16_t VCShaderCompiler_InternSubprogram(VCShaderSubprogramLibrary *library,
+                                                  VCShaderSubprogramSource *source) {
+    uint64_t key = VCShaderCompiler_GetSubprogramKey(source);
+    VCShaderSubprogramKeyEntry *keyEntry = NULL;
+    HASH_FIND(hh, library->keys, &key, sizeof(key), keyEntry);
+    if (keyEntry != NULL)
+        return keyEntry->id;
+
+    if (library->subprogramsLength > UINT16_MAX) {
+        fprintf(stderr, "video error: too many combiner subprograms\n");
+        abort();
+    }
+    if (library->subprogramsLength == library->subprogramsCapacity) {
+        library->subprogramsCapacity = library->subprogramsCapacity == 0 ? 64 :
+            library->subprogramsCapacity * 2;
+        library->subprograms = (VCShaderSubprogram **)
+            realloc(library->subprograms,
+                    sizeof(VCShaderSubprogram *) * library->subprogramsCapacity);
+        if (library->subprograms == NULL)
+            abort();
+    }
+
+    keyEntry = (VCShaderSubprogramKeyEntry *)malloc(sizeof(VCShaderSubprogramKeyEntry));
+    if (keyEntry == NULL)
+        abort();
+    keyEntry->key = key;
+    keyEntry->id = (uint16_t)library->subprogramsLength;
+    HASH_ADD(hh, library->keys, key, sizeof(keyEntry->key), keyEntry);
+    VCShaderSubprogram *subprogram = VCShaderCompiler_CreateSubprogram(source);
+    subprogram->key = key;
+    library->subprograms[library->subprogramsLength++] = subprogram;
+    return keyEntry->id;
+}
+
+// `source` is hashed whole, so it must have been zeroed before being filled in.
+uint16_t VCShaderCompiler_GetOrCreateSubprogramID(VCShaderSubprogramLibrary *library,
+                                                  VCShaderSubprogramSource *source) {
+    VCShaderSubprogramSourceEntry *sourceEntry = NULL;
+    HASH_FIND(hh, library->sources, source, sizeof(VCShaderSubprogramSource), sourceEntry);
+    if (sourceEntry != NULL)
+        return sourceEntry->id;
+
+    sourceEntry = (VCShaderSubprogramSourceEntry *)malloc(sizeof(VCShaderSubprogramSourceEntry));
+    if (sourceEntry == NULL)
+        abort();
+    sourceEntry->source = *source;
+    sourceEntry->id = VCShaderCompiler_InternSubprogram(library, source);
+    HASH_ADD(hh, library->sources, source, sizeof(VCShaderSubprogramSource), sourceEntry);
+    return sourceEntry->id;
+}
+
+// The number of distinct combiner states seen, which grows with every primitive and environment
+// color seen when colors are folded.
+uint32_t VCShaderCompiler_GetCombinerStateCount(VCShaderSubprogramLibrary *library) {
+    return HASH_COUNT(library->sources);
+}
+
+uint32_t VCShaderCompiler_GetSubprogramCount(VCShaderSubprogramLibrary *library) {
+    return (uint32_t)library->subprogramsLength;
+}
+
+uint32_t VCShaderCompiler_GetShaderProgramCount(VCShaderProgramDescriptorLibrary *library) {
+    return HASH_COUNT(library->shaderProgramDescriptors);
+}
+
+// Compiles the subprogram twice, with the basic passes and with all of them, and reports on both.
+void VCShaderCompiler_GetSubprogramStatistics(VCShaderSubprogramSource *source,
+                                              VCShaderSubprogramStatistics *statistics) {
+    VCShaderSubprogram subprogram;
+    VCShaderCompiler_GenerateSubprogram(source, &subprogram);
+    statistics->generatedInstructions =
+        (uint32_t)(subprogram.rgb.instructionCount + subprogram.a.instructionCount);
+    VCShaderCompiler_OptimizeSubprogram(&subprogram, 0, NULL);
+    statistics->basicInstructions =
+        (uint32_t)(subprogram.rgb.instructionCount + subprogram.a.instructionCount);
+    statistics->basicCost = VCShaderCompiler_GetFunctionCost(&subprogram.rgb, 4) +
+        VCShaderCompiler_GetFunctionCost(&subprogram.a, 4);
+    VCShaderCompiler_DestroyShaderSubprogram(&subprogram);
+
+    VCShaderCompiler_GenerateSubprogram(source, &subprogram);
+    VCShaderCompiler_OptimizeSubprogram(&subprogram, VC_SHADER_OPTIMIZE_ALL, NULL);
+    statistics->instructions =
+        (uint32_t)(subprogram.rgb.instructionCount + subprogram.a.instructionCount);
+    statistics->cost = VCShaderCompiler_GetFunctionCost(&subprogram.rgb, 3) +
+        VCShaderCompiler_GetFunctionCost(&subprogram.a, 1);
+    statistics->registers =
+        (uint32_t)(VCShaderCompiler_CountRegistersUsedInFunction(&subprogram.rgb) +
+                   VCShaderCompiler_CountRegistersUsedInFunction(&subprogram.a));
+    VCShaderCompiler_DestroyShaderSubprogram(&subprogram);
+}
+
+// Appends the IR of the subprogram's functions as generated and after each optimization pass that
+// changes them.
+void VCShaderCompiler_TraceSubprogram(VCString *trace, VCShaderSubprogramSource *source) {
+    VCShaderSubprogram subprogram;
+    VCShaderCompiler_GenerateSubprogram(source, &subprogram);
+    VCShaderCompiler_OptimizeSubprogram(&subprogram, VC_SHADER_OPTIMIZE_ALL, trace);
+    VCShaderCompiler_DestroyShaderSubprogram(&subprogram);
+}
+
+void VCShaderCompiler_ClearSubprogramIDList(VCShaderSubprogramIDList *list) {
+    list->length = 0;
+}
+
+// Returns true if the subprogram is in the list already or the list has fewer than `maxLength`.
+bool VCShaderCompiler_SubprogramListHasRoomFor(VCShaderSubprogramIDList *list,
+                                               uint16_t subprogramID,
+                                               int maxLength) {
+    if (list->length < maxLength)
+        return true;
+    for (uint16_t index = 0; index < list->length; index++) {
+        if (list->ids[index] == subprogramID)
+            return true;
+    }
+    return false;
+}
+
+// Returns the index vertices should use to refer to the subprogram.
+uint8_t VCShaderCompiler_AddSubprogramToList(VCShaderSubprogramIDList *list,
+                                             uint16_t subprogramID) {
+    for (uint16_t index = 0; index < list->length; index++) {
+        if (list->ids[index] == subprogramID)
+            return (uint8_t)index;
+    }
+    if (list->length == VC_SHADER_MAX_SUBPROGRAMS_PER_PROGRAM) {
+        // Out of indices. Draw with the last subprogram rather than overflow.
+        return (uint8_t)(list->length - 1);
+    }
+    list->ids[list->length] = subprogramID;
+    return (uint8_t)list->length++;
+}
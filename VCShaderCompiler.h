@@ -1,99 +1,122 @@
-// mupen64plus-video-videocore/VCShaderCompiler.h
-//
-// Copyright (c) 2016 The mupen64plus-video-videocore Authors
-
-#ifndef VC_SHADER_COMPILER_H
-#define VC_SHADER_COMPILER_H
-
-#include "VCCombiner.h"
-#include "VCGeometry.h"
-#include "VCUtils.h"
-#include "uthash.h"
-#include <stdint.h>
-
-struct VCShaderProgram;
-struct VCShaderProgramDescriptorLibrary;
-struct VCShaderSubprogram;
-struct VCShaderSubprogramLibrary;
-struct VCShaderSubprogramSignatureListEntry;
-struct VCShaderSubprogramSignatureTableEntry;
-struct VCShaderSubprogramEntry;
-
-struct VCShaderSubprogramContext {
-    VCColor primColor;
-    VCColor envColor;
-    bool secondCycleEnabled;
-    uint8_t triangleMode;
-};
-
-struct VCShaderSubprogramSignatureTable {
-    VCShaderSubprogramSignatureTableEntry *entries;
-};
-
-struct VCShaderSubprogramSignatureList {
-    VCShaderSubprogramSignatureListEntry *entries;
-    uint32_t length;
-};
-
-struct VCShaderSubprogramSource {
-    VCUnpackedCombiner cycle0;
-    VCUnpackedCombiner cycle1;
-    VCShaderSubprogramContext context;
-};
-
-struct VCShaderSubprogramSignature {
-    VCString serializedData;
-    VCShaderSubprogramSource source;
-    UT_hash_handle hh;
-};
-
-struct VCShaderProgramSignature {
-    VCString serializedData;
-    UT_hash_handle hh;
-};
-
-struct VCShaderProgramDescriptor {
-    VCShaderProgramSignature programSignature;
-    VCShaderSubprogramSignatureList subprogramSignatures;
-    // Lazily initialized pointer to the actual program.
-    VCShaderProgram *program;
-    uint16_t id;
-    UT_hash_handle hh;
-};
-
-VCShaderProgramDescriptorLibrary *VCShaderCompiler_CreateShaderProgramDescriptorLibrary();
-uint16_t VCShaderCompiler_GetOrCreateShaderProgramID(
-        VCShaderProgramDescriptorLibrary *library,
-        VCShaderSubprogramSignatureList *subprogramDescriptors,
-        bool *newlyCreated);
-VCShaderSubprogramSignatureTable VCShaderCompiler_CreateSubprogramSignatureTable();
-void VCShaderCompiler_DestroySubprogramSignatureTable(VCShaderSubprogramSignatureTable *table);
-VCShaderSubprogramSignature VCShaderCompiler_CreateSubprogramSignatureForCurrentCombiner(
-        VCShaderSubprogramContext *context);
-void VCShaderCompiler_GenerateGLSLFragmentShaderForProgram(VCString *shaderSource,
-                                                           VCShaderProgram *program);
-VCShaderSubprogramContext VCShaderCompiler_CreateSubprogramContext(VCColor primColor,
-                                                                   VCColor envColor,
-                                                                   bool secondCycleEnabled,
-                                                                   uint8_t triangleMode);
-VCShaderSubprogramLibrary *VCShaderCompiler_CreateSubprogramLibrary();
-uint16_t VCShaderCompiler_GetOrCreateSubprogramID(VCShaderSubprogramSignatureTable *table,
-                                                  VCShaderSubprogramSignature *descriptor);
-VCShaderProgram *VCShaderCompiler_GetOrCreateProgram(
-        VCShaderSubprogramLibrary *subprogramLibrary,
-        VCShaderProgramDescriptor *programDescriptor);
-VCShaderProgramDescriptor *VCShaderCompiler_GetShaderProgramDescriptorByID(
-        VCShaderProgramDescriptorLibrary *library,
-        uint16_t id);
-VCShaderSubprogramSignatureList VCShaderCompiler_ConvertSubprogramSignatureTableToList(
-        VCShaderSubprogramSignatureTable *table);
-void VCShaderCompiler_DestroySubprogramSignatureList(VCShaderSubprogramSignatureList *list);
-VCShaderSubprogramSignature VCShaderCompiler_GetOrCreateSubprogramSignatureForCurrentCombiner(
-        VCShaderSubprogramLibrary *library,
-        VCShaderSubprogramContext *context);
-void VCShaderCompiler_DestroySubprogramSignature(VCShaderSubprogramSignature *signature);
-bool VCShaderCompiler_ExpireOldProgramIfNecessary(VCShaderProgramDescriptorLibrary *library,
-                                                  uint16_t *shaderProgramIDToDelete);
-
-#endif
-
+// mupen64plus-video-videocore/VCShaderCompiler.h
+//
+// Copyright (c) 2016 The mupen64plus-video-videocore Authors
+
+#ifndef VC_SHADER_COMPILER_H
+#define VC_SHADER_COMPILER_H
+
+#include "VCCombiner.h"
+#include "VCGeometry.h"
+#include "VCUtils.h"
+#include "uthash.h"
+#include <stdint.h>
+
+// The most subprograms a program may have, since vertices refer to them by an 8-bit index.
+#define VC_SHADER_MAX_SUBPROGRAMS_PER_PROGRAM   256
+
+// The generic combiner program's table of subprograms: a row of RGBA texels per subprogram, as many
+// rows as there can be subprograms in a program.
+#define VC_SHADER_UBERSHADER_TABLE_WIDTH    4
+#define VC_SHADER_UBERSHADER_TABLE_HEIGHT   VC_SHADER_MAX_SUBPROGRAMS_PER_PROGRAM
+#define VC_SHADER_UBERSHADER_TABLE_SIZE \
+    (VC_SHADER_UBERSHADER_TABLE_WIDTH * VC_SHADER_UBERSHADER_TABLE_HEIGHT * 4)
+
+// How `VCShaderCompiler_GetOrCreateShaderProgramID` came up with a program: one with exactly the
+// subprograms asked for, one with more, or a new one.
+#define VC_SHADER_PROGRAM_FOUND     0
+#define VC_SHADER_PROGRAM_REUSED    1
+#define VC_SHADER_PROGRAM_CREATED   2
+
+// Optimization passes run on top of the basic ones (constant and value propagation and dead code
+// elimination), which always run.
+#define VC_SHADER_OPTIMIZE_IDENTITIES   0x01
+#define VC_SHADER_OPTIMIZE_LERPS        0x02
+#define VC_SHADER_OPTIMIZE_CSE          0x04
+#define VC_SHADER_OPTIMIZE_ALL          0x07
+
+struct VCShaderProgram;
+struct VCShaderProgramDescriptorLibrary;
+struct VCShaderSubprogram;
+struct VCShaderSubprogramLibrary;
+
+struct VCShaderSubprogramContext {
+    VCColor primColor;
+    VCColor envColor;
+    bool secondCycleEnabled;
+    uint8_t triangleMode;
+    bool foldColors;
+};
+
+struct VCShaderSubprogramSource {
+    VCUnpackedCombiner cycle0;
+    VCUnpackedCombiner cycle1;
+    VCShaderSubprogramContext context;
+};
+
+// What compiling a subprogram came to, RGB and alpha functions together. Costs are in scalar ALU
+// operations per fragment according to the compiler's cost model. The `basic` figures are for the
+// basic passes only, with every value a `vec4`.
+struct VCShaderSubprogramStatistics {
+    uint32_t generatedInstructions;
+    uint32_t basicInstructions;
+    uint32_t basicCost;
+    uint32_t instructions;
+    uint32_t cost;
+    uint32_t registers;
+};
+
+// The subprograms a batch uses, by interned subprogram ID, in the order its vertices index them.
+struct VCShaderSubprogramIDList {
+    uint16_t ids[VC_SHADER_MAX_SUBPROGRAMS_PER_PROGRAM];
+    uint16_t length;
+};
+
+struct VCShaderProgramDescriptor {
+    // The key; `subprogramCount` interned subprogram IDs.
+    uint16_t *subprogramIDs;
+    uint16_t subprogramCount;
+    // Lazily initialized pointer to the actual program.
+    VCShaderProgram *program;
+    uint16_t id;
+    UT_hash_handle hh;
+};
+
+VCShaderProgramDescriptorLibrary *VCShaderCompiler_CreateShaderProgramDescriptorLibrary();
+uint16_t VCShaderCompiler_GetOrCreateShaderProgramID(VCShaderProgramDescriptorLibrary *library,
+                                                     VCShaderSubprogramLibrary *subprogramLibrary,
+                                                     VCShaderSubprogramIDList *subprogramIDs,
+                                                     uint8_t *subprogramIndices,
+                                                     uint8_t *resolution);
+void VCShaderCompiler_GenerateGLSLFragmentShaderForProgram(VCString *shaderSource,
+                                                           VCShaderProgram *program);
+void VCShaderCompiler_GenerateUbershaderTableForProgram(uint8_t *table, VCShaderProgram *program);
+VCShaderSubprogramContext VCShaderCompiler_CreateSubprogramContext(VCColor primColor,
+                                                                   VCColor envColor,
+                                                                   bool secondCycleEnabled,
+                                                                   uint8_t triangleMode,
+                                                                   bool foldColors);
+VCShaderSubprogramLibrary *VCShaderCompiler_CreateSubprogramLibrary();
+uint16_t VCShaderCompiler_GetOrCreateSubprogramID(VCShaderSubprogramLibrary *library,
+                                                  VCShaderSubprogramSource *source);
+void VCShaderCompiler_GetSubprogramStatistics(VCShaderSubprogramSource *source,
+                                              VCShaderSubprogramStatistics *statistics);
+void VCShaderCompiler_TraceSubprogram(VCString *trace, VCShaderSubprogramSource *source);
+void VCShaderCompiler_ClearSubprogramIDList(VCShaderSubprogramIDList *list);
+uint8_t VCShaderCompiler_AddSubprogramToList(VCShaderSubprogramIDList *list, uint16_t subprogramID);
+bool VCShaderCompiler_SubprogramListHasRoomFor(VCShaderSubprogramIDList *list,
+                                               uint16_t subprogramID,
+                                               int maxLength);
+VCShaderProgram *VCShaderCompiler_GetOrCreateProgram(
+        VCShaderSubprogramLibrary *subprogramLibrary,
+        VCShaderProgramDescriptor *programDescriptor);
+VCShaderProgramDescriptor *VCShaderCompiler_GetShaderProgramDescriptorByID(
+        VCShaderProgramDescriptorLibrary *library,
+        uint16_t id);
+uint32_t VCShaderCompiler_GetCombinerStateCount(VCShaderSubprogramLibrary *library);
+uint32_t VCShaderCompiler_GetSubprogramCount(VCShaderSubprogramLibrary *library);
+uint32_t VCShaderCompiler_GetShaderProgramCount(VCShaderProgramDescriptorLibrary *library);
+bool VCShaderCompiler_ExpireOldProgramIfNecessary(VCShaderProgramDescriptorLibrary *library,
+                                                  uint16_t *shaderProgramIDToDelete);
+
+#endif
+
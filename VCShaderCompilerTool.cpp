@@ -0,0 +1,357 @@
+// mupen64plus-video-videocore/VCShaderCompilerTool.cpp
+//
+// Copyright (c) 2016 The mupen64plus-video-videocore Authors
+//
+// `vcshaderc`: runs the combiner shader compiler without a GL context, on combiner modes given as
+// the `muxs0` and `muxs1` words of `gDPSetCombine`, the cycle type, and the triangle mode. Modes
+// come from the command line or from corpus files such as `combiners.txt` and the log that
+// `debug.combinerLog` writes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "GBI.h"
+#include "VCCombiner.h"
+#include "VCRenderer.h"
+#include "VCShaderCompiler.h"
+
+#define VC_SHADER_COMPILER_TOOL_MAX_LINE_LENGTH 256
+
+#define VC_SHADER_COMPILER_TOOL_DEFAULT_MAX_SUBPROGRAMS 8
+
+typedef bool (*VCShaderCompilerToolModeCallback)(VCCombinerMode *mode,
+                                                 const char *comment,
+                                                 void *userData);
+
+static void VCShaderCompilerTool_Usage() {
+    fprintf(stderr, "usage: vcshaderc stats CORPUS\n");
+    fprintf(stderr, "       vcshaderc compile MUXS0 MUXS1 CYCLE-TYPE [TRIANGLE-MODE]\n");
+    fprintf(stderr, "       vcshaderc compile -f CORPUS\n");
+    fprintf(stderr, "       vcshaderc batch CORPUS [MAX-SUBPROGRAMS-PER-PROGRAM]\n");
+    fprintf(stderr, "CYCLE-TYPE is one of 1cycle, 2cycle, copy, or fill; TRIANGLE-MODE is one\n");
+    fprintf(stderr, "of normal, texrect, or rectfill.\n");
+    exit(1);
+}
+
+static double VCShaderCompilerTool_GetMicroseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1000000.0 + (double)now.tv_nsec / 1000.0;
+}
+
+// Calls `callback` with each combiner mode in the corpus, a file of combiner mode lines with `#`
+// starting comments, until it returns false.
+static bool VCShaderCompilerTool_ForEachMode(const char *path,
+                                             VCShaderCompilerToolModeCallback callback,
+                                             void *userData) {
+    FILE *corpus = fopen(path, "r");
+    if (corpus == NULL) {
+        fprintf(stderr, "vcshaderc: couldn't open `%s`\n", path);
+        return false;
+    }
+
+    char line[VC_SHADER_COMPILER_TOOL_MAX_LINE_LENGTH];
+    size_t lineNumber = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), corpus) != NULL) {
+        lineNumber++;
+        line[strcspn(line, "\n")] = '\0';
+        const char *comment = "";
+        char *commentStart = strchr(line, '#');
+        if (commentStart != NULL) {
+            *commentStart++ = '\0';
+            comment = commentStart + strspn(commentStart, " \t");
+        }
+        if (line[strspn(line, " \t")] == '\0')
+            continue;
+
+        VCCombinerMode mode;
+        if (!VCCombiner_ParseMode(line, &mode)) {
+            fprintf(stderr, "vcshaderc: %s:%zu: bad combiner mode\n", path, lineNumber);
+            ok = false;
+            break;
+        }
+        ok = callback(&mode, comment, userData);
+    }
+    fclose(corpus);
+    return ok;
+}
+
+// Colors aren't known, so they're left out of the subprogram.
+static void VCShaderCompilerTool_CreateSubprogramSource(VCCombinerMode *mode,
+                                                        VCShaderSubprogramSource *source) {
+    memset(source, '\0', sizeof(VCShaderSubprogramSource));
+    VCCombiner_UnpackCombiner(mode->muxs0,
+                              mode->muxs1,
+                              mode->cycleType,
+                              &source->cycle0,
+                              &source->cycle1);
+    VCColor noColor = { 0, 0, 0, 0 };
+    source->context = VCShaderCompiler_CreateSubprogramContext(noColor,
+                                                               noColor,
+                                                               mode->cycleType == G_CYC_2CYCLE,
+                                                               mode->triangleMode,
+                                                               false);
+}
+
+// Generates the fragment shader code for a program with the listed subprograms, as the renderer
+// would. Returns how long that took, in microseconds.
+static double VCShaderCompilerTool_GenerateGLSL(VCString *glsl,
+                                                VCShaderSubprogramLibrary *subprogramLibrary,
+                                                VCShaderProgramDescriptorLibrary *programLibrary,
+                                                VCShaderSubprogramIDList *subprogramIDs) {
+    uint8_t subprogramIndices[VC_SHADER_MAX_SUBPROGRAMS_PER_PROGRAM], resolution;
+    double startTime = VCShaderCompilerTool_GetMicroseconds();
+    uint16_t programID = VCShaderCompiler_GetOrCreateShaderProgramID(programLibrary,
+                                                                     subprogramLibrary,
+                                                                     subprogramIDs,
+                                                                     subprogramIndices,
+                                                                     &resolution);
+    VCShaderProgramDescriptor *programDescriptor =
+        VCShaderCompiler_GetShaderProgramDescriptorByID(programLibrary, programID);
+    VCShaderProgram *program = VCShaderCompiler_GetOrCreateProgram(subprogramLibrary,
+                                                                   programDescriptor);
+    VCShaderCompiler_GenerateGLSLFragmentShaderForProgram(glsl, program);
+    return VCShaderCompilerTool_GetMicroseconds() - startTime;
+}
+
+struct VCShaderCompilerToolStats {
+    VCShaderSubprogramStatistics totals;
+    size_t modeCount;
+};
+
+static bool VCShaderCompilerTool_StatsForMode(VCCombinerMode *mode,
+                                              const char *comment,
+                                              void *userData) {
+    VCShaderCompilerToolStats *stats = (VCShaderCompilerToolStats *)userData;
+    VCShaderSubprogramSource source;
+    VCShaderCompilerTool_CreateSubprogramSource(mode, &source);
+    VCShaderSubprogramStatistics statistics;
+    VCShaderCompiler_GetSubprogramStatistics(&source, &statistics);
+
+    VCCombiner_WriteMode(stdout, mode);
+    printf(" %5u %5u %5u %5u %5u %5u %s\n",
+           statistics.generatedInstructions,
+           statistics.basicInstructions,
+           statistics.basicCost,
+           statistics.instructions,
+           statistics.cost,
+           statistics.registers,
+           comment);
+
+    stats->totals.generatedInstructions += statistics.generatedInstructions;
+    stats->totals.basicInstructions += statistics.basicInstructions;
+    stats->totals.basicCost += statistics.basicCost;
+    stats->totals.instructions += statistics.instructions;
+    stats->totals.cost += statistics.cost;
+    stats->totals.registers += statistics.registers;
+    stats->modeCount++;
+    return true;
+}
+
+// Reports instruction counts and costs for each combiner mode in the corpus, before and after the
+// optimizations beyond the basic ones.
+static int VCShaderCompilerTool_Stats(int argc, char **argv) {
+    VCShaderCompilerToolStats stats;
+    memset(&stats, '\0', sizeof(stats));
+    printf("MUXS0    MUXS1    CYCLE  TRIANGLE INSNS BASIC COST  OPT   COST  REGS\n");
+    if (!VCShaderCompilerTool_ForEachMode(argv[2], VCShaderCompilerTool_StatsForMode, &stats))
+        return 1;
+    printf("%-33s %5u %5u %5u %5u %5u %5u (%zu combiner modes)\n",
+           "total",
+           stats.totals.generatedInstructions,
+           stats.totals.basicInstructions,
+           stats.totals.basicCost,
+           stats.totals.instructions,
+           stats.totals.cost,
+           stats.totals.registers,
+           stats.modeCount);
+    return 0;
+}
+
+// Prints the IR after each optimization pass, the fragment shader code of a program with just this
+// mode in it, and what compiling it came to.
+static bool VCShaderCompilerTool_CompileMode(VCCombinerMode *mode,
+                                             const char *comment,
+                                             void *userData) {
+    VCShaderSubprogramSource source;
+    VCShaderCompilerTool_CreateSubprogramSource(mode, &source);
+
+    printf("# ");
+    VCCombiner_WriteMode(stdout, mode);
+    printf(comment[0] != '\0' ? " %s\n" : "\n", comment);
+
+    VCString trace = VCString_Create();
+    VCShaderCompiler_TraceSubprogram(&trace, &source);
+    fwrite(trace.ptr, 1, trace.len, stdout);
+    VCString_Destroy(&trace);
+
+    VCShaderSubprogramLibrary *subprogramLibrary = VCShaderCompiler_CreateSubprogramLibrary();
+    VCShaderProgramDescriptorLibrary *programLibrary =
+        VCShaderCompiler_CreateShaderProgramDescriptorLibrary();
+    double startTime = VCShaderCompilerTool_GetMicroseconds();
+    uint16_t subprogramID = VCShaderCompiler_GetOrCreateSubprogramID(subprogramLibrary, &source);
+    double subprogramTime = VCShaderCompilerTool_GetMicroseconds() - startTime;
+    VCShaderSubprogramIDList subprogramIDs;
+    VCShaderCompiler_ClearSubprogramIDList(&subprogramIDs);
+    VCShaderCompiler_AddSubprogramToList(&subprogramIDs, subprogramID);
+    VCString glsl = VCString_Create();
+    double glslTime = VCShaderCompilerTool_GenerateGLSL(&glsl,
+                                                        subprogramLibrary,
+                                                        programLibrary,
+                                                        &subprogramIDs);
+    printf("glsl:\n");
+    fwrite(glsl.ptr, 1, glsl.len, stdout);
+
+    VCShaderSubprogramStatistics statistics;
+    VCShaderCompiler_GetSubprogramStatistics(&source, &statistics);
+    printf("instructions: %u generated, %u after basic passes, %u after all passes\n",
+           statistics.generatedInstructions,
+           statistics.basicInstructions,
+           statistics.instructions);
+    printf("cost: %u after basic passes, %u after all passes\n",
+           statistics.basicCost,
+           statistics.cost);
+    printf("registers: %u\n", statistics.registers);
+    printf("time: %.1f us to compile the subprogram, %.1f us to generate %zu bytes of GLSL\n\n",
+           subprogramTime,
+           glslTime,
+           glsl.len);
+    VCString_Destroy(&glsl);
+    return true;
+}
+
+static int VCShaderCompilerTool_Compile(int argc, char **argv) {
+    if (strcmp(argv[2], "-f") == 0) {
+        if (argc != 4)
+            VCShaderCompilerTool_Usage();
+        bool ok = VCShaderCompilerTool_ForEachMode(argv[3],
+                                                   VCShaderCompilerTool_CompileMode,
+                                                   NULL);
+        return ok ? 0 : 1;
+    }
+
+    VCString line = VCString_Create();
+    for (int argIndex = 2; argIndex < argc; argIndex++)
+        VCString_AppendFormat(&line, "%s ", argv[argIndex]);
+    VCCombinerMode mode;
+    bool ok = VCCombiner_ParseMode(line.ptr, &mode);
+    VCString_Destroy(&line);
+    if (!ok)
+        VCShaderCompilerTool_Usage();
+    VCShaderCompilerTool_CompileMode(&mode, "", NULL);
+    return 0;
+}
+
+// Compiles a corpus the way the renderer would if each mode were drawn in turn, with a program for
+// every `maxSubprogramsPerProgram` distinct modes.
+struct VCShaderCompilerToolBatch {
+    VCShaderSubprogramLibrary *subprogramLibrary;
+    VCShaderProgramDescriptorLibrary *programLibrary;
+    VCShaderSubprogramIDList subprogramIDs;
+    int maxSubprogramsPerProgram;
+    size_t modeCount;
+    size_t programCount;
+    size_t glslLength;
+    double subprogramTime;
+    double maxSubprogramTime;
+    double glslTime;
+    double maxGLSLTime;
+};
+
+static void VCShaderCompilerTool_FinishBatchProgram(VCShaderCompilerToolBatch *batch) {
+    if (batch->subprogramIDs.length == 0)
+        return;
+    VCString glsl = VCString_Create();
+    double glslTime = VCShaderCompilerTool_GenerateGLSL(&glsl,
+                                                        batch->subprogramLibrary,
+                                                        batch->programLibrary,
+                                                        &batch->subprogramIDs);
+    batch->glslTime += glslTime;
+    if (batch->maxGLSLTime < glslTime)
+        batch->maxGLSLTime = glslTime;
+    batch->glslLength += glsl.len;
+    batch->programCount++;
+    VCString_Destroy(&glsl);
+    VCShaderCompiler_ClearSubprogramIDList(&batch->subprogramIDs);
+}
+
+static bool VCShaderCompilerTool_BatchMode(VCCombinerMode *mode,
+                                           const char *comment,
+                                           void *userData) {
+    VCShaderCompilerToolBatch *batch = (VCShaderCompilerToolBatch *)userData;
+    VCShaderSubprogramSource source;
+    VCShaderCompilerTool_CreateSubprogramSource(mode, &source);
+
+    double startTime = VCShaderCompilerTool_GetMicroseconds();
+    uint16_t subprogramID = VCShaderCompiler_GetOrCreateSubprogramID(batch->subprogramLibrary,
+                                                                     &source);
+    double subprogramTime = VCShaderCompilerTool_GetMicroseconds() - startTime;
+    batch->subprogramTime += subprogramTime;
+    if (batch->maxSubprogramTime < subprogramTime)
+        batch->maxSubprogramTime = subprogramTime;
+    batch->modeCount++;
+
+    if (!VCShaderCompiler_SubprogramListHasRoomFor(&batch->subprogramIDs,
+                                                   subprogramID,
+                                                   batch->maxSubprogramsPerProgram)) {
+        VCShaderCompilerTool_FinishBatchProgram(batch);
+    }
+    VCShaderCompiler_AddSubprogramToList(&batch->subprogramIDs, subprogramID);
+    return true;
+}
+
+// Reports how long compiling every mode in the corpus and generating its programs takes.
+static int VCShaderCompilerTool_Batch(int argc, char **argv) {
+    VCShaderCompilerToolBatch batch;
+    memset(&batch, '\0', sizeof(batch));
+    batch.maxSubprogramsPerProgram = VC_SHADER_COMPILER_TOOL_DEFAULT_MAX_SUBPROGRAMS;
+    if (argc == 4) {
+        char *end = NULL;
+        long maxSubprogramsPerProgram = strtol(argv[3], &end, 10);
+        if (end == argv[3] || *end != '\0' || maxSubprogramsPerProgram < 1 ||
+                maxSubprogramsPerProgram > VC_SHADER_MAX_SUBPROGRAMS_PER_PROGRAM) {
+            VCShaderCompilerTool_Usage();
+        }
+        batch.maxSubprogramsPerProgram = (int)maxSubprogramsPerProgram;
+    }
+    batch.subprogramLibrary = VCShaderCompiler_CreateSubprogramLibrary();
+    batch.programLibrary = VCShaderCompiler_CreateShaderProgramDescriptorLibrary();
+    VCShaderCompiler_ClearSubprogramIDList(&batch.subprogramIDs);
+
+    if (!VCShaderCompilerTool_ForEachMode(argv[2], VCShaderCompilerTool_BatchMode, &batch))
+        return 1;
+    VCShaderCompilerTool_FinishBatchProgram(&batch);
+    if (batch.modeCount == 0)
+        return 0;
+
+    printf("%zu combiner modes: %u combiner states, %u subprograms\n",
+           batch.modeCount,
+           VCShaderCompiler_GetCombinerStateCount(batch.subprogramLibrary),
+           VCShaderCompiler_GetSubprogramCount(batch.subprogramLibrary));
+    printf("subprograms: %.1f us total, %.2f us mean per mode, %.1f us max\n",
+           batch.subprogramTime,
+           batch.subprogramTime / batch.modeCount,
+           batch.maxSubprogramTime);
+    printf("%zu programs of up to %d subprograms: %.1f us total, %.1f us mean, %.1f us max, "
+           "%zu bytes of GLSL mean\n",
+           batch.programCount,
+           batch.maxSubprogramsPerProgram,
+           batch.glslTime,
+           batch.glslTime / batch.programCount,
+           batch.maxGLSLTime,
+           batch.glslLength / batch.programCount);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 3 && strcmp(argv[1], "stats") == 0)
+        return VCShaderCompilerTool_Stats(argc, argv);
+    if (argc >= 3 && strcmp(argv[1], "compile") == 0)
+        return VCShaderCompilerTool_Compile(argc, argv);
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "batch") == 0)
+        return VCShaderCompilerTool_Batch(argc, argv);
+    VCShaderCompilerTool_Usage();
+    return 1;
+}
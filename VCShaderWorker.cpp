@@ -0,0 +1,402 @@
+// mupen64plus-video-videocore/VCShaderWorker.cpp
+//
+// Copyright (c) 2016 The mupen64plus-video-videocore Authors
+
+#include <SDL2/SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "VCRenderer.h"
+#include "VCShaderWorker.h"
+
+#define INITIAL_JOBS_CAPACITY 8
+
+static void VCShaderWorker_MakeSharedContextCurrent(VCShaderWorker *worker, bool current);
+
+static void VCShaderWorker_AppendJob(VCShaderJob **jobs,
+                                     size_t *length,
+                                     size_t *capacity,
+                                     VCShaderJob *job) {
+    if (*length == *capacity) {
+        *capacity = *capacity == 0 ? INITIAL_JOBS_CAPACITY : *capacity * 2;
+        *jobs = (VCShaderJob *)realloc(*jobs, sizeof(VCShaderJob) * *capacity);
+        if (*jobs == NULL)
+            abort();
+    }
+    (*jobs)[(*length)++] = *job;
+}
+
+// Links an N64 program with the given fragment shader, from the shader cache entry's program
+// binary if it has a usable one. Returns false if the program failed to link.
+bool VCShaderWorker_CreateProgram(VCShaderWorker *worker,
+                                  VCProgram *program,
+                                  const char *fragmentShaderSource,
+                                  VCShaderCacheEntry *cacheEntry) {
+    VCShaderCache *cache = &worker->cache;
+    program->program = glCreateProgram();
+    // The vertex shader belongs to the worker, so programs don't keep it.
+    program->vertexShader = 0;
+    program->fragmentShader = 0;
+    if (cacheEntry == NULL ||
+            !VCShaderCache_LoadProgramBinary(cache, cacheEntry, program->program)) {
+        VCRenderer_CompileShaderFromCString(&program->fragmentShader,
+                                            GL_FRAGMENT_SHADER,
+                                            fragmentShaderSource);
+        GL(glAttachShader(program->program, worker->vertexShader));
+        GL(glAttachShader(program->program, program->fragmentShader));
+        GL(glBindAttribLocation(program->program, 0, "aPosition"));
+        GL(glBindAttribLocation(program->program, 1, "aTextureUv"));
+        GL(glBindAttribLocation(program->program, 2, "aTexture0Bounds"));
+        GL(glBindAttribLocation(program->program, 3, "aTexture1Bounds"));
+        GL(glBindAttribLocation(program->program, 4, "aShade"));
+        GL(glBindAttribLocation(program->program, 5, "aPrimitive"));
+        GL(glBindAttribLocation(program->program, 6, "aEnvironment"));
+        GL(glBindAttribLocation(program->program, 7, "aControl"));
+        if (VCShaderCache_IsOpen(cache))
+            VCShaderCache_PrepareProgramForLink(cache, program->program);
+        GL(glLinkProgram(program->program));
+    }
+
+    GLint linkStatus = GL_FALSE;
+    GL(glGetProgramiv(program->program, GL_LINK_STATUS, &linkStatus));
+    if (linkStatus != GL_TRUE)
+        return false;
+
+    // Uniforms start out zeroed after a binary is loaded too, so set them either way.
+    GL(glUseProgram(program->program));
+    GLint uTexture0 = glGetUniformLocation(program->program, "uTexture0");
+    GL(glUniform1i(uTexture0, 0));
+    GLint uTexture1 = glGetUniformLocation(program->program, "uTexture1");
+    GL(glUniform1i(uTexture1, 1));
+    return true;
+}
+
+static void VCShaderWorker_Compile(VCShaderWorker *worker, VCShaderJob *job) {
+    VCShaderCache *cache = &worker->cache;
+    uint32_t key = 0;
+    VCShaderCacheEntry *cacheEntry = NULL;
+    if (VCShaderCache_IsOpen(cache)) {
+        key = VCShaderCache_HashSource(job->source);
+        cacheEntry = VCShaderCache_Find(cache, key, job->source);
+    }
+
+    if (cacheEntry != NULL && cacheEntry->program != 0) {
+        // Prewarmed already; just take it.
+        job->program.program = cacheEntry->program;
+        job->program.vertexShader = 0;
+        job->program.fragmentShader = 0;
+        cacheEntry->program = 0;
+        job->linked = true;
+    } else {
+        job->linked = VCShaderWorker_CreateProgram(worker, &job->program, job->source, cacheEntry);
+        if (job->linked)
+            VCShaderCache_Store(cache, key, job->source, job->program.program);
+        else
+            fprintf(stderr, "video warning: failed to link a combiner program\n");
+    }
+}
+
+static void VCShaderWorker_RunJob(VCShaderWorker *worker, VCShaderJob *job) {
+    switch (job->type) {
+    case VC_SHADER_JOB_COMPILE:
+        VCShaderWorker_Compile(worker, job);
+        free(job->source);
+        job->source = NULL;
+        // Make sure the program is complete before the render thread's context touches it.
+        if (worker->sharedContext)
+            GL(glFinish());
+        SDL_LockMutex(worker->mutex);
+        VCShaderWorker_AppendJob(&worker->results,
+                                 &worker->resultsLength,
+                                 &worker->resultsCapacity,
+                                 job);
+        SDL_UnlockMutex(worker->mutex);
+        break;
+    case VC_SHADER_JOB_OPEN_CACHE:
+        if (VCShaderCache_IsOpen(&worker->cache))
+            VCShaderCache_Close(&worker->cache);
+        VCShaderCache_Open(&worker->cache, job->source, job->stamp);
+        break;
+    case VC_SHADER_JOB_CLOSE_CACHE:
+        if (VCShaderCache_IsOpen(&worker->cache))
+            VCShaderCache_Close(&worker->cache);
+        break;
+    }
+    free(job->source);
+}
+
+// Links one program from the shader cache ahead of time. Returns false if there are none left.
+static bool VCShaderWorker_PrewarmOne(VCShaderWorker *worker) {
+    VCShaderCache *cache = &worker->cache;
+    if (!VCShaderCache_IsOpen(cache))
+        return false;
+    VCShaderCacheEntry *entry = VCShaderCache_NextEntryToPrewarm(cache);
+    if (entry == NULL)
+        return false;
+
+    VCProgram program;
+    if (!VCShaderWorker_CreateProgram(worker, &program, entry->source, entry)) {
+        GL(glDeleteProgram(program.program));
+        GL(glDeleteShader(program.fragmentShader));
+        return true;
+    }
+    // The fragment shader is freed along with the program.
+    GL(glDeleteShader(program.fragmentShader));
+    VCShaderCache_Store(cache, entry->key, entry->source, program.program);
+    entry->program = program.program;
+    return true;
+}
+
+static bool VCShaderWorker_CanPrewarm(VCShaderWorker *worker) {
+    return VCShaderCache_IsOpen(&worker->cache) &&
+        worker->cache.entriesPrewarmed < worker->cache.entriesLoaded;
+}
+
+static bool VCShaderWorker_DequeueJob(VCShaderWorker *worker, VCShaderJob *job) {
+    SDL_LockMutex(worker->mutex);
+    bool dequeued = worker->jobsLength > 0;
+    if (dequeued) {
+        *job = worker->jobs[0];
+        worker->jobsLength--;
+        memmove(&worker->jobs[0], &worker->jobs[1], sizeof(VCShaderJob) * worker->jobsLength);
+    }
+    SDL_UnlockMutex(worker->mutex);
+    return dequeued;
+}
+
+// Compiles programs as they're requested and prewarms cached ones while there's nothing else to
+// do.
+static int VCShaderWorker_ThreadMain(void *userData) {
+    VCShaderWorker *worker = (VCShaderWorker *)userData;
+    VCShaderWorker_MakeSharedContextCurrent(worker, true);
+
+    while (true) {
+        SDL_LockMutex(worker->mutex);
+        while (worker->jobsLength == 0 && !worker->stopping && !VCShaderWorker_CanPrewarm(worker))
+            SDL_CondWait(worker->jobsAvailableCond, worker->mutex);
+        bool stopping = worker->stopping && worker->jobsLength == 0;
+        SDL_UnlockMutex(worker->mutex);
+        if (stopping)
+            break;
+
+        VCShaderJob job;
+        if (VCShaderWorker_DequeueJob(worker, &job))
+            VCShaderWorker_RunJob(worker, &job);
+        else
+            VCShaderWorker_PrewarmOne(worker);
+    }
+
+    if (VCShaderCache_IsOpen(&worker->cache))
+        VCShaderCache_Close(&worker->cache);
+    GL(glFinish());
+    VCShaderWorker_MakeSharedContextCurrent(worker, false);
+    return 0;
+}
+
+// Tries to create a context sharing objects with the render thread's, which must be current. On
+// GLES, SDL can't give a second context a surface without putting a window on the screen, so the
+// context is made with EGL directly and drawn to a 1x1 pbuffer it never uses.
+static bool VCShaderWorker_CreateSharedContext(VCShaderWorker *worker) {
+#ifdef HAVE_OPENGLES2
+    EGLDisplay display = eglGetCurrentDisplay();
+    EGLContext currentContext = eglGetCurrentContext();
+    if (display == EGL_NO_DISPLAY || currentContext == EGL_NO_CONTEXT)
+        return false;
+
+    EGLint configAttributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) ||
+            configCount < 1) {
+        return false;
+    }
+
+    EGLint surfaceAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+    worker->eglSurface = eglCreatePbufferSurface(display, config, surfaceAttributes);
+    if (worker->eglSurface == EGL_NO_SURFACE)
+        return false;
+    EGLint contextAttributes[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+    worker->eglContext = eglCreateContext(display, config, currentContext, contextAttributes);
+    if (worker->eglContext == EGL_NO_CONTEXT) {
+        eglDestroySurface(display, worker->eglSurface);
+        worker->eglSurface = EGL_NO_SURFACE;
+        return false;
+    }
+    worker->eglDisplay = display;
+    return true;
+#else
+    SDL_Window *currentWindow = SDL_GL_GetCurrentWindow();
+    SDL_GLContext currentContext = SDL_GL_GetCurrentContext();
+    worker->window = SDL_CreateWindow("mupen64plus-video-videocore shader worker",
+                                      SDL_WINDOWPOS_UNDEFINED,
+                                      SDL_WINDOWPOS_UNDEFINED,
+                                      1,
+                                      1,
+                                      SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+    if (worker->window == NULL)
+        return false;
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+    worker->context = SDL_GL_CreateContext(worker->window);
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+    SDL_GL_MakeCurrent(currentWindow, currentContext);
+    if (worker->context == NULL) {
+        SDL_DestroyWindow(worker->window);
+        worker->window = NULL;
+        return false;
+    }
+    return true;
+#endif
+}
+
+// Binds the shared context to the calling thread, or unbinds it.
+static void VCShaderWorker_MakeSharedContextCurrent(VCShaderWorker *worker, bool current) {
+#ifdef HAVE_OPENGLES2
+    if (current) {
+        eglMakeCurrent(worker->eglDisplay,
+                       worker->eglSurface,
+                       worker->eglSurface,
+                       worker->eglContext);
+    } else {
+        eglMakeCurrent(worker->eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglReleaseThread();
+    }
+#else
+    SDL_GL_MakeCurrent(worker->window, current ? worker->context : NULL);
+#endif
+}
+
+static void VCShaderWorker_DestroySharedContext(VCShaderWorker *worker) {
+#ifdef HAVE_OPENGLES2
+    eglDestroyContext(worker->eglDisplay, worker->eglContext);
+    eglDestroySurface(worker->eglDisplay, worker->eglSurface);
+    worker->eglContext = EGL_NO_CONTEXT;
+    worker->eglSurface = EGL_NO_SURFACE;
+#else
+    SDL_GL_DeleteContext(worker->context);
+    SDL_DestroyWindow(worker->window);
+    worker->context = NULL;
+    worker->window = NULL;
+#endif
+    worker->sharedContext = false;
+}
+
+// Must be called on the render thread. With `threaded` false, or if a shared context can't be
+// had, jobs are left for the render thread to run.
+void VCShaderWorker_Create(VCShaderWorker *worker,
+                           const char *vertexShaderSource,
+                           bool threaded) {
+    memset(worker, '\0', sizeof(*worker));
+    VCRenderer_CompileShaderFromCString(&worker->vertexShader,
+                                        GL_VERTEX_SHADER,
+                                        vertexShaderSource);
+    worker->mutex = SDL_CreateMutex();
+    worker->jobsAvailableCond = SDL_CreateCond();
+    if (!threaded)
+        return;
+    if (!VCShaderWorker_CreateSharedContext(worker)) {
+        fprintf(stderr,
+                "video warning: couldn't create a shared GL context; linking shader programs on "
+                "the render thread\n");
+        return;
+    }
+    worker->sharedContext = true;
+    // Make sure the vertex shader is compiled before the worker's context attaches it.
+    GL(glFinish());
+    worker->thread = SDL_CreateThread(VCShaderWorker_ThreadMain, "VCShaderWorker", worker);
+    if (worker->thread == NULL) {
+        fprintf(stderr,
+                "video warning: couldn't start the shader worker thread; linking shader programs "
+                "on the render thread\n");
+        VCShaderWorker_DestroySharedContext(worker);
+    }
+}
+
+// Closes the shader cache and, if there's a worker thread, waits for it to exit. Programs that
+// finished linking but weren't collected are deleted, as is the vertex shader, which programs
+// still in use keep alive until they're deleted too. The worker can't be used again until it's
+// created afresh.
+void VCShaderWorker_Stop(VCShaderWorker *worker) {
+    VCShaderJob closeJob;
+    memset(&closeJob, '\0', sizeof(closeJob));
+    closeJob.type = VC_SHADER_JOB_CLOSE_CACHE;
+    VCShaderWorker_Enqueue(worker, &closeJob);
+
+    if (worker->thread != NULL) {
+        SDL_LockMutex(worker->mutex);
+        worker->stopping = true;
+        SDL_CondSignal(worker->jobsAvailableCond);
+        SDL_UnlockMutex(worker->mutex);
+        SDL_WaitThread(worker->thread, NULL);
+        worker->thread = NULL;
+        VCShaderWorker_DestroySharedContext(worker);
+    } else {
+        VCShaderWorker_RunQueuedJobs(worker);
+    }
+
+    // Taking the results leaves `worker->results` empty, so freeing them here frees it.
+    VCShaderJob *results = NULL;
+    size_t resultsLength = VCShaderWorker_TakeResults(worker, &results);
+    for (size_t i = 0; i < resultsLength; i++)
+        GL(glDeleteProgram(results[i].program.program));
+    free(results);
+    free(worker->jobs);
+    worker->jobs = NULL;
+    worker->jobsLength = worker->jobsCapacity = 0;
+    GL(glDeleteShader(worker->vertexShader));
+    worker->vertexShader = 0;
+
+    SDL_DestroyCond(worker->jobsAvailableCond);
+    worker->jobsAvailableCond = NULL;
+    SDL_DestroyMutex(worker->mutex);
+    worker->mutex = NULL;
+}
+
+// Takes ownership of the job's source.
+void VCShaderWorker_Enqueue(VCShaderWorker *worker, VCShaderJob *job) {
+    SDL_LockMutex(worker->mutex);
+    VCShaderWorker_AppendJob(&worker->jobs, &worker->jobsLength, &worker->jobsCapacity, job);
+    SDL_CondSignal(worker->jobsAvailableCond);
+    SDL_UnlockMutex(worker->mutex);
+}
+
+// Runs every queued job now. Only for use without a worker thread.
+void VCShaderWorker_RunQueuedJobs(VCShaderWorker *worker) {
+    VCShaderJob job;
+    while (VCShaderWorker_DequeueJob(worker, &job))
+        VCShaderWorker_RunJob(worker, &job);
+}
+
+// Without a worker thread, runs queued jobs and then prewarms cached programs, for no longer than
+// `budgetMs` unless there's a job that has been waiting since the last call. One job always runs so
+// that programs get linked at all, and a single link can take longer than the budget.
+void VCShaderWorker_Poll(VCShaderWorker *worker, uint32_t budgetMs) {
+    if (worker->thread != NULL)
+        return;
+
+    uint32_t startTimestamp = SDL_GetTicks();
+    VCShaderJob job;
+    if (VCShaderWorker_DequeueJob(worker, &job))
+        VCShaderWorker_RunJob(worker, &job);
+    while (SDL_GetTicks() - startTimestamp < budgetMs) {
+        if (VCShaderWorker_DequeueJob(worker, &job))
+            VCShaderWorker_RunJob(worker, &job);
+        else if (!VCShaderWorker_PrewarmOne(worker))
+            break;
+    }
+}
+
+// Hands finished compile jobs over to the caller, who must free the returned array.
+size_t VCShaderWorker_TakeResults(VCShaderWorker *worker, VCShaderJob **results) {
+    SDL_LockMutex(worker->mutex);
+    size_t resultsLength = worker->resultsLength;
+    *results = worker->results;
+    worker->results = NULL;
+    worker->resultsLength = worker->resultsCapacity = 0;
+    SDL_UnlockMutex(worker->mutex);
+    return resultsLength;
+}
+
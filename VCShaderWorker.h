@@ -0,0 +1,80 @@
+// mupen64plus-video-videocore/VCShaderWorker.h
+//
+// Copyright (c) 2016 The mupen64plus-video-videocore Authors
+
+#ifndef VCSHADERWORKER_H
+#define VCSHADERWORKER_H
+
+#include <SDL2/SDL.h>
+#include <stdint.h>
+#include "VCGL.h"
+
+#ifdef HAVE_OPENGLES2
+#include <EGL/egl.h>
+#endif
+#include "VCShaderCache.h"
+
+#define VC_SHADER_JOB_COMPILE       0
+#define VC_SHADER_JOB_OPEN_CACHE    1
+#define VC_SHADER_JOB_CLOSE_CACHE   2
+
+// `source` is the fragment shader source for compile jobs and the cache path otherwise. Finished
+// compile jobs come back with `program` filled in and `linked` set if linking succeeded.
+struct VCShaderJob {
+    uint8_t type;
+    uint32_t shaderProgramID;
+    uint32_t stamp;
+    char *source;
+    VCProgram program;
+    bool linked;
+};
+
+// Links combiner programs and owns the shader cache. Jobs run on a thread of their own with a GL
+// context shared with the render thread's where the platform allows (a hidden window on desktop
+// GL, an EGL pbuffer on GLES); otherwise the render thread runs them itself between frames via
+// `VCShaderWorker_Poll`.
+struct VCShaderWorker {
+    // For use by whichever thread runs jobs only.
+    VCShaderCache cache;
+
+    // The N64 vertex shader, compiled once on the render thread and attached to every program.
+    GLuint vertexShader;
+
+    SDL_Thread *thread;
+    bool sharedContext;
+#ifdef HAVE_OPENGLES2
+    EGLDisplay eglDisplay;
+    EGLSurface eglSurface;
+    EGLContext eglContext;
+#else
+    SDL_Window *window;
+    SDL_GLContext context;
+#endif
+    SDL_mutex *mutex;
+    SDL_cond *jobsAvailableCond;
+
+    // Protected by `mutex`.
+    VCShaderJob *jobs;
+    size_t jobsLength;
+    size_t jobsCapacity;
+    VCShaderJob *results;
+    size_t resultsLength;
+    size_t resultsCapacity;
+    bool stopping;
+};
+
+void VCShaderWorker_Create(VCShaderWorker *worker,
+                           const char *vertexShaderSource,
+                           bool threaded);
+void VCShaderWorker_Stop(VCShaderWorker *worker);
+void VCShaderWorker_Enqueue(VCShaderWorker *worker, VCShaderJob *job);
+void VCShaderWorker_RunQueuedJobs(VCShaderWorker *worker);
+void VCShaderWorker_Poll(VCShaderWorker *worker, uint32_t budgetMs);
+size_t VCShaderWorker_TakeResults(VCShaderWorker *worker, VCShaderJob **results);
+bool VCShaderWorker_CreateProgram(VCShaderWorker *worker,
+                                  VCProgram *program,
+                                  const char *fragmentShaderSource,
+                                  VCShaderCacheEntry *cacheEntry);
+
+#endif
+
@@ -0,0 +1,129 @@
+// mupen64plus-video-videocore/VCTextureDecoder.cpp
+//
+// Copyright (c) 2016 The mupen64plus-video-videocore Authors
+
+#include <SDL2/SDL.h>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "VCAtlas.h"
+#include "VCTextureDecoder.h"
+
+static int VCTextureDecoder_ThreadMain(void *userData) {
+    VCTextureDecoder *decoder = (VCTextureDecoder *)userData;
+    SDL_LockMutex(decoder->mutex);
+    while (true) {
+        while (decoder->jobsStarted == decoder->jobsLength && !decoder->stopping)
+            SDL_CondWait(decoder->jobsAvailableCond, decoder->mutex);
+        if (decoder->jobsStarted == decoder->jobsLength)
+            break;
+
+        VCTextureDecodeJob *job = decoder->jobs[decoder->jobsStarted++];
+        SDL_UnlockMutex(decoder->mutex);
+
+        VCAtlas_DecodeTexture(job);
+        free(job);
+
+        SDL_LockMutex(decoder->mutex);
+        decoder->jobsFinished++;
+        if (decoder->jobsFinished == decoder->jobsLength)
+            SDL_CondSignal(decoder->jobsFinishedCond);
+    }
+    SDL_UnlockMutex(decoder->mutex);
+    return 0;
+}
+
+void VCTextureDecoder_Create(VCTextureDecoder *decoder, uint32_t threadCount) {
+    decoder->mutex = SDL_CreateMutex();
+    decoder->jobsAvailableCond = SDL_CreateCond();
+    decoder->jobsFinishedCond = SDL_CreateCond();
+
+    decoder->jobs = NULL;
+    decoder->jobsLength = 0;
+    decoder->jobsCapacity = 0;
+    decoder->jobsStarted = 0;
+    decoder->jobsFinished = 0;
+    decoder->stopping = false;
+
+    decoder->threadCount = threadCount;
+    decoder->threads = NULL;
+    if (threadCount == 0)
+        return;
+
+    decoder->threads = (SDL_Thread **)malloc(sizeof(SDL_Thread *) * threadCount);
+    if (decoder->threads == NULL)
+        abort();
+    for (uint32_t i = 0; i < threadCount; i++) {
+        decoder->threads[i] = SDL_CreateThread(VCTextureDecoder_ThreadMain,
+                                               "VCTextureDecoder",
+                                               (void *)decoder);
+        assert(decoder->threads[i] != NULL);
+    }
+}
+
+void VCTextureDecoder_Enqueue(VCTextureDecoder *decoder, VCTextureDecodeJob *job) {
+    // With no worker threads, just decode synchronously.
+    if (decoder->threadCount == 0) {
+        VCAtlas_DecodeTexture(job);
+        free(job);
+        return;
+    }
+
+    SDL_LockMutex(decoder->mutex);
+
+    // Decoders that are never waited on start the job list over whenever they've caught up, so
+    // that it doesn't grow forever.
+    if (decoder->jobsFinished == decoder->jobsLength) {
+        decoder->jobsLength = 0;
+        decoder->jobsStarted = 0;
+        decoder->jobsFinished = 0;
+    }
+    if (decoder->jobsLength >= decoder->jobsCapacity) {
+        decoder->jobsCapacity = decoder->jobsCapacity == 0 ? 16 : decoder->jobsCapacity * 2;
+        decoder->jobs = (VCTextureDecodeJob **)realloc(
+                decoder->jobs,
+                sizeof(VCTextureDecodeJob *) * decoder->jobsCapacity);
+        if (decoder->jobs == NULL)
+            abort();
+    }
+    decoder->jobs[decoder->jobsLength++] = job;
+    SDL_CondSignal(decoder->jobsAvailableCond);
+    SDL_UnlockMutex(decoder->mutex);
+}
+
+void VCTextureDecoder_WaitForJobs(VCTextureDecoder *decoder) {
+    SDL_LockMutex(decoder->mutex);
+    while (decoder->jobsFinished < decoder->jobsLength)
+        SDL_CondWait(decoder->jobsFinishedCond, decoder->mutex);
+    decoder->jobsLength = 0;
+    decoder->jobsStarted = 0;
+    decoder->jobsFinished = 0;
+    SDL_UnlockMutex(decoder->mutex);
+}
+
+// Lets the jobs already enqueued finish, then stops the threads and frees everything the decoder
+// holds. The decoder can't be used again until it's created afresh.
+void VCTextureDecoder_Destroy(VCTextureDecoder *decoder) {
+    VCTextureDecoder_WaitForJobs(decoder);
+
+    SDL_LockMutex(decoder->mutex);
+    decoder->stopping = true;
+    SDL_CondBroadcast(decoder->jobsAvailableCond);
+    SDL_UnlockMutex(decoder->mutex);
+    for (uint32_t i = 0; i < decoder->threadCount; i++)
+        SDL_WaitThread(decoder->threads[i], NULL);
+    free(decoder->threads);
+    decoder->threads = NULL;
+    decoder->threadCount = 0;
+
+    free(decoder->jobs);
+    decoder->jobs = NULL;
+    decoder->jobsCapacity = 0;
+
+    SDL_DestroyCond(decoder->jobsFinishedCond);
+    SDL_DestroyCond(decoder->jobsAvailableCond);
+    SDL_DestroyMutex(decoder->mutex);
+    decoder->jobsFinishedCond = NULL;
+    decoder->jobsAvailableCond = NULL;
+    decoder->mutex = NULL;
+}
@@ -0,0 +1,39 @@
+// mupen64plus-video-videocore/VCTextureDecoder.h
+//
+// Copyright (c) 2016 The mupen64plus-video-videocore Authors
+
+#ifndef VCTEXTUREDECODER_H
+#define VCTEXTUREDECODER_H
+
+#include <SDL2/SDL.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+struct VCTextureDecodeJob;
+
+// A small pool of threads that decode textures while the RSP thread carries on with the display
+// list. Jobs are owned by the decoder once enqueued and are freed once decoded.
+struct VCTextureDecoder {
+    SDL_Thread **threads;
+    uint32_t threadCount;
+
+    SDL_mutex *mutex;
+    SDL_cond *jobsAvailableCond;
+    SDL_cond *jobsFinishedCond;
+
+    // Protected by `mutex`.
+    VCTextureDecodeJob **jobs;
+    size_t jobsLength;
+    size_t jobsCapacity;
+    size_t jobsStarted;
+    size_t jobsFinished;
+    bool stopping;
+};
+
+void VCTextureDecoder_Create(VCTextureDecoder *decoder, uint32_t threadCount);
+void VCTextureDecoder_Enqueue(VCTextureDecoder *decoder, VCTextureDecodeJob *job);
+void VCTextureDecoder_WaitForJobs(VCTextureDecoder *decoder);
+void VCTextureDecoder_Destroy(VCTextureDecoder *decoder);
+
+#endif
+
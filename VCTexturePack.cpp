@@ -0,0 +1,378 @@
+// mupen64plus-video-videocore/VCTexturePack.cpp
+//
+// Copyright (c) 2016 The mupen64plus-video-videocore Authors
+
+#ifdef __linux__
+#include <linux/limits.h>
+#endif
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "VCTexturePack.h"
+#include "xxhash.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define VC_TEXTURE_PACK_MAGIC           0x58544356  // "VCTX"
+#define VC_TEXTURE_PACK_RECORD_MAGIC    0x52544356  // "VCTR"
+#define VC_TEXTURE_PACK_VERSION         2
+#define PIXELS_HASH_SEED                0xdeadbeef
+#define INITIAL_SLOTS_LENGTH            256
+
+struct VCTexturePackHeader {
+    uint32_t magic;
+    uint32_t version;
+};
+
+const uint8_t *VCTexturePackRecord_Pixels(const VCTexturePackRecord *record) {
+    return (const uint8_t *)record + sizeof(VCTexturePackRecord);
+}
+
+// Only remembers where the pack is; the file is opened and indexed on first use.
+void VCTexturePack_Open(VCTexturePack *pack, const char *path, size_t maxLength) {
+    memset(pack, '\0', sizeof(*pack));
+    pack->path = strdup(path);
+    pack->maxLength = maxLength < UINT32_MAX ? maxLength : UINT32_MAX;
+    pack->fd = -1;
+}
+
+bool VCTexturePack_IsOpen(VCTexturePack *pack) {
+    return pack->path != NULL;
+}
+
+#ifndef _WIN32
+
+// Records are padded out to 8 bytes so that the keys of the ones after them stay aligned in the
+// mapping.
+static size_t VCTexturePackRecord_Length(const VCTexturePackRecord *record) {
+    return (sizeof(VCTexturePackRecord) + record->pixelsLength + 7) & ~(size_t)7;
+}
+
+static void VCTexturePack_InsertSlot(VCTexturePackSlot *slots,
+                                     size_t slotsLength,
+                                     uint64_t key,
+                                     uint32_t offset) {
+    size_t mask = slotsLength - 1;
+    size_t index = (size_t)key & mask;
+    while (slots[index].offset != 0 && slots[index].key != key)
+        index = (index + 1) & mask;
+    slots[index].key = key;
+    slots[index].offset = offset;
+}
+
+// Points the key at a record, replacing any older record for the same key. Offset 0 is the file
+// header, so it marks empty slots.
+static void VCTexturePack_Index(VCTexturePack *pack, uint64_t key, uint32_t offset) {
+    if ((pack->recordsLength + 1) * 2 > pack->slotsLength) {
+        size_t newSlotsLength = pack->slotsLength == 0 ? INITIAL_SLOTS_LENGTH :
+            pack->slotsLength * 2;
+        VCTexturePackSlot *newSlots =
+            (VCTexturePackSlot *)calloc(newSlotsLength, sizeof(VCTexturePackSlot));
+        if (newSlots == NULL)
+            abort();
+        for (size_t i = 0; i < pack->slotsLength; i++) {
+            if (pack->slots[i].offset != 0) {
+                VCTexturePack_InsertSlot(newSlots,
+                                         newSlotsLength,
+                                         pack->slots[i].key,
+                                         pack->slots[i].offset);
+            }
+        }
+        free(pack->slots);
+        pack->slots = newSlots;
+        pack->slotsLength = newSlotsLength;
+    }
+    VCTexturePack_InsertSlot(pack->slots, pack->slotsLength, key, offset);
+    pack->recordsLength++;
+}
+
+static uint32_t VCTexturePack_LookUp(VCTexturePack *pack, uint64_t key) {
+    if (pack->slotsLength == 0)
+        return 0;
+    size_t mask = pack->slotsLength - 1;
+    for (size_t index = (size_t)key & mask;
+            pack->slots[index].offset != 0;
+            index = (index + 1) & mask) {
+        if (pack->slots[index].key == key)
+            return pack->slots[index].offset;
+    }
+    return 0;
+}
+
+static bool VCTexturePack_Map(VCTexturePack *pack) {
+    if (pack->mapping != NULL)
+        munmap(pack->mapping, pack->mappingLength);
+    pack->mapping = (uint8_t *)mmap(NULL, pack->fileLength, PROT_READ, MAP_SHARED, pack->fd, 0);
+    if (pack->mapping == MAP_FAILED) {
+        fprintf(stderr, "video warning: couldn't map texture pack: %s\n", strerror(errno));
+        pack->mapping = NULL;
+        pack->mappingLength = 0;
+        return false;
+    }
+    pack->mappingLength = pack->fileLength;
+    return true;
+}
+
+static bool VCTexturePack_WriteHeader(int fd) {
+    VCTexturePackHeader header = { VC_TEXTURE_PACK_MAGIC, VC_TEXTURE_PACK_VERSION };
+    return ftruncate(fd, 0) == 0 && pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+}
+
+// Opens the file and builds the index from the record headers. Only the headers are read here;
+// pixels are paged in from the mapping when they're used.
+static bool VCTexturePack_Load(VCTexturePack *pack) {
+    if (pack->loaded)
+        return pack->mapping != NULL;
+    pack->loaded = true;
+
+    pack->fd = open(pack->path, O_RDWR | O_CREAT, 0644);
+    if (pack->fd < 0) {
+        fprintf(stderr,
+                "video warning: couldn't open texture pack `%s`: %s\n",
+                pack->path,
+                strerror(errno));
+        return false;
+    }
+
+    struct stat info;
+    VCTexturePackHeader header = { 0, 0 };
+    if (fstat(pack->fd, &info) != 0 ||
+            pread(pack->fd, &header, sizeof(header), 0) != sizeof(header) ||
+            header.magic != VC_TEXTURE_PACK_MAGIC ||
+            header.version != VC_TEXTURE_PACK_VERSION) {
+        if (!VCTexturePack_WriteHeader(pack->fd)) {
+            fprintf(stderr, "video warning: couldn't initialize texture pack `%s`\n", pack->path);
+            close(pack->fd);
+            pack->fd = -1;
+            return false;
+        }
+        info.st_size = sizeof(header);
+    }
+
+    pack->fileLength = (size_t)info.st_size;
+    if (!VCTexturePack_Map(pack))
+        return false;
+
+    size_t offset = sizeof(VCTexturePackHeader);
+    while (offset + sizeof(VCTexturePackRecord) <= pack->fileLength) {
+        const VCTexturePackRecord *record = (const VCTexturePackRecord *)&pack->mapping[offset];
+        if (record->magic != VC_TEXTURE_PACK_RECORD_MAGIC)
+            break;
+        size_t end = offset + VCTexturePackRecord_Length(record);
+        if (end > pack->fileLength)
+            break;
+        VCTexturePack_Index(pack, record->key, (uint32_t)offset);
+        offset = end;
+    }
+
+    // Drop whatever's left of a record that was only partly written.
+    if (offset < pack->fileLength) {
+        if (ftruncate(pack->fd, offset) != 0)
+            pack->full = true;
+        pack->fileLength = offset;
+    }
+    return true;
+}
+
+void VCTexturePack_Close(VCTexturePack *pack) {
+    if (pack->mapping != NULL)
+        munmap(pack->mapping, pack->mappingLength);
+    if (pack->fd >= 0)
+        close(pack->fd);
+    free(pack->slots);
+    free(pack->path);
+    memset(pack, '\0', sizeof(*pack));
+    pack->fd = -1;
+}
+
+const VCTexturePackRecord *VCTexturePack_Find(VCTexturePack *pack, uint64_t key) {
+    if (!VCTexturePack_IsOpen(pack) || !VCTexturePack_Load(pack))
+        return NULL;
+    uint32_t offset = VCTexturePack_LookUp(pack, key);
+    if (offset == 0)
+        return NULL;
+
+    // Records appended since the file was mapped aren't in the mapping yet.
+    if (offset + sizeof(VCTexturePackRecord) > pack->mappingLength && !VCTexturePack_Map(pack))
+        return NULL;
+    const VCTexturePackRecord *record = (const VCTexturePackRecord *)&pack->mapping[offset];
+    if (offset + VCTexturePackRecord_Length(record) > pack->mappingLength &&
+            !VCTexturePack_Map(pack)) {
+        return NULL;
+    }
+    record = (const VCTexturePackRecord *)&pack->mapping[offset];
+
+    if (XXH32(VCTexturePackRecord_Pixels(record), record->pixelsLength, PIXELS_HASH_SEED) !=
+            record->pixelsHash) {
+        return NULL;
+    }
+    return record;
+}
+
+void VCTexturePack_Append(VCTexturePack *pack,
+                          VCTexturePackRecord *record,
+                          const uint8_t *pixels) {
+    if (!VCTexturePack_IsOpen(pack) || !VCTexturePack_Load(pack) || pack->full)
+        return;
+
+    record->magic = VC_TEXTURE_PACK_RECORD_MAGIC;
+    record->reserved = 0;
+    record->pixelsHash = XXH32(pixels, record->pixelsLength, PIXELS_HASH_SEED);
+
+    size_t length = VCTexturePackRecord_Length(record);
+    if (pack->fileLength + length > pack->maxLength) {
+        fprintf(stderr,
+                "video warning: texture pack `%s` is full; run `vctexpack compact` on it\n",
+                pack->path);
+        pack->full = true;
+        return;
+    }
+
+    uint64_t padding = 0;
+    size_t paddingLength = length - sizeof(VCTexturePackRecord) - record->pixelsLength;
+    off_t offset = (off_t)pack->fileLength;
+    if (pwrite(pack->fd, record, sizeof(*record), offset) != sizeof(*record) ||
+            pwrite(pack->fd, pixels, record->pixelsLength, offset + sizeof(*record)) !=
+            (ssize_t)record->pixelsLength ||
+            pwrite(pack->fd,
+                   &padding,
+                   paddingLength,
+                   offset + sizeof(*record) + record->pixelsLength) != (ssize_t)paddingLength) {
+        // Leave the file as it was and stop writing to it.
+        fprintf(stderr, "video warning: couldn't write to texture pack `%s`\n", pack->path);
+        if (ftruncate(pack->fd, offset) != 0)
+            fprintf(stderr, "video warning: texture pack `%s` may be corrupt\n", pack->path);
+        pack->full = true;
+        return;
+    }
+
+    VCTexturePack_Index(pack, record->key, (uint32_t)pack->fileLength);
+    pack->fileLength += length;
+}
+
+// Rewrites the pack with only the newest valid record for each key. If that's still more than
+// `maxLength`, the oldest records are dropped until it fits.
+bool VCTexturePack_Compact(const char *path,
+                           size_t maxLength,
+                           size_t *recordsKept,
+                           size_t *recordsDropped) {
+    // Don't let loading the pack reinitialize something that isn't one.
+    int fd = open(path, O_RDONLY);
+    VCTexturePackHeader header = { 0, 0 };
+    bool ok = fd >= 0 && read(fd, &header, sizeof(header)) == sizeof(header) &&
+        header.magic == VC_TEXTURE_PACK_MAGIC && header.version == VC_TEXTURE_PACK_VERSION;
+    if (fd >= 0)
+        close(fd);
+    if (!ok)
+        return false;
+
+    VCTexturePack pack;
+    VCTexturePack_Open(&pack, path, SIZE_MAX);
+    if (!VCTexturePack_Load(&pack)) {
+        VCTexturePack_Close(&pack);
+        return false;
+    }
+
+    uint32_t *offsets = (uint32_t *)malloc(sizeof(uint32_t) * (pack.recordsLength + 1));
+    if (offsets == NULL)
+        abort();
+    size_t offsetsLength = 0, recordCount = 0;
+    size_t offset = sizeof(VCTexturePackHeader);
+    while (offset < pack.fileLength) {
+        const VCTexturePackRecord *record = (const VCTexturePackRecord *)&pack.mapping[offset];
+        recordCount++;
+        if (VCTexturePack_LookUp(&pack, record->key) == offset &&
+                XXH32(VCTexturePackRecord_Pixels(record),
+                      record->pixelsLength,
+                      PIXELS_HASH_SEED) == record->pixelsHash) {
+            offsets[offsetsLength++] = (uint32_t)offset;
+        }
+        offset += VCTexturePackRecord_Length(record);
+    }
+
+    size_t firstOffsetIndex = offsetsLength, compactedLength = sizeof(VCTexturePackHeader);
+    while (firstOffsetIndex > 0) {
+        const VCTexturePackRecord *record =
+            (const VCTexturePackRecord *)&pack.mapping[offsets[firstOffsetIndex - 1]];
+        size_t length = VCTexturePackRecord_Length(record);
+        if (compactedLength + length > maxLength)
+            break;
+        compactedLength += length;
+        firstOffsetIndex--;
+    }
+
+    char *tempPath = (char *)malloc(strlen(path) + 5);
+    if (tempPath == NULL)
+        abort();
+    sprintf(tempPath, "%s.tmp", path);
+    fd = open(tempPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ok = fd >= 0 && VCTexturePack_WriteHeader(fd);
+    off_t writeOffset = sizeof(VCTexturePackHeader);
+    for (size_t i = firstOffsetIndex; ok && i < offsetsLength; i++) {
+        const VCTexturePackRecord *record =
+            (const VCTexturePackRecord *)&pack.mapping[offsets[i]];
+        size_t length = VCTexturePackRecord_Length(record);
+        ok = pwrite(fd, record, length, writeOffset) == (ssize_t)length;
+        writeOffset += length;
+    }
+    if (fd >= 0)
+        ok = fsync(fd) == 0 && close(fd) == 0 && ok;
+    ok = ok && rename(tempPath, path) == 0;
+    if (!ok)
+        unlink(tempPath);
+
+    if (recordsKept != NULL)
+        *recordsKept = offsetsLength - firstOffsetIndex;
+    if (recordsDropped != NULL)
+        *recordsDropped = recordCount - (offsetsLength - firstOffsetIndex);
+    free(tempPath);
+    free(offsets);
+    VCTexturePack_Close(&pack);
+    return ok;
+}
+
+#else
+
+// No memory mapping here, so the pack is never loaded and every lookup misses.
+static bool VCTexturePack_Load(VCTexturePack *pack) {
+    if (!pack->loaded)
+        fprintf(stderr, "video warning: the texture pack isn't supported on this platform\n");
+    pack->loaded = true;
+    return false;
+}
+
+void VCTexturePack_Close(VCTexturePack *pack) {
+    free(pack->slots);
+    free(pack->path);
+    memset(pack, '\0', sizeof(*pack));
+    pack->fd = -1;
+}
+
+const VCTexturePackRecord *VCTexturePack_Find(VCTexturePack *pack, uint64_t key) {
+    if (VCTexturePack_IsOpen(pack))
+        VCTexturePack_Load(pack);
+    return NULL;
+}
+
+void VCTexturePack_Append(VCTexturePack *pack,
+                          VCTexturePackRecord *record,
+                          const uint8_t *pixels) {
+}
+
+bool VCTexturePack_Compact(const char *path,
+                           size_t maxLength,
+                           size_t *recordsKept,
+                           size_t *recordsDropped) {
+    return false;
+}
+
+#endif
+
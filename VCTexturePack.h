@@ -0,0 +1,73 @@
+// mupen64plus-video-videocore/VCTexturePack.h
+//
+// Copyright (c) 2016 The mupen64plus-video-videocore Authors
+
+#ifndef VCTEXTUREPACK_H
+#define VCTEXTUREPACK_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define VC_TEXTURE_PACK_FLAG_REPEAT_X   1
+#define VC_TEXTURE_PACK_FLAG_REPEAT_Y   2
+#define VC_TEXTURE_PACK_FLAG_MIRROR_X   4
+#define VC_TEXTURE_PACK_FLAG_MIRROR_Y   8
+
+// Describes a decoded, atlas-ready texture stored in a pack. The pixels (border included) follow
+// the record in the file. The key is a 64-bit hash of the texture's source, so that two textures
+// colliding on it, and one permanently standing in for the other, is vanishingly unlikely.
+struct VCTexturePackRecord {
+    uint32_t magic;
+    uint32_t pixelsLength;
+    uint64_t key;
+    uint16_t width;
+    uint16_t height;
+    uint16_t texelWidth;
+    uint16_t texelHeight;
+    uint8_t pageFormat;
+    uint8_t rawFormat;
+    uint8_t flags;
+    uint8_t reserved;
+    uint32_t pixelsHash;
+};
+
+struct VCTexturePackSlot {
+    uint64_t key;
+    uint32_t offset;
+};
+
+// An append-only file of decoded textures for one ROM, memory-mapped for reading. Later records
+// for a key supersede earlier ones; `VCTexturePack_Compact()` drops the superseded ones. A pack
+// isn't thread-safe; callers sharing one between threads have to serialize access to it.
+struct VCTexturePack {
+    char *path;
+    size_t maxLength;
+    bool loaded;
+    bool full;
+
+    int fd;
+    uint8_t *mapping;
+    size_t mappingLength;
+    size_t fileLength;
+
+    // Open-addressed index from key to the offset of the newest record for it.
+    VCTexturePackSlot *slots;
+    size_t slotsLength;
+    size_t recordsLength;
+};
+
+void VCTexturePack_Open(VCTexturePack *pack, const char *path, size_t maxLength);
+void VCTexturePack_Close(VCTexturePack *pack);
+bool VCTexturePack_IsOpen(VCTexturePack *pack);
+const VCTexturePackRecord *VCTexturePack_Find(VCTexturePack *pack, uint64_t key);
+const uint8_t *VCTexturePackRecord_Pixels(const VCTexturePackRecord *record);
+void VCTexturePack_Append(VCTexturePack *pack,
+                          VCTexturePackRecord *record,
+                          const uint8_t *pixels);
+bool VCTexturePack_Compact(const char *path,
+                           size_t maxLength,
+                           size_t *recordsKept,
+                           size_t *recordsDropped);
+
+#endif
+
@@ -0,0 +1,59 @@
+// mupen64plus-video-videocore/VCTexturePackTool.cpp
+//
+// Copyright (c) 2016 The mupen64plus-video-videocore Authors
+//
+// `vctexpack`: maintenance for the on-disk texture packs written when `textures.diskCache` is on,
+// and building HD texture packs for `textures.hdTextureDirectory`.
+
+#define STB_IMAGE_IMPLEMENTATION
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "VCHDTexturePack.h"
+#include "VCTexturePack.h"
+#include "stb_image.h"
+
+static void VCTexturePackTool_Usage() {
+    fprintf(stderr, "usage: vctexpack compact PACK [MAX-SIZE-MB]\n");
+    fprintf(stderr, "       vctexpack build-hd PACK DIRECTORY\n");
+    exit(1);
+}
+
+static int VCTexturePackTool_Compact(int argc, char **argv) {
+    size_t maxLength = SIZE_MAX;
+    if (argc == 4) {
+        char *end = NULL;
+        long maxSizeMB = strtol(argv[3], &end, 10);
+        if (end == argv[3] || *end != '\0' || maxSizeMB <= 0)
+            VCTexturePackTool_Usage();
+        maxLength = (size_t)maxSizeMB * 1024 * 1024;
+    }
+
+    size_t recordsKept = 0, recordsDropped = 0;
+    if (!VCTexturePack_Compact(argv[2], maxLength, &recordsKept, &recordsDropped)) {
+        fprintf(stderr, "vctexpack: couldn't compact `%s`\n", argv[2]);
+        return 1;
+    }
+    printf("%s: kept %zu textures, dropped %zu\n", argv[2], recordsKept, recordsDropped);
+    return 0;
+}
+
+static int VCTexturePackTool_BuildHD(int argc, char **argv) {
+    size_t entriesWritten = 0;
+    if (!VCHDTexturePack_Build(argv[2], argv[3], &entriesWritten)) {
+        fprintf(stderr, "vctexpack: couldn't build `%s` from `%s`\n", argv[2], argv[3]);
+        return 1;
+    }
+    printf("%s: wrote %zu textures\n", argv[2], entriesWritten);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 3 && argc <= 4 && strcmp(argv[1], "compact") == 0)
+        return VCTexturePackTool_Compact(argc, argv);
+    if (argc == 4 && strcmp(argv[1], "build-hd") == 0)
+        return VCTexturePackTool_BuildHD(argc, argv);
+    VCTexturePackTool_Usage();
+    return 1;
+}
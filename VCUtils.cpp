@@ -2,14 +2,23 @@
 //
 // Copyright (c) 2016 The mupen64plus-video-videocore Authors
 
+#ifdef __linux__
+#include <linux/limits.h>
+#endif
+
 #include "VCUtils.h"
 #include <assert.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
 size_t VCUtils_NextPowerOfTwo(size_t n) {
     n--;
     n |= n >> 1;
@@ -22,6 +31,52 @@ size_t VCUtils_NextPowerOfTwo(size_t n) {
     return n;
 }
 
+#ifndef _WIN32
+
+// Returns `~/.cache/mupen64plus/videocore/CRC1-CRC2.EXTENSION` (or the equivalent under
+// `$XDG_CACHE_HOME`) for the ROM with the given header, creating the directories as necessary.
+// Caller is responsible for freeing the result.
+char *VCUtils_CachePathForROM(const uint8_t *romHeader, const char *extension) {
+    char *path = (char *)malloc(PATH_MAX + 1);
+    if (path == NULL)
+        abort();
+
+    const char *cacheHome = getenv("XDG_CACHE_HOME");
+    if (cacheHome == NULL || cacheHome[0] == '\0') {
+        const char *home = getenv("HOME");
+        if (home == NULL)
+            home = ".";
+        snprintf(path, PATH_MAX, "%s/.cache", home);
+    } else {
+        snprintf(path, PATH_MAX, "%s", cacheHome);
+    }
+    size_t length = strlen(path);
+    snprintf(&path[length], PATH_MAX - length, "/mupen64plus");
+    mkdir(path, 0755);
+    length = strlen(path);
+    snprintf(&path[length], PATH_MAX - length, "/videocore");
+    mkdir(path, 0755);
+
+    uint32_t crc1, crc2;
+    memcpy(&crc1, &romHeader[0x10], sizeof(crc1));
+    memcpy(&crc2, &romHeader[0x14], sizeof(crc2));
+    length = strlen(path);
+    snprintf(&path[length], PATH_MAX - length, "/%08X-%08X.%s", crc1, crc2, extension);
+    return path;
+}
+
+#else
+
+char *VCUtils_CachePathForROM(const uint8_t *romHeader, const char *extension) {
+    char *path = (char *)malloc(strlen(extension) + sizeof("videocore."));
+    if (path == NULL)
+        abort();
+    sprintf(path, "videocore.%s", extension);
+    return path;
+}
+
+#endif
+
 VCString VCString_Create() {
     VCString string = { NULL, 0, 0 };
     return string;
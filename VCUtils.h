@@ -6,6 +6,7 @@
 #define VCUTILS_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 struct VCString {
     char *ptr;
@@ -18,6 +19,7 @@ inline float VCUtils_MinF(float a, float b) {
 }
 
 size_t VCUtils_NextPowerOfTwo(size_t n);
+char *VCUtils_CachePathForROM(const uint8_t *romHeader, const char *extension);
 VCString VCString_Create();
 void VCString_Destroy(VCString *string);
 VCString VCString_Duplicate(VCString *string);
@@ -208,6 +208,14 @@ inline u16 RGBA8888_RGBA4444( u32 color )
 	       ((color & 0xf0000000) >> 28);	// a
 }
 
+inline u16 RGBA8888_RGBA5551( u32 color )
+{
+	return ((color & 0x000000f8) <<  8) |	// r
+	       ((color & 0x0000f800) >>  5) |	// g
+	       ((color & 0x00f80000) >> 18) |	// b
+	       ((color & 0x80000000) >> 31);	// a
+}
+
 inline u32 RGBA5551_RGBA8888( u16 color )
 {
 	// ok
@@ -8,6 +8,7 @@
 #include "Debug.h"
 #include "convert.h"
 #include "CRC.h"
+#include "Textures.h"
 #include "FrameBuffer.h"
 #include "DepthBuffer.h"
 #include "VI.h"
@@ -519,6 +520,8 @@ void gDPLoadTile( u32 tile, u32 uls, u32 ult, u32 lrs, u32 lrt )
  		dest += line;
 	}
 
+	TextureCache_UpdatePalettes( gDP.loadTile->tmem, gDP.loadTile->tmem + line * height );
+
 	gDP.textureMode = TEXTUREMODE_NORMAL;
 	gDP.loadType = LOADTYPE_TILE;
 	gDP.changed |= CHANGED_TMEM;
@@ -580,6 +583,8 @@ void gDPLoadBlock( u32 tile, u32 uls, u32 ult, u32 lrs, u32 dxt )
 	else
 		UnswapCopy( src, dest, bytes );
 
+	TextureCache_UpdatePalettes( gDP.loadTile->tmem, gDP.loadTile->tmem + ((bytes + 7) >> 3) );
+
 	gDP.textureMode = TEXTUREMODE_NORMAL;
 	gDP.loadType = LOADTYPE_BLOCK;
 	gDP.changed |= CHANGED_TMEM;
@@ -602,28 +607,19 @@ void gDPLoadTLUT( u32 tile, u32 uls, u32 ult, u32 lrs, u32 lrt )
 	u16 *dest = (u16*)&TMEM[gDP.tiles[tile].tmem]; 
 	u16 *src = (u16*)&RDRAM[address];
 
-	u16 pal = (gDP.tiles[tile].tmem - 256) >> 4;
-
-	int i = 0;
-	while (i < count)
+	for (int i = 0; i < count; i++)
 	{
-		for (u16 j = 0; (j < 16) && (i < count); j++, i++)
-		{
-			u16 color = swapword( src[i^1] );
+		u16 color = swapword( src[i^1] );
 
-			*dest = color;
-			//dest[1] = color;
-			//dest[2] = color;
-			//dest[3] = color;
+		*dest = color;
+		//dest[1] = color;
+		//dest[2] = color;
+		//dest[3] = color;
 
-			dest += 4;
-		}
-        
-		gDP.paletteCRC16[pal] = CRC_CalculatePalette( 0xFFFFFFFF, &TMEM[256 + (pal << 4)], 16 );
-		pal++;
+		dest += 4;
 	}
 
-	gDP.paletteCRC256 = CRC_Calculate( 0xFFFFFFFF, gDP.paletteCRC16, 64 );
+	TextureCache_UpdatePalettes( gDP.tiles[tile].tmem, gDP.tiles[tile].tmem + count );
 
 	gDP.changed |= CHANGED_TMEM;
 
@@ -230,8 +230,10 @@ struct gDPInfo
 	u32 changed;
 
 	//u16 palette[256];
-	u32 paletteCRC16[16];
-	u32 paletteCRC256;
+	u32 paletteHash16[16];
+	u32 paletteHash256;
+	u32 paletteRGBA[256];	// TLUT expanded from RGBA5551 to RGBA8888
+	u32 paletteIA[256];		// TLUT expanded from IA88 to RGBA8888
 	u32 half_1, half_2;
 	u32 textureMode;
 	u32 loadType;
@@ -62,6 +62,7 @@ EXPORT int CALL InitiateGFX (GFX_INFO Gfx_Info)
 {
 	DMEM = Gfx_Info.DMEM;
 	IMEM = Gfx_Info.IMEM;
+	HEADER = Gfx_Info.HEADER;
 	RDRAM = Gfx_Info.RDRAM;
 
 	REG.MI_INTR = Gfx_Info.MI_INTR_REG;
@@ -125,6 +126,12 @@ EXPORT void CALL ProcessRDPList(void)
 
 EXPORT void CALL RomClosed (void)
 {
+    VCAtlas_CloseTexturePack(&VCRenderer_SharedRenderer()->atlas);
+    VCAtlas_CloseReplacementPack(&VCRenderer_SharedRenderer()->atlas);
+    VCAtlas_DestroyDecoders(&VCRenderer_SharedRenderer()->atlas);
+    VCRenderer_CloseShaderCache(VCRenderer_SharedRenderer());
+    VCRenderer_CloseCombinerLog(VCRenderer_SharedRenderer());
+    VCAtlas_CloseTrace(&VCRenderer_SharedRenderer()->atlas);
 #ifdef DEBUG
 	CloseDebugDlg();
 #endif
@@ -135,6 +142,11 @@ EXPORT int CALL RomOpen (void)
     RSP_Init();
     VCRenderer *renderer = VCRenderer_SharedRenderer();
     VCRenderer_Start(renderer);
+    VCAtlas_OpenTexturePack(&renderer->atlas, HEADER);
+    VCAtlas_OpenReplacementPack(&renderer->atlas, HEADER);
+    VCRenderer_OpenShaderCache(renderer, HEADER);
+    VCRenderer_OpenCombinerLog(renderer);
+    VCAtlas_OpenTrace(&renderer->atlas);
     return TRUE;
 }
 
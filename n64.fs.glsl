@@ -1,67 +1,73 @@
 // mupen64plus-video-videocore/n64.fs.glsl
+//
+// The generic combiner program, appended to `n64.inc.fs.glsl`. Batches are drawn with it while
+// their own program is compiled. Row `vControl.x` of `uCombinerTable` describes the subprogram:
+// cycle 0 RGB, cycle 0 alpha, cycle 1 RGB, and cycle 1 alpha inputs, A-D in each texel's RGBA.
+// See `VCShaderCompiler_GenerateUbershaderTableForProgram`.
 
-uniform sampler2D uTexture0;
-uniform sampler2D uTexture1;
+uniform sampler2D uCombinerTable;
 
-varying vec2 vTextureUv;
-varying vec4 vTexture0Bounds;
-varying vec4 vTexture1Bounds;
-varying vec4 vCombineA;
-varying vec4 vCombineB;
-varying vec4 vCombineC;
-varying vec4 vCombineD;
-
-vec3 CombineColor(vec3 combiner, vec4 texel0, vec4 texel1) {
-    if (combiner.r >= 0.0)
-        return combiner;
-    if (combiner.g < 0.0) {
-        if (combiner.b < 0.0)
-            return texel0.aaa;
-        return texel1.aaa;
+vec4 CombinerInput(float selector, vec4 combined, vec4 texel0, vec4 texel1) {
+    if (selector < 5.5) {
+        if (selector < 0.5)
+            return vec4(0.0);
+        if (selector < 1.5)
+            return vec4(1.0);
+        if (selector < 2.5)
+            return vPrimitive;
+        if (selector < 3.5)
+            return vPrimitive.aaaa;
+        if (selector < 4.5)
+            return vEnvironment;
+        return vEnvironment.aaaa;
     }
-    if (combiner.b < 0.0)
-        return texel0.rgb;
-    return texel1.rgb;
+    if (selector < 6.5)
+        return texel0;
+    if (selector < 7.5)
+        return texel0.aaaa;
+    if (selector < 8.5)
+        return texel1;
+    if (selector < 9.5)
+        return texel1.aaaa;
+    if (selector < 10.5)
+        return vShade;
+    if (selector < 11.5)
+        return vShade.aaaa;
+    return combined;
 }
 
-float CombineAlpha(float combiner, float texel0, float texel1) {
-    if (combiner < 0.0)
-        return (combiner < -100.0) ? texel0 : texel1;
-    return combiner;
+vec4 Combine(float column, float row, vec4 combined, vec4 texel0, vec4 texel1) {
+    vec4 selectors = floor(texture2D(uCombinerTable, vec2(column, row)) * 255.0 + 0.5);
+    vec4 a = CombinerInput(selectors.x, combined, texel0, texel1);
+    vec4 b = CombinerInput(selectors.y, combined, texel0, texel1);
+    vec4 c = CombinerInput(selectors.z, combined, texel0, texel1);
+    vec4 d = CombinerInput(selectors.w, combined, texel0, texel1);
+    return (a - b) * c + d;
 }
 
-vec2 AtlasUv(vec4 textureBounds) {
-    vec2 uv = vTextureUv;
-    if (textureBounds.z > 0.0)
-        uv.x = clamp(uv.x, 0.0, 1.0);
-    else if (uv.x < 0.0)
-        uv.x = 1.0 - fract(uv.x);
-    else
-        uv.x = fract(uv.x);
+void main(void) {
+#ifdef VC_GPU_TEXTURE_DECODE
+    vec4 texture0Color = SampleTexture(uTexture0, vTexture0Bounds, vTextureDecode.xy);
+    vec4 texture1Color = SampleTexture(uTexture1, vTexture1Bounds, vTextureDecode.zw);
+#else
+    vec4 texture0Color = SampleTexture(uTexture0, vTexture0Bounds);
+    vec4 texture1Color = SampleTexture(uTexture1, vTexture1Bounds);
+#endif
 
-    if (textureBounds.w > 0.0)
-        uv.y = clamp(uv.y, 0.0, 1.0);
-    else if (uv.y < 0.0)
-        uv.y = 1.0 - fract(uv.y);
-    else
-        uv.y = fract(uv.y);
+    // Round, since the VideoCore IV sometimes adds some error to varyings.
+    float row = (floor(vControl.x + 0.5) + 0.5) / 256.0;
+    vec4 combined = vec4(0.0);
+    combined.rgb = Combine(0.125, row, combined, texture0Color, texture1Color).rgb;
+    combined.a = Combine(0.375, row, combined, texture0Color, texture1Color).a;
+    vec4 fragRGB = Combine(0.625, row, combined, texture0Color, texture1Color);
+    vec4 fragA = Combine(0.875, row, combined, texture0Color, texture1Color);
 
-    return uv * abs(textureBounds.zw) + textureBounds.xy;
-}
-
-void main(void) {
-    vec4 texture0Color = texture2D(uTexture0, AtlasUv(vTexture0Bounds));
-    vec4 texture1Color = texture2D(uTexture1, AtlasUv(vTexture1Bounds));
-    vec4 color = vec4(CombineColor(vCombineA.rgb, texture0Color, texture1Color),
-                      CombineAlpha(vCombineA.a, texture0Color.a, texture1Color.a));
-    color -= vec4(CombineColor(vCombineB.rgb, texture0Color, texture1Color),
-                  CombineAlpha(vCombineB.a, texture0Color.a, texture1Color.a));
-    color *= vec4(CombineColor(vCombineC.rgb, texture0Color, texture1Color),
-                  CombineAlpha(vCombineC.a, texture0Color.a, texture1Color.a));
-    color += vec4(CombineColor(vCombineD.rgb, texture0Color, texture1Color),
-                  CombineAlpha(vCombineD.a, texture0Color.a, texture1Color.a));
-    if (color.a == 0.0)
+    if (fragA.a * 255.0 < vControl.y)
         discard;
-    gl_FragColor = color;
+    if (vControl.z < 0.5)
+        fragA.a = 1.0;
+    else if (vControl.z < 1.5)
+        fragA.a = 0.0;
+    gl_FragColor = vec4(fragRGB.rgb, fragA.a);
 }
 
@@ -10,6 +10,10 @@ varying vec4 vShade;
 varying vec4 vPrimitive;
 varying vec4 vEnvironment;
 varying vec3 vControl;
+#ifdef VC_GPU_TEXTURE_DECODE
+// Only declared when needed: the VideoCore IV has just eight varyings.
+varying vec4 vTextureDecode;
+#endif
 
 vec2 AtlasUv(vec4 textureBounds) {
     vec2 uv = vTextureUv;
@@ -30,3 +34,95 @@ vec2 AtlasUv(vec4 textureBounds) {
     return uv * abs(textureBounds.zw) + textureBounds.xy;
 }
 
+#ifdef VC_GPU_TEXTURE_DECODE
+
+// Raw texture formats. Keep in sync with `VC_RAW_TEXTURE_FORMAT_*` in `VCAtlas.h`:
+// 1 = I4, 2 = IA4, 3 = CI4, 4 = I8, 5 = IA8, 6 = CI8, 7 = IA16.
+
+vec4 FetchAtlasPixel(sampler2D atlas, vec2 pixel) {
+    return texture2D(atlas, (pixel + 0.5) / 1024.0);
+}
+
+// Returns the undecoded bits of a texel: a nibble or byte in `.x`, or both bytes of a 16-bit texel
+// in `.xy`.
+vec2 FetchRawTexelBits(sampler2D atlas, vec2 origin, float format, vec2 texel) {
+    if (format > 6.5) {
+        vec4 pixel = FetchAtlasPixel(atlas, origin + vec2(floor(texel.x / 2.0), texel.y));
+        pixel = floor(pixel * 255.0 + 0.5);
+        return mod(texel.x, 2.0) < 0.5 ? pixel.xy : pixel.zw;
+    }
+
+    float texelsPerPixel = format < 3.5 ? 8.0 : 4.0;
+    float byteIndex = floor(mod(texel.x, texelsPerPixel) * 4.0 / texelsPerPixel);
+    vec4 pixel = FetchAtlasPixel(atlas, origin + vec2(floor(texel.x / texelsPerPixel), texel.y));
+    vec4 byteMask = vec4(equal(vec4(byteIndex), vec4(0.0, 1.0, 2.0, 3.0)));
+    float value = floor(dot(pixel, byteMask) * 255.0 + 0.5);
+    if (format < 3.5)
+        value = mod(texel.x, 2.0) < 0.5 ? floor(value / 16.0) : mod(value, 16.0);
+    return vec2(value, 0.0);
+}
+
+// Matches the conversions in `convert.h`.
+vec4 DecodeRawTexel(sampler2D atlas, vec2 origin, float format, vec2 texel, float paletteRow) {
+    vec2 bits = FetchRawTexelBits(atlas, origin, format, texel);
+    if (format < 1.5)
+        return vec4(bits.x / 15.0);
+    if (format < 2.5) {
+        float intensity = floor(bits.x / 2.0) / 7.0;
+        return vec4(mod(bits.x, 2.0), vec3(intensity));
+    }
+    if (format < 3.5 || (format > 5.5 && format < 6.5))
+        return FetchAtlasPixel(atlas, vec2(origin.x + bits.x, paletteRow));
+    if (format < 4.5)
+        return vec4(bits.x / 255.0);
+    if (format < 5.5)
+        return vec4(vec3(floor(bits.x / 16.0) / 15.0), mod(bits.x, 16.0) / 15.0);
+    return vec4(vec3(bits.x / 255.0), bits.y / 255.0);
+}
+
+// `size` includes any mirrored copy and is negative if the texture repeats.
+float WrapRawTexelCoordinate(float texel, float size, float mirror) {
+    float period = abs(size);
+    if (size > 0.0)
+        texel = clamp(texel, 0.0, period - 1.0);
+    else
+        texel = mod(texel, period);
+    if (mirror > 0.5 && texel >= period * 0.5)
+        texel = period - 1.0 - texel;
+    return texel;
+}
+
+vec4 SampleRawTexture(sampler2D atlas, vec4 textureBounds, vec2 decode) {
+    vec2 origin = textureBounds.xy * 1024.0;
+    vec2 size = textureBounds.zw * 1024.0;
+    vec2 mirror = vec2(mod(decode.y, 2.0), floor(decode.y / 2.0));
+    float paletteRow = origin.y + abs(size.y) * (mirror.y > 0.5 ? 0.5 : 1.0);
+
+    // Filter by hand, since the hardware can only filter decoded texels.
+    vec2 position = vTextureUv * abs(size) - 0.5;
+    vec2 base = floor(position);
+    vec2 weight = position - base;
+    float s0 = WrapRawTexelCoordinate(base.x, size.x, mirror.x);
+    float s1 = WrapRawTexelCoordinate(base.x + 1.0, size.x, mirror.x);
+    float t0 = WrapRawTexelCoordinate(base.y, size.y, mirror.y);
+    float t1 = WrapRawTexelCoordinate(base.y + 1.0, size.y, mirror.y);
+    vec4 texel00 = DecodeRawTexel(atlas, origin, decode.x, vec2(s0, t0), paletteRow);
+    vec4 texel10 = DecodeRawTexel(atlas, origin, decode.x, vec2(s1, t0), paletteRow);
+    vec4 texel01 = DecodeRawTexel(atlas, origin, decode.x, vec2(s0, t1), paletteRow);
+    vec4 texel11 = DecodeRawTexel(atlas, origin, decode.x, vec2(s1, t1), paletteRow);
+    return mix(mix(texel00, texel10, weight.x), mix(texel01, texel11, weight.x), weight.y);
+}
+
+vec4 SampleTexture(sampler2D atlas, vec4 textureBounds, vec2 decode) {
+    if (decode.x > 0.5)
+        return SampleRawTexture(atlas, textureBounds, decode);
+    return texture2D(atlas, AtlasUv(textureBounds));
+}
+
+#else
+
+vec4 SampleTexture(sampler2D atlas, vec4 textureBounds) {
+    return texture2D(atlas, AtlasUv(textureBounds));
+}
+
+#endif
@@ -16,14 +16,21 @@ varying vec4 vShade;
 varying vec4 vPrimitive;
 varying vec4 vEnvironment;
 varying vec3 vControl;
+#ifdef VC_GPU_TEXTURE_DECODE
+varying vec4 vTextureDecode;
+#endif
 
 void main(void) {
     if (aTexture0Bounds.z != 0.0 && aTexture0Bounds.w != 0.0)
         vTextureUv = aTextureUv / abs(aTexture0Bounds.zw);  // FIXME(tachi)
     else
         vTextureUv = aTextureUv;
-    vTexture0Bounds = aTexture0Bounds / 1024.0;
-    vTexture1Bounds = aTexture1Bounds / 1024.0;
+    // Textures decoded on the GPU keep their format and mirroring in the high bits of the origin.
+    vTexture0Bounds = vec4(mod(aTexture0Bounds.xy, 1024.0), aTexture0Bounds.zw) / 1024.0;
+    vTexture1Bounds = vec4(mod(aTexture1Bounds.xy, 1024.0), aTexture1Bounds.zw) / 1024.0;
+#ifdef VC_GPU_TEXTURE_DECODE
+    vTextureDecode = vec4(floor(aTexture0Bounds.xy / 1024.0), floor(aTexture1Bounds.xy / 1024.0));
+#endif
     vShade = aShade;
     vPrimitive = aPrimitive;
     vEnvironment = aEnvironment;